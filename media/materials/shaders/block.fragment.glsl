@@ -18,30 +18,103 @@
 
 #version 130
 #extension GL_EXT_gpu_shader4 : enable
+#extension GL_ARB_uniform_buffer_object : require
+
+// This must match FrameUniformBlock (see renderer_material.h).
+layout(std140) uniform FrameUniforms
+{
+    vec3 camera_position;
+    float fog_distance;
+    vec3 sun_direction;
+    vec3 moon_direction;
+    vec3 sun_light_color;
+    vec3 moon_light_color;
+    vec3 zenith_color;
+    vec3 horizon_color;
+};
 
 uniform sampler2DArray material_texture_array;
 uniform sampler2DArray material_specular_map_array;
 uniform sampler2DArray material_bump_map_array;
-uniform float fog_distance;
+
+// When texture lighting is on, the light is taken from the Chunk light textures instead of
+// from the vertex lighting (see Chunk::get_texture_lighting()).
+uniform bool texture_lighting;
+uniform sampler3D light_texture;
+uniform sampler3D sunlight_texture;
+
+// These must match Chunk::SIZE, ChunkLightVolume::SIZE, ChunkLightTexture::SIZE, and
+// Block::MAX_LIGHT_COMPONENT_LEVEL.
+const float CHUNK_SIZE = 16.0;
+const float LIGHT_VOLUME_SIZE = 18.0;
+const float LIGHT_TEXTURE_SIZE = 72.0;
+const float MAX_LIGHT_COMPONENT_LEVEL = 15.0;
 
 varying vec3 tangent_sun_direction;
 varying vec3 tangent_camera_direction;
-varying vec3 base_lighting;
-varying vec3 sun_lighting;
+varying vec3 vertex_light_level;
+varying vec3 vertex_sunlight_level;
+varying float moon_incidence;
+varying vec3 light_texture_position;
+varying vec3 face_block_position;
+
+// This is the same attenuation that the vertex lighting uses (see calculate_vertex_lighting()).
+vec3 attenuate_light( vec3 level, float power_base )
+{
+    return step( 0.001, level ) * pow( vec3( 0.75 ), max( vec3( power_base ) - level, 0.0 ) );
+}
+
+// Each Chunk in the mesh's region has its own slot in the light textures, with a one Block
+// apron around it, so the filtering never reaches into another Chunk's slot.  The filtering
+// averages the four Blocks in front of the face that touch this point, and the alpha tells
+// how many of them are translucent (the rest contribute no light).
+void sample_light_texture( out vec3 light_level, out vec3 sunlight_level )
+{
+    vec3 slot = floor( face_block_position / CHUNK_SIZE );
+    vec3 texel = slot * LIGHT_VOLUME_SIZE + 1.0 + ( light_texture_position - slot * CHUNK_SIZE );
+    vec3 coordinates = texel / LIGHT_TEXTURE_SIZE;
+
+    vec4 light = texture3D( light_texture, coordinates );
+    vec3 sunlight = texture3D( sunlight_texture, coordinates ).rgb;
+
+    float alpha = max( light.a, 0.25 );
+    float power_base = MAX_LIGHT_COMPONENT_LEVEL + 2.0 * ( 3.0 - 4.0 * light.a );
+    light_level = attenuate_light( light.rgb * MAX_LIGHT_COMPONENT_LEVEL / alpha, power_base );
+    sunlight_level = attenuate_light( sunlight * MAX_LIGHT_COMPONENT_LEVEL / alpha, power_base );
+}
 varying vec3 texture_coordinates;
 varying float fog_depth;
 
 void main()
 {
+    vec3 light_level = vertex_light_level;
+    vec3 sunlight_level = vertex_sunlight_level;
+
+    if ( texture_lighting )
+    {
+        sample_light_texture( light_level, sunlight_level );
+    }
+
+    vec3 sun_lighting = sunlight_level * sun_light_color;
+    vec3 moon_lighting = moon_light_color * sunlight_level;
+    vec3 moon_diffuse = moon_lighting * moon_incidence;
+
+    vec3 ambient_light = vec3( 0.06, 0.06, 0.06 ) + 0.50 * sun_lighting + 0.45 * moon_lighting;
+    vec3 base_lighting = ambient_light + light_level + moon_diffuse;
+
     vec4 texture_color = texture2DArray( material_texture_array, texture_coordinates );
 
     // The bump map uses the 'z' coordinate to represent height, while Digbuild uses the 'y'
-    // coordinate; thus the bump map needs to be swizzled a bit.
-    vec3 bump_direction = texture2DArray( material_bump_map_array, texture_coordinates ).xzy;
-    // The bump map 'x' and 'z' coordinates are packed into the range [0,1] so they need to be
-    // massaged into their real range of [-1,1].  The 'y' coordinate is not packed this way.
-    bump_direction.x = bump_direction.x * 2.0 - 1.0;
-    bump_direction.z = bump_direction.z * 2.0 - 1.0;
+    // coordinate; thus the bump map needs to be swizzled a bit.  The bump map 'x' and 'z'
+    // coordinates are packed into the range [0,1] so they need to be massaged into their
+    // real range of [-1,1].  Only those two are stored (the compressed bump map has just
+    // two channels), so the height is reconstructed from them.  It is left in its packed
+    // form, which is how it has always been used.
+    vec2 bump_packed = texture2DArray( material_bump_map_array, texture_coordinates ).xy * 2.0 - 1.0;
+    vec3 bump_direction = vec3(
+        bump_packed.x,
+        sqrt( max( 1.0 - dot( bump_packed, bump_packed ), 0.0 ) ) * 0.5 + 0.5,
+        bump_packed.y );
     bump_direction = normalize( bump_direction );
 
     float bump_factor = clamp( dot( tangent_sun_direction, bump_direction ), 0.0, 1.0 );
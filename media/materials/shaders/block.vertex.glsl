@@ -17,17 +17,55 @@
 ///////////////////////////////////////////////////////////////////////////
 
 #version 130
+#extension GL_ARB_uniform_buffer_object : require
 
-uniform vec3 camera_position;
-uniform vec3 sun_direction;
-uniform vec3 moon_direction;
-uniform vec3 sun_light_color;
-uniform vec3 moon_light_color;
+// This must match FrameUniformBlock (see renderer_material.h).
+layout(std140) uniform FrameUniforms
+{
+    vec3 camera_position;
+    float fog_distance;
+    vec3 sun_direction;
+    vec3 moon_direction;
+    vec3 sun_light_color;
+    vec3 moon_light_color;
+    vec3 zenith_color;
+    vec3 horizon_color;
+};
+
+uniform vec3 mesh_origin;
+
+// The position is relative to the mesh_origin, and its 'w' component holds the direction that
+// the face points in, which is an index into the arrays below (see CardinalRelation).
+attribute vec4 vertex_position;
+attribute vec3 vertex_texcoords;
+attribute vec3 vertex_lighting;
+attribute vec3 vertex_sunlighting;
+
+const vec3 face_normals[6] = vec3[6](
+    vec3(  0.0,  1.0,  0.0 ),
+    vec3(  0.0, -1.0,  0.0 ),
+    vec3(  0.0,  0.0,  1.0 ),
+    vec3(  0.0,  0.0, -1.0 ),
+    vec3(  1.0,  0.0,  0.0 ),
+    vec3( -1.0,  0.0,  0.0 )
+);
+
+const vec3 face_tangents[6] = vec3[6](
+    vec3(  0.0,  0.0,  1.0 ),
+    vec3(  0.0,  0.0, -1.0 ),
+    vec3(  1.0,  0.0,  0.0 ),
+    vec3( -1.0,  0.0,  0.0 ),
+    vec3(  0.0,  1.0,  0.0 ),
+    vec3(  0.0, -1.0,  0.0 )
+);
 
 varying vec3 tangent_sun_direction;
 varying vec3 tangent_camera_direction;
-varying vec3 sun_lighting;
-varying vec3 base_lighting;
+varying vec3 vertex_light_level;
+varying vec3 vertex_sunlight_level;
+varying float moon_incidence;
+varying vec3 light_texture_position;
+varying vec3 face_block_position;
 varying vec3 texture_coordinates;
 varying float fog_depth;
 
@@ -43,28 +81,29 @@ void main()
     //
     // NOTE: Digbuild actually uses a TNB matrix, because it uses the 'y' coordinate to represent height.
 
-    vec3 tangent = gl_MultiTexCoord0.xyz;
-    vec3 bitangent = cross( gl_Normal, tangent );
-    mat3 tbn_transpose = transpose( mat3( tangent, gl_Normal, bitangent ) );
-    tangent_sun_direction = normalize( tbn_transpose * sun_direction );
-    tangent_camera_direction = normalize( tbn_transpose * ( camera_position - gl_Vertex.xyz ) );
-
-    vec3 light_level = gl_MultiTexCoord2.rgb;
-    vec3 sunlight_level = gl_MultiTexCoord3.rgb;
+    int face = int( vertex_position.w );
+    vec3 normal = face_normals[face];
+    vec3 tangent = face_tangents[face];
+    vec4 position = vec4( mesh_origin + vertex_position.xyz, 1.0 );
 
-    sun_lighting = sunlight_level * sun_light_color;
+    vec3 bitangent = cross( normal, tangent );
+    mat3 tbn_transpose = transpose( mat3( tangent, normal, bitangent ) );
+    tangent_sun_direction = normalize( tbn_transpose * sun_direction );
+    tangent_camera_direction = normalize( tbn_transpose * ( camera_position - position.xyz ) );
 
-    float moon_incidence = 0.65 + 0.35 * dot( moon_direction, gl_Normal );
-    vec3 moon_lighting = moon_light_color * sunlight_level;
-    vec3 moon_diffuse = moon_lighting * moon_incidence;
+    vertex_light_level = vertex_lighting;
+    vertex_sunlight_level = vertex_sunlighting;
+    moon_incidence = 0.65 + 0.35 * dot( moon_direction, normal );
 
-    vec3 ambient_light = vec3( 0.06, 0.06, 0.06 ) + 0.50 * sun_lighting + 0.45 * moon_lighting;
-    base_lighting = ambient_light + light_level + moon_diffuse;
+    // For texture lighting, the light is sampled in the layer of Blocks in front of the face,
+    // which is in the Chunk of the Block that the face belongs to (see block.fragment.glsl).
+    light_texture_position = vertex_position.xyz + 0.5 * normal;
+    face_block_position = vertex_position.xyz - 0.5 * normal;
 
-    texture_coordinates = gl_MultiTexCoord1.stp;
+    texture_coordinates = vertex_texcoords;
     
-    vec4 eye_position = gl_ModelViewMatrix * gl_Vertex;
+    vec4 eye_position = gl_ModelViewMatrix * position;
     fog_depth = abs( eye_position.z / eye_position.w );
 
-    gl_Position = ftransform();
+    gl_Position = gl_ModelViewProjectionMatrix * position;
 }
@@ -17,9 +17,21 @@
 ///////////////////////////////////////////////////////////////////////////
 
 #version 130
+#extension GL_ARB_uniform_buffer_object : require
+
+// This must match FrameUniformBlock (see renderer_material.h).
+layout(std140) uniform FrameUniforms
+{
+    vec3 camera_position;
+    float fog_distance;
+    vec3 sun_direction;
+    vec3 moon_direction;
+    vec3 sun_light_color;
+    vec3 moon_light_color;
+    vec3 zenith_color;
+    vec3 horizon_color;
+};
 
-uniform vec3 zenith_color;
-uniform vec3 horizon_color;
 uniform float skydome_radius;
 
 varying float height;
@@ -0,0 +1,80 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BENCHMARK_RESULT_H
+#define BENCHMARK_RESULT_H
+
+#include <map>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../timer.h"
+#include "../log.h"
+
+// Each stage of a benchmark is timed on every iteration, and only its fastest time is kept,
+// which is much less noisy than the average.
+struct BenchmarkResult
+{
+    BenchmarkResult() :
+        checksum_( 0 )
+    {
+    }
+
+    // The time since the timer was last reset is divided between the given number of steps,
+    // and the timer is reset so that the next stage can be timed with it.
+    void add_time( const std::string& stage, HighResolutionTimer& timer, const unsigned num_steps = 1 )
+    {
+        const double seconds = timer.get_seconds_elapsed() / num_steps;
+        timer.reset();
+
+        TimeMap::iterator time_it = fastest_times_.find( stage );
+
+        if ( time_it == fastest_times_.end() )
+        {
+            fastest_times_[stage] = seconds;
+        }
+        else
+        {
+            time_it->second = std::min( time_it->second, seconds );
+        }
+    }
+
+    double get_time( const std::string& stage ) const
+    {
+        TimeMap::const_iterator time_it = fastest_times_.find( stage );
+
+        if ( time_it == fastest_times_.end() )
+        {
+            throw std::runtime_error( make_string() << "Benchmark stage " << stage << " was never timed." );
+        }
+
+        return time_it->second;
+    }
+
+    long checksum_;
+
+protected:
+
+    typedef std::map<std::string, double> TimeMap;
+
+    TimeMap fastest_times_;
+};
+
+#endif // BENCHMARK_RESULT_H
@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BENCHMARK_STORE_H
+#define BENCHMARK_STORE_H
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <string>
+
+// The ChunkStore is a flat directory, so it's simple to clear out.  Every benchmark run has
+// to start without one, or the World would load its columns instead of generating them,
+// and each run should clean up after itself.
+inline void remove_store( const std::string& path )
+{
+    DIR* directory = opendir( path.c_str() );
+
+    if ( !directory )
+    {
+        return;
+    }
+
+    while ( const dirent* entry = readdir( directory ) )
+    {
+        const std::string name = entry->d_name;
+
+        if ( name != "." && name != ".." )
+        {
+            unlink( ( path + "/" + name ).c_str() );
+        }
+    }
+
+    closedir( directory );
+    rmdir( path.c_str() );
+}
+
+#endif // BENCHMARK_STORE_H
@@ -0,0 +1,171 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+// This benchmark times the lighting and geometry updates for every Chunk in a patch of
+// generated terrain, in the same order that a full update of the World would run them.
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <boost/foreach.hpp>
+
+#include "../math.h"
+#include "../timer.h"
+#include "../chunk.h"
+#include "../world_generator.h"
+#include "benchmark_result.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const int
+    COLUMNS_PER_EDGE = 8,
+    NUM_ITERATIONS = 10;
+
+const uint64_t WORLD_SEED = 0;
+
+bool highest_chunk( const Chunk* a, const Chunk* b )
+{
+    return a->get_position()[1] > b->get_position()[1];
+}
+
+// The checksum covers all of the lighting and geometry, so that changes to their layout can
+// be verified not to change the results.
+long get_checksum( const ChunkV& chunks )
+{
+    long checksum = 0;
+
+    BOOST_FOREACH( const Chunk* chunk, chunks )
+    {
+        FOREACH_BLOCK( x, y, z )
+        {
+            const Block& block = chunk->get_block( Vector3i( x, y, z ) );
+            checksum += gmtl::dot( block.get_light_level(), Vector3i( 1, 17, 289 ) );
+            checksum += gmtl::dot( block.get_sunlight_level(), Vector3i( 3, 51, 867 ) );
+        }
+
+        checksum += chunk->get_mesh()->num_triangles_;
+    }
+
+    return checksum;
+}
+
+void run_benchmark( ChunkV& chunks, BenchmarkResult& result )
+{
+    // Resetting the lighting has to happen from the top down, since each Chunk's sunlight
+    // depends on the Chunk above it.  The rest can be done in any order.
+    std::sort( chunks.begin(), chunks.end(), highest_chunk );
+
+    HighResolutionTimer timer;
+
+    BOOST_FOREACH( Chunk* chunk, chunks )
+    {
+        chunk->reset_lighting();
+    }
+
+    result.add_time( "reset_lighting", timer );
+
+    BOOST_FOREACH( Chunk* chunk, chunks )
+    {
+        chunk->apply_lighting_to_self();
+    }
+
+    result.add_time( "apply_lighting_to_self", timer );
+
+    BOOST_FOREACH( Chunk* chunk, chunks )
+    {
+        chunk->apply_lighting_to_neighbors();
+    }
+
+    result.add_time( "apply_lighting_to_nbrs", timer );
+
+    // Every iteration produces the same lighting, so the meshes have to be rebuilt by force.
+    // Updating them again afterwards shows how cheap it is to find out that nothing changed.
+    BOOST_FOREACH( Chunk* chunk, chunks )
+    {
+        chunk->invalidate_geometry();
+        chunk->update_geometry();
+    }
+
+    result.add_time( "update_geometry", timer );
+
+    BOOST_FOREACH( Chunk* chunk, chunks )
+    {
+        chunk->update_geometry();
+    }
+
+    result.add_time( "update_geometry (same)", timer );
+    result.checksum_ = get_checksum( chunks );
+}
+
+void print_row( const BenchmarkResult& result, const std::string& stage, const unsigned num_chunks )
+{
+    const double seconds = result.get_time( stage );
+
+    std::cout <<
+        std::setw( 24 ) << std::left << stage <<
+        std::setw( 12 ) << std::right << std::fixed << std::setprecision( 2 ) << seconds * 1000.0 <<
+        std::setw( 12 ) << std::setprecision( 1 ) << seconds * 1e6 / num_chunks << std::endl;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    const WorldGenerator generator( WORLD_SEED );
+    ChunkMap chunk_map;
+    ChunkV chunks;
+
+    for ( int x = -COLUMNS_PER_EDGE / 2; x < COLUMNS_PER_EDGE / 2; ++x )
+    {
+        for ( int z = -COLUMNS_PER_EDGE / 2; z < COLUMNS_PER_EDGE / 2; ++z )
+        {
+            const ChunkSPV column = generator.generate_column( Vector2i( x * Chunk::SIZE_X, z * Chunk::SIZE_Z ) );
+
+            BOOST_FOREACH( const ChunkSP& chunk, column )
+            {
+                chunk_stitch_into_map( chunk, chunk_map );
+                chunks.push_back( chunk.get() );
+            }
+        }
+    }
+
+    BenchmarkResult result;
+
+    for ( int i = 0; i < NUM_ITERATIONS; ++i )
+    {
+        run_benchmark( chunks, result );
+    }
+
+    std::cout << chunks.size() << " chunks, " << NUM_ITERATIONS << " iterations, checksum " << result.checksum_ << std::endl;
+    std::cout <<
+        std::setw( 24 ) << std::left << "(fastest iteration)" <<
+        std::setw( 12 ) << std::right << "total ms" <<
+        std::setw( 12 ) << "us/chunk" << std::endl;
+
+    print_row( result, "reset_lighting", chunks.size() );
+    print_row( result, "apply_lighting_to_self", chunks.size() );
+    print_row( result, "apply_lighting_to_nbrs", chunks.size() );
+    print_row( result, "update_geometry", chunks.size() );
+    print_row( result, "update_geometry (same)", chunks.size() );
+
+    return 0;
+}
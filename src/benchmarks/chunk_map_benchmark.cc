@@ -0,0 +1,236 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+// This benchmark compares the VectorHashMap that is used for the ChunkMap against
+// the std::map that it replaced, using access patterns similar to those of the World.
+
+#include <map>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <boost/random/variate_generator.hpp>
+#include <boost/random/linear_congruential.hpp>
+
+#include "../math.h"
+#include "../timer.h"
+#include "../vector_hash_map.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Chunks are stand-ins here, since only the container performance is of interest.
+typedef boost::shared_ptr<int> ChunkSP;
+
+typedef std::map<Vector3i, ChunkSP, VectorLess<Vector3i> > TreeChunkMap;
+typedef VectorHashMap<Vector3i, ChunkSP> HashChunkMap;
+
+const int
+    CHUNK_SIZE = 16,
+    COLUMNS_PER_EDGE = 32,
+    CHUNKS_PER_COLUMN = 12,
+    NUM_BLOCK_LOOKUPS = 4000000;
+
+typedef std::vector<Vector3i> Vector3iV;
+
+struct BenchmarkResult
+{
+    BenchmarkResult() :
+        insert_( 0.0 ),
+        block_lookup_( 0.0 ),
+        neighbor_lookup_( 0.0 ),
+        iterate_( 0.0 ),
+        erase_( 0.0 ),
+        checksum_( 0 )
+    {
+    }
+
+    double
+        insert_,
+        block_lookup_,
+        neighbor_lookup_,
+        iterate_,
+        erase_;
+
+    long checksum_;
+};
+
+Vector3i get_chunk_position( const Vector3i& block_position )
+{
+    Vector3i chunk_position;
+
+    for ( int i = 0; i < Vector3i::Size; ++i )
+    {
+        const int remainder = ( ( block_position[i] % CHUNK_SIZE ) + CHUNK_SIZE ) % CHUNK_SIZE;
+        chunk_position[i] = block_position[i] - remainder;
+    }
+
+    return chunk_position;
+}
+
+template <typename MapType>
+BenchmarkResult run_benchmark( const Vector3iV& chunk_positions, const Vector3iV& block_positions )
+{
+    BenchmarkResult result;
+    MapType chunks;
+    HighResolutionTimer timer;
+
+    for ( unsigned i = 0; i < chunk_positions.size(); ++i )
+    {
+        chunks[chunk_positions[i]] = ChunkSP( new int( i ) );
+    }
+
+    result.insert_ = timer.get_seconds_elapsed();
+    timer.reset();
+
+    // This is similar to what World::get_block() does for every Block that the Player
+    // collides with, targets, etc.
+    for ( unsigned i = 0; i < block_positions.size(); ++i )
+    {
+        typename MapType::const_iterator chunk_it = chunks.find( get_chunk_position( block_positions[i] ) );
+
+        if ( chunk_it != chunks.end() )
+        {
+            result.checksum_ += *chunk_it->second;
+        }
+    }
+
+    result.block_lookup_ = timer.get_seconds_elapsed();
+    timer.reset();
+
+    // This is similar to what chunk_stitch_into_map() does for every Chunk.
+    for ( unsigned i = 0; i < chunk_positions.size(); ++i )
+    {
+        for ( int x = -1; x <= 1; ++x )
+        {
+            for ( int y = -1; y <= 1; ++y )
+            {
+                for ( int z = -1; z <= 1; ++z )
+                {
+                    const Vector3i neighbor_position = chunk_positions[i] + Vector3i( x, y, z ) * CHUNK_SIZE;
+                    typename MapType::const_iterator chunk_it = chunks.find( neighbor_position );
+
+                    if ( chunk_it != chunks.end() )
+                    {
+                        result.checksum_ += *chunk_it->second;
+                    }
+                }
+            }
+        }
+    }
+
+    result.neighbor_lookup_ = timer.get_seconds_elapsed();
+    timer.reset();
+
+    for ( typename MapType::const_iterator chunk_it = chunks.begin(); chunk_it != chunks.end(); ++chunk_it )
+    {
+        result.checksum_ += *chunk_it->second;
+    }
+
+    result.iterate_ = timer.get_seconds_elapsed();
+    timer.reset();
+
+    for ( unsigned i = 0; i < chunk_positions.size(); ++i )
+    {
+        chunks.erase( chunk_positions[i] );
+    }
+
+    result.erase_ = timer.get_seconds_elapsed();
+
+    return result;
+}
+
+void print_row( const std::string& label, const double tree_seconds, const double hash_seconds )
+{
+    std::cout <<
+        std::setw( 18 ) << std::left << label <<
+        std::setw( 12 ) << std::right << std::fixed << std::setprecision( 2 ) << tree_seconds * 1000.0 <<
+        std::setw( 12 ) << hash_seconds * 1000.0 <<
+        std::setw( 10 ) << std::setprecision( 1 ) << tree_seconds / hash_seconds << "x" << std::endl;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    boost::rand48 generator( 0 );
+
+    Vector3iV chunk_positions;
+
+    for ( int x = -COLUMNS_PER_EDGE / 2; x < COLUMNS_PER_EDGE / 2; ++x )
+    {
+        for ( int z = -COLUMNS_PER_EDGE / 2; z < COLUMNS_PER_EDGE / 2; ++z )
+        {
+            for ( int y = 0; y < CHUNKS_PER_COLUMN; ++y )
+            {
+                chunk_positions.push_back( Vector3i( x, y, z ) * CHUNK_SIZE );
+            }
+        }
+    }
+
+    boost::variate_generator<boost::rand48&, boost::uniform_int<> >
+        shuffle_random( generator, boost::uniform_int<>( 0, chunk_positions.size() - 1 ) );
+
+    for ( unsigned i = 0; i < chunk_positions.size(); ++i )
+    {
+        std::swap( chunk_positions[i], chunk_positions[shuffle_random()] );
+    }
+
+    const int horizontal_extent = COLUMNS_PER_EDGE * CHUNK_SIZE / 2;
+
+    boost::variate_generator<boost::rand48&, boost::uniform_int<> >
+        horizontal_random( generator, boost::uniform_int<>( -horizontal_extent, horizontal_extent ) ),
+        vertical_random( generator, boost::uniform_int<>( 0, CHUNKS_PER_COLUMN * CHUNK_SIZE ) );
+
+    Vector3iV block_positions;
+
+    for ( int i = 0; i < NUM_BLOCK_LOOKUPS; ++i )
+    {
+        block_positions.push_back( Vector3i( horizontal_random(), vertical_random(), horizontal_random() ) );
+    }
+
+    const BenchmarkResult
+        tree = run_benchmark<TreeChunkMap>( chunk_positions, block_positions ),
+        hash = run_benchmark<HashChunkMap>( chunk_positions, block_positions );
+
+    if ( tree.checksum_ != hash.checksum_ )
+    {
+        std::cerr << "Checksum mismatch: " << tree.checksum_ << " != " << hash.checksum_ << std::endl;
+        return 1;
+    }
+
+    std::cout << chunk_positions.size() << " chunks, " << NUM_BLOCK_LOOKUPS << " block lookups" << std::endl;
+    std::cout <<
+        std::setw( 18 ) << std::left << "(milliseconds)" <<
+        std::setw( 12 ) << std::right << "std::map" <<
+        std::setw( 12 ) << "hash" <<
+        std::setw( 11 ) << "speedup" << std::endl;
+
+    print_row( "insert", tree.insert_, hash.insert_ );
+    print_row( "block lookup", tree.block_lookup_, hash.block_lookup_ );
+    print_row( "neighbor lookup", tree.neighbor_lookup_, hash.neighbor_lookup_ );
+    print_row( "iterate", tree.iterate_, hash.iterate_ );
+    print_row( "erase", tree.erase_, hash.erase_ );
+
+    return 0;
+}
@@ -0,0 +1,703 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+// This benchmark runs a fixed set of scenarios through the World (and the WorldGenerator
+// and Chunk code beneath it) without a window, and prints the results as JSON, so that
+// they can be compared between versions.  Every scenario uses the same seed, and has a
+// checksum of its results, so that a change in speed can be told apart from a change in
+// behavior.
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+#include "../math.h"
+#include "../timer.h"
+#include "../world_generator.h"
+#include "../world.h"
+#include "../world_replication.h"
+#include "benchmark_store.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const uint64_t WORLD_SEED = 0;
+
+const char* STORE_PATH = "engine_benchmark_store";
+
+// The server World has its own store, since it's generated separately.
+const char* SERVER_STORE_PATH = "engine_benchmark_server_store";
+
+const Vector3f SPAWN_POSITION( 0.0f, 120.0f, 0.0f );
+
+// The column of Blocks that the spawn position is in.
+const Vector2i SPAWN_COLUMN( 0, 0 );
+
+// Each region is WorldGenerator::REGION_SIZE Blocks on a side, which is 8x8 columns.
+const int NUM_GENERATION_REGIONS = 2;
+
+const int
+    NUM_GENERATION_ITERATIONS = 3,
+    NUM_RELIGHT_ITERATIONS = 3,
+    NUM_EDIT_ITERATIONS = 10,
+    NUM_GEOMETRY_ITERATIONS = 3,
+    NUM_FLUID_TICKS = 1000;
+
+// In the fluid scenario, a shaft this deep is dug into the sea floor every so many ticks.
+const int
+    FLUID_SHAFT_INTERVAL = 50,
+    FLUID_SHAFT_DEPTH = 4;
+
+// In the replication scenario, the server World is replicated to this many clients, all of
+// whose Players are at the spawn position.  The first one's messages are applied to a
+// replica World, to check that it ends up the same as the server's.
+const int NUM_REPLICATION_CLIENTS = 4;
+
+// The clients (and the server World) only see this far, which keeps them within the
+// columns that are loaded at startup, so that nothing is generated in the background.
+const Scalar REPLICATION_VIEW_RADIUS = 40.0f;
+
+// The replica is given up to this many ticks to stream in all of its columns.  Then this
+// many more ticks are run, with a shaft dug every so often.
+const int
+    MAX_REPLICATION_STREAMING_TICKS = 100,
+    NUM_REPLICATION_TICKS = 200,
+    REPLICATION_SHAFT_INTERVAL = 20;
+
+const float REPLICATION_TICK_INTERVAL = 1.0f / 20.0f;
+
+// The times of every iteration of a scenario are kept, in seconds.  The fastest one is
+// the least noisy to compare, but the mean and the slowest show up stalls.
+struct ScenarioResult
+{
+    ScenarioResult( const std::string& name ) :
+        name_( name ),
+        checksum_( 0 )
+    {
+    }
+
+    void add_time( const double seconds )
+    {
+        times_.push_back( seconds );
+    }
+
+    // Anything else that a scenario measures is printed along with its times.
+    template <typename T>
+    void add_metric( const std::string& name, const T& value )
+    {
+        std::ostringstream stream;
+        stream << std::boolalpha << value;
+        metrics_.push_back( Metric( name, stream.str() ) );
+    }
+
+    typedef std::pair<std::string, std::string> Metric;
+
+    std::string name_;
+
+    std::vector<double> times_;
+
+    std::vector<Metric> metrics_;
+
+    long checksum_;
+};
+
+typedef std::vector<ScenarioResult> ScenarioResultV;
+
+long get_material_checksum( const Chunk& chunk )
+{
+    long checksum = 0;
+
+    FOREACH_BLOCK( x, y, z )
+    {
+        const Block& block = chunk.get_block( Vector3i( x, y, z ) );
+        checksum += ( block.get_material() + 1 ) * ( x + 17 * y + 289 * z + 1 ) + block.get_data();
+    }
+
+    return checksum;
+}
+
+long get_lighting_checksum( const World& world )
+{
+    long checksum = 0;
+
+    BOOST_FOREACH( const ChunkMap::value_type& chunk_it, world.get_chunks() )
+    {
+        const Chunk& chunk = *chunk_it.second;
+
+        FOREACH_BLOCK( x, y, z )
+        {
+            const Block& block = chunk.get_block( Vector3i( x, y, z ) );
+            checksum += gmtl::dot( block.get_light_level(), Vector3i( 1, 17, 289 ) );
+            checksum += gmtl::dot( block.get_sunlight_level(), Vector3i( 3, 51, 867 ) );
+        }
+    }
+
+    return checksum;
+}
+
+long get_geometry_checksum( const World& world )
+{
+    long checksum = 0;
+
+    BOOST_FOREACH( const ChunkMap::value_type& chunk_it, world.get_chunks() )
+    {
+        checksum += chunk_it.second->get_mesh()->num_triangles_;
+    }
+
+    return checksum;
+}
+
+long get_world_checksum( const World& world )
+{
+    long checksum = 0;
+
+    BOOST_FOREACH( const ChunkMap::value_type& chunk_it, world.get_chunks() )
+    {
+        checksum += get_material_checksum( *chunk_it.second );
+    }
+
+    return checksum;
+}
+
+bool column_within_radius( const Vector3i& chunk_position, const Vector3f& position, const Scalar radius )
+{
+    const Vector2f column_center(
+        Scalar( chunk_position[0] ) + Scalar( Chunk::SIZE_X ) / 2.0f,
+        Scalar( chunk_position[2] ) + Scalar( Chunk::SIZE_Z ) / 2.0f
+    );
+
+    return gmtl::length( Vector2f( column_center - Vector2f( position[0], position[2] ) ) ) <= radius;
+}
+
+bool materials_match( const Chunk& a, const Chunk& b )
+{
+    FOREACH_BLOCK( x, y, z )
+    {
+        const Vector3i index( x, y, z );
+
+        if ( a.get_block( index ).get_material() != b.get_block( index ).get_material() )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns true if the replica has exactly the Chunks that the server has within the view
+// radius, with the same materials.  The lighting of the columns at the edge of a replica is
+// different, and the flow levels of its fluids can lag behind (see world_replication.h),
+// so neither is compared.
+bool replica_matches( const World& server, const World& replica, const Vector3f& player_position )
+{
+    unsigned num_server_chunks = 0;
+
+    BOOST_FOREACH( const ChunkMap::value_type& chunk_it, server.get_chunks() )
+    {
+        if ( !column_within_radius( chunk_it.first, player_position, REPLICATION_VIEW_RADIUS ) )
+        {
+            continue;
+        }
+
+        ++num_server_chunks;
+
+        const ChunkMap::const_iterator replica_it = replica.get_chunks().find( chunk_it.first );
+
+        if ( replica_it == replica.get_chunks().end() ||
+             !materials_match( *replica_it->second, *chunk_it.second ) )
+        {
+            return false;
+        }
+    }
+
+    return num_server_chunks == replica.get_chunks().size();
+}
+
+// Runs a full update of whatever has been marked, and times it.  The updated Chunks have
+// to be collected afterwards, just as the main loop would.
+double update_chunks( World& world )
+{
+    HighResolutionTimer timer;
+    world.update_chunks();
+    const double seconds = timer.get_seconds_elapsed();
+
+    World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+    world.get_updated_chunks();
+
+    return seconds;
+}
+
+// Returns the position of the highest solid Block in the column.
+Vector3i find_surface( const World& world, const Vector2i& column )
+{
+    int top = 0;
+
+    BOOST_FOREACH( const ChunkMap::value_type& chunk_it, world.get_chunks() )
+    {
+        top = std::max( top, chunk_it.second->get_position()[1] + Chunk::SIZE_Y - 1 );
+    }
+
+    for ( int y = top; y > 0; --y )
+    {
+        const Vector3i position( column[0], y, column[1] );
+        const ConstBlockIterator block_it = world.get_block( position );
+
+        if ( block_it.block_ && block_it.block_->get_collision_mode() == BLOCK_COLLISION_MODE_SOLID )
+        {
+            return position;
+        }
+    }
+
+    return Vector3i( column[0], 0, column[1] );
+}
+
+ScenarioResult run_cold_generation()
+{
+    ScenarioResult result( "cold_generation" );
+    const int num_columns = WorldGenerator::CHUNKS_PER_REGION_EDGE[0] * WorldGenerator::CHUNKS_PER_REGION_EDGE[1];
+
+    for ( int i = 0; i < NUM_GENERATION_ITERATIONS; ++i )
+    {
+        // A new generator is used each time, so that nothing it has worked out for one
+        // iteration is reused by the next.
+        HighResolutionTimer timer;
+        const WorldGenerator generator( WORLD_SEED );
+        std::vector<ChunkSPV> columns;
+
+        for ( int region = 0; region < NUM_GENERATION_REGIONS; ++region )
+        {
+            for ( int column = 0; column < num_columns; ++column )
+            {
+                const Vector2i column_position(
+                    ( region * WorldGenerator::CHUNKS_PER_REGION_EDGE[0] + column % WorldGenerator::CHUNKS_PER_REGION_EDGE[0] ) * Chunk::SIZE_X,
+                    ( column / WorldGenerator::CHUNKS_PER_REGION_EDGE[0] ) * Chunk::SIZE_Z
+                );
+
+                columns.push_back( generator.generate_column( column_position ) );
+            }
+        }
+
+        result.add_time( timer.get_seconds_elapsed() );
+
+        result.checksum_ = 0;
+
+        BOOST_FOREACH( const ChunkSPV& column, columns )
+        {
+            BOOST_FOREACH( const ChunkSP& chunk, column )
+            {
+                result.checksum_ += get_material_checksum( *chunk );
+            }
+        }
+    }
+
+    return result;
+}
+
+ScenarioResult run_full_relight( World& world )
+{
+    ScenarioResult result( "full_relight" );
+
+    for ( int i = 0; i < NUM_RELIGHT_ITERATIONS; ++i )
+    {
+        {
+            World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+
+            BOOST_FOREACH( const ChunkMap::value_type& chunk_it, world.get_chunks() )
+            {
+                world.mark_chunk_for_update( chunk_it.second.get() );
+            }
+        }
+
+        result.add_time( update_chunks( world ) );
+    }
+
+    World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+    result.checksum_ = get_lighting_checksum( world );
+
+    return result;
+}
+
+// Digs out the surface Block at the spawn position, and then puts it back, so the World is
+// left as it was.  Each dig and each placement is timed as one iteration.
+ScenarioResult run_block_edit( World& world )
+{
+    ScenarioResult result( "block_edit_relight" );
+
+    Vector3i position;
+    BlockMaterial material;
+
+    {
+        World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+        position = find_surface( world, SPAWN_COLUMN );
+        material = world.get_block( position ).block_->get_material();
+    }
+
+    for ( int i = 0; i < NUM_EDIT_ITERATIONS; ++i )
+    {
+        const BlockMaterial new_material = i % 2 == 0 ? BLOCK_MATERIAL_AIR : material;
+
+        {
+            World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+            world.get_block( position ).block_->set_material( new_material );
+            world.mark_block_for_update( position );
+        }
+
+        result.add_time( update_chunks( world ) );
+    }
+
+    World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+    result.checksum_ = get_lighting_checksum( world );
+
+    return result;
+}
+
+ScenarioResult run_geometry_rebuild( World& world )
+{
+    ScenarioResult result( "geometry_rebuild" );
+
+    for ( int i = 0; i < NUM_GEOMETRY_ITERATIONS; ++i )
+    {
+        {
+            World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+
+            // The meshes would otherwise be found to be unchanged, and not rebuilt at all.
+            BOOST_FOREACH( const ChunkMap::value_type& chunk_it, world.get_chunks() )
+            {
+                chunk_it.second->invalidate_geometry();
+            }
+
+            world.set_greedy_meshing( Chunk::get_greedy_meshing() );
+        }
+
+        result.add_time( update_chunks( world ) );
+    }
+
+    World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+    result.checksum_ = get_geometry_checksum( world );
+
+    return result;
+}
+
+// Digs a shaft down from the surface of the given column.  The spawn position is out at
+// sea, so the water pours into it.
+// Precondition: you must hold the Chunk lock before calling this!
+void dig_shaft( World& world, const Vector2i& column )
+{
+    const Vector3i surface = find_surface( world, column );
+
+    for ( int depth = 0; depth < FLUID_SHAFT_DEPTH; ++depth )
+    {
+        const Vector3i position = surface - Vector3i( 0, depth, 0 );
+        BlockIterator block_it = world.get_block( position );
+
+        if ( block_it.block_ && block_it.block_->get_material() != BLOCK_MATERIAL_BEDROCK )
+        {
+            block_it.block_->set_material( BLOCK_MATERIAL_AIR );
+            world.mark_block_for_update( position );
+        }
+    }
+}
+
+// The water would settle down (and stop being simulated) after a while, so a new shaft is
+// dug for it to flow into every so often.  Only the simulation steps are timed.  This
+// leaves the World full of holes, so it has to come last.
+ScenarioResult run_fluid_ticks( World& world )
+{
+    ScenarioResult result( "fluid_ticks" );
+
+    World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+
+    // The fluids are simulated around the surface, rather than up at the spawn position.
+    const Vector3i surface = find_surface( world, SPAWN_COLUMN );
+    const Vector3i surface_chunk = surface - world.get_block_index( surface );
+
+    for ( int i = 0; i < NUM_FLUID_TICKS; ++i )
+    {
+        if ( i % FLUID_SHAFT_INTERVAL == 0 )
+        {
+            // This scatters the shafts deterministically within the simulated Chunks.
+            const int shaft = i / FLUID_SHAFT_INTERVAL;
+            dig_shaft( world, SPAWN_COLUMN + Vector2i( shaft * 37 % 41 - 20, shaft * 53 % 41 - 20 ) );
+        }
+
+        HighResolutionTimer timer;
+        world.simulate_fluids( surface_chunk );
+        result.add_time( timer.get_seconds_elapsed() );
+    }
+
+    result.checksum_ = get_world_checksum( world );
+
+    return result;
+}
+
+// Runs one tick of the server, and applies the first client's messages to the replica.
+// Only the server's part of the tick is timed: the clients' positions are received, the
+// server World is stepped and updated, and the messages for every client are queued up and
+// taken.  The replica applying its messages (and lighting and meshing the columns) is the
+// client's work.
+double run_replication_tick(
+    World& server,
+    WorldReplicator& replicator,
+    const std::vector<ReplicationClientId>& client_ids,
+    WorldReplica& replica,
+    World& replica_world
+)
+{
+    ByteV player_position_message;
+    WorldReplica::encode_player_position( SPAWN_POSITION, player_position_message );
+
+    ByteV replica_messages;
+
+    HighResolutionTimer timer;
+
+    BOOST_FOREACH( const ReplicationClientId client_id, client_ids )
+    {
+        replicator.receive( client_id, &player_position_message[0], player_position_message.size() );
+    }
+
+    {
+        World::ChunkGuard chunk_guard( server.get_chunk_lock() );
+        server.do_one_step( REPLICATION_TICK_INTERVAL, replicator.get_player_positions() );
+    }
+
+    server.update_chunks();
+
+    {
+        World::ChunkGuard chunk_guard( server.get_chunk_lock() );
+        server.get_evicted_chunks();
+        replicator.replicate( server );
+    }
+
+    BOOST_FOREACH( const ReplicationClientId client_id, client_ids )
+    {
+        ByteV messages;
+        replicator.take_messages( client_id, messages );
+
+        if ( client_id == client_ids.front() )
+        {
+            replica_messages.swap( messages );
+        }
+    }
+
+    const double seconds = timer.get_seconds_elapsed();
+
+    if ( !replica_messages.empty() )
+    {
+        replica.receive( &replica_messages[0], replica_messages.size() );
+    }
+
+    {
+        World::ChunkGuard chunk_guard( replica_world.get_chunk_lock() );
+        replica.apply( replica_world );
+    }
+
+    update_chunks( replica_world );
+
+    return seconds;
+}
+
+// A server World is replicated to several clients, one of which applies it to a replica
+// World.  The columns are streamed in first, and then shafts are dug (and filled in by the
+// fluid simulation), so that only the modified Blocks are replicated.  The bytes sent to
+// each client are measured separately for each of these.
+ScenarioResult run_server_replication()
+{
+    ScenarioResult result( "server_replication" );
+
+    remove_store( SERVER_STORE_PATH );
+
+    {
+        World server( WORLD_SEED, SPAWN_POSITION, SERVER_STORE_PATH, WORLD_MODE_SERVER );
+        server.set_view_radius( REPLICATION_VIEW_RADIUS );
+
+        WorldReplicator replicator( SPAWN_POSITION );
+        std::vector<ReplicationClientId> client_ids;
+
+        for ( int i = 0; i < NUM_REPLICATION_CLIENTS; ++i )
+        {
+            client_ids.push_back( replicator.add_client( server.get_world_seed() ) );
+            replicator.set_view_radius( client_ids.back(), REPLICATION_VIEW_RADIUS );
+        }
+
+        // The replica World can't be created until the replica has been welcomed.
+        WorldReplica replica;
+        ByteV welcome_message;
+        replicator.take_messages( client_ids.front(), welcome_message );
+        replica.receive( &welcome_message[0], welcome_message.size() );
+        World replica_world( replica.get_world_seed(), replica.get_spawn_position(), "", WORLD_MODE_REPLICA );
+
+        unsigned num_expected_chunks = 0;
+
+        BOOST_FOREACH( const ChunkMap::value_type& chunk_it, server.get_chunks() )
+        {
+            if ( column_within_radius( chunk_it.first, SPAWN_POSITION, REPLICATION_VIEW_RADIUS ) )
+            {
+                ++num_expected_chunks;
+            }
+        }
+
+        int num_streaming_ticks = 0;
+
+        while ( num_streaming_ticks < MAX_REPLICATION_STREAMING_TICKS &&
+                replica_world.get_chunks().size() < num_expected_chunks )
+        {
+            result.add_time( run_replication_tick( server, replicator, client_ids, replica, replica_world ) );
+            ++num_streaming_ticks;
+        }
+
+        uint64_t initial_bytes_sent = 0;
+
+        BOOST_FOREACH( const ReplicationClientId client_id, client_ids )
+        {
+            initial_bytes_sent += replicator.get_bytes_sent( client_id );
+        }
+
+        for ( int i = 0; i < NUM_REPLICATION_TICKS; ++i )
+        {
+            if ( i % REPLICATION_SHAFT_INTERVAL == 0 )
+            {
+                World::ChunkGuard chunk_guard( server.get_chunk_lock() );
+                const int shaft = i / REPLICATION_SHAFT_INTERVAL;
+                dig_shaft( server, SPAWN_COLUMN + Vector2i( shaft * 37 % 41 - 20, shaft * 53 % 41 - 20 ) );
+            }
+
+            result.add_time( run_replication_tick( server, replicator, client_ids, replica, replica_world ) );
+        }
+
+        uint64_t total_bytes_sent = 0;
+
+        BOOST_FOREACH( const ReplicationClientId client_id, client_ids )
+        {
+            total_bytes_sent += replicator.get_bytes_sent( client_id );
+        }
+
+        World::ChunkGuard server_guard( server.get_chunk_lock() );
+        World::ChunkGuard replica_guard( replica_world.get_chunk_lock() );
+
+        result.add_metric( "clients", NUM_REPLICATION_CLIENTS );
+        result.add_metric( "streaming_ticks", num_streaming_ticks );
+        result.add_metric( "initial_bytes_per_client", initial_bytes_sent / NUM_REPLICATION_CLIENTS );
+        result.add_metric( "tick_bytes_per_client",
+            double( total_bytes_sent - initial_bytes_sent ) / NUM_REPLICATION_CLIENTS / NUM_REPLICATION_TICKS );
+        result.add_metric( "replica_matches", replica_matches( server, replica_world, SPAWN_POSITION ) );
+        result.checksum_ = get_world_checksum( replica_world );
+    }
+
+    remove_store( SERVER_STORE_PATH );
+
+    return result;
+}
+
+void print_result( const ScenarioResult& result, const bool last )
+{
+    std::vector<double> times = result.times_;
+    std::sort( times.begin(), times.end() );
+
+    double total = 0.0;
+
+    BOOST_FOREACH( const double seconds, times )
+    {
+        total += seconds;
+    }
+
+    std::cout <<
+        "    {\"name\": \"" << result.name_ << "\"" <<
+        ", \"iterations\": " << times.size() <<
+        std::fixed << std::setprecision( 4 ) <<
+        ", \"min_ms\": " << times.front() * 1000.0 <<
+        ", \"median_ms\": " << times[times.size() / 2] * 1000.0 <<
+        ", \"mean_ms\": " << total / times.size() * 1000.0 <<
+        ", \"max_ms\": " << times.back() * 1000.0 <<
+        ", \"total_ms\": " << total * 1000.0 <<
+        ", \"checksum\": " << result.checksum_;
+
+    BOOST_FOREACH( const ScenarioResult::Metric& metric, result.metrics_ )
+    {
+        std::cout << ", \"" << metric.first << "\": " << metric.second;
+    }
+
+    std::cout << "}" << ( last ? "" : "," ) << std::endl;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    remove_store( STORE_PATH );
+
+    ScenarioResultV results;
+    results.push_back( run_cold_generation() );
+
+    unsigned num_chunks = 0;
+
+    {
+        // The World generates and updates the columns around the spawn position up front.
+        HighResolutionTimer timer;
+        World world( WORLD_SEED, SPAWN_POSITION, STORE_PATH );
+
+        ScenarioResult startup( "world_startup" );
+        startup.add_time( timer.get_seconds_elapsed() );
+
+        {
+            World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+            world.get_updated_chunks();
+            startup.checksum_ = get_lighting_checksum( world );
+            num_chunks = world.get_chunks().size();
+        }
+
+        results.push_back( startup );
+        results.push_back( run_full_relight( world ) );
+        results.push_back( run_block_edit( world ) );
+        results.push_back( run_geometry_rebuild( world ) );
+        results.push_back( run_fluid_ticks( world ) );
+    }
+
+    remove_store( STORE_PATH );
+
+    results.push_back( run_server_replication() );
+
+    std::cout <<
+        "{" << std::endl <<
+        "  \"benchmark\": \"engine\"," << std::endl <<
+        "  \"seed\": " << WORLD_SEED << "," << std::endl <<
+        "  \"threads\": " << boost::thread::hardware_concurrency() << "," << std::endl <<
+        "  \"greedy_meshing\": " << ( Chunk::get_greedy_meshing() ? "true" : "false" ) << "," << std::endl <<
+        "  \"world_chunks\": " << num_chunks << "," << std::endl <<
+        "  \"scenarios\": [" << std::endl;
+
+    for ( unsigned i = 0; i < results.size(); ++i )
+    {
+        print_result( results[i], i + 1 == results.size() );
+    }
+
+    std::cout <<
+        "  ]" << std::endl <<
+        "}" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+// This benchmark drops crowds of Entities onto a patch of generated terrain, and times how
+// many of them EntitySystem::step_all() can step through the collision code per millisecond.
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/variate_generator.hpp>
+#include <boost/random/linear_congruential.hpp>
+
+#include "../math.h"
+#include "../timer.h"
+#include "../world.h"
+#include "../entity.h"
+#include "benchmark_result.h"
+#include "benchmark_store.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const unsigned NUM_ENTITIES[] = { 1000, 4000, 16000 };
+
+const int
+    NUM_SETTLING_STEPS = 60,
+    NUM_ITERATIONS = 5,
+    NUM_STEPS_PER_ITERATION = 60;
+
+const float STEP_TIME = 1.0f / 60.0f;
+
+const uint64_t WORLD_SEED = 0;
+
+const char* STORE_PATH = "entity_benchmark_store";
+
+// The Entities are scattered within this distance of the spawn position, which is well
+// inside of the columns that the World generates up front.
+const Scalar
+    SPAWN_RADIUS = 15.0f,
+    SPAWN_MIN_HEIGHT = 60.0f,
+    SPAWN_MAX_HEIGHT = 110.0f,
+    MAX_HORIZONTAL_SPEED = 1.5f;
+
+const Vector3f
+    SPAWN_POSITION( 0.0f, 120.0f, 0.0f ),
+    ENTITY_SIZE( 0.50f, 1.9f, 0.50f ),
+    GRAVITY( 0.0f, -30.0f, 0.0f );
+
+long get_checksum( const EntitySystem& entities, const std::vector<EntitySystem::EntityId>& ids )
+{
+    long checksum = 0;
+
+    for ( unsigned i = 0; i < ids.size(); ++i )
+    {
+        const Vector3i position = vector_cast<int>( pointwise_floor( entities.get_position( ids[i] ) ) );
+        checksum += gmtl::dot( position, Vector3i( 1, 17, 289 ) );
+    }
+
+    return checksum;
+}
+
+void run_benchmark( World& world, const unsigned num_entities, BenchmarkResult& result )
+{
+    boost::rand48 generator( num_entities );
+    boost::variate_generator<boost::rand48&, boost::uniform_real<Scalar> >
+        unit_random( generator, boost::uniform_real<Scalar>( -1.0f, 1.0f ) ),
+        height_random( generator, boost::uniform_real<Scalar>( SPAWN_MIN_HEIGHT, SPAWN_MAX_HEIGHT ) );
+
+    EntitySystem entities;
+    std::vector<EntitySystem::EntityId> ids;
+
+    for ( unsigned i = 0; i < num_entities; ++i )
+    {
+        const Vector3f position(
+            SPAWN_POSITION[0] + unit_random() * SPAWN_RADIUS,
+            height_random(),
+            SPAWN_POSITION[2] + unit_random() * SPAWN_RADIUS
+        );
+
+        const EntitySystem::EntityId id = entities.add_entity( position, ENTITY_SIZE );
+        entities.set_velocity( id, Vector3f( unit_random(), 0.0f, unit_random() ) * MAX_HORIZONTAL_SPEED );
+        entities.set_acceleration( id, GRAVITY );
+        ids.push_back( id );
+    }
+
+    // Let the Entities land first, so that the timed steps are mostly spent sliding along
+    // the terrain instead of falling through the air.
+    for ( int i = 0; i < NUM_SETTLING_STEPS; ++i )
+    {
+        entities.step_all( STEP_TIME, world );
+    }
+
+    for ( int i = 0; i < NUM_ITERATIONS; ++i )
+    {
+        HighResolutionTimer timer;
+
+        for ( int j = 0; j < NUM_STEPS_PER_ITERATION; ++j )
+        {
+            entities.step_all( STEP_TIME, world );
+        }
+
+        result.add_time( "step", timer, NUM_STEPS_PER_ITERATION );
+    }
+
+    result.checksum_ = get_checksum( entities, ids );
+}
+
+} // anonymous namespace
+
+int main()
+{
+    remove_store( STORE_PATH );
+
+    {
+        World world( WORLD_SEED, SPAWN_POSITION, STORE_PATH );
+        World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+
+        std::cout <<
+            std::setw( 12 ) << std::left << "entities" <<
+            std::setw( 12 ) << std::right << "ms/step" <<
+            std::setw( 14 ) << "entities/ms" <<
+            std::setw( 14 ) << "checksum" << std::endl;
+
+        for ( unsigned i = 0; i < sizeof( NUM_ENTITIES ) / sizeof( NUM_ENTITIES[0] ); ++i )
+        {
+            BenchmarkResult result;
+            run_benchmark( world, NUM_ENTITIES[i], result );
+            const double step_seconds = result.get_time( "step" );
+
+            std::cout <<
+                std::setw( 12 ) << std::left << NUM_ENTITIES[i] <<
+                std::setw( 12 ) << std::right << std::fixed << std::setprecision( 3 ) << step_seconds * 1000.0 <<
+                std::setw( 14 ) << std::setprecision( 0 ) << NUM_ENTITIES[i] / ( step_seconds * 1000.0 ) <<
+                std::setw( 14 ) << result.checksum_ << std::endl;
+        }
+    }
+
+    // The World saves its columns when it's destroyed, so the store can only be removed after.
+    remove_store( STORE_PATH );
+
+    return 0;
+}
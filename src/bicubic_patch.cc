@@ -200,3 +200,45 @@ Scalar BicubicPatch::interpolate( const Vector2f& position ) const
         coefficients_[14] * px2 * py3 +
         coefficients_[15] * px3 * py3;
 }
+
+void BicubicPatch::interpolate_row( const Vector2f& start, const Scalar step, const unsigned count, Scalar* out ) const
+{
+    assert( start[1] >= 0.0f && start[1] <= 1.0 );
+
+    // The terms are summed in the same order as in interpolate(), so that the results come
+    // out exactly the same.  The Y powers are shared by the whole row, and the loop has no
+    // dependencies between iterations, so it vectorizes.
+
+    const Scalar
+        py  = start[1],
+        py2 = py * py,
+        py3 = py * py2;
+
+    for ( unsigned i = 0; i < count; ++i )
+    {
+        const Scalar
+            px  = start[0] + Scalar( i ) * step,
+            px2 = px * px,
+            px3 = px * px2;
+
+        assert( px >= 0.0f && px <= 1.0 );
+
+        out[i] =
+            coefficients_[0]  +
+            coefficients_[1]  * px +
+            coefficients_[2]  * px2 +
+            coefficients_[3]  * px3 +
+            coefficients_[4]  * py +
+            coefficients_[5]  * px * py +
+            coefficients_[6]  * px2 * py +
+            coefficients_[7]  * px3 * py +
+            coefficients_[8]  * py2 +
+            coefficients_[9]  * px * py2 +
+            coefficients_[10] * px2 * py2 +
+            coefficients_[11] * px3 * py2 +
+            coefficients_[12] * py3 +
+            coefficients_[13] * px * py3 +
+            coefficients_[14] * px2 * py3 +
+            coefficients_[15] * px3 * py3;
+    }
+}
@@ -67,6 +67,10 @@ struct BicubicPatch
 
     Scalar interpolate( const Vector2f& position ) const;
 
+    // Evaluates count points starting at the given position and stepping along the X axis,
+    // which is much cheaper than calling interpolate() for each of them.
+    void interpolate_row( const Vector2f& start, const Scalar step, const unsigned count, Scalar* out ) const;
+
 protected:
 
     Scalar coefficients_[16];
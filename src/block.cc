@@ -24,7 +24,12 @@
 
 const int
     Block::MIN_LIGHT_COMPONENT_LEVEL,
-    Block::MAX_LIGHT_COMPONENT_LEVEL;
+    Block::MAX_LIGHT_COMPONENT_LEVEL,
+    Block::LIGHT_COMPONENT_BITS;
+
+const uint16_t
+    Block::LIGHT_LEVEL_MASK,
+    Block::SUNLIGHT_SOURCE_FLAG;
 
 const Vector3i
     Block::MIN_LIGHT_LEVEL( MIN_LIGHT_COMPONENT_LEVEL, MIN_LIGHT_COMPONENT_LEVEL, MIN_LIGHT_COMPONENT_LEVEL ),
@@ -48,7 +53,6 @@ std::ostream& operator<<( std::ostream& s, const Block& block )
           << "             color | " << block.get_color()          << std::endl
           << "    collision_mode | " << block.get_collision_mode() << std::endl
           << "is_sunlight_source | " << block.is_sunlight_source() << std::endl
-          << "        is_visited | " << block.is_visited()         << std::endl
           << "       light_level | " << block.get_light_level()    << std::endl
           << "    sunlight_level | " << block.get_sunlight_level() << std::endl
           << "              data | " << block.get_data()           << std::endl;
@@ -62,25 +62,92 @@ enum BlockCollisionMode
     BLOCK_COLLISION_MODE_FLUID
 };
 
-// TODO: It might be worth some testing to see if splitting these fields out into separate
-//       lookup tables is more cache-friendly.
+// The material properties that are needed in the innermost loops of the lighting, meshing,
+// and collision code are kept in these flat tables, so that looking one up is just a shift
+// and a mask of a constant.  The rest of the properties are in BlockMaterialAttributes.
+#define BLOCK_MATERIAL_BIT( material ) ( uint32_t( 1 ) << ( material ) )
+
+const uint32_t BLOCK_MATERIAL_TRANSLUCENT_MASK =
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_AIR ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_LAVA ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_CLEAR ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_RED ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_ORANGE ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_YELLOW ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_GREEN ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_BLUE ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_VIOLET ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_WATER );
+
+const uint32_t BLOCK_MATERIAL_LIGHT_SOURCE_MASK =
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_LAVA );
+
+const uint32_t BLOCK_MATERIAL_FLOWABLE_MASK =
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_LAVA ) |
+    BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_WATER );
+
+// A material is color saturated if its color is pure white, so that it doesn't filter light.
+const uint32_t BLOCK_MATERIAL_COLOR_SATURATED_MASK =
+    ~(
+        BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_LAVA ) |
+        BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_RED ) |
+        BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_ORANGE ) |
+        BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_YELLOW ) |
+        BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_GREEN ) |
+        BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_BLUE ) |
+        BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_GLASS_VIOLET ) |
+        BLOCK_MATERIAL_BIT( BLOCK_MATERIAL_WATER )
+    );
+
+// Each material's collision mode is packed into two bits.  The modes are stored XORed with
+// BLOCK_COLLISION_MODE_SOLID, so that any material that isn't listed here is solid.
+const int BLOCK_COLLISION_MODE_BITS = 2;
+
+#define BLOCK_MATERIAL_COLLISION_MODE( material, mode )\
+    ( uint64_t( ( mode ) ^ BLOCK_COLLISION_MODE_SOLID ) << ( BLOCK_COLLISION_MODE_BITS * ( material ) ) )
+
+const uint64_t BLOCK_MATERIAL_COLLISION_MODES =
+    BLOCK_MATERIAL_COLLISION_MODE( BLOCK_MATERIAL_AIR, BLOCK_COLLISION_MODE_NONE ) |
+    BLOCK_MATERIAL_COLLISION_MODE( BLOCK_MATERIAL_LAVA, BLOCK_COLLISION_MODE_FLUID ) |
+    BLOCK_MATERIAL_COLLISION_MODE( BLOCK_MATERIAL_WATER, BLOCK_COLLISION_MODE_FLUID );
+
+inline bool block_material_is_translucent( const BlockMaterial material )
+{
+    return BLOCK_MATERIAL_TRANSLUCENT_MASK & BLOCK_MATERIAL_BIT( material );
+}
+
+inline bool block_material_is_light_source( const BlockMaterial material )
+{
+    return BLOCK_MATERIAL_LIGHT_SOURCE_MASK & BLOCK_MATERIAL_BIT( material );
+}
+
+inline bool block_material_is_flowable( const BlockMaterial material )
+{
+    return BLOCK_MATERIAL_FLOWABLE_MASK & BLOCK_MATERIAL_BIT( material );
+}
+
+inline bool block_material_is_color_saturated( const BlockMaterial material )
+{
+    return BLOCK_MATERIAL_COLOR_SATURATED_MASK & BLOCK_MATERIAL_BIT( material );
+}
+
+inline BlockCollisionMode block_material_collision_mode( const BlockMaterial material )
+{
+    const int mode_mask = ( 1 << BLOCK_COLLISION_MODE_BITS ) - 1;
+    const int mode_bits = int( BLOCK_MATERIAL_COLLISION_MODES >> ( BLOCK_COLLISION_MODE_BITS * material ) ) & mode_mask;
+    return BlockCollisionMode( mode_bits ^ BLOCK_COLLISION_MODE_SOLID );
+}
+
 struct BlockMaterialAttributes
 {
     BlockMaterialAttributes(
         const std::string& name,
         const std::string& texture_filename,
-        const bool translucent,
-        const bool is_light_source,
-        const Vector3f& color,
-        const BlockCollisionMode collision_mode
+        const Vector3f& color
     ) :
         name_( name ),
         texture_filename_( texture_filename ),
-        translucent_( translucent ),
-        is_light_source_( is_light_source ),
-        is_color_saturated_( color == Vector3f( 1.0f, 1.0f, 1.0f ) ),
-        color_( color ),
-        collision_mode_( collision_mode )
+        color_( color )
     {
     }
 
@@ -88,43 +155,36 @@ struct BlockMaterialAttributes
         name_,
         texture_filename_;
 
-    const bool
-        translucent_,
-        is_light_source_,
-        is_color_saturated_;
-
     // For translucent blocks, the color represents the filtering color.
     // For light source blocks, the color represents the light's color.
     const Vector3f color_;
-
-    const BlockCollisionMode collision_mode_;
 };
 
 inline const BlockMaterialAttributes& get_block_material_attributes( const BlockMaterial material )
 {
     static const BlockMaterialAttributes attributes[NUM_BLOCK_MATERIALS] =
     {
-        /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        //                       name,             texture,        translucent, light-source, color,                          collision-mode
-        /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        BlockMaterialAttributes( "Air",            "wtf",          true,        false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_NONE ),
-        BlockMaterialAttributes( "Grass",          "grass",        false,       false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Dirt",           "dirt",         false,       false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Clay",           "clay",         false,       false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Mud",            "mud",          false,       false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Stone",          "stone",        false,       false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Bedrock",        "bedrock",      false,       false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Lava",           "lava",         true ,       true,         Vector3f( 0.93f, 0.26f, 0.0f ), BLOCK_COLLISION_MODE_FLUID ),
-        BlockMaterialAttributes( "Tree Trunk",     "tree-trunk",   false,       false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Tree Leaf",      "tree-leaf",    false,       false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Glass (Clear)",  "glass-clear",  true,        false,        Vector3f( 1.0f,  1.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Glass (Red)",    "glass-red",    true,        false,        Vector3f( 1.0f,  0.0f,  0.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Glass (Orange)", "glass-orange", true,        false,        Vector3f( 1.0f,  0.5f,  0.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Glass (Yellow)", "glass-yellow", true,        false,        Vector3f( 1.0f,  1.0f,  0.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Glass (Green)",  "glass-green",  true,        false,        Vector3f( 0.0f,  1.0f,  0.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Glass (Blue)",   "glass-blue",   true,        false,        Vector3f( 0.0f,  0.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Glass (Violet)", "glass-violet", true,        false,        Vector3f( 1.0f,  0.0f,  1.0f ), BLOCK_COLLISION_MODE_SOLID ),
-        BlockMaterialAttributes( "Water",          "water",        true,        false,        Vector3f( 0.0f,  0.0f,  1.0f ), BLOCK_COLLISION_MODE_FLUID )
+        ///////////////////////////////////////////////////////////////////////////////////////
+        //                       name,             texture,        color
+        ///////////////////////////////////////////////////////////////////////////////////////
+        BlockMaterialAttributes( "Air",            "wtf",          Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Grass",          "grass",        Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Dirt",           "dirt",         Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Clay",           "clay",         Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Mud",            "mud",          Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Stone",          "stone",        Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Bedrock",        "bedrock",      Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Lava",           "lava",         Vector3f( 0.93f, 0.26f, 0.0f ) ),
+        BlockMaterialAttributes( "Tree Trunk",     "tree-trunk",   Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Tree Leaf",      "tree-leaf",    Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Glass (Clear)",  "glass-clear",  Vector3f( 1.0f,  1.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Glass (Red)",    "glass-red",    Vector3f( 1.0f,  0.0f,  0.0f ) ),
+        BlockMaterialAttributes( "Glass (Orange)", "glass-orange", Vector3f( 1.0f,  0.5f,  0.0f ) ),
+        BlockMaterialAttributes( "Glass (Yellow)", "glass-yellow", Vector3f( 1.0f,  1.0f,  0.0f ) ),
+        BlockMaterialAttributes( "Glass (Green)",  "glass-green",  Vector3f( 0.0f,  1.0f,  0.0f ) ),
+        BlockMaterialAttributes( "Glass (Blue)",   "glass-blue",   Vector3f( 0.0f,  0.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Glass (Violet)", "glass-violet", Vector3f( 1.0f,  0.0f,  1.0f ) ),
+        BlockMaterialAttributes( "Water",          "water",        Vector3f( 0.0f,  0.0f,  1.0f ) )
     };
 
     assert( material >= 0 && material < NUM_BLOCK_MATERIALS );
@@ -147,15 +207,9 @@ struct Block
 
     Block() :
         material_( BLOCK_MATERIAL_AIR ),
-        sunlight_source_( false ),
-        visited_( false ),
-        light_level_r_( 0 ),
-        light_level_g_( 0 ),
-        light_level_b_( 0 ),
-        sunlight_level_r_( 0 ),
-        sunlight_level_g_( 0 ),
-        sunlight_level_b_( 0 ),
-        data_( 0 )
+        data_( 0 ),
+        light_( 0 ),
+        sunlight_( 0 )
     {
     }
 
@@ -169,42 +223,57 @@ struct Block
 
     BlockMaterial get_material() const { return BlockMaterial( material_ ); }
     const BlockMaterialAttributes& get_material_attributes() const { return get_block_material_attributes( get_material() ); }
-    bool is_translucent() const { return get_material_attributes().translucent_; }
-    bool is_light_source() const { return get_material_attributes().is_light_source_; }
-    bool is_color_saturated() const { return get_material_attributes().is_color_saturated_; }
+    bool is_translucent() const { return block_material_is_translucent( get_material() ); }
+    bool is_light_source() const { return block_material_is_light_source( get_material() ); }
+    bool is_color_saturated() const { return block_material_is_color_saturated( get_material() ); }
     const Vector3f& get_color() const { return get_material_attributes().color_; }
-    BlockCollisionMode get_collision_mode() const { return get_material_attributes().collision_mode_; }
+    BlockCollisionMode get_collision_mode() const { return block_material_collision_mode( get_material() ); }
 
-    void set_sunlight_source( const bool sunlight_source ) { sunlight_source_ = sunlight_source; }
-    bool is_sunlight_source() const { return sunlight_source_; }
-
-    void set_visited( const bool visited ) { visited_ = visited; }
-    bool is_visited() const { return visited_; }
+    void set_sunlight_source( const bool sunlight_source ) { set_flag( SUNLIGHT_SOURCE_FLAG, sunlight_source ); }
+    bool is_sunlight_source() const { return light_ & SUNLIGHT_SOURCE_FLAG; }
 
     void set_light_level( const Vector3i& light_level )
     {
         assert( light_level_valid( light_level ) );
-        light_level_r_ = light_level[0];
-        light_level_g_ = light_level[1];
-        light_level_b_ = light_level[2];
+        light_ = ( light_ & ~LIGHT_LEVEL_MASK ) | pack_light_level( light_level );
     }
 
     Vector3i get_light_level() const
     {
-        return Vector3i( light_level_r_, light_level_g_, light_level_b_ );
+        return unpack_light_level( light_ );
     }
 
     void set_sunlight_level( const Vector3i& sunlight_level )
     {
         assert( light_level_valid( sunlight_level ) );
-        sunlight_level_r_ = sunlight_level[0];
-        sunlight_level_g_ = sunlight_level[1];
-        sunlight_level_b_ = sunlight_level[2];
+        sunlight_ = pack_light_level( sunlight_level );
     }
 
     Vector3i get_sunlight_level() const
     {
-        return Vector3i( sunlight_level_r_, sunlight_level_g_, sunlight_level_b_ );
+        return unpack_light_level( sunlight_ );
+    }
+
+    // These compare or copy whole light levels at once, without unpacking them.
+    bool has_light() const { return light_ & LIGHT_LEVEL_MASK; }
+    bool has_sunlight() const { return sunlight_; }
+
+    // Each light level is packed into 16 bits, with 4 bits for each of the red, green, and
+    // blue components.  This is also handy for keeping light levels compact elsewhere.
+    static uint16_t pack_light_level( const Vector3i& light_level )
+    {
+        return uint16_t(
+            light_level[0] |
+            light_level[1] << LIGHT_COMPONENT_BITS |
+            light_level[2] << ( 2 * LIGHT_COMPONENT_BITS ) );
+    }
+
+    static Vector3i unpack_light_level( const uint16_t packed )
+    {
+        return Vector3i(
+            packed & MAX_LIGHT_COMPONENT_LEVEL,
+            packed >> LIGHT_COMPONENT_BITS & MAX_LIGHT_COMPONENT_LEVEL,
+            packed >> ( 2 * LIGHT_COMPONENT_BITS ) & MAX_LIGHT_COMPONENT_LEVEL );
     }
 
     void set_data( const uint8_t data )
@@ -217,8 +286,52 @@ struct Block
         return data_;
     }
 
+    // All of the Block's state, packed into a single word (e.g. for hashing).
+    uint64_t get_bits() const
+    {
+        return
+            uint64_t( material_ ) |
+            uint64_t( data_ ) << 8 |
+            uint64_t( light_ ) << 16 |
+            uint64_t( sunlight_ ) << 32;
+    }
+
+    // The parts of get_bits() that do and don't depend on the lighting.
+    uint64_t get_unlit_bits() const { return uint64_t( material_ ) | uint64_t( data_ ) << 8; }
+    uint64_t get_light_bits() const { return uint64_t( light_ ) | uint64_t( sunlight_ ) << 16; }
+
+    bool operator==( const Block& other ) const
+    {
+        return
+            material_ == other.material_ &&
+            data_ == other.data_ &&
+            light_ == other.light_ &&
+            sunlight_ == other.sunlight_;
+    }
+
+    bool operator!=( const Block& other ) const
+    {
+        return !( *this == other );
+    }
+
 private:
 
+    // The sunlight source flag is kept in the spare bits of the (non-sun) light.
+    static const int LIGHT_COMPONENT_BITS = 4;
+
+    static const uint16_t
+        LIGHT_LEVEL_MASK = 0x0fff,
+        SUNLIGHT_SOURCE_FLAG = 0x1000;
+
+    void set_flag( const uint16_t flag, const bool value )
+    {
+        if ( value )
+        {
+            light_ |= flag;
+        }
+        else light_ &= ~flag;
+    }
+
     bool light_level_valid( const int light_level ) const
     {
         return ( light_level >= MIN_LIGHT_COMPONENT_LEVEL && light_level <= MAX_LIGHT_COMPONENT_LEVEL );
@@ -237,16 +350,10 @@ private:
         return true;
     }
 
-    uint8_t material_         : 8;
-    uint8_t sunlight_source_  : 1;
-    uint8_t visited_          : 1;
-    uint8_t light_level_r_    : 4;
-    uint8_t light_level_g_    : 4;
-    uint8_t light_level_b_    : 4;
-    uint8_t sunlight_level_r_ : 4;
-    uint8_t sunlight_level_g_ : 4;
-    uint8_t sunlight_level_b_ : 4;
-    uint8_t data_             : 8; // Material-specific data.
+    uint8_t material_;
+    uint8_t data_; // Material-specific data.
+    uint16_t light_;
+    uint16_t sunlight_;
 };
 
 // TODO: Move debug output operators to a common header file?
@@ -283,6 +390,7 @@ struct BlockFace
     BlockFace( const Vector3f& normal, const Vector3f& tangent, const BlockMaterial material ) :
         normal_( normal ),
         tangent_( tangent ),
+        size_( 1.0f, 1.0f ),
         material_( material )
     {
     }
@@ -293,6 +401,10 @@ struct BlockFace
         normal_,
         tangent_;
 
+    // The number of Blocks that the face spans from vertex 0 to 1, and from vertex 1 to 2.
+    // This is only larger than one for faces that were merged by the greedy mesher.
+    Vector2f size_;
+
     BlockMaterial material_;
 };
 
@@ -305,8 +417,7 @@ struct BlockDataFlowable
     BlockDataFlowable( Block& block ) : 
         block_( block )
     {
-        assert( block_.get_material() == BLOCK_MATERIAL_WATER ||
-                block_.get_material() == BLOCK_MATERIAL_LAVA );
+        assert( block_material_is_flowable( block_.get_material() ) );
     }
 
     // TODO: Right now there's nothing really special about a "source".
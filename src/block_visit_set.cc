@@ -0,0 +1,85 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "block_visit_set.h"
+#include "chunk.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for BlockVisitSet:
+//////////////////////////////////////////////////////////////////////////////////
+
+BlockVisitSet::BlockVisitSet() :
+    generation_( 1 ),
+    num_chunk_marks_used_( 0 ),
+    last_chunk_marks_( 0 )
+{
+}
+
+void BlockVisitSet::clear()
+{
+    num_chunk_marks_used_ = 0;
+    last_chunk_marks_ = 0;
+    ++generation_;
+
+    // When the generation wraps around, old marks could be mistaken for new ones, so they
+    // have to be reset for real.  This only happens once every 65535 clears.
+    if ( generation_ == 0 )
+    {
+        for ( ChunkMarksSPV::iterator it = chunk_marks_.begin(); it != chunk_marks_.end(); ++it )
+        {
+            std::fill( ( *it )->marks_.begin(), ( *it )->marks_.end(), 0 );
+        }
+
+        generation_ = 1;
+    }
+}
+
+BlockVisitSet::ChunkMarks& BlockVisitSet::find_chunk_marks( const Chunk* chunk )
+{
+    for ( unsigned i = 0; i < num_chunk_marks_used_; ++i )
+    {
+        if ( chunk_marks_[i]->chunk_ == chunk )
+        {
+            last_chunk_marks_ = chunk_marks_[i].get();
+            return *last_chunk_marks_;
+        }
+    }
+
+    // The marks left over from an earlier generation (possibly for a different Chunk) are
+    // all older than the current generation, so they can be reused without being reset.
+    if ( num_chunk_marks_used_ == chunk_marks_.size() )
+    {
+        chunk_marks_.push_back( ChunkMarksSP( new ChunkMarks ) );
+    }
+
+    last_chunk_marks_ = chunk_marks_[num_chunk_marks_used_++].get();
+    last_chunk_marks_->chunk_ = chunk;
+    return *last_chunk_marks_;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for BlockVisitSet::ChunkMarks:
+//////////////////////////////////////////////////////////////////////////////////
+
+BlockVisitSet::ChunkMarks::ChunkMarks() :
+    chunk_( 0 ),
+    marks_( Chunk::SIZE_X * Chunk::SIZE_Y * Chunk::SIZE_Z, 0 )
+{
+}
@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef BLOCK_VISIT_SET_H
+#define BLOCK_VISIT_SET_H
+
+#include <stdint.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+struct Chunk;
+
+// This keeps track of which Blocks have been visited by e.g. a flood fill, identifying
+// each Block by its Chunk and its packed index within the Chunk.  Rather than storing a
+// flag in each Block, which would have to be reset afterwards by walking over all of the
+// visited Blocks again, each visited Block is stamped with the current generation.  Thus,
+// clearing the set only has to advance the generation.
+//
+// The marks for each Chunk take up 8 KB, and are reused for different Chunks across
+// generations, so it's best to keep a set around rather than to create one per use.
+struct BlockVisitSet : public boost::noncopyable
+{
+    BlockVisitSet();
+
+    void clear();
+
+    bool is_visited( const Chunk* chunk, const uint16_t index )
+    {
+        return get_chunk_marks( chunk ).marks_[index] == generation_;
+    }
+
+    void set_visited( const Chunk* chunk, const uint16_t index )
+    {
+        get_chunk_marks( chunk ).marks_[index] = generation_;
+    }
+
+private:
+
+    struct ChunkMarks
+    {
+        ChunkMarks();
+
+        const Chunk* chunk_;
+        std::vector<uint16_t> marks_;
+    };
+
+    typedef boost::shared_ptr<ChunkMarks> ChunkMarksSP;
+    typedef std::vector<ChunkMarksSP> ChunkMarksSPV;
+
+    ChunkMarks& get_chunk_marks( const Chunk* chunk )
+    {
+        // Visits tend to stay within the same Chunk for a while.
+        if ( last_chunk_marks_ && last_chunk_marks_->chunk_ == chunk )
+        {
+            return *last_chunk_marks_;
+        }
+
+        return find_chunk_marks( chunk );
+    }
+
+    ChunkMarks& find_chunk_marks( const Chunk* chunk );
+
+    uint16_t generation_;
+
+    // Only the first num_chunk_marks_used_ elements belong to the current generation.
+    ChunkMarksSPV chunk_marks_;
+    unsigned num_chunk_marks_used_;
+    ChunkMarks* last_chunk_marks_;
+};
+
+#endif // BLOCK_VISIT_SET_H
@@ -16,13 +16,17 @@
 // along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
 ///////////////////////////////////////////////////////////////////////////
 
-#include <queue>
+#include <algorithm>
 
 #include <boost/foreach.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <string.h>
 
 #include "chunk.h"
+#include "block_visit_set.h"
+#include "ring_buffer.h"
 
 //////////////////////////////////////////////////////////////////////////////////
 // Local definitions:
@@ -30,28 +34,124 @@
 
 namespace {
 
+// The table is filled in during static initialization, before any of the worker threads
+// that build meshes can have been started.
+struct LightingAttenuationTable
+{
+    static const int
+        MAX_POWER = 32,
+        GRANULARITY = 10,
+        NUM_ENTRIES = MAX_POWER * GRANULARITY + 1;
+
+    LightingAttenuationTable()
+    {
+        for ( int i = 0; i < NUM_ENTRIES; ++i )
+        {
+            attenuation_[i] = gmtl::Math::pow( 0.75f, Scalar( i ) / Scalar( GRANULARITY ) );
+        }
+    }
+
+    Scalar attenuation_[NUM_ENTRIES];
+};
+
+const LightingAttenuationTable LIGHTING_ATTENUATION_TABLE;
+
 Scalar get_lighting_attenuation( const Scalar power )
 {
-    const int MAX_POWER = 32;
-    const int GRANULARITY = 10;
+    int index = int( roundf( power * Scalar( LightingAttenuationTable::GRANULARITY ) ) );
+    index = std::max( index, 0 );
+    index = std::min( index, LightingAttenuationTable::NUM_ENTRIES - 1 );
+    return LIGHTING_ATTENUATION_TABLE.attenuation_[index];
+}
+
+// The neighbors are the Block in front of the vertex (0), the Blocks beside that one that
+// also touch the vertex (1 and 2), and the Block diagonal to it (3).  Any of them may be null,
+// where there is no Chunk.
+void calculate_vertex_lighting(
+    const Block* const neighbors[],
+    const bool neighbor_ab_contributes,
+    Vector3f& vertex_lighting,
+    Vector3f& vertex_sunlighting
+)
+{
+    const int NUM_NEIGHBORS = 4;
+
+    // The lighting value for this vertex will be an average of the lighting provided by
+    // all the translucent blocks that may contribute to it.  This gives a smooth lighting
+    // effect, instead of the blocky lighting that per-face unaveraged lighting gives.
+    Vector3i total_lighting = Block::MIN_LIGHT_LEVEL;
+    Vector3i total_sunlighting = Block::MIN_LIGHT_LEVEL;
+
+    // The number of translucent blocks that may contribute light to the vertex
+    // is used to determine an ambient occlusion factor.  Less contributors means
+    // more ambient occlusion.
+    int num_contributors = 0;
+
+    for ( int i = 0; i < NUM_NEIGHBORS; ++i )
+    {
+        const Block* block = neighbors[i];
 
-    static Scalar lighting_attenuation_table[MAX_POWER * GRANULARITY + 1];
-    static bool initialized = false;
+        if ( block )
+        {
+            if ( block->is_translucent() )
+            {
+                total_lighting += block->get_light_level();
+                total_sunlighting += block->get_sunlight_level();
+                ++num_contributors;
+            }
+        }
+        else if ( i != 3 || neighbor_ab_contributes )
+        {
+            total_sunlighting += Block::MAX_LIGHT_LEVEL;
+            ++num_contributors;
+        }
+    }
 
-    if ( !initialized )
+    const Vector3f average_lighting = vector_cast<Scalar>( total_lighting ) / Scalar( num_contributors );
+    const Vector3f average_sunlighting = vector_cast<Scalar>( total_sunlighting ) / Scalar( num_contributors );
+    const int ambient_occlusion_power = NUM_NEIGHBORS - neighbor_ab_contributes - num_contributors;
+    const int power_base = Block::MAX_LIGHT_COMPONENT_LEVEL + 2 * ambient_occlusion_power;
+    
+    for ( int i = 0; i < Vector3i::Size; ++i )
     {
-        for ( int i = 0; i <= MAX_POWER * GRANULARITY; ++i )
+        // Don't bother computing the attenuation if the lighting is nearly zero.
+        if ( average_lighting[i] > gmtl::GMTL_EPSILON )
         {
-            lighting_attenuation_table[i] = gmtl::Math::pow( 0.75f, Scalar( i ) / Scalar( GRANULARITY ) );
+            const Scalar power = power_base - average_lighting[i];
+            vertex_lighting[i] = get_lighting_attenuation( power );
         }
+        else vertex_lighting[i] = 0.0f;
 
-        initialized = true;
+        // TODO: Remove duplication.
+        if ( average_sunlighting[i] > gmtl::GMTL_EPSILON )
+        {
+            const Scalar power = power_base - average_sunlighting[i];
+            vertex_sunlighting[i] = get_lighting_attenuation( power );
+        }
+        else vertex_sunlighting[i] = 0.0f;
     }
+}
 
-    int index = int( roundf( power * Scalar( GRANULARITY ) ) );
-    index = std::max( index, 0 );
-    index = std::min( index, MAX_POWER * GRANULARITY );
-    return lighting_attenuation_table[index];
+// Each word is mixed in with a multiply and a shift, so that every one of its bits
+// affects the whole hash.
+const uint64_t GEOMETRY_HASH_SEED = 0xcbf29ce484222325ull;
+
+uint64_t hash_bits( const uint64_t hash, const uint64_t bits )
+{
+    const uint64_t mixed = ( hash ^ bits ) * 0x9e3779b97f4a7c15ull;
+    return mixed ^ ( mixed >> 29 );
+}
+
+// With texture lighting, the mesh doesn't depend on the light levels, so they go into a
+// separate hash.
+void hash_block( const Block& block, const bool texture_lighting, uint64_t& geometry_hash, uint64_t& light_hash )
+{
+    if ( texture_lighting )
+    {
+        geometry_hash = hash_bits( geometry_hash, block.get_unlit_bits() );
+        light_hash = hash_bits( light_hash, block.get_light_bits() );
+    }
+    else geometry_hash = hash_bits( geometry_hash, block.get_bits() );
 }
 
 // This function returns true if the incoming light affected the current light.
@@ -71,26 +171,49 @@ bool mix_light( Vector3i& current, const Vector3i& incoming )
     return affected;
 }
 
+// Filtering light through a translucent Block scales each of its components by the Block's
+// color.  There are only a few possible light levels, so the filtered levels are precomputed
+// for every material, which keeps floating point math out of the lighting loops entirely.
+struct LightFilterTable
+{
+    LightFilterTable()
+    {
+        FOREACH_BLOCK_MATERIAL( material )
+        {
+            const Vector3f& filter_color = get_block_material_attributes( material ).color_;
+
+            for ( int i = 0; i < Vector3i::Size; ++i )
+            {
+                for ( int level = 0; level <= Block::MAX_LIGHT_COMPONENT_LEVEL; ++level )
+                {
+                    levels_[material][i][level] = uint8_t( roundf( filter_color[i] * Scalar( level ) ) );
+                }
+            }
+        }
+    }
+
+    uint8_t levels_[NUM_BLOCK_MATERIALS][Vector3i::Size][Block::MAX_LIGHT_COMPONENT_LEVEL + 1];
+};
+
+const LightFilterTable& get_light_filter_table()
+{
+    // The table is a function-local static so that it's safely built by whichever update
+    // worker gets here first.
+    static const LightFilterTable table;
+    return table;
+}
+
 void filter_light( Vector3i& current, const Block& block )
 {
     if ( !block.is_color_saturated() )
     {
-        const Vector3f& filter_color = block.get_color();
+        const uint8_t ( &levels )[Vector3i::Size][Block::MAX_LIGHT_COMPONENT_LEVEL + 1] =
+            get_light_filter_table().levels_[block.get_material()];
 
-        for ( unsigned i = 0; i < Vector3i::Size; ++i )
+        for ( int i = 0; i < Vector3i::Size; ++i )
         {
-            // TODO: The following lookup of filter_color[i] is the main bottleneck
-            //       in the whole lighting system.  Why?  Does it cause cache thrashing?
-            //
-            //       I wonder if all the convenience functions for getting at material
-            //       attributes are a bad thing?
-            current[i] = static_cast<int>( roundf( filter_color[i] * current[i] ) );
+            current[i] = levels[i][current[i]];
         }
-
-        // TODO: The following is equivalent but much slower:
-        //
-        // current = vector_cast<int>(
-        //     pointwise_round( pointwise_product( filter_color, vector_cast<Scalar>( current ) ) ) );
     }
 }
 
@@ -130,6 +253,17 @@ bool light_would_be_affected( const Vector3i& current, const Vector3i& incoming
     return false;
 }
 
+Vector3i get_light_source_color( const Block& block )
+{
+    return vector_cast<int>(
+        pointwise_round( Vector3f( block.get_color() * Scalar( Block::MAX_LIGHT_COMPONENT_LEVEL ) ) ) );
+}
+
+// The is_fixed_source() function returns true for Blocks whose light does not depend on
+// their neighbors at all, so it must never be removed by remove_light().  The emits_light()
+// function returns true for Blocks that need to be re-flooded with their own light if
+// the light that they receive from elsewhere is removed.
+
 struct ColorLightStrategy
 {
     static Vector3i get_light( const Block& block )
@@ -141,6 +275,16 @@ struct ColorLightStrategy
     {
         block.set_light_level( light );
     }
+
+    static bool is_fixed_source( const Block& block )
+    {
+        return false;
+    }
+
+    static bool emits_light( const Block& block )
+    {
+        return block.is_light_source();
+    }
 };
 
 struct SunLightStrategy
@@ -154,6 +298,16 @@ struct SunLightStrategy
     {
         block.set_sunlight_level( light );
     }
+
+    static bool is_fixed_source( const Block& block )
+    {
+        return block.is_sunlight_source();
+    }
+
+    static bool emits_light( const Block& block )
+    {
+        return false;
+    }
 };
 
 struct ExternalNeighborStrategy
@@ -179,29 +333,116 @@ struct InternalNeighborStrategy
     }
 };
 
-typedef std::pair<const BlockIterator, const Vector3i> FloodFillBlock;
-typedef std::queue<FloodFillBlock> FloodFillQueue;
+// Each Block in a flood fill queue is stored as its Chunk and its packed index within the
+// Chunk, along with its packed incoming light, so that the queue stays compact.
+struct FloodFillBlock
+{
+    FloodFillBlock() :
+        chunk_( 0 ),
+        index_( 0 ),
+        light_( 0 )
+    {
+    }
+
+    FloodFillBlock( const BlockIterator& block_it, const Vector3i& light ) :
+        chunk_( block_it.chunk_ ),
+        index_( Chunk::pack_block_index( block_it.index_ ) ),
+        light_( Block::pack_light_level( light ) )
+    {
+    }
+
+    BlockIterator get_block_iterator() const
+    {
+        const Vector3i index = Chunk::unpack_block_index( index_ );
+        return BlockIterator( chunk_, &chunk_->get_block( index ), index );
+    }
+
+    Vector3i get_light() const { return Block::unpack_light_level( light_ ); }
+
+    Chunk* chunk_;
+    uint16_t index_;
+    uint16_t light_;
+};
+
+typedef RingBuffer<FloodFillBlock> FloodFillQueue;
+
+// Each thread that does lighting keeps its own queue and visit marks, which are reused for
+// every flood fill, so that they don't have to be allocated (or cleared) repeatedly.  This
+// gives a significant (and measured) performance gain.
+struct FloodFillArena
+{
+    FloodFillQueue queue_;
+    BlockVisitSet blocks_visited_;
+};
+
+FloodFillArena& get_flood_fill_arena()
+{
+    static boost::thread_specific_ptr<FloodFillArena> arena;
+
+    if ( !arena.get() )
+    {
+        arena.reset( new FloodFillArena );
+    }
+
+    return *arena;
+}
+
+// Adds the Chunk that contains the Block to the set, as well as any neighboring Chunks
+// that share a face, edge or corner with it.  The geometry of all of these Chunks depends
+// on the lighting of the Block, since the vertex lighting is sampled from adjacent Blocks.
+void add_chunks_sharing_block( const BlockIterator& block_it, ChunkSet& chunks )
+{
+    chunks.insert( block_it.chunk_ );
+
+    const Vector3i& index = block_it.index_;
+
+    FOREACH_SURROUNDING( x, y, z )
+    {
+        const Vector3i relation( x, y, z );
+        bool shared = true;
+
+        for ( int i = 0; i < Vector3i::Size; ++i )
+        {
+            if ( ( relation[i] == -1 && index[i] != 0 ) ||
+                 ( relation[i] == 1 && index[i] != Chunk::SIZE[i] - 1 ) )
+            {
+                shared = false;
+            }
+        }
+
+        Chunk* neighbor = shared ? block_it.chunk_->get_neighbor( relation ) : 0;
 
-// The 'queue' and 'blocks_visited' parameters here could be local variables
-// (with the queue seed passed in instead).  The reason they are parameters is
-// so that if flood_fill_light() is called many times, they will not have to be
-// allocated repeatedly.  This gives a significant (and measured) performance gain.
+        if ( neighbor )
+        {
+            chunks.insert( neighbor );
+        }
+    }
+}
+
+// The queue should contain only the source block.  The visit marks are cleared before the
+// flood fill starts, so the same BlockVisitSet can be reused for every flood fill.
+//
+// If 'chunks_affected' is provided, every Chunk whose geometry might be affected
+// by a change in lighting is added to it.
 template <typename LightStrategy, typename NeighborStrategy>
-void flood_fill_light( const bool skip_source_block, FloodFillQueue& queue, BlockV& blocks_visited )
+void flood_fill_light( const bool skip_source_block, FloodFillQueue& queue, BlockVisitSet& blocks_visited, ChunkSet* chunks_affected = 0 )
 {
     bool source_block = true;
 
+    blocks_visited.clear();
+
     while ( !queue.empty() )
     {
         const FloodFillBlock flood_block = queue.front();
-        Block& block = *flood_block.first.block_;
         queue.pop();
 
-        if ( !block.is_visited() )
+        if ( !blocks_visited.is_visited( flood_block.chunk_, flood_block.index_ ) )
         {
-            blocks_visited.push_back( &block );
-            block.set_visited( true );
-            Vector3i light_level = flood_block.second;
+            blocks_visited.set_visited( flood_block.chunk_, flood_block.index_ );
+
+            const BlockIterator block_it = flood_block.get_block_iterator();
+            Block& block = *block_it.block_;
+            Vector3i light_level = flood_block.get_light();
 
             if ( !skip_source_block || !source_block )
             {
@@ -214,6 +455,11 @@ void flood_fill_light( const bool skip_source_block, FloodFillQueue& queue, Bloc
                 }
 
                 LightStrategy::set_light( block, block_light_level );
+
+                if ( chunks_affected )
+                {
+                    add_chunks_sharing_block( block_it, *chunks_affected );
+                }
             }
             else source_block = false;
 
@@ -225,371 +471,1662 @@ void flood_fill_light( const bool skip_source_block, FloodFillQueue& queue, Bloc
             FOREACH_CARDINAL_RELATION( relation )
             {
                 const Vector3i relation_vector = cardinal_relation_vector( relation );
-                const BlockIterator neighbor = NeighborStrategy::get_block_neighbor( flood_block.first, relation_vector );
+                const BlockIterator neighbor = NeighborStrategy::get_block_neighbor( block_it, relation_vector );
 
                 if ( neighbor.block_ &&
-                     !neighbor.block_->is_visited() &&
-                     neighbor.block_->is_translucent() )
+                     neighbor.block_->is_translucent() &&
+                     !blocks_visited.is_visited( neighbor.chunk_, Chunk::pack_block_index( neighbor.index_ ) ) )
                 {
                     if ( light_would_be_affected(
                              LightStrategy::get_light( *neighbor.block_ ), light_level ) )
                     {
-                        queue.push( std::make_pair( neighbor, light_level ) );
+                        queue.push( FloodFillBlock( neighbor, light_level ) );
                     }
                 }
             }
         }
     }
-
-    BOOST_FOREACH( Block* block, blocks_visited )
-    {
-        block->set_visited( false );
-    }
-
-    blocks_visited.clear();
 }
 
-} // anonymous namespace
+// This removes any light that might have originated from the Blocks in the queue (each
+// of which is paired with the light that was removed from it).  A neighboring Block that
+// has less light than the removed light may have been lit by it, so its light is removed
+// as well, and so on.  A neighbor that has at least as much light is lit by something
+// else, so it is added to the seeds, from which light is re-flooded by add_light().
+template <typename LightStrategy>
+void remove_light( FloodFillQueue& queue, BlockIteratorV& seeds, BlockIteratorV& sources, ChunkSet& chunks_affected )
+{
+    while ( !queue.empty() )
+    {
+        const BlockIterator removal_block = queue.front().get_block_iterator();
+        const Vector3i removal_light_level = queue.front().get_light();
+        queue.pop();
 
-//////////////////////////////////////////////////////////////////////////////////
-// Static constant definitions for Chunk:
-//////////////////////////////////////////////////////////////////////////////////
+        FOREACH_CARDINAL_RELATION( relation )
+        {
+            const Vector3i relation_vector = cardinal_relation_vector( relation );
+            const BlockIterator neighbor = ExternalNeighborStrategy::get_block_neighbor( removal_block, relation_vector );
 
-const int
-    Chunk::SIZE_X,
-    Chunk::SIZE_Y,
-    Chunk::SIZE_Z;
+            if ( !neighbor.block_ )
+            {
+                continue;
+            }
 
-const Vector3i Chunk::SIZE( SIZE_X, SIZE_Y, SIZE_Z );
+            Block& block = *neighbor.block_;
 
-//////////////////////////////////////////////////////////////////////////////////
-// Function definitions for Chunk:
-//////////////////////////////////////////////////////////////////////////////////
+            if ( LightStrategy::is_fixed_source( block ) )
+            {
+                seeds.push_back( neighbor );
+                continue;
+            }
 
-Chunk::Chunk( const Vector3i& position ) :
-    position_( position )
-{
-    FOREACH_SURROUNDING( x, y, z )
-    {
-        get_neighbor_impl( Vector3i( x, y, z ) ) = 0;
-    }
+            const Vector3i light_level = LightStrategy::get_light( block );
+            Vector3i
+                remaining_light_level = light_level,
+                removed_light_level = Block::MIN_LIGHT_LEVEL;
 
-    get_neighbor_impl( Vector3i( 0, 0, 0 ) ) = this;
-}
+            bool
+                removed = false,
+                lit_elsewhere = false;
 
-Chunk::BlockFlow Chunk::get_possible_flow( const Block& block, const Vector3i& block_index, const CardinalRelation relation )
-{
-    BlockFlow possible_flow;
-    possible_flow.first = get_block_neighbor( block_index, cardinal_relation_vector( relation ) );
+            for ( int i = 0; i < Vector3i::Size; ++i )
+            {
+                if ( light_level[i] == Block::MIN_LIGHT_COMPONENT_LEVEL )
+                {
+                    continue;
+                }
 
-    // TODO: If the neighbor block does not exist, but it IS in an existing column,
-    //       extend that column and flow into it.
-    possible_flow.second = 0.0f;
+                if ( light_level[i] < removal_light_level[i] )
+                {
+                    remaining_light_level[i] = Block::MIN_LIGHT_COMPONENT_LEVEL;
+                    removed_light_level[i] = light_level[i];
+                    removed = true;
+                }
+                else lit_elsewhere = true;
+            }
 
-    if ( possible_flow.first.block_ )
-    {
-        Block& neighbor = *possible_flow.first.block_;
+            if ( removed )
+            {
+                LightStrategy::set_light( block, remaining_light_level );
+                add_chunks_sharing_block( neighbor, chunks_affected );
+                queue.push( FloodFillBlock( neighbor, removed_light_level ) );
 
-        if ( neighbor.get_material() == BLOCK_MATERIAL_AIR )
-        {
-            possible_flow.second = 1.0f;
-        }
-        else if ( ( block.get_material() == BLOCK_MATERIAL_WATER &&
-                    neighbor.get_material() == BLOCK_MATERIAL_LAVA ) ||
-                  ( block.get_material() == BLOCK_MATERIAL_LAVA &&
-                    neighbor.get_material() == BLOCK_MATERIAL_WATER ) )
-        {
-            possible_flow.second = 1.0f / BlockDataFlowable::MAX_FLOW_LEVEL;
-        }
-        else if ( block.get_material() == neighbor.get_material() )
-        {
-            possible_flow.second = 1.0f;
+                if ( LightStrategy::emits_light( block ) )
+                {
+                    sources.push_back( neighbor );
+                }
+            }
 
-            if ( relation != CARDINAL_RELATION_BELOW )
+            if ( lit_elsewhere )
             {
-                possible_flow.second -=
-                    Scalar( BlockDataFlowable( neighbor ).get_flow_level() ) / BlockDataFlowable::MAX_FLOW_LEVEL;
+                seeds.push_back( neighbor );
             }
         }
     }
-
-    return possible_flow;
 }
 
-void Chunk::flow_block(
-    const Block& block,
-    const BlockFlow& neighbor_flow,
-    const Scalar remaining_flow,
-    BlockV& blocks_visited,
-    ChunkSet& chunks_modified
-)
+// This floods light into the Blocks surrounding the seeds (based on their current light)
+// and the sources (based on the light they emit), after remove_light() has run.
+template <typename LightStrategy>
+void add_light( const BlockIteratorV& seeds, const BlockIteratorV& sources, ChunkSet& chunks_affected )
 {
-    // TODO: If this neighbor does not exist, but it IS in an existing column,
-    //       extend that column and flow into it.
+    FloodFillArena& arena = get_flood_fill_arena();
 
-    if ( neighbor_flow.first.block_ )
+    BOOST_FOREACH( const BlockIterator& source, sources )
     {
-        Block& neighbor_block = *neighbor_flow.first.block_;
-        const int flow_level = static_cast<int>( roundf( neighbor_flow.second * remaining_flow ) );
-        bool visited = false;
+        arena.queue_.push( FloodFillBlock( source, get_light_source_color( *source.block_ ) ) );
+        flood_fill_light<LightStrategy, ExternalNeighborStrategy>( false, arena.queue_, arena.blocks_visited_, &chunks_affected );
+    }
 
-        if ( neighbor_block.get_material() == BLOCK_MATERIAL_AIR )
-        {
-            neighbor_block.set_material( block.get_material() );
-            BlockDataFlowable( neighbor_block ).set_flow_level( flow_level );
-            visited = true;
-        }
-        else if ( ( block.get_material() == BLOCK_MATERIAL_WATER &&
-                    neighbor_block.get_material() == BLOCK_MATERIAL_LAVA ) ||
-                  ( block.get_material() == BLOCK_MATERIAL_LAVA &&
-                    neighbor_block.get_material() == BLOCK_MATERIAL_WATER ) )
-        {
-            neighbor_block.set_material( BLOCK_MATERIAL_BEDROCK );
-            visited = true;
-        }
-        else if ( block.get_material() == neighbor_block.get_material() )
-        {
-            BlockDataFlowable neighbor_flowable( neighbor_block );
-            const int flow = std::max( neighbor_flowable.get_flow_level(), flow_level );
-            neighbor_flowable.set_flow_level( flow );
-        }
+    BOOST_FOREACH( const BlockIterator& seed, seeds )
+    {
+        const Vector3i light_level = LightStrategy::get_light( *seed.block_ );
 
-        if ( visited )
+        if ( light_level != Block::MIN_LIGHT_LEVEL )
         {
-            neighbor_block.set_visited( true );
-            blocks_visited.push_back( &neighbor_block );
-            chunks_modified.insert( neighbor_flow.first.chunk_ );
+            arena.queue_.push( FloodFillBlock( seed, light_level ) );
+            flood_fill_light<LightStrategy, ExternalNeighborStrategy>( true, arena.queue_, arena.blocks_visited_, &chunks_affected );
         }
     }
 }
 
-void Chunk::simulate( BlockV& blocks_visited, ChunkSet& chunks_modified )
+// The sunlight sources are the Blocks that have an unobstructed view of the sky, so
+// modifying a Block may change which Blocks are sources in the column beneath it.  This
+// recalculates the sources from the modified Block downward (the same way reset_lighting()
+// does), until it reaches a Block whose status was unaffected.
+void update_sunlight_sources(
+    const BlockIterator& block_it,
+    FloodFillQueue& removal_queue,
+    BlockIteratorV& seeds,
+    ChunkSet& chunks_affected
+)
 {
-    FOREACH_BLOCK( x, y, z )
-    {
-        const Vector3i index( x, y, z );
-        Block& block = get_block( index );
+    const Vector3i
+        above = cardinal_relation_vector( CARDINAL_RELATION_ABOVE ),
+        below = cardinal_relation_vector( CARDINAL_RELATION_BELOW );
 
-        if ( ( block.get_material() == BLOCK_MATERIAL_WATER ||
-               block.get_material() == BLOCK_MATERIAL_LAVA ) &&
-             !block.is_visited() )
-        {
-            BlockDataFlowable block_flow( block );
-            Scalar remaining_flow = block_flow.get_flow_level();
-            const BlockFlow down_flow = get_possible_flow( block, index, CARDINAL_RELATION_BELOW );
+    const Block* block_above = ExternalNeighborStrategy::get_block_neighbor( block_it, above ).block_;
 
-            if ( down_flow.second >= gmtl::GMTL_EPSILON )
-            {
-                // Any flow that goes downward is consumed here, and will not be allocated
-                // towards possible laterally adjacent blocks.
-                flow_block( block, down_flow, remaining_flow, blocks_visited, chunks_modified );
-                remaining_flow -= down_flow.second * remaining_flow;
-            }
+    Vector3i sunlight_level = Block::MIN_LIGHT_LEVEL;
+    bool sunlight_above = false;
 
-            if ( remaining_flow > gmtl::GMTL_EPSILON )
-            {
-                const BlockFlow neighbor_flows[4] =
-                {
-                    get_possible_flow( block, index, CARDINAL_RELATION_NORTH ),
-                    get_possible_flow( block, index, CARDINAL_RELATION_SOUTH ),
-                    get_possible_flow( block, index, CARDINAL_RELATION_EAST ),
-                    get_possible_flow( block, index, CARDINAL_RELATION_WEST )
-                };
-
-                // TODO: Divying up the remaining flow as follows seems like a more
-                //       accurate way to simulate the fluid, but it tends to attenuate
-                //       the flow very quickly...
-                //
-                // Scalar total_flow = 0.0f;
-                //
-                // for ( int i = 0; i < 4; ++i )
-                // {
-                //     total_flow += neighbor_flows[i].second;
-                // }
-                //
-                // remaining_flow /= total_flow;
-
-                remaining_flow -= 1;
-
-                for ( int i = 0; i < 4; ++i )
+    if ( !block_above )
+    {
+        sunlight_above = true;
+        sunlight_level = Block::MAX_LIGHT_LEVEL;
+    }
+    else if ( block_above->is_sunlight_source() )
+    {
+        sunlight_above = true;
+        sunlight_level = block_above->get_sunlight_level();
+    }
+
+    for ( BlockIterator it = block_it; it.block_; it = ExternalNeighborStrategy::get_block_neighbor( it, below ) )
+    {
+        Block& block = *it.block_;
+        const bool was_sunlight_source = block.is_sunlight_source();
+        const Vector3i old_sunlight_level = block.get_sunlight_level();
+
+        if ( sunlight_above && block.is_translucent() )
+        {
+            filter_light( sunlight_level, block );
+
+            if ( was_sunlight_source && old_sunlight_level == sunlight_level )
+            {
+                break;
+            }
+
+            block.set_sunlight_source( true );
+            block.set_sunlight_level( sunlight_level );
+            seeds.push_back( it );
+        }
+        else
+        {
+            sunlight_above = false;
+
+            if ( !was_sunlight_source )
+            {
+                break;
+            }
+
+            block.set_sunlight_source( false );
+            block.set_sunlight_level( Block::MIN_LIGHT_LEVEL );
+        }
+
+        const Vector3i new_sunlight_level = block.get_sunlight_level();
+        Vector3i removed_sunlight_level = Block::MIN_LIGHT_LEVEL;
+        bool removed = false;
+
+        for ( int i = 0; i < Vector3i::Size; ++i )
+        {
+            if ( new_sunlight_level[i] < old_sunlight_level[i] )
+            {
+                removed_sunlight_level[i] = old_sunlight_level[i];
+                removed = true;
+            }
+        }
+
+        if ( removed )
+        {
+            removal_queue.push( FloodFillBlock( it, removed_sunlight_level ) );
+        }
+
+        add_chunks_sharing_block( it, chunks_affected );
+    }
+}
+
+bool is_uniformly_lit( const BlockFace& face )
+{
+    for ( int i = 1; i < BlockFace::NUM_VERTICES; ++i )
+    {
+        if ( face.vertices_[i].lighting_ != face.vertices_[0].lighting_ ||
+             face.vertices_[i].sunlighting_ != face.vertices_[0].sunlighting_ )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Translucent faces are never merged, since they're sorted by their centroids for rendering,
+// which does not work well for large faces.
+bool is_mergeable( const BlockFace& face )
+{
+    return !block_material_is_translucent( face.material_ ) && is_uniformly_lit( face );
+}
+
+bool can_merge_faces( const BlockFace& a, const BlockFace& b )
+{
+    return a.material_ == b.material_ &&
+           a.vertices_[0].lighting_ == b.vertices_[0].lighting_ &&
+           a.vertices_[0].sunlighting_ == b.vertices_[0].sunlighting_;
+}
+
+// Each face that the greedy mesher considers occupies a cell in a grid, indexed by the
+// direction that it faces, and the index of the Block that it belongs to.
+struct FaceCell
+{
+    unsigned face_;
+    int relation_;
+    Vector3i block_index_;
+
+    // The directions from vertex 0 to 1 (u), and from vertex 1 to 2 (v).
+    Vector3i u_;
+    Vector3i v_;
+
+    bool mergeable_;
+    bool merged_;
+};
+
+typedef std::vector<FaceCell> FaceCellV;
+
+// Cells are visited one plane at a time, starting from their minimum corners in (u, v), so that
+// each merged face can be grown towards +u and +v only.
+bool face_cell_order( const FaceCell& a, const FaceCell& b )
+{
+    if ( a.relation_ != b.relation_ )
+    {
+        return a.relation_ < b.relation_;
+    }
+
+    const int
+        a_plane = gmtl::dot( a.block_index_, cardinal_relation_vector( CardinalRelation( a.relation_ ) ) ),
+        b_plane = gmtl::dot( b.block_index_, cardinal_relation_vector( CardinalRelation( b.relation_ ) ) );
+
+    if ( a_plane != b_plane )
+    {
+        return a_plane < b_plane;
+    }
+
+    const int
+        a_v = gmtl::dot( a.block_index_, a.v_ ),
+        b_v = gmtl::dot( b.block_index_, b.v_ );
+
+    if ( a_v != b_v )
+    {
+        return a_v < b_v;
+    }
+
+    return gmtl::dot( a.block_index_, a.u_ ) < gmtl::dot( b.block_index_, b.u_ );
+}
+
+int get_face_cell_key( const int relation, const Vector3i& block_index )
+{
+    return ( ( relation * Chunk::SIZE_X + block_index[0] ) * Chunk::SIZE_Y + block_index[1] ) * Chunk::SIZE_Z + block_index[2];
+}
+
+bool block_index_in_range( const Vector3i& index )
+{
+    return index[0] >= 0 && index[1] >= 0 && index[2] >= 0 &&
+           index[0] < Chunk::SIZE_X && index[1] < Chunk::SIZE_Y && index[2] < Chunk::SIZE_Z;
+}
+
+// Returns the cell at the given (u, v) offset from the cell, if its face can be merged into it.
+FaceCell* find_mergeable_cell(
+    FaceCellV& cells,
+    const std::vector<int>& cell_grid,
+    const BlockFaceV& faces,
+    const FaceCell& cell,
+    const int u,
+    const int v
+)
+{
+    const Vector3i index = cell.block_index_ + cell.u_ * u + cell.v_ * v;
+
+    if ( !block_index_in_range( index ) )
+    {
+        return 0;
+    }
+
+    const int other = cell_grid[get_face_cell_key( cell.relation_, index )];
+
+    if ( other == -1 || cells[other].merged_ || !cells[other].mergeable_ ||
+         !can_merge_faces( faces[cell.face_], faces[cells[other].face_] ) )
+    {
+        return 0;
+    }
+
+    return &cells[other];
+}
+
+// This replaces runs of adjacent, identically lit faces with single larger faces, by growing
+// a rectangle from each unmerged face: first as far as possible along u, and then along v for
+// as long as every face in the next row can be merged too.
+void merge_faces( const Vector3i& chunk_position, BlockFaceV& faces )
+{
+    FaceCellV cells( faces.size() );
+
+    for ( unsigned i = 0; i < faces.size(); ++i )
+    {
+        const BlockFace& face = faces[i];
+        FaceCell& cell = cells[i];
+        cell.face_ = i;
+        cell.relation_ = NUM_CARDINAL_RELATIONS;
+
+        FOREACH_CARDINAL_RELATION( relation )
+        {
+            if ( vector_cast<Scalar>( cardinal_relation_vector( relation ) ) == face.normal_ )
+            {
+                cell.relation_ = relation;
+            }
+        }
+
+        assert( cell.relation_ != NUM_CARDINAL_RELATIONS );
+
+        Vector3f center( 0.0f, 0.0f, 0.0f );
+
+        for ( int j = 0; j < BlockFace::NUM_VERTICES; ++j )
+        {
+            center += face.vertices_[j].position_;
+        }
+
+        center /= Scalar( BlockFace::NUM_VERTICES );
+        center -= face.normal_ * 0.5f;
+
+        cell.block_index_ = vector_cast<int>( pointwise_floor( center ) ) - chunk_position;
+        cell.u_ = vector_cast<int>( pointwise_round( Vector3f( face.vertices_[1].position_ - face.vertices_[0].position_ ) ) );
+        cell.v_ = vector_cast<int>( pointwise_round( Vector3f( face.vertices_[2].position_ - face.vertices_[1].position_ ) ) );
+        cell.mergeable_ = is_mergeable( face );
+        cell.merged_ = false;
+    }
+
+    std::sort( cells.begin(), cells.end(), face_cell_order );
+
+    std::vector<int> cell_grid( NUM_CARDINAL_RELATIONS * Chunk::SIZE_X * Chunk::SIZE_Y * Chunk::SIZE_Z, -1 );
+
+    for ( unsigned i = 0; i < cells.size(); ++i )
+    {
+        cell_grid[get_face_cell_key( cells[i].relation_, cells[i].block_index_ )] = i;
+    }
+
+    BlockFaceV merged_faces;
+
+    for ( unsigned i = 0; i < cells.size(); ++i )
+    {
+        FaceCell& cell = cells[i];
+
+        if ( cell.merged_ )
+        {
+            continue;
+        }
+
+        cell.merged_ = true;
+        const BlockFace& face = faces[cell.face_];
+
+        if ( !cell.mergeable_ )
+        {
+            merged_faces.push_back( face );
+            continue;
+        }
+
+        int width = 1;
+
+        while ( FaceCell* other = find_mergeable_cell( cells, cell_grid, faces, cell, width, 0 ) )
+        {
+            other->merged_ = true;
+            ++width;
+        }
+
+        int height = 1;
+
+        for ( ;; )
+        {
+            std::vector<FaceCell*> row;
+
+            for ( int u = 0; u < width; ++u )
+            {
+                FaceCell* other = find_mergeable_cell( cells, cell_grid, faces, cell, u, height );
+
+                if ( !other )
+                {
+                    break;
+                }
+
+                row.push_back( other );
+            }
+
+            if ( int( row.size() ) != width )
+            {
+                break;
+            }
+
+            BOOST_FOREACH( FaceCell* other, row )
+            {
+                other->merged_ = true;
+            }
+
+            ++height;
+        }
+
+        BlockFace merged_face = face;
+        const Vector3f
+            u = vector_cast<Scalar>( cell.u_ ) * Scalar( width ),
+            v = vector_cast<Scalar>( cell.v_ ) * Scalar( height );
+
+        merged_face.vertices_[1].position_ = face.vertices_[0].position_ + u;
+        merged_face.vertices_[2].position_ = face.vertices_[0].position_ + u + v;
+        merged_face.vertices_[3].position_ = face.vertices_[0].position_ + v;
+        merged_face.size_ = Vector2f( face.size_[0] * Scalar( width ), face.size_[1] * Scalar( height ) );
+        merged_faces.push_back( merged_face );
+    }
+
+    faces.swap( merged_faces );
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Class definition for PaddedChunkBlocks:
+//////////////////////////////////////////////////////////////////////////////////
+
+// A copy of a Chunk's Blocks, surrounded by a one Block thick apron that is copied from the
+// neighboring Chunks.  The mesher looks up any Block within one step of the Chunk with a
+// plain array offset, rather than wrapping the index into a neighbor and following its
+// pointer, and it never touches the Chunks themselves once the copy has been made.
+struct PaddedChunkBlocks
+{
+    static const int
+        SIZE_X = Chunk::SIZE_X + 2,
+        SIZE_Y = Chunk::SIZE_Y + 2,
+        SIZE_Z = Chunk::SIZE_Z + 2,
+        NUM_BLOCKS = SIZE_X * SIZE_Y * SIZE_Z;
+
+    // Each thread that does meshing reuses its own copy, since it is too large to allocate
+    // for every Chunk (or to put on the stack).
+    static PaddedChunkBlocks& get_thread_instance()
+    {
+        static boost::thread_specific_ptr<PaddedChunkBlocks> instance;
+
+        if ( !instance.get() )
+        {
+            instance.reset( new PaddedChunkBlocks );
+        }
+
+        return *instance;
+    }
+
+    void fill( const Chunk& chunk );
+
+    void get_light_volume( ChunkLightVolume& light_volume ) const;
+
+    // Each component of the index (relative to the Chunk) must be in [-1, SIZE].  This
+    // returns null where there is no surrounding Chunk.
+    const Block* get_block( const Vector3i& index ) const
+    {
+        const int offset = get_offset( index );
+        return present_[offset] ? &blocks_[offset] : 0;
+    }
+
+    // The index must be inside the Chunk itself.
+    const Block& get_inner_block( const Vector3i& index ) const
+    {
+        return blocks_[get_offset( index )];
+    }
+
+    bool has_neighbor( const Vector3i& relation ) const
+    {
+        return neighbors_[relation[0] + 1][relation[1] + 1][relation[2] + 1];
+    }
+
+    bool has_neighbor_column( const CardinalRelation relation ) const
+    {
+        return neighbor_columns_[relation];
+    }
+
+private:
+
+    // The Blocks are in the same order as a Chunk's storage, so that each vertical run
+    // can be copied at once.
+    static int get_offset( const Vector3i& index )
+    {
+        assert( index[0] >= -1 && index[0] <= Chunk::SIZE_X );
+        assert( index[1] >= -1 && index[1] <= Chunk::SIZE_Y );
+        assert( index[2] >= -1 && index[2] <= Chunk::SIZE_Z );
+        return ( ( index[0] + 1 ) * SIZE_Z + index[2] + 1 ) * SIZE_Y + index[1] + 1;
+    }
+
+    Block blocks_[NUM_BLOCKS];
+    bool present_[NUM_BLOCKS];
+    bool neighbors_[3][3][3];
+    bool neighbor_columns_[NUM_CARDINAL_RELATIONS];
+};
+
+void PaddedChunkBlocks::fill( const Chunk& chunk )
+{
+    FOREACH_SURROUNDING( x, y, z )
+    {
+        const Vector3i relation( x, y, z );
+        const Chunk* source = chunk.get_neighbor( relation );
+        neighbors_[x + 1][y + 1][z + 1] = source != 0;
+
+        // The range of indices (relative to the Chunk) that this neighbor covers.
+        Vector3i begin, end;
+
+        for ( int i = 0; i < Vector3i::Size; ++i )
+        {
+            begin[i] = relation[i] < 0 ? -1 : ( relation[i] > 0 ? Chunk::SIZE[i] : 0 );
+            end[i] = relation[i] < 0 ? 0 : Chunk::SIZE[i] + ( relation[i] > 0 ? 1 : 0 );
+        }
+
+        const Vector3i source_offset = -pointwise_product( relation, Chunk::SIZE );
+        const int run = end[1] - begin[1];
+
+        for ( int bx = begin[0]; bx < end[0]; ++bx )
+        {
+            for ( int bz = begin[2]; bz < end[2]; ++bz )
+            {
+                const Vector3i index( bx, begin[1], bz );
+                const int offset = get_offset( index );
+                Block* destination = &blocks_[offset];
+                std::fill( present_ + offset, present_ + offset + run, source != 0 );
+
+                if ( !source )
+                {
+                    std::fill( destination, destination + run, Block() );
+                }
+                else if ( source->storage_ )
+                {
+                    const Vector3i source_index = index + source_offset;
+                    const Block* first = &source->storage_->blocks_[source_index[0]][source_index[2]][source_index[1]];
+                    std::copy( first, first + run, destination );
+                }
+                else std::fill( destination, destination + run, source->uniform_block_ );
+            }
+        }
+    }
+
+    const Chunk* column = &chunk;
+
+    while ( const Chunk* below = column->get_neighbor( Vector3i( 0, -1, 0 ) ) )
+    {
+        column = below;
+    }
+
+    FOREACH_CARDINAL_RELATION( relation )
+    {
+        neighbor_columns_[relation] = column->get_neighbor( cardinal_relation_vector( relation ) ) != 0;
+    }
+}
+
+void PaddedChunkBlocks::get_light_volume( ChunkLightVolume& light_volume ) const
+{
+    BOOST_STATIC_ASSERT( ChunkLightVolume::SIZE == SIZE_X && ChunkLightVolume::SIZE == SIZE_Y && ChunkLightVolume::SIZE == SIZE_Z );
+
+    int texel = 0;
+
+    for ( int z = -1; z <= Chunk::SIZE_Z; ++z )
+    {
+        for ( int y = -1; y <= Chunk::SIZE_Y; ++y )
+        {
+            for ( int x = -1; x <= Chunk::SIZE_X; ++x, ++texel )
+            {
+                const Block* block = get_block( Vector3i( x, y, z ) );
+
+                // Where there's no Chunk, the vertex lighting treats the Blocks as translucent
+                // and fully sunlit.
+                if ( !block )
+                {
+                    light_volume.light_[texel] = ChunkLightVolume::TRANSLUCENT_ALPHA;
+                    light_volume.sunlight_[texel] = Block::pack_light_level( Block::MAX_LIGHT_LEVEL );
+                }
+                else if ( block->is_translucent() )
+                {
+                    light_volume.light_[texel] = ChunkLightVolume::TRANSLUCENT_ALPHA | Block::pack_light_level( block->get_light_level() );
+                    light_volume.sunlight_[texel] = Block::pack_light_level( block->get_sunlight_level() );
+                }
+                else
+                {
+                    light_volume.light_[texel] = 0;
+                    light_volume.sunlight_[texel] = 0;
+                }
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Class definition for ChunkCornerLighting:
+//////////////////////////////////////////////////////////////////////////////////
+
+// The vertex lighting at each corner of the Blocks in a Chunk, for each direction that a face
+// at that corner may point.  Up to four faces share each corner (those of the four Blocks
+// around it, in the plane behind it), and its lighting is only calculated for the first one.
+struct ChunkCornerLighting
+{
+    static const int
+        SIZE_X = Chunk::SIZE_X + 1,
+        SIZE_Y = Chunk::SIZE_Y + 1,
+        SIZE_Z = Chunk::SIZE_Z + 1,
+        NUM_CORNERS = SIZE_X * SIZE_Y * SIZE_Z;
+
+    // Like the PaddedChunkBlocks, each thread that does meshing reuses its own.
+    static ChunkCornerLighting& get_thread_instance()
+    {
+        static boost::thread_specific_ptr<ChunkCornerLighting> instance;
+
+        if ( !instance.get() )
+        {
+            instance.reset( new ChunkCornerLighting );
+        }
+
+        return *instance;
+    }
+
+    ChunkCornerLighting() :
+        blocks_( 0 ),
+        generation_( 0 )
+    {
+        clear_generations();
+    }
+
+    // Forgets all of the cached lighting.  The lighting will be calculated from the given
+    // Blocks, which must not change until the next reset.
+    void reset( const PaddedChunkBlocks& blocks )
+    {
+        blocks_ = &blocks;
+
+        // Rather than clearing every corner, each reset starts a new generation, and only
+        // the corners that were calculated during the current one are valid.
+        if ( ++generation_ == 0 )
+        {
+            clear_generations();
+            generation_ = 1;
+        }
+    }
+
+    // The arguments are the same as those of the vertices in Chunk::add_external_face().
+    void get_vertex_lighting(
+        const Vector3i& primary_index,
+        const CardinalRelation primary_relation,
+        const Vector3i& neighbor_relation_a,
+        const Vector3i& neighbor_relation_b,
+        Vector3f& vertex_lighting,
+        Vector3f& vertex_sunlighting
+    );
+
+private:
+
+    struct CornerLighting
+    {
+        Vector3f
+            lighting_,
+            sunlighting_;
+    };
+
+    void clear_generations()
+    {
+        std::fill( corner_generations_[0], corner_generations_[0] + NUM_CORNERS * NUM_CARDINAL_RELATIONS, 0u );
+    }
+
+    const PaddedChunkBlocks* blocks_;
+
+    unsigned generation_;
+
+    unsigned corner_generations_[NUM_CORNERS][NUM_CARDINAL_RELATIONS];
+    CornerLighting corners_[NUM_CORNERS][NUM_CARDINAL_RELATIONS];
+};
+
+void ChunkCornerLighting::get_vertex_lighting(
+    const Vector3i& primary_index,
+    const CardinalRelation primary_relation,
+    const Vector3i& neighbor_relation_a,
+    const Vector3i& neighbor_relation_b,
+    Vector3f& vertex_lighting,
+    Vector3f& vertex_sunlighting
+)
+{
+    const Vector3i primary_relation_vector = cardinal_relation_vector( primary_relation );
+    const Vector3i neighbor_index = primary_index + primary_relation_vector;
+    const Block* neighbors[4];
+    neighbors[0] = blocks_->get_block( neighbor_index );
+    neighbors[1] = blocks_->get_block( neighbor_index + neighbor_relation_a );
+    neighbors[2] = blocks_->get_block( neighbor_index + neighbor_relation_b );
+    neighbors[3] = 0;
+
+    // The 'ab' neighbor cannot contribute light to the vertex if both neighbors 'a' and 'b'
+    // are opaque, because they would fully block any light from 'ab'.  The lighting then
+    // depends on which of the faces around the corner this is, so it can't be shared.
+    if ( neighbors[1] && !neighbors[1]->is_translucent() &&
+         neighbors[2] && !neighbors[2]->is_translucent() )
+    {
+        calculate_vertex_lighting( neighbors, false, vertex_lighting, vertex_sunlighting );
+        return;
+    }
+
+    // Otherwise all four of the Blocks in front of the corner contribute equally, whichever
+    // of them this face belongs to.
+    Vector3i corner_index = primary_index;
+
+    for ( int i = 0; i < Vector3i::Size; ++i )
+    {
+        if ( primary_relation_vector[i] > 0 || neighbor_relation_a[i] > 0 || neighbor_relation_b[i] > 0 )
+        {
+            ++corner_index[i];
+        }
+    }
+
+    const int offset = ( corner_index[0] * SIZE_Z + corner_index[2] ) * SIZE_Y + corner_index[1];
+    CornerLighting& corner = corners_[offset][primary_relation];
+
+    if ( corner_generations_[offset][primary_relation] != generation_ )
+    {
+        neighbors[3] = blocks_->get_block( neighbor_index + neighbor_relation_a + neighbor_relation_b );
+        calculate_vertex_lighting( neighbors, true, corner.lighting_, corner.sunlighting_ );
+        corner_generations_[offset][primary_relation] = generation_;
+    }
+
+    vertex_lighting = corner.lighting_;
+    vertex_sunlighting = corner.sunlighting_;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for Chunk:
+//////////////////////////////////////////////////////////////////////////////////
+
+const int
+    Chunk::SIZE_X,
+    Chunk::SIZE_Y,
+    Chunk::SIZE_Z;
+
+const Vector3i Chunk::SIZE( SIZE_X, SIZE_Y, SIZE_Z );
+
+#ifdef GREEDY_MESHING
+volatile bool Chunk::greedy_meshing_ = true;
+#else
+volatile bool Chunk::greedy_meshing_ = false;
+#endif
+
+#ifdef TEXTURE_LIGHTING
+volatile bool Chunk::texture_lighting_ = true;
+#else
+volatile bool Chunk::texture_lighting_ = false;
+#endif
+
+const size_t
+    Chunk::CHUNKS_PER_SLAB,
+    Chunk::BLOCK_STORAGES_PER_SLAB;
+
+SlabAllocator
+    Chunk::chunk_allocator_( sizeof( Chunk ), CHUNKS_PER_SLAB ),
+    Chunk::block_storage_allocator_( sizeof( Chunk::BlockStorage ), BLOCK_STORAGES_PER_SLAB );
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for Chunk:
+//////////////////////////////////////////////////////////////////////////////////
+
+Chunk::Chunk( const Vector3i& position ) :
+    position_( position ),
+    storage_( new BlockStorage ),
+    fluids_scanned_( false ),
+    mesh_( new ChunkMesh ),
+    geometry_hash_( 0 ),
+    light_hash_( 0 ),
+    geometry_hashed_( false ),
+    reference_count_( 0 )
+{
+    FOREACH_SURROUNDING( x, y, z )
+    {
+        get_neighbor_impl( Vector3i( x, y, z ) ) = 0;
+    }
+
+    get_neighbor_impl( Vector3i( 0, 0, 0 ) ) = this;
+
+    // The storage starts out full of air.
+    memset( opaque_heights_, 0, sizeof( opaque_heights_ ) );
+    memset( filter_heights_, 0, sizeof( filter_heights_ ) );
+}
+
+void Chunk::compact()
+{
+    if ( !storage_ )
+    {
+        return;
+    }
+
+    const Block* blocks = &storage_->blocks_[0][0][0];
+    const Block& first = blocks[0];
+
+    for ( int i = 1; i < SIZE_X * SIZE_Y * SIZE_Z; ++i )
+    {
+        if ( blocks[i] != first )
+        {
+            return;
+        }
+    }
+
+    uniform_block_ = first;
+    storage_.reset();
+}
+
+void Chunk::expand()
+{
+    if ( storage_ )
+    {
+        return;
+    }
+
+    storage_.reset( new BlockStorage );
+    Block* blocks = &storage_->blocks_[0][0][0];
+    std::fill( blocks, blocks + SIZE_X * SIZE_Y * SIZE_Z, uniform_block_ );
+}
+
+Chunk::BlockFlow Chunk::get_possible_flow( const Block& block, const Vector3i& block_index, const CardinalRelation relation )
+{
+    BlockFlow possible_flow;
+    possible_flow.first = get_block_neighbor( block_index, cardinal_relation_vector( relation ) );
+
+    // TODO: If the neighbor block does not exist, but it IS in an existing column,
+    //       extend that column and flow into it.
+    possible_flow.second = 0.0f;
+
+    if ( possible_flow.first.block_ )
+    {
+        Block& neighbor = *possible_flow.first.block_;
+
+        if ( neighbor.get_material() == BLOCK_MATERIAL_AIR )
+        {
+            possible_flow.second = 1.0f;
+        }
+        else if ( ( block.get_material() == BLOCK_MATERIAL_WATER &&
+                    neighbor.get_material() == BLOCK_MATERIAL_LAVA ) ||
+                  ( block.get_material() == BLOCK_MATERIAL_LAVA &&
+                    neighbor.get_material() == BLOCK_MATERIAL_WATER ) )
+        {
+            possible_flow.second = 1.0f / BlockDataFlowable::MAX_FLOW_LEVEL;
+        }
+        else if ( block.get_material() == neighbor.get_material() )
+        {
+            possible_flow.second = 1.0f;
+
+            if ( relation != CARDINAL_RELATION_BELOW )
+            {
+                possible_flow.second -=
+                    Scalar( BlockDataFlowable( neighbor ).get_flow_level() ) / BlockDataFlowable::MAX_FLOW_LEVEL;
+            }
+        }
+    }
+
+    return possible_flow;
+}
+
+void Chunk::wake_fluid( const Vector3i& index, const uint16_t step )
+{
+    // Reading the Block through a const Chunk keeps a uniform Chunk from being expanded.
+    const Chunk& self = *this;
+
+    if ( block_material_is_flowable( self.get_block( index ).get_material() ) )
+    {
+        awake_fluids_.push_back( AwakeFluid( pack_block_index( index ), step ) );
+    }
+}
+
+void Chunk::wake_all_fluids( const uint16_t step )
+{
+    if ( storage_ )
+    {
+        // The packed index of each Block is the same as its position in the storage.
+        const Block* blocks = &storage_->blocks_[0][0][0];
+
+        for ( int i = 0; i < SIZE_X * SIZE_Y * SIZE_Z; ++i )
+        {
+            if ( block_material_is_flowable( blocks[i].get_material() ) )
+            {
+                awake_fluids_.push_back( AwakeFluid( uint16_t( i ), step ) );
+            }
+        }
+    }
+    else if ( block_material_is_flowable( uniform_block_.get_material() ) )
+    {
+        // The Blocks inside of a uniform Chunk have nowhere to flow, but the Blocks on its
+        // surface may be able to flow into the surrounding Chunks.
+        FOREACH_BLOCK( x, y, z )
+        {
+            if ( x == 0 || y == 0 || z == 0 || x == SIZE_X - 1 || y == SIZE_Y - 1 || z == SIZE_Z - 1 )
+            {
+                awake_fluids_.push_back( AwakeFluid( pack_block_index( Vector3i( x, y, z ) ), step ) );
+            }
+        }
+    }
+}
+
+bool Chunk::flow_block(
+    const Block& block,
+    const BlockFlow& neighbor_flow,
+    const Scalar remaining_flow,
+    const uint16_t step,
+    BlockIteratorV& blocks_modified
+)
+{
+    // TODO: If this neighbor does not exist, but it IS in an existing column,
+    //       extend that column and flow into it.
+
+    if ( !neighbor_flow.first.block_ )
+    {
+        return false;
+    }
+
+    Block& neighbor_block = *neighbor_flow.first.block_;
+    const int flow_level = static_cast<int>( roundf( neighbor_flow.second * remaining_flow ) );
+
+    if ( neighbor_block.get_material() == BLOCK_MATERIAL_AIR )
+    {
+        neighbor_block.set_material( block.get_material() );
+        BlockDataFlowable( neighbor_block ).set_flow_level( flow_level );
+        blocks_modified.push_back( neighbor_flow.first );
+    }
+    else if ( ( block.get_material() == BLOCK_MATERIAL_WATER &&
+                neighbor_block.get_material() == BLOCK_MATERIAL_LAVA ) ||
+              ( block.get_material() == BLOCK_MATERIAL_LAVA &&
+                neighbor_block.get_material() == BLOCK_MATERIAL_WATER ) )
+    {
+        neighbor_block.set_material( BLOCK_MATERIAL_BEDROCK );
+        blocks_modified.push_back( neighbor_flow.first );
+    }
+    else if ( block.get_material() == neighbor_block.get_material() )
+    {
+        BlockDataFlowable neighbor_flowable( neighbor_block );
+
+        if ( flow_level <= neighbor_flowable.get_flow_level() )
+        {
+            return false;
+        }
+
+        neighbor_flowable.set_flow_level( flow_level );
+    }
+    else return false;
+
+    neighbor_flow.first.chunk_->wake_fluid( neighbor_flow.first.index_, step );
+    return true;
+}
+
+bool Chunk::simulate_block( Block& block, const Vector3i& block_index, const uint16_t step, BlockIteratorV& blocks_modified )
+{
+    bool modified = false;
+
+    BlockDataFlowable block_flow( block );
+    Scalar remaining_flow = block_flow.get_flow_level();
+    const BlockFlow down_flow = get_possible_flow( block, block_index, CARDINAL_RELATION_BELOW );
+
+    if ( down_flow.second >= gmtl::GMTL_EPSILON )
+    {
+        // Any flow that goes downward is consumed here, and will not be allocated
+        // towards possible laterally adjacent blocks.
+        modified |= flow_block( block, down_flow, remaining_flow, step, blocks_modified );
+        remaining_flow -= down_flow.second * remaining_flow;
+    }
+
+    if ( remaining_flow > gmtl::GMTL_EPSILON )
+    {
+        const BlockFlow neighbor_flows[4] =
+        {
+            get_possible_flow( block, block_index, CARDINAL_RELATION_NORTH ),
+            get_possible_flow( block, block_index, CARDINAL_RELATION_SOUTH ),
+            get_possible_flow( block, block_index, CARDINAL_RELATION_EAST ),
+            get_possible_flow( block, block_index, CARDINAL_RELATION_WEST )
+        };
+
+        // TODO: Divying up the remaining flow as follows seems like a more
+        //       accurate way to simulate the fluid, but it tends to attenuate
+        //       the flow very quickly...
+        //
+        // Scalar total_flow = 0.0f;
+        //
+        // for ( int i = 0; i < 4; ++i )
+        // {
+        //     total_flow += neighbor_flows[i].second;
+        // }
+        //
+        // remaining_flow /= total_flow;
+
+        remaining_flow -= 1;
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            modified |= flow_block( block, neighbor_flows[i], remaining_flow, step, blocks_modified );
+        }
+    }
+
+    return modified;
+}
+
+void Chunk::simulate( const uint16_t step, BlockIteratorV& blocks_modified )
+{
+    if ( !fluids_scanned_ )
+    {
+        // The Blocks are woken up as of the previous step, so that they can flow right away.
+        wake_all_fluids( step - 1 );
+        fluids_scanned_ = true;
+    }
+
+    // Sorting the awake Blocks brings any duplicates together, so that each Block is only
+    // simulated once.  If any of the duplicates were woken up during this step, the Block
+    // has to wait for the next one.
+    AwakeFluidV fluids;
+    fluids.swap( awake_fluids_ );
+    std::sort( fluids.begin(), fluids.end() );
+
+    unsigned num_simulated = 0;
+
+    for ( size_t i = 0; i < fluids.size(); ++i )
+    {
+        const uint16_t packed_index = fluids[i].index_;
+
+        while ( i + 1 < fluids.size() && fluids[i + 1].index_ == packed_index )
+        {
+            ++i;
+        }
+
+        // The duplicates are sorted by step, so the last one is the most recent.
+        if ( fluids[i].step_ == step || num_simulated == MAX_FLUID_BLOCKS_PER_STEP )
+        {
+            awake_fluids_.push_back( fluids[i] );
+            continue;
+        }
+
+        const Vector3i block_index = unpack_block_index( packed_index );
+        Block& block = get_block( block_index );
+
+        if ( !block_material_is_flowable( block.get_material() ) )
+        {
+            continue;
+        }
+
+        ++num_simulated;
+
+        // A Block that didn't manage to flow anywhere is settled, and goes back to sleep.
+        if ( simulate_block( block, block_index, step, blocks_modified ) )
+        {
+            awake_fluids_.push_back( AwakeFluid( packed_index, step ) );
+        }
+    }
+}
+
+void Chunk::update_heightmap_column( const int x, const int z )
+{
+    uint8_t
+        opaque_height = 0,
+        filter_height = 0;
+
+    for ( int y = SIZE_Y - 1; y >= 0; --y )
+    {
+        const Block& block = storage_ ? storage_->blocks_[x][z][y] : uniform_block_;
+
+        if ( !block.is_translucent() )
+        {
+            opaque_height = uint8_t( y + 1 );
+            break;
+        }
+        else if ( !filter_height && !block.is_color_saturated() )
+        {
+            filter_height = uint8_t( y + 1 );
+        }
+    }
+
+    opaque_heights_[x][z] = opaque_height;
+    filter_heights_[x][z] = filter_height;
+}
+
+void Chunk::reset_lighting()
+{
+    // Every Block's lighting is about to be rewritten, so the columns are walked directly.
+    expand();
+
+    for ( int x = 0; x < SIZE_X; ++x )
+    {
+        for ( int z = 0; z < SIZE_Z; ++z )
+        {
+            update_heightmap_column( x, z );
+
+            const Vector3i top_block_index( x, SIZE_Y - 1, z );
+            const Block* block_above = get_block_neighbor( top_block_index, Vector3i( 0, 1, 0 ) ).block_;
+
+            Vector3i sunlight_level = Block::MIN_LIGHT_LEVEL;
+            bool sunlight_above = false;
+
+            if ( !block_above )
+            {
+                sunlight_above = true;
+                sunlight_level = Block::MAX_LIGHT_LEVEL;
+            }
+            else if ( block_above->is_sunlight_source() )
+            {
+                sunlight_above = true;
+                sunlight_level = block_above->get_sunlight_level();
+            }
+
+            // The sunlight passes straight down to the filter height, is filtered down to the
+            // opaque height, and stops there.  Without any sunlight from above, nothing is lit.
+            const int opaque_height = sunlight_above ? opaque_heights_[x][z] : SIZE_Y;
+            const int filter_height = std::max( opaque_height, int( filter_heights_[x][z] ) );
+
+            Block* column = storage_->blocks_[x][z];
+            int y = SIZE_Y - 1;
+
+            for ( ; y >= filter_height; --y )
+            {
+                Block& block = column[y];
+                block.set_light_level( Block::MIN_LIGHT_LEVEL );
+                block.set_sunlight_source( true );
+                block.set_sunlight_level( sunlight_level );
+            }
+
+            for ( ; y >= opaque_height; --y )
+            {
+                Block& block = column[y];
+                block.set_light_level( Block::MIN_LIGHT_LEVEL );
+                filter_light( sunlight_level, block );
+                block.set_sunlight_source( true );
+                block.set_sunlight_level( sunlight_level );
+            }
+
+            for ( ; y >= 0; --y )
+            {
+                Block& block = column[y];
+                block.set_light_level( Block::MIN_LIGHT_LEVEL );
+                block.set_sunlight_source( false );
+                block.set_sunlight_level( Block::MIN_LIGHT_LEVEL );
+            }
+        }
+    }
+}
+
+void Chunk::apply_lighting_to_self()
+{
+    FloodFillArena& arena = get_flood_fill_arena();
+
+    FOREACH_BLOCK( x, y, z )
+    {
+        const Vector3i index( x, y, z );
+        Block& block = get_block( index );
+        BlockIterator block_it( this, &block, index );
+
+        if ( block.is_sunlight_source() )
+        {
+            arena.queue_.push( FloodFillBlock( block_it, block.get_sunlight_level() ) );
+            flood_fill_light<SunLightStrategy, InternalNeighborStrategy>( true, arena.queue_, arena.blocks_visited_ );
+        }
+
+        if ( block.is_light_source() )
+        {
+            arena.queue_.push( FloodFillBlock( block_it, get_light_source_color( block ) ) );
+            flood_fill_light<ColorLightStrategy, InternalNeighborStrategy>( false, arena.queue_, arena.blocks_visited_ );
+        }
+    }
+}
+
+void Chunk::apply_lighting_to_neighbors()
+{
+    FloodFillArena& arena = get_flood_fill_arena();
+
+    FOREACH_BLOCK( x, y, z )
+    {
+        // Throw out any Block that is not on the edge of this Chunk.
+        //
+        // FIXME: This is super ugly and slow.  This _NEEDS_ to be rewritten with a
+        //        loop that only generates the edge coordinates.
+        //
+        if ( x > 0 && x < SIZE_X - 1 &&
+             y > 0 && y < SIZE_Y - 1 &&
+             z > 0 && z < SIZE_Z - 1 )
+        {
+            continue;
+        }
+
+        const Vector3i index( x, y, z );
+        Block& block = get_block( index );
+        BlockIterator block_it( this, &block, index );
+
+        if ( block.has_sunlight() )
+        {
+            arena.queue_.push( FloodFillBlock( block_it, block.get_sunlight_level() ) );
+            flood_fill_light<SunLightStrategy, ExternalNeighborStrategy>( true, arena.queue_, arena.blocks_visited_ );
+        }
+
+        if ( block.has_light() )
+        {
+            arena.queue_.push( FloodFillBlock( block_it, block.get_light_level() ) );
+            flood_fill_light<ColorLightStrategy, ExternalNeighborStrategy>( true, arena.queue_, arena.blocks_visited_ );
+        }
+    }
+}
+
+bool Chunk::update_geometry()
+{
+    const bool texture_lighting = texture_lighting_;
+    uint64_t light_hash = 0;
+    const uint64_t geometry_hash = calculate_geometry_hash( texture_lighting, light_hash );
+
+    const bool
+        geometry_changed = !geometry_hashed_ || geometry_hash != geometry_hash_,
+        light_changed = texture_lighting && ( !geometry_hashed_ || light_hash != light_hash_ );
+
+    if ( !geometry_changed && !light_changed )
+    {
+        return false;
+    }
+
+    geometry_hash_ = geometry_hash;
+    light_hash_ = light_hash;
+    geometry_hashed_ = true;
+
+    // Everything past this point reads only from this copy.
+    PaddedChunkBlocks& blocks = PaddedChunkBlocks::get_thread_instance();
+    blocks.fill( *this );
+
+    // The coarsest level of detail is built first, so that each finer level can link to the
+    // next coarser one.  Building the vertex data here, rather than in the renderer, means
+    // that it's built in parallel by the update workers instead of stalling the main thread.
+    ChunkMeshSP published_mesh;
+
+    if ( geometry_changed )
+    {
+        const ChunkFaceConnectivity connectivity = calculate_face_connectivity();
+
+        // A corner's lighting only depends on the Blocks around it, so it's shared by the faces
+        // of every level of detail.
+        ChunkCornerLighting& corner_lighting = ChunkCornerLighting::get_thread_instance();
+        corner_lighting.reset( blocks );
+
+        for ( int level = ChunkMesh::NUM_LEVELS_OF_DETAIL - 1; level >= 0; --level )
+        {
+            BlockFaceV faces;
+
+            if ( level == 0 )
+            {
+                add_external_faces( blocks, corner_lighting, faces );
+            }
+            else add_coarse_faces( blocks, corner_lighting, level, faces );
+
+            if ( greedy_meshing_ )
+            {
+                merge_faces( position_, faces );
+            }
+
+            published_mesh.reset( new ChunkMesh( position_, faces, connectivity, level, published_mesh ) );
+        }
+    }
+
+    // Without texture lighting, this releases any light volume left over from when it was on.
+    ChunkLightVolumeSP published_light_volume;
+
+    if ( light_changed )
+    {
+        ChunkLightVolume* light_volume = new ChunkLightVolume;
+        published_light_volume.reset( light_volume );
+        blocks.get_light_volume( *light_volume );
+    }
+
+    // The old mesh is released outside of the lock, since that might take a while.
+    {
+        boost::lock_guard<boost::mutex> guard( mesh_lock_ );
+
+        if ( geometry_changed )
+        {
+            mesh_.swap( published_mesh );
+        }
+
+        if ( light_changed || !texture_lighting )
+        {
+            light_volume_.swap( published_light_volume );
+        }
+    }
+
+    return true;
+}
+
+uint64_t Chunk::calculate_geometry_hash( const bool texture_lighting, uint64_t& light_hash )
+{
+    // The mesh is built from the Blocks in this Chunk, the Blocks just across its surface (for
+    // hiding faces and for the vertex lighting), which of the surrounding Chunks and columns
+    // exist, and the meshing modes.  Nothing else can change it.  The light volume is built
+    // from the light levels of the same Blocks.
+
+    uint64_t hash = hash_bits( hash_bits( GEOMETRY_HASH_SEED, greedy_meshing_ ), texture_lighting );
+    light_hash = GEOMETRY_HASH_SEED;
+
+    if ( storage_ )
+    {
+        const Block* blocks = &storage_->blocks_[0][0][0];
+
+        for ( int i = 0; i < SIZE_X * SIZE_Y * SIZE_Z; ++i )
+        {
+            hash_block( blocks[i], texture_lighting, hash, light_hash );
+        }
+    }
+    else
+    {
+        hash = ~hash;
+        hash_block( uniform_block_, texture_lighting, hash, light_hash );
+    }
+
+    FOREACH_SURROUNDING( x, y, z )
+    {
+        const Vector3i relation( x, y, z );
+
+        if ( relation == Vector3i( 0, 0, 0 ) )
+        {
+            continue;
+        }
+
+        const Chunk* neighbor = get_neighbor( relation );
+        hash = hash_bits( hash, neighbor != 0 );
+
+        if ( !neighbor )
+        {
+            continue;
+        }
+
+        // Only the layer of the neighbor's Blocks that touches this Chunk matters.
+        Vector3i begin, end;
+
+        for ( int i = 0; i < Vector3i::Size; ++i )
+        {
+            begin[i] = relation[i] < 0 ? SIZE[i] - 1 : 0;
+            end[i] = relation[i] > 0 ? 1 : SIZE[i];
+        }
+
+        for ( int bx = begin[0]; bx < end[0]; ++bx )
+        {
+            for ( int bz = begin[2]; bz < end[2]; ++bz )
+            {
+                for ( int by = begin[1]; by < end[1]; ++by )
                 {
-                    flow_block( block, neighbor_flows[i], remaining_flow, blocks_visited, chunks_modified );
+                    hash_block( neighbor->get_block( Vector3i( bx, by, bz ) ), texture_lighting, hash, light_hash );
                 }
             }
         }
     }
+
+    Chunk* column = get_column_bottom();
+
+    FOREACH_CARDINAL_RELATION( relation )
+    {
+        hash = hash_bits( hash, column->get_neighbor( cardinal_relation_vector( relation ) ) != 0 );
+    }
+
+    return hash;
 }
 
-void Chunk::reset_lighting()
+void Chunk::add_external_faces(
+    const PaddedChunkBlocks& blocks,
+    ChunkCornerLighting& corner_lighting,
+    BlockFaceV& faces
+) const
 {
-    for ( int x = 0; x < SIZE_X; ++x )
+    FOREACH_BLOCK( x, y, z )
     {
-        for ( int z = 0; z < SIZE_Z; ++z )
-        {
-            const int y_max = SIZE_Y - 1;
-            const Vector3i top_block_index( x, y_max, z );
-            const Block* block_above = get_block_neighbor( top_block_index, Vector3i( 0, 1, 0 ) ).block_;
+        const Vector3i block_index( x, y, z );
+        const Block& block = blocks.get_inner_block( block_index );
 
-            Vector3i sunlight_level = Block::MIN_LIGHT_LEVEL;
-            bool sunlight_above = false;
+        if ( block.get_material() != BLOCK_MATERIAL_AIR )
+        {
+            const Vector3f block_position = vector_cast<Scalar>( Vector3i( position_ + block_index ) );
 
-            if ( !block_above )
-            {
-                sunlight_above = true;
-                sunlight_level = Block::MAX_LIGHT_LEVEL;
-            }
-            else if ( block_above->is_sunlight_source() )
+            FOREACH_CARDINAL_RELATION( relation )
             {
-                sunlight_above = true;
-                sunlight_level = block_above->get_sunlight_level();
-            }
+                const Vector3i relation_vector = cardinal_relation_vector( relation );
+                const Block* block_neighbor = blocks.get_block( block_index + relation_vector );
 
-            for ( int y = y_max; y >= 0; --y )
-            {
-                Block& block = get_block( Vector3i( x, y, z ) );
-                block.set_light_level( Block::MIN_LIGHT_LEVEL );
+                bool add_face = false;
 
-                if ( sunlight_above )
+                if ( block_neighbor )
                 {
-                    if ( block.is_translucent() )
-                    {
-                        filter_light( sunlight_level, block );
-                        block.set_sunlight_source( true );
-                        block.set_sunlight_level( sunlight_level );
-                    }
-                    else sunlight_above = false;
+                    add_face = ( block_neighbor->is_translucent() &&
+                                 block.get_material() != block_neighbor->get_material() );
+                }
+                else
+                {
+                    // Don't add faces on the sides of the chunk in which there is not presently a column
+                    // of chunks.  Also, don't add faces on the bottom of the column, facing downward.
+                    add_face = ( relation == CARDINAL_RELATION_ABOVE ||
+                               ( relation != CARDINAL_RELATION_BELOW && blocks.has_neighbor_column( relation ) ) );
                 }
 
-                if ( !sunlight_above )
+                if ( add_face )
                 {
-                    block.set_sunlight_source( false );
-                    block.set_sunlight_level( Block::MIN_LIGHT_LEVEL );
+                    add_external_face( corner_lighting, faces, block_index, block_position, block, relation, relation_vector );
                 }
             }
         }
     }
 }
 
-void Chunk::apply_lighting_to_self()
+void Chunk::add_coarse_faces(
+    const PaddedChunkBlocks& blocks,
+    ChunkCornerLighting& corner_lighting,
+    const unsigned level_of_detail,
+    BlockFaceV& faces
+) const
 {
-    FloodFillQueue sun_flood_queue;
-    FloodFillQueue color_flood_queue;
-    BlockV blocks_visited;
+    // Each cell of scale^3 Blocks is treated as a single large Block.  A cell is opaque if any
+    // of its Blocks are, and solid if any of them are, so a coarse mesh always covers at least
+    // as much as the full detail mesh would.  Where a coarse Chunk meets a Chunk at a different
+    // level of detail, the neighbor's surface may not line up with its own, so the coarse Chunk
+    // is closed off with faces along its sides.  Those are only skipped where the neighboring
+    // Blocks themselves hide the face, whatever level of detail the neighbor is drawn at.
 
-    FOREACH_BLOCK( x, y, z )
-    {
-        const Vector3i index( x, y, z );
-        Block& block = get_block( index );
-        BlockIterator block_it( this, &block, index );
+    const int scale = 1 << level_of_detail;
+    const Vector3i num_cells = SIZE / scale;
 
-        if ( block.is_sunlight_source() )
+    std::vector<BlockMaterial> cell_materials( num_cells[0] * num_cells[1] * num_cells[2] );
+
+    #define CELL_MATERIAL( cell_index )\
+        cell_materials[( ( cell_index )[0] / scale * num_cells[1] + ( cell_index )[1] / scale ) * num_cells[2] + ( cell_index )[2] / scale]
+
+    for ( int x = 0; x < SIZE_X; x += scale )
+    {
+        for ( int y = 0; y < SIZE_Y; y += scale )
         {
-            sun_flood_queue.push( std::make_pair( block_it, block.get_sunlight_level() ) );
-            flood_fill_light<SunLightStrategy, InternalNeighborStrategy>( true, sun_flood_queue, blocks_visited );
+            for ( int z = 0; z < SIZE_Z; z += scale )
+            {
+                const Vector3i cell_index( x, y, z );
+                CELL_MATERIAL( cell_index ) = get_downsampled_material( blocks, cell_index, scale );
+            }
         }
+    }
 
-        if ( block.is_light_source() )
+    for ( int x = 0; x < SIZE_X; x += scale )
+    {
+        for ( int y = 0; y < SIZE_Y; y += scale )
         {
-            const Vector3i light_color =
-                vector_cast<int>(
-                    pointwise_round( Vector3f( block.get_color() * Scalar( Block::MAX_LIGHT_COMPONENT_LEVEL ) ) ) );
-            color_flood_queue.push( std::make_pair( block_it, light_color ) );
-            flood_fill_light<ColorLightStrategy, InternalNeighborStrategy>( false, color_flood_queue, blocks_visited );
+            for ( int z = 0; z < SIZE_Z; z += scale )
+            {
+                const Vector3i cell_index( x, y, z );
+                const BlockMaterial material = CELL_MATERIAL( cell_index );
+
+                if ( material == BLOCK_MATERIAL_AIR )
+                {
+                    continue;
+                }
+
+                Block cell;
+                cell.set_material( material );
+                const Vector3f cell_position = vector_cast<Scalar>( Vector3i( position_ + cell_index ) );
+
+                FOREACH_CARDINAL_RELATION( relation )
+                {
+                    const Vector3i relation_vector = cardinal_relation_vector( relation );
+                    const Vector3i neighbor_index = cell_index + relation_vector * scale;
+
+                    bool add_face = false;
+
+                    if ( block_in_range( neighbor_index ) )
+                    {
+                        const BlockMaterial neighbor_material = CELL_MATERIAL( neighbor_index );
+                        add_face = ( block_material_is_translucent( neighbor_material ) &&
+                                     material != neighbor_material );
+                    }
+                    else if ( blocks.has_neighbor( relation_vector ) )
+                    {
+                        add_face = !cell_side_is_hidden( blocks, cell_index, scale, relation_vector, material );
+                    }
+                    else
+                    {
+                        add_face = ( relation == CARDINAL_RELATION_ABOVE ||
+                                   ( relation != CARDINAL_RELATION_BELOW && blocks.has_neighbor_column( relation ) ) );
+                    }
+
+                    if ( add_face )
+                    {
+                        add_external_face( corner_lighting, faces, cell_index, cell_position, cell, relation, relation_vector, scale );
+                    }
+                }
+            }
         }
     }
+
+    #undef CELL_MATERIAL
 }
 
-void Chunk::apply_lighting_to_neighbors()
+BlockMaterial Chunk::get_downsampled_material( const PaddedChunkBlocks& blocks, const Vector3i& cell_index, const int scale )
 {
-    FloodFillQueue sun_flood_queue;
-    FloodFillQueue color_flood_queue;
-    BlockV blocks_visited;
+    // The most common opaque material wins, or failing that, the most common translucent one.
+    unsigned counts[NUM_BLOCK_MATERIALS] = { 0 };
 
-    FOREACH_BLOCK( x, y, z )
+    for ( int x = 0; x < scale; ++x )
     {
-        // Throw out any Block that is not on the edge of this Chunk.
-        //
-        // FIXME: This is super ugly and slow.  This _NEEDS_ to be rewritten with a
-        //        loop that only generates the edge coordinates.
-        //
-        if ( x > 0 && x < SIZE_X - 1 &&
-             y > 0 && y < SIZE_Y - 1 &&
-             z > 0 && z < SIZE_Z - 1 )
+        for ( int y = 0; y < scale; ++y )
         {
-            continue;
+            for ( int z = 0; z < scale; ++z )
+            {
+                ++counts[blocks.get_inner_block( cell_index + Vector3i( x, y, z ) ).get_material()];
+            }
         }
+    }
 
-        const Vector3i index( x, y, z );
-        Block& block = get_block( index );
-        BlockIterator block_it( this, &block, index );
+    BlockMaterial
+        opaque_material = BLOCK_MATERIAL_AIR,
+        translucent_material = BLOCK_MATERIAL_AIR;
 
-        if ( block.get_sunlight_level() != Block::MIN_LIGHT_LEVEL )
+    FOREACH_BLOCK_MATERIAL( material )
+    {
+        if ( material == BLOCK_MATERIAL_AIR || !counts[material] )
         {
-            sun_flood_queue.push( std::make_pair( block_it, block.get_sunlight_level() ) );
-            flood_fill_light<SunLightStrategy, ExternalNeighborStrategy>( true, sun_flood_queue, blocks_visited );
+            continue;
         }
 
-        if ( block.get_light_level() != Block::MIN_LIGHT_LEVEL )
+        BlockMaterial& best = block_material_is_translucent( material ) ? translucent_material : opaque_material;
+
+        if ( best == BLOCK_MATERIAL_AIR || counts[material] > counts[best] )
         {
-            color_flood_queue.push( std::make_pair( block_it, block.get_light_level() ) );
-            flood_fill_light<ColorLightStrategy, ExternalNeighborStrategy>( true, color_flood_queue, blocks_visited );
+            best = material;
         }
     }
+
+    return opaque_material != BLOCK_MATERIAL_AIR ? opaque_material : translucent_material;
 }
 
-void Chunk::update_geometry()
+bool Chunk::cell_side_is_hidden(
+    const PaddedChunkBlocks& blocks,
+    const Vector3i& cell_index,
+    const int scale,
+    const Vector3i& relation_vector,
+    const BlockMaterial material
+)
 {
-    external_faces_.clear();
+    // The side of the cell is hidden if every Block just across it (in the neighboring Chunk) is
+    // either opaque or made of the same material as the cell.
 
-    Chunk* column = get_column_bottom();
-    Chunk* neighbor_columns[NUM_CARDINAL_RELATIONS];
-    FOREACH_CARDINAL_RELATION( relation )
+    for ( int x = 0; x < scale; ++x )
+    {
+        for ( int y = 0; y < scale; ++y )
+        {
+            for ( int z = 0; z < scale; ++z )
+            {
+                const Vector3i block_index = cell_index + Vector3i( x, y, z );
+
+                if ( block_in_range( block_index + relation_vector ) )
+                {
+                    continue;
+                }
+
+                const Block* neighbor = blocks.get_block( block_index + relation_vector );
+
+                if ( !neighbor || ( neighbor->is_translucent() && neighbor->get_material() != material ) )
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+ChunkFaceConnectivity Chunk::calculate_face_connectivity()
+{
+    if ( is_uniform() )
     {
-        neighbor_columns[relation] = 
-            column->get_neighbor( cardinal_relation_vector( relation ) );
+        return ChunkFaceConnectivity( uniform_block_.is_translucent() );
     }
 
+    ChunkFaceConnectivity connectivity( false );
+
+    // Each connected region of translucent Blocks is flood filled, and all of the faces of
+    // the Chunk that the region touches are connected to each other.
+
+    bool visited[SIZE_X][SIZE_Y][SIZE_Z];
+    memset( visited, 0, sizeof( visited ) );
+    std::vector<Vector3i> stack;
+
     FOREACH_BLOCK( x, y, z )
     {
-        const Vector3i block_index( x, y, z );
-        const Block& block = get_block( block_index );
+        if ( visited[x][y][z] || !storage_->blocks_[x][z][y].is_translucent() )
+        {
+            continue;
+        }
 
-        if ( block.get_material() != BLOCK_MATERIAL_AIR )
+        uint8_t face_mask = 0;
+        visited[x][y][z] = true;
+        stack.push_back( Vector3i( x, y, z ) );
+
+        while ( !stack.empty() )
         {
-            const Vector3f block_position = vector_cast<Scalar>( Vector3i( position_ + block_index ) );
+            const Vector3i index = stack.back();
+            stack.pop_back();
 
             FOREACH_CARDINAL_RELATION( relation )
             {
-                const Vector3i relation_vector = cardinal_relation_vector( relation );
-                const Block* block_neighbor = get_block_neighbor( block_index, relation_vector ).block_;
+                const Vector3i neighbor_index = index + cardinal_relation_vector( relation );
 
-                bool add_face = false;
-
-                if ( block_neighbor )
-                {
-                    add_face = ( block_neighbor->is_translucent() &&
-                                 block.get_material() != block_neighbor->get_material() );
-                }
-                else
+                if ( !block_in_range( neighbor_index ) )
                 {
-                    // Don't add faces on the sides of the chunk in which there is not presently a column
-                    // of chunks.  Also, don't add faces on the bottom of the column, facing downward.
-                    add_face = ( relation == CARDINAL_RELATION_ABOVE ||
-                               ( relation != CARDINAL_RELATION_BELOW && neighbor_columns[relation] ) );
+                    face_mask |= 1 << relation;
                 }
-
-                if ( add_face )
+                else if ( !visited[neighbor_index[0]][neighbor_index[1]][neighbor_index[2]] &&
+                          get_block( neighbor_index ).is_translucent() )
                 {
-                    add_external_face( block_index, block_position, block, relation, relation_vector );
+                    visited[neighbor_index[0]][neighbor_index[1]][neighbor_index[2]] = true;
+                    stack.push_back( neighbor_index );
                 }
             }
         }
+
+        // Nothing else can be connected once a region touches all the faces at once.
+        if ( face_mask == ChunkFaceConnectivity::ALL_FACES )
+        {
+            return ChunkFaceConnectivity( true );
+        }
+
+        connectivity.connect( face_mask );
     }
+
+    return connectivity;
 }
 
-void Chunk::add_external_face( const Vector3i& block_index, const Vector3f& block_position, const Block& block, const CardinalRelation relation, const Vector3i& relation_vector )
+void Chunk::add_external_face(
+    ChunkCornerLighting& corner_lighting,
+    BlockFaceV& faces,
+    const Vector3i& block_index,
+    const Vector3f& block_position,
+    const Block& block,
+    const CardinalRelation relation,
+    const Vector3i& relation_vector,
+    const int scale
+)
 {
-    external_faces_.push_back(
+    faces.push_back(
         BlockFace(
             vector_cast<Scalar>( relation_vector ),
             vector_cast<Scalar>( cardinal_relation_vector( cardinal_relation_tangent( relation ) ) ),
@@ -597,15 +2134,23 @@ void Chunk::add_external_face( const Vector3i& block_index, const Vector3f& bloc
         )
     );
 
+    faces.back().size_ = Vector2f( Scalar( scale ), Scalar( scale ) );
+
+    // With texture lighting, the shader doesn't use the vertex lighting, so it's left at zero.
+    const bool vertex_lighting = !texture_lighting_;
+
     Vector3f
-        average_lighting,
-        average_sunlighting;
+        average_lighting( 0.0f, 0.0f, 0.0f ),
+        average_sunlighting( 0.0f, 0.0f, 0.0f );
 
+    // For a face that spans more than one Block, the lighting at each corner is that of the
+    // Block in the corresponding corner.
     #define V( vertex, x, y, z, nax, nay, naz, nbx, nby, nbz )\
         {\
-            calculate_vertex_lighting( block_index, relation_vector, Vector3i( nax, nay, naz ), Vector3i( nbx, nby, nbz ), average_lighting, average_sunlighting );\
-            external_faces_.back().vertices_[vertex] =\
-                BlockFace::Vertex( block_position + Vector3f( x, y, z ), average_lighting, average_sunlighting );\
+            const Vector3i corner_index = block_index + Vector3i( x, y, z ) * ( scale - 1 );\
+            if ( vertex_lighting ) corner_lighting.get_vertex_lighting( corner_index, relation, Vector3i( nax, nay, naz ), Vector3i( nbx, nby, nbz ), average_lighting, average_sunlighting );\
+            faces.back().vertices_[vertex] =\
+                BlockFace::Vertex( block_position + Vector3f( x, y, z ) * Scalar( scale ), average_lighting, average_sunlighting );\
         }
 
     switch ( relation )
@@ -658,108 +2203,104 @@ void Chunk::add_external_face( const Vector3i& block_index, const Vector3f& bloc
     #undef V
 }
 
-void Chunk::calculate_vertex_lighting(
-    const Vector3i& primary_index,
-    const Vector3i& primary_relation,
-    const Vector3i& neighbor_relation_a,
-    const Vector3i& neighbor_relation_b,
-    Vector3f& vertex_lighting,
-    Vector3f& vertex_sunlighting
-)
-{
-    const int NUM_NEIGHBORS = 4;
-    BlockIterator neighbors[NUM_NEIGHBORS];
-    neighbors[0] = get_block_neighbor( primary_index, primary_relation );
-    neighbors[1] = get_block_neighbor( primary_index, primary_relation + neighbor_relation_a );
-    neighbors[2] = get_block_neighbor( primary_index, primary_relation + neighbor_relation_b );
+//////////////////////////////////////////////////////////////////////////////////
+// Free function definitions:
+//////////////////////////////////////////////////////////////////////////////////
 
-    // The 'ab' neighbor cannot contribute light to the vertex if both neighbors 'a' and 'b'
-    // are opaque, because they would fully block any light from 'ab'.
-    bool neighbor_ab_contributes = false;
+int chunk_get_neighborhood_color( const Vector3i& position )
+{
+    int color = 0;
 
-    if ( !neighbors[1].block_ || neighbors[1].block_->is_translucent() ||
-         !neighbors[2].block_ || neighbors[2].block_->is_translucent() )
+    for ( int i = 0; i < Vector3i::Size; ++i )
     {
-        neighbor_ab_contributes = true;
-        neighbors[3] = get_block_neighbor( primary_index, primary_relation + neighbor_relation_a + neighbor_relation_b );
+        const int index = position[i] / Chunk::SIZE[i];
+        color = color * 3 + ( ( index % 3 ) + 3 ) % 3;
     }
 
-    // The lighting value for this vertex will be an average of the lighting provided by
-    // all the translucent blocks that may contribute to it.  This gives a smooth lighting
-    // effect, instead of the blocky lighting that per-face unaveraged lighting gives.
-    Vector3i total_lighting = Block::MIN_LIGHT_LEVEL;
-    Vector3i total_sunlighting = Block::MIN_LIGHT_LEVEL;
-
-    // The number of translucent blocks that may contribute light to the vertex
-    // is used to determine an ambient occlusion factor.  Less contributors means
-    // more ambient occlusion.
-    int num_contributors = 0;
+    return color;
+}
 
-    for ( int i = 0; i < NUM_NEIGHBORS; ++i )
+void chunk_stitch_into_map( ChunkSP chunk, ChunkMap& chunks )
+{
+    FOREACH_SURROUNDING( x, y, z )
     {
-        const Block* block = neighbors[i].block_;
+        const Vector3i relation( x, y, z );
 
-        if ( block )
-        {
-            if ( block->is_translucent() )
-            {
-                total_lighting += block->get_light_level();
-                total_sunlighting += block->get_sunlight_level();
-                ++num_contributors;
-            }
-        }
-        else if ( i != 3 || neighbor_ab_contributes )
+        ChunkMap::iterator neighbor_it =
+            chunks.find( chunk->get_position() + pointwise_product( relation, Chunk::SIZE ) );
+
+        if ( neighbor_it != chunks.end() )
         {
-            total_sunlighting += Block::MAX_LIGHT_LEVEL;
-            ++num_contributors;
+            chunk->set_neighbor( relation, neighbor_it->second.get() );
         }
     }
 
-    const Vector3f average_lighting = vector_cast<Scalar>( total_lighting ) / Scalar( num_contributors );
-    const Vector3f average_sunlighting = vector_cast<Scalar>( total_sunlighting ) / Scalar( num_contributors );
-    const int ambient_occlusion_power = NUM_NEIGHBORS - neighbor_ab_contributes - num_contributors;
-    const int power_base = Block::MAX_LIGHT_COMPONENT_LEVEL + 2 * ambient_occlusion_power;
-    
-    for ( int i = 0; i < Vector3i::Size; ++i )
+    chunks[chunk->get_position()] = chunk;
+}
+
+void chunk_update_block_lighting( const BlockIteratorV& modified_blocks, ChunkSet& chunks_affected )
+{
+    FloodFillQueue
+        sun_removal_queue,
+        color_removal_queue;
+
+    BlockIteratorV
+        sun_seeds,
+        sun_sources,
+        color_seeds,
+        color_sources;
+
+    BOOST_FOREACH( const BlockIterator& block_it, modified_blocks )
     {
-        // Don't bother computing the attenuation if the lighting is nearly zero.
-        if ( average_lighting[i] > gmtl::GMTL_EPSILON )
-        {
-            const Scalar power = power_base - average_lighting[i];
-            vertex_lighting[i] = get_lighting_attenuation( power );
-        }
-        else vertex_lighting[i] = 0.0f;
+        Block& block = *block_it.block_;
 
-        // TODO: Remove duplication.
-        if ( average_sunlighting[i] > gmtl::GMTL_EPSILON )
+        // The geometry of the modified Block (and of its neighbors' faces) always changes.
+        add_chunks_sharing_block( block_it, chunks_affected );
+
+        update_sunlight_sources( block_it, sun_removal_queue, sun_seeds, chunks_affected );
+
+        // The material of the Block changed, so whatever light it used to receive from its
+        // neighbors might be incorrect now.  It's simplest to remove it and re-flood it.
+        const Vector3i old_sunlight_level = block.get_sunlight_level();
+
+        if ( !block.is_sunlight_source() && old_sunlight_level != Block::MIN_LIGHT_LEVEL )
         {
-            const Scalar power = power_base - average_sunlighting[i];
-            vertex_sunlighting[i] = get_lighting_attenuation( power );
+            block.set_sunlight_level( Block::MIN_LIGHT_LEVEL );
+            sun_removal_queue.push( FloodFillBlock( block_it, old_sunlight_level ) );
         }
-        else vertex_sunlighting[i] = 0.0f;
-    }
-}
 
-//////////////////////////////////////////////////////////////////////////////////
-// Free function definitions:
-//////////////////////////////////////////////////////////////////////////////////
+        const Vector3i old_light_level = block.get_light_level();
 
-void chunk_stitch_into_map( ChunkSP chunk, ChunkMap& chunks )
-{
-    FOREACH_SURROUNDING( x, y, z )
-    {
-        const Vector3i relation( x, y, z );
+        if ( old_light_level != Block::MIN_LIGHT_LEVEL )
+        {
+            block.set_light_level( Block::MIN_LIGHT_LEVEL );
+            color_removal_queue.push( FloodFillBlock( block_it, old_light_level ) );
+        }
 
-        ChunkMap::iterator neighbor_it =
-            chunks.find( chunk->get_position() + pointwise_product( relation, Chunk::SIZE ) );
+        if ( block.is_light_source() )
+        {
+            color_sources.push_back( block_it );
+        }
 
-        if ( neighbor_it != chunks.end() )
+        // Any surrounding light may now be able to flow into (or through) the Block.
+        FOREACH_CARDINAL_RELATION( relation )
         {
-            chunk->set_neighbor( relation, neighbor_it->second.get() );
+            const BlockIterator neighbor =
+                ExternalNeighborStrategy::get_block_neighbor( block_it, cardinal_relation_vector( relation ) );
+
+            if ( neighbor.block_ )
+            {
+                sun_seeds.push_back( neighbor );
+                color_seeds.push_back( neighbor );
+            }
         }
     }
 
-    chunks[chunk->get_position()] = chunk;
+    remove_light<SunLightStrategy>( sun_removal_queue, sun_seeds, sun_sources, chunks_affected );
+    remove_light<ColorLightStrategy>( color_removal_queue, color_seeds, color_sources, chunks_affected );
+
+    add_light<SunLightStrategy>( sun_seeds, sun_sources, chunks_affected );
+    add_light<ColorLightStrategy>( color_seeds, color_sources, chunks_affected );
 }
 
 void chunk_unstitch_from_map( ChunkSP chunk, ChunkMap& chunks )
@@ -23,16 +23,23 @@
 #include <map>
 #include <set>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/utility.hpp>
+#include <boost/thread.hpp>
 
 #include "math.h"
+#include "vector_hash_map.h"
 #include "cardinal_relation.h"
 #include "block.h"
+#include "chunk_mesh.h"
+#include "slab_allocator.h"
 
+// The Blocks are visited in the same order that they're stored in memory.
 #define FOREACH_BLOCK( x_name, y_name, z_name )\
     for ( int x_name = 0; x_name < Chunk::SIZE_X; ++x_name )\
-        for ( int y_name = 0; y_name < Chunk::SIZE_Y; ++y_name )\
-            for ( int z_name = 0; z_name < Chunk::SIZE_Z; ++z_name )
+        for ( int z_name = 0; z_name < Chunk::SIZE_Z; ++z_name )\
+            for ( int y_name = 0; y_name < Chunk::SIZE_Y; ++y_name )
 
 #define FOREACH_SURROUNDING( x_name, y_name, z_name )\
     for ( int x_name = -1; x_name <= 1; ++x_name )\
@@ -40,6 +47,8 @@
             for ( int z_name = -1; z_name <= 1; ++z_name )
 
 struct Chunk;
+struct PaddedChunkBlocks;
+struct ChunkCornerLighting;
 
 typedef std::set<Chunk*> ChunkSet;
 
@@ -57,6 +66,22 @@ struct BlockIterator
     Vector3i index_;
 };
 
+typedef std::vector<BlockIterator> BlockIteratorV;
+
+struct ConstBlockIterator
+{
+    ConstBlockIterator( const Chunk* chunk = 0, const Block* block = 0, Vector3i index = Vector3i( 0, 0, 0 ) ) :
+        chunk_( chunk ),
+        block_( block ),
+        index_( index )
+    {
+    }
+
+    const Chunk* chunk_;
+    const Block* block_;
+    Vector3i index_;
+};
+
 struct Chunk : public boost::noncopyable
 {
     static const int
@@ -66,15 +91,69 @@ struct Chunk : public boost::noncopyable
 
     static const Vector3i SIZE;
 
+    // A Block's index within its Chunk fits in 12 bits when packed (in storage order), which
+    // is handy for keeping flood fill queues and visit marks compact.
+    static uint16_t pack_block_index( const Vector3i& index )
+    {
+        return uint16_t( ( index[0] * SIZE_Z + index[2] ) * SIZE_Y + index[1] );
+    }
+
+    static Vector3i unpack_block_index( const uint16_t packed )
+    {
+        return Vector3i( packed / ( SIZE_Z * SIZE_Y ), packed % SIZE_Y, packed / SIZE_Y % SIZE_Z );
+    }
+
     Chunk( const Vector3i& position );
 
+    // Chunks (and their BlockStorage) are allocated from slabs, since they're created and
+    // destroyed constantly as the World streams columns in and out.
+    static void* operator new( size_t size ) { return chunk_allocator_.allocate( size ); }
+    static void operator delete( void* pointer ) { chunk_allocator_.deallocate( pointer ); }
+
     const Vector3i& get_position() const { return position_; }
 
+    // Greedy meshing merges coplanar faces of the same material into larger quads, as long
+    // as they're lit identically.  It's on by default if GREEDY_MESHING is defined, and can
+    // be toggled at run time, but it only affects Chunks whose geometry is updated afterwards.
+    static bool get_greedy_meshing() { return greedy_meshing_; }
+    static void set_greedy_meshing( const bool greedy_meshing ) { greedy_meshing_ = greedy_meshing; }
+
+    // With texture lighting, the light levels aren't baked into the mesh's vertices.  Instead,
+    // they're kept in a separate ChunkLightVolume, which the renderer samples from, so that a
+    // change in lighting alone only replaces the light volume, and doesn't rebuild the mesh.
+    // It's on by default if TEXTURE_LIGHTING is defined, and can be toggled at run time.
+    static bool get_texture_lighting() { return texture_lighting_; }
+    static void set_texture_lighting( const bool texture_lighting ) { texture_lighting_ = texture_lighting; }
+
+    // A Chunk whose Blocks are all identical (which is true of most Chunks that are entirely
+    // air or entirely buried) only stores a single Block.  Any non-const access to its Blocks
+    // expands it back out to full storage, since the caller might modify them, so code that
+    // only reads Blocks should do so through a const Chunk where possible.  New Chunks start
+    // out expanded, and are compacted by the World once their first update is finished.
+    bool is_uniform() const { return !storage_; }
+
+    // If all of the Blocks are identical, this releases the full storage.  It examines every
+    // Block, so it's best called once a batch of modifications is finished.
+    // Precondition: no other thread may be accessing the Chunk's Blocks.
+    void compact();
+
+    // Precondition: no other thread may be accessing the Chunk's Blocks.
+    void expand();
+
+    // This includes the Chunk itself, but not its mesh.
+    size_t get_memory_usage() const
+    {
+        return
+            sizeof( Chunk ) +
+            ( storage_ ? sizeof( BlockStorage ) : 0 ) +
+            awake_fluids_.capacity() * sizeof( AwakeFluid );
+    }
+
     Block* maybe_get_block( const Vector3i& index )
     {
         if( block_in_range( index ) )
         {
-            return &blocks_[index[0]][index[1]][index[2]];
+            return &get_block( index );
         }
         else return 0;
     }
@@ -82,45 +161,65 @@ struct Chunk : public boost::noncopyable
     Block& get_block( const Vector3i& index )
     {
         assert( block_in_range( index ) );
-        return blocks_[index[0]][index[1]][index[2]];
+
+        if ( !storage_ )
+        {
+            expand();
+        }
+
+        return storage_->blocks_[index[0]][index[2]][index[1]];
     }
 
-    void set_block( const Vector3i& index, const Block& block )
+    const Block& get_block( const Vector3i& index ) const
     {
         assert( block_in_range( index ) );
-        blocks_[index[0]][index[1]][index[2]] = block;
+        return storage_ ? storage_->blocks_[index[0]][index[2]][index[1]] : uniform_block_;
     }
 
-    BlockIterator get_block_neighbor( const Vector3i& index, const Vector3i& relation )
+    void set_block( const Vector3i& index, const Block& block )
     {
-        assert( relation_in_range( relation ) );
-        Vector3i neighbor_index = index + relation;
-        Vector3i neighbor_chunk_relation( 0, 0, 0 );
+        assert( block_in_range( index ) );
 
-        for ( int i = 0; i < 3; ++i )
+        if ( !storage_ && block == uniform_block_ )
         {
-            if ( neighbor_index[i] == -1 )
-            {
-                neighbor_index[i] = SIZE[i] - 1;
-                neighbor_chunk_relation[i] = -1;
-            }
-            else if ( neighbor_index[i] == SIZE[i] )
-            {
-                neighbor_index[i] = 0;
-                neighbor_chunk_relation[i] = 1;
-            }
+            return;
         }
 
+        get_block( index ) = block;
+    }
+
+    BlockIterator get_block_neighbor( const Vector3i& index, const Vector3i& relation )
+    {
+        Vector3i neighbor_index, neighbor_chunk_relation;
+        get_neighbor_index( index, relation, neighbor_index, neighbor_chunk_relation );
+
         Chunk* neighbor_chunk = get_neighbor( neighbor_chunk_relation );
         Block* neighbor_block = neighbor_chunk ? &neighbor_chunk->get_block( neighbor_index ) : 0;
         return BlockIterator( neighbor_chunk, neighbor_block, neighbor_index );
     }
 
+    // Unlike the non-const version, this never expands the storage of a uniform neighbor.
+    ConstBlockIterator get_block_neighbor( const Vector3i& index, const Vector3i& relation ) const
+    {
+        Vector3i neighbor_index, neighbor_chunk_relation;
+        get_neighbor_index( index, relation, neighbor_index, neighbor_chunk_relation );
+
+        const Chunk* neighbor_chunk = get_neighbor( neighbor_chunk_relation );
+        const Block* neighbor_block = neighbor_chunk ? &neighbor_chunk->get_block( neighbor_index ) : 0;
+        return ConstBlockIterator( neighbor_chunk, neighbor_block, neighbor_index );
+    }
+
     Chunk* get_neighbor( const Vector3i& relation )
     {
         return get_neighbor_impl( relation );
     }
 
+    const Chunk* get_neighbor( const Vector3i& relation ) const
+    {
+        assert( relation_in_range( relation ) );
+        return neighbors_[relation[0] + 1][relation[1] + 1][relation[2] + 1];
+    }
+
     void set_neighbor( const Vector3i& relation, Chunk* new_neighbor )
     {
         const Vector3i reverse_relation = -relation;
@@ -153,40 +252,150 @@ struct Chunk : public boost::noncopyable
         return get_extreme( CARDINAL_RELATION_ABOVE );
     }
 
-    // TODO: move, make private
-    typedef std::pair<BlockIterator, Scalar> BlockFlow;
-    BlockFlow get_possible_flow( const Block& block, const Vector3i& block_index, const CardinalRelation relation );
-    void flow_block(
-        const Block& block,
-        const BlockFlow& neighbor_flow,
-        const Scalar remaining_flow,
-        BlockV& blocks_visited,
-        ChunkSet& chunks_modified
-    );
+    // Rather than scanning every Block, the fluid simulation only visits the Blocks that are
+    // awake.  A Block stays awake for as long as it keeps flowing, and is woken up again if
+    // anything around it is modified.  All of a Chunk's fluid Blocks are woken up the first
+    // time it's simulated.  Blocks that are woken up during a step (e.g. by being flowed
+    // into) wait until the next step to flow themselves.
+    static const unsigned MAX_FLUID_BLOCKS_PER_STEP = 1024;
+
+    void wake_fluid( const Vector3i& index, const uint16_t step );
+
+    bool has_awake_fluids() const { return !fluids_scanned_ || !awake_fluids_.empty(); }
+
+    // At most MAX_FLUID_BLOCKS_PER_STEP Blocks are simulated, and the rest stay awake for
+    // the next step.  Flowing can modify (and wake up) the Blocks of any of the surrounding
+    // Chunks, so this must not run at the same time as it does for an overlapping Chunk.
+    void simulate( const uint16_t step, BlockIteratorV& blocks_modified );
+
+    // For each vertical column of Blocks, the heightmap holds the height (from the bottom of
+    // the Chunk) just above its highest opaque Block, and just above the highest Block over
+    // that which filters light, or zero where there is no such Block.  Sunlight passes through
+    // everything above both heights untouched, and never reaches anything below the opaque
+    // height.  It's rebuilt by reset_lighting(), and otherwise must be updated whenever the
+    // material of a Block is set (see World::mark_block_for_update()).
+    int get_opaque_height( const int x, const int z ) const { return opaque_heights_[x][z]; }
+    int get_filter_height( const int x, const int z ) const { return filter_heights_[x][z]; }
+    void update_heightmap( const Vector3i& index ) { update_heightmap_column( index[0], index[2] ); }
 
-    void simulate( BlockV& blocks_visited, ChunkSet& chunks_modified );
     void reset_lighting();
     void apply_lighting_to_self();
     void apply_lighting_to_neighbors();
-    void update_geometry();
 
-    const BlockFaceV& get_external_faces() const { return external_faces_; }
+    // This returns false (and leaves the mesh alone) if nothing that the mesh is built from
+    // has changed since the last time, in which case there's no need to upload it again.
+    bool update_geometry();
+
+    // This makes the next update_geometry() rebuild the mesh, whether or not it has changed.
+    void invalidate_geometry() { geometry_hashed_ = false; }
+
+    // The mesh is double-buffered: update_geometry() builds a new mesh from the external
+    // faces on the side, and swaps it in when it's complete.  Thus, the mesh can be read at
+    // any time without holding the Chunk lock, even while the Chunk is being updated.
+    ChunkMeshSP get_mesh() const
+    {
+        boost::lock_guard<boost::mutex> guard( mesh_lock_ );
+        return mesh_;
+    }
+
+    // The light volume is double-buffered along with the mesh.  It's null unless texture
+    // lighting was enabled when the geometry was last updated.
+    ChunkLightVolumeSP get_light_volume() const
+    {
+        boost::lock_guard<boost::mutex> guard( mesh_lock_ );
+        return light_volume_;
+    }
 
 private:
 
-    bool relation_in_range( const Vector3i& relation )
+    static volatile bool
+        greedy_meshing_,
+        texture_lighting_;
+
+    // The Blocks in each vertical column are contiguous, since most of the lighting and
+    // meshing work walks up or down columns (and sunlight only ever travels downward).
+    struct BlockStorage
+    {
+        static void* operator new( size_t size ) { return block_storage_allocator_.allocate( size ); }
+        static void operator delete( void* pointer ) { block_storage_allocator_.deallocate( pointer ); }
+
+        Block blocks_[SIZE_X][SIZE_Z][SIZE_Y];
+    };
+
+    static const size_t
+        CHUNKS_PER_SLAB         = 256,
+        BLOCK_STORAGES_PER_SLAB = 32;
+
+    static SlabAllocator
+        chunk_allocator_,
+        block_storage_allocator_;
+
+    friend void intrusive_ptr_add_ref( Chunk* chunk );
+    friend void intrusive_ptr_release( Chunk* chunk );
+
+    friend struct PaddedChunkBlocks;
+
+    // A Block that is awake is listed along with the step that woke it up.  The same Block
+    // may be listed more than once.
+    struct AwakeFluid
+    {
+        AwakeFluid( const uint16_t index, const uint16_t step ) :
+            index_( index ),
+            step_( step )
+        {
+        }
+
+        bool operator<( const AwakeFluid& other ) const
+        {
+            return index_ < other.index_ || ( index_ == other.index_ && step_ < other.step_ );
+        }
+
+        uint16_t
+            index_,
+            step_;
+    };
+
+    typedef std::vector<AwakeFluid> AwakeFluidV;
+
+    bool relation_in_range( const Vector3i& relation ) const
     {
         return relation[0] >= -1 && relation[0] <= 1 &&
                relation[1] >= -1 && relation[1] <= 1 &&
                relation[2] >= -1 && relation[2] <= 1;
     }
 
-    bool block_in_range( const Vector3i& index )
+    static bool block_in_range( const Vector3i& index )
     {
         return index[0] >= 0 && index[1] >= 0 && index[2] >= 0 &&
                index[0] < SIZE_X && index[1] < SIZE_Y && index[2] < SIZE_Z;
     }
 
+    void get_neighbor_index(
+        const Vector3i& index,
+        const Vector3i& relation,
+        Vector3i& neighbor_index,
+        Vector3i& neighbor_chunk_relation
+    ) const
+    {
+        assert( relation_in_range( relation ) );
+        neighbor_index = index + relation;
+        neighbor_chunk_relation = Vector3i( 0, 0, 0 );
+
+        for ( int i = 0; i < 3; ++i )
+        {
+            if ( neighbor_index[i] == -1 )
+            {
+                neighbor_index[i] = SIZE[i] - 1;
+                neighbor_chunk_relation[i] = -1;
+            }
+            else if ( neighbor_index[i] == SIZE[i] )
+            {
+                neighbor_index[i] = 0;
+                neighbor_chunk_relation[i] = 1;
+            }
+        }
+    }
+
     Chunk*& get_neighbor_impl( const Vector3i& relation )
     {
         assert( relation_in_range( relation ) );
@@ -209,38 +418,132 @@ private:
         return extreme;
     }
 
-    void add_external_face(
+    void update_heightmap_column( const int x, const int z );
+
+    void wake_all_fluids( const uint16_t step );
+
+    typedef std::pair<BlockIterator, Scalar> BlockFlow;
+    BlockFlow get_possible_flow( const Block& block, const Vector3i& block_index, const CardinalRelation relation );
+
+    // These return whether any Blocks were modified.
+    bool simulate_block( Block& block, const Vector3i& block_index, const uint16_t step, BlockIteratorV& blocks_modified );
+    bool flow_block(
+        const Block& block,
+        const BlockFlow& neighbor_flow,
+        const Scalar remaining_flow,
+        const uint16_t step,
+        BlockIteratorV& blocks_modified
+    );
+
+    // With texture lighting, the light levels are hashed separately, into the light_hash.
+    uint64_t calculate_geometry_hash( const bool texture_lighting, uint64_t& light_hash );
+
+    // The meshing only reads from the PaddedChunkBlocks (and the Chunk's position), never
+    // from the Chunk's own Blocks or its neighbors.  The ChunkCornerLighting must have been
+    // reset with the same PaddedChunkBlocks.
+    void add_external_faces(
+        const PaddedChunkBlocks& blocks,
+        ChunkCornerLighting& corner_lighting,
+        BlockFaceV& faces
+    ) const;
+    void add_coarse_faces(
+        const PaddedChunkBlocks& blocks,
+        ChunkCornerLighting& corner_lighting,
+        const unsigned level_of_detail,
+        BlockFaceV& faces
+    ) const;
+
+    static BlockMaterial get_downsampled_material( const PaddedChunkBlocks& blocks, const Vector3i& cell_index, const int scale );
+
+    static bool cell_side_is_hidden(
+        const PaddedChunkBlocks& blocks,
+        const Vector3i& cell_index,
+        const int scale,
+        const Vector3i& relation_vector,
+        const BlockMaterial material
+    );
+
+    // The face may span a cube of scale^3 Blocks, starting at the given one.
+    static void add_external_face(
+        ChunkCornerLighting& corner_lighting,
+        BlockFaceV& faces,
         const Vector3i& block_index,
         const Vector3f& block_position,
         const Block& block,
         const CardinalRelation relation,
-        const Vector3i& relation_vector
+        const Vector3i& relation_vector,
+        const int scale = 1
     );
 
-    void calculate_vertex_lighting(
-        const Vector3i& primary_index,
-        const Vector3i& primary_relation,
-        const Vector3i& neighbor_relation_a,
-        const Vector3i& neighbor_relation_b,
-        Vector3f& vertex_lighting,
-        Vector3f& vertex_sunlighting
-    );
+    ChunkFaceConnectivity calculate_face_connectivity();
 
     Vector3i position_;
 
-    Block blocks_[SIZE_X][SIZE_Y][SIZE_Z];
+    // If this is null, every Block in the Chunk is the same as the uniform_block_.
+    boost::scoped_ptr<BlockStorage> storage_;
+
+    Block uniform_block_;
+
+    AwakeFluidV awake_fluids_;
 
-    BlockFaceV external_faces_;
+    bool fluids_scanned_;
+
+    uint8_t
+        opaque_heights_[SIZE_X][SIZE_Z],
+        filter_heights_[SIZE_X][SIZE_Z];
+
+    ChunkMeshSP mesh_;
+
+    ChunkLightVolumeSP light_volume_;
+
+    // This is a hash of everything that the mesh_ was built from, if it has been built yet.
+    uint64_t geometry_hash_;
+
+    // And this is a hash of the light levels that the light_volume_ was built from.
+    uint64_t light_hash_;
+
+    bool geometry_hashed_;
+
+    mutable boost::mutex mesh_lock_;
 
     Chunk* neighbors_[3][3][3];
+
+    // The number of ChunkSPs that refer to this Chunk.
+    volatile int reference_count_;
 };
 
-typedef boost::shared_ptr<Chunk> ChunkSP;
+inline void intrusive_ptr_add_ref( Chunk* chunk )
+{
+    __sync_add_and_fetch( &chunk->reference_count_, 1 );
+}
+
+inline void intrusive_ptr_release( Chunk* chunk )
+{
+    if ( __sync_sub_and_fetch( &chunk->reference_count_, 1 ) == 0 )
+    {
+        delete chunk;
+    }
+}
+
+// The reference count lives in the Chunk itself, so that a Chunk is a single allocation.
+typedef boost::intrusive_ptr<Chunk> ChunkSP;
 typedef std::vector<ChunkSP> ChunkSPV;
 typedef std::vector<Chunk*> ChunkV;
-typedef std::map<Vector3i, ChunkSP, VectorLess<Vector3i> > ChunkMap;
+typedef VectorHashMap<Vector3i, ChunkSP> ChunkMap;
+
+// Chunks with the same color are at least three Chunks apart along some axis, which means
+// that the 3x3x3 neighborhoods surrounding them never overlap.  Thus, steps that may modify
+// a Chunk's neighbors can safely be run in parallel for Chunks of the same color.
+const int CHUNK_NUM_NEIGHBORHOOD_COLORS = 27;
+
+int chunk_get_neighborhood_color( const Vector3i& position );
 
 void chunk_stitch_into_map( ChunkSP chunk, ChunkMap& chunks );
 void chunk_unstitch_from_map( ChunkSP chunk, ChunkMap& chunks );
 
+// This updates the lighting around Blocks that have been modified incrementally, rather than
+// resetting and re-flooding the lighting for entire Chunks.  Any Chunks whose geometry may
+// have been affected (by the modified Blocks or the lighting changes) are added to the set.
+void chunk_update_block_lighting( const BlockIteratorV& modified_blocks, ChunkSet& chunks_affected );
+
 #endif // CHUNK_H
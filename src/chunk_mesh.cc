@@ -0,0 +1,157 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#include <boost/foreach.hpp>
+
+#include "chunk.h"
+#include "chunk_mesh.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+bool face_material_order( const BlockFace& a, const BlockFace& b )
+{
+    return a.material_ < b.material_;
+}
+
+int floor_divide( const int numerator, const int denominator )
+{
+    return numerator >= 0 ? numerator / denominator : -( ( denominator - 1 - numerator ) / denominator );
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for ChunkMesh:
+//////////////////////////////////////////////////////////////////////////////////
+
+const unsigned ChunkMesh::VERTICES_PER_FACE;
+const unsigned ChunkMesh::INDICES_PER_FACE;
+const int ChunkMesh::ORIGIN_SPACING;
+const unsigned ChunkMesh::NUM_LEVELS_OF_DETAIL;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for ChunkFaceConnectivity:
+//////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t ChunkFaceConnectivity::ALL_FACES;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkMesh:
+//////////////////////////////////////////////////////////////////////////////////
+
+Vector3i ChunkMesh::get_origin( const Vector3i& chunk_position )
+{
+    Vector3i origin;
+
+    for ( int i = 0; i < Vector3i::Size; ++i )
+    {
+        const int spacing = ORIGIN_SPACING * Chunk::SIZE[i];
+        origin[i] = floor_divide( chunk_position[i], spacing ) * spacing;
+    }
+
+    return origin;
+}
+
+ChunkMesh::ChunkMesh() :
+    num_triangles_( 0 ),
+    num_unmerged_triangles_( 0 )
+{
+}
+
+ChunkMesh::ChunkMesh(
+    const Vector3i& chunk_position,
+    const BlockFaceV& chunk_faces,
+    const ChunkFaceConnectivity& connectivity,
+    const unsigned level_of_detail,
+    const ChunkMeshSP& coarser_mesh
+) :
+    num_triangles_( chunk_faces.size() * 2 ), // Two triangles per (square) face.
+    num_unmerged_triangles_( 0 ),
+    connectivity_( connectivity ),
+    coarser_mesh_( coarser_mesh )
+{
+    BlockFaceV faces = chunk_faces;
+    const Vector3f origin = vector_cast<Scalar>( get_origin( chunk_position ) );
+
+    // The size of a face is measured in Blocks, but at the lower levels of detail, the
+    // unmerged faces are already larger than a single Block.
+    const unsigned unmerged_face_area = 1 << ( 2 * level_of_detail );
+
+    // Although each vertex specifies its own texture ID, and thus the faces can be drawn in
+    // any order, it makes sense to group them together by texture, under the assumption that
+    // this will be more friendly to the GPU's texture cache.
+
+    std::sort( faces.begin(), faces.end(), face_material_order );
+
+    BOOST_FOREACH( const BlockFace& face, faces )
+    {
+        num_unmerged_triangles_ += unsigned( face.size_[0] * face.size_[1] ) / unmerged_face_area * 2;
+
+        if ( block_material_is_translucent( face.material_ ) )
+        {
+            Vector3f centroid;
+
+            for ( unsigned i = 0; i < VERTICES_PER_FACE; ++i )
+            {
+                centroid += face.vertices_[i].position_;
+            }
+
+            centroid /= Scalar( VERTICES_PER_FACE );
+
+            // Nudge the centroid slightly toward the center of the Block, so that
+            // neighboring Blocks with different translucent materials won't Z fight.
+            centroid -= 0.1f * face.normal_;
+            translucent_centroids_.push_back( centroid );
+
+            add_face( origin, face, translucent_vertices_ );
+        }
+        else add_face( origin, face, opaque_vertices_ );
+    }
+}
+
+void ChunkMesh::add_face( const Vector3f& origin, const BlockFace& face, BlockVertexV& vertices )
+{
+    const BlockFace::Vertex* v = face.vertices_;
+    const Scalar m = face.material_;
+
+    // The shader reconstructs the normal and tangent from the direction the face points in.
+    CardinalRelation relation = CARDINAL_RELATION_ABOVE;
+
+    FOREACH_CARDINAL_RELATION( candidate )
+    {
+        if ( face.normal_ == vector_cast<Scalar>( cardinal_relation_vector( candidate ) ) )
+        {
+            relation = candidate;
+        }
+    }
+
+    // The texture is repeated once per Block across merged faces.
+    const Scalar
+        s = face.size_[0],
+        r = face.size_[1];
+
+    vertices.push_back( BlockVertex( v[0].position_ - origin, relation, Vector3f( 0.0f, 0.0f, m ), v[0].lighting_, v[0].sunlighting_ ) );
+    vertices.push_back( BlockVertex( v[1].position_ - origin, relation, Vector3f( s,    0.0f, m ), v[1].lighting_, v[1].sunlighting_ ) );
+    vertices.push_back( BlockVertex( v[2].position_ - origin, relation, Vector3f( s,    r,    m ), v[2].lighting_, v[2].sunlighting_ ) );
+    vertices.push_back( BlockVertex( v[3].position_ - origin, relation, Vector3f( 0.0f, r,    m ), v[3].lighting_, v[3].sunlighting_ ) );
+}
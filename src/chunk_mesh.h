@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef CHUNK_MESH_H
+#define CHUNK_MESH_H
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include "math.h"
+#include "cardinal_relation.h"
+#include "block.h"
+
+// Chunk vertices are packed tightly, to save on GPU memory and upload bandwidth.  Positions
+// are relative to the origin of the Chunk's mesh (see ChunkMesh::get_origin()), which is
+// passed to the shader as a uniform, and the normal and tangent are reconstructed by the
+// shader from the index of the face's direction.
+struct BlockVertex
+{
+    BlockVertex()
+    {
+    }
+
+    BlockVertex(
+        const Vector3f& relative_position,
+        const CardinalRelation face_relation,
+        const Vector3f& texcoords,
+        const Vector3f& lighting,
+        const Vector3f& sunlighting
+    ) :
+        x_( uint8_t( relative_position[0] ) ),
+        y_( uint8_t( relative_position[1] ) ),
+        z_( uint8_t( relative_position[2] ) ),
+        face_( uint8_t( face_relation ) ),
+        s_( uint8_t( texcoords[0] ) ), t_( uint8_t( texcoords[1] ) ), p_( uint8_t( texcoords[2] ) ), unused_( 0 ),
+        lr_( pack_light( lighting[0] ) ), lg_( pack_light( lighting[1] ) ), lb_( pack_light( lighting[2] ) ), la_( 0 ),
+        slr_( pack_light( sunlighting[0] ) ), slg_( pack_light( sunlighting[1] ) ), slb_( pack_light( sunlighting[2] ) ), sla_( 0 )
+    {
+    }
+
+    static uint8_t pack_light( const Scalar light )
+    {
+        return uint8_t( std::max( 0.0f, std::min( light, 1.0f ) ) * 255.0f + 0.5f );
+    }
+
+    uint8_t x_, y_, z_, face_;          // Position, and the CardinalRelation of the face
+    uint8_t s_, t_, p_, unused_;        // Texture coordinates
+    uint8_t lr_, lg_, lb_, la_;         // Light color (normalized)
+    uint8_t slr_, slg_, slb_, sla_;     // Sunlight color (normalized)
+
+} __attribute__( ( packed ) );
+
+typedef std::vector<BlockVertex> BlockVertexV;
+
+// This records which of the faces of a Chunk can see each other through its translucent
+// Blocks.  The renderer uses it to cull Chunks that are hidden behind opaque terrain, such
+// as the ones deep underground.  By default, all of the faces are connected to each other.
+struct ChunkFaceConnectivity
+{
+    static const uint8_t ALL_FACES = ( 1 << NUM_CARDINAL_RELATIONS ) - 1;
+
+    ChunkFaceConnectivity( const bool connected = true )
+    {
+        FOREACH_CARDINAL_RELATION( relation )
+        {
+            connected_faces_[relation] = connected ? ALL_FACES : 0;
+        }
+    }
+
+    // Connects each of the faces in the mask (indexed by CardinalRelation) to all the others.
+    void connect( const uint8_t face_mask )
+    {
+        FOREACH_CARDINAL_RELATION( relation )
+        {
+            if ( face_mask & ( 1 << relation ) )
+            {
+                connected_faces_[relation] |= face_mask;
+            }
+        }
+    }
+
+    bool are_connected( const CardinalRelation a, const CardinalRelation b ) const
+    {
+        return connected_faces_[a] & ( 1 << b );
+    }
+
+    uint8_t connected_faces_[NUM_CARDINAL_RELATIONS];
+};
+
+// A ChunkMesh holds the vertex data for a Chunk, ready to be copied straight into VBOs.  It's
+// built from the Chunk's external faces by the Chunk update workers, so that all the renderer
+// has to do on the main thread is upload it.  Once built, a ChunkMesh never changes, so it can
+// be shared between threads freely.
+//
+// Every face is a quad made of two triangles, with its vertices wound in the same order, so
+// the opaque faces don't need any indices of their own; they can all share a single buffer
+// of indices that repeats the same pattern.
+//
+// Each mesh links to a coarser version of itself, built from the Chunk's Blocks downsampled
+// by a factor of two along each axis, for drawing the Chunk when it's far away.
+struct ChunkMesh;
+
+typedef boost::shared_ptr<const ChunkMesh> ChunkMeshSP;
+
+struct ChunkMesh : public boost::noncopyable
+{
+    static const unsigned
+        VERTICES_PER_FACE = 4,
+        INDICES_PER_FACE = 6;
+
+    // The number of Chunks along each side of the cube of Chunks that share a mesh origin.
+    static const int ORIGIN_SPACING = 4;
+
+    // Including the full detail mesh.  At level N, each face spans 2^N Blocks.
+    static const unsigned NUM_LEVELS_OF_DETAIL = 3;
+
+    typedef std::vector<Vector3f> Vector3fV;
+
+    // The vertex positions in a mesh are relative to this origin.  It's shared by a cube of
+    // neighboring Chunks that's small enough for the positions to fit in bytes, so that the
+    // renderer can draw all of the Chunks in the cube at once.
+    static Vector3i get_origin( const Vector3i& chunk_position );
+
+    // Appends the indices of the triangles that make up the given faces.
+    template <typename IndexType>
+    static void get_face_indices( const unsigned first_face, const unsigned num_faces, std::vector<IndexType>& indices )
+    {
+        for ( IndexType i = first_face * VERTICES_PER_FACE; i < ( first_face + num_faces ) * VERTICES_PER_FACE; i += VERTICES_PER_FACE )
+        {
+            indices.push_back( i + 0 );
+            indices.push_back( i + 3 );
+            indices.push_back( i + 2 );
+
+            indices.push_back( i + 0 );
+            indices.push_back( i + 2 );
+            indices.push_back( i + 1 );
+        }
+    }
+
+    ChunkMesh();
+    ChunkMesh(
+        const Vector3i& chunk_position,
+        const BlockFaceV& faces,
+        const ChunkFaceConnectivity& connectivity,
+        const unsigned level_of_detail = 0,
+        const ChunkMeshSP& coarser_mesh = ChunkMeshSP()
+    );
+
+    // A mesh is only empty if all of its levels of detail are empty.
+    bool empty() const
+    {
+        return opaque_vertices_.empty() && translucent_vertices_.empty() && ( !coarser_mesh_ || coarser_mesh_->empty() );
+    }
+
+    // If the requested level of detail isn't available, the coarsest available one is returned.
+    const ChunkMesh& get_level_of_detail( const unsigned level ) const
+    {
+        return level == 0 || !coarser_mesh_ ? *this : coarser_mesh_->get_level_of_detail( level - 1 );
+    }
+
+    BlockVertexV
+        opaque_vertices_,
+        translucent_vertices_;
+
+    // The (world space) centroid of each translucent face, for sorting the faces by depth.
+    Vector3fV translucent_centroids_;
+
+    unsigned num_triangles_;
+
+    // The number of triangles there would have been without greedy meshing.
+    unsigned num_unmerged_triangles_;
+
+    ChunkFaceConnectivity connectivity_;
+
+    ChunkMeshSP coarser_mesh_;
+
+protected:
+
+    void add_face( const Vector3f& origin, const BlockFace& face, BlockVertexV& vertices );
+};
+
+// The light levels of a Chunk's Blocks, and of the Blocks just around it, for rendering with
+// texture lighting (see Chunk::get_texture_lighting()).  The texels are in the order that a
+// 3D texture expects, with 'x' varying fastest and 'z' slowest.  Each is a packed light level
+// (see Block::pack_light_level()), which is laid out just like GL_UNSIGNED_SHORT_4_4_4_4_REV.
+struct ChunkLightVolume : public boost::noncopyable
+{
+    // A Chunk, with a one Block apron on every side.  This must match Chunk::SIZE.
+    static const int
+        SIZE = 18,
+        NUM_TEXELS = SIZE * SIZE * SIZE;
+
+    // The alpha of the light is fully on for translucent Blocks, and off for opaque ones,
+    // whose light is zero.  Thus the shader can tell how many of the Blocks that it filters
+    // between are able to contribute light.
+    static const uint16_t TRANSLUCENT_ALPHA = 0xf000;
+
+    uint16_t
+        light_[NUM_TEXELS],
+        sunlight_[NUM_TEXELS];
+};
+
+typedef boost::shared_ptr<const ChunkLightVolume> ChunkLightVolumeSP;
+
+#endif // CHUNK_MESH_H
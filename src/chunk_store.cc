@@ -0,0 +1,533 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+#include <stdexcept>
+#include <fstream>
+#include <set>
+#include <algorithm>
+#include <limits>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <boost/foreach.hpp>
+
+#include "log.h"
+#include "chunk_store.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const uint32_t
+    REGION_FILE_MAGIC = 0x47524244, // "DBRG"
+    REGION_FILE_VERSION = 1;
+
+const int
+    COLUMNS_PER_REGION_X = WorldGenerator::REGION_SIZE / Chunk::SIZE_X,
+    COLUMNS_PER_REGION_Z = WorldGenerator::REGION_SIZE / Chunk::SIZE_Z;
+
+// NOTE: The region files are written in the native byte order, so they are not portable
+//       between machines of different endianness.
+
+struct RegionColumnEntry
+{
+    uint32_t offset_;
+    uint32_t size_;
+};
+
+struct RegionFileHeader
+{
+    uint32_t magic_;
+    uint32_t version_;
+    RegionColumnEntry columns_[COLUMNS_PER_REGION_X][COLUMNS_PER_REGION_Z];
+};
+
+// The beginning and end of the bytes that a column's data occupies in its region file.
+typedef std::pair<uint64_t, uint64_t> RegionExtent;
+
+// Each column is stored as the number of Chunks it contains, followed by each of the
+// Chunks from the bottom up.  Each Chunk is a count of runs, followed by the runs.
+struct BlockRun
+{
+    uint16_t length_;
+    uint8_t material_;
+    uint8_t data_;
+};
+
+// Blocks are run-length encoded a horizontal layer at a time, since the terrain tends
+// to be made up of horizontal layers of the same material.
+#define FOREACH_BLOCK_HORIZONTAL_LAYERS( x_name, y_name, z_name )\
+    for ( int y_name = 0; y_name < Chunk::SIZE_Y; ++y_name )\
+        for ( int x_name = 0; x_name < Chunk::SIZE_X; ++x_name )\
+            for ( int z_name = 0; z_name < Chunk::SIZE_Z; ++z_name )
+
+template <typename T>
+void append_value( std::vector<uint8_t>& data, const T& value )
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>( &value );
+    data.insert( data.end(), bytes, bytes + sizeof( T ) );
+}
+
+template <typename T>
+bool read_value( const uint8_t*& data, const uint8_t* end, T& value )
+{
+    if ( data + sizeof( T ) > end )
+    {
+        return false;
+    }
+
+    memcpy( &value, data, sizeof( T ) );
+    data += sizeof( T );
+    return true;
+}
+
+void encode_chunk( const Chunk& chunk, std::vector<uint8_t>& data )
+{
+    std::vector<BlockRun> runs;
+
+    FOREACH_BLOCK_HORIZONTAL_LAYERS( x, y, z )
+    {
+        const Block& block = chunk.get_block( Vector3i( x, y, z ) );
+
+        if ( !runs.empty() &&
+             runs.back().material_ == block.get_material() &&
+             runs.back().data_ == block.get_data() )
+        {
+            ++runs.back().length_;
+        }
+        else
+        {
+            BlockRun run;
+            run.length_ = 1;
+            run.material_ = block.get_material();
+            run.data_ = block.get_data();
+            runs.push_back( run );
+        }
+    }
+
+    append_value( data, uint32_t( runs.size() ) );
+
+    BOOST_FOREACH( const BlockRun& run, runs )
+    {
+        append_value( data, run );
+    }
+}
+
+bool decode_chunk( const uint8_t*& data, const uint8_t* end, Chunk& chunk )
+{
+    uint32_t num_runs;
+
+    if ( !read_value( data, end, num_runs ) )
+    {
+        return false;
+    }
+
+    BlockRun run;
+    run.length_ = 0;
+
+    FOREACH_BLOCK_HORIZONTAL_LAYERS( x, y, z )
+    {
+        while ( run.length_ == 0 )
+        {
+            if ( num_runs-- == 0 || !read_value( data, end, run ) || run.material_ >= NUM_BLOCK_MATERIALS )
+            {
+                return false;
+            }
+        }
+
+        Block& block = chunk.get_block( Vector3i( x, y, z ) );
+        block.set_material( BlockMaterial( run.material_ ) );
+        block.set_data( run.data_ );
+        --run.length_;
+    }
+
+    return num_runs == 0 && run.length_ == 0;
+}
+
+bool decode_column( const Vector2i& column_position, const uint8_t* data, const uint8_t* end, ChunkSPV& chunks )
+{
+    uint32_t num_chunks;
+
+    if ( !read_value( data, end, num_chunks ) )
+    {
+        return false;
+    }
+
+    for ( uint32_t i = 0; i < num_chunks; ++i )
+    {
+        ChunkSP chunk( new Chunk( Vector3i( column_position[0], i * Chunk::SIZE_Y, column_position[1] ) ) );
+
+        if ( !decode_chunk( data, end, *chunk ) )
+        {
+            return false;
+        }
+
+        chunks.push_back( chunk );
+    }
+
+    return data == end;
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkStore:
+//////////////////////////////////////////////////////////////////////////////////
+
+ChunkStore::ChunkStore( const std::string& path, const uint64_t default_world_seed ) :
+    path_( path ),
+    world_seed_( default_world_seed )
+{
+    if ( mkdir( path_.c_str(), 0755 ) != 0 && errno != EEXIST )
+    {
+        throw std::runtime_error( make_string() << "Unable to create chunk store directory " << path_ << ": " << strerror( errno ) );
+    }
+
+    const std::string seed_filename = path_ + "/seed";
+    std::ifstream seed_input( seed_filename.c_str() );
+
+    if ( seed_input )
+    {
+        if ( !( seed_input >> world_seed_ ) )
+        {
+            throw std::runtime_error( "Unable to read world seed from " + seed_filename );
+        }
+    }
+    else
+    {
+        std::ofstream seed_output( seed_filename.c_str() );
+
+        if ( !( seed_output << world_seed_ << std::endl ) )
+        {
+            throw std::runtime_error( "Unable to write world seed to " + seed_filename );
+        }
+    }
+}
+
+ChunkStore::~ChunkStore()
+{
+    flush();
+}
+
+bool ChunkStore::load_column( const Vector2i& column_position, ChunkSPV& chunks )
+{
+    // The column's data is copied out while the lock is held (since a flush could replace or
+    // remap it), but it's decoded afterwards, so that columns can be loaded in parallel.
+    ByteV data;
+
+    {
+        boost::lock_guard<boost::mutex> guard( lock_ );
+
+        ColumnDataMap::const_iterator queued_it = queued_columns_.find( column_position );
+
+        if ( queued_it != queued_columns_.end() )
+        {
+            data = queued_it->second;
+        }
+        else
+        {
+            const Vector2i region_position = WorldGenerator::get_region_position( column_position );
+            const Vector2i column_index = pointwise_quotient( column_position - region_position, Vector2i( Chunk::SIZE_X, Chunk::SIZE_Z ) );
+            const uint8_t* region_data = 0;
+            uint32_t size = 0;
+
+            if ( !get_region_file( region_position ).read_column( column_index, region_data, size ) )
+            {
+                return false;
+            }
+
+            data.assign( region_data, region_data + size );
+        }
+    }
+
+    if ( data.empty() || !decode_column( column_position, &data[0], &data[0] + data.size(), chunks ) )
+    {
+        LOG( "Discarding corrupt column at " << column_position << "." );
+        chunks.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void ChunkStore::save_column( const Vector2i& column_position, const ChunkSPV& chunks )
+{
+    ByteV data;
+    append_value( data, uint32_t( chunks.size() ) );
+
+    for ( unsigned i = 0; i < chunks.size(); ++i )
+    {
+        assert( chunks[i]->get_position() == Vector3i( column_position[0], i * Chunk::SIZE_Y, column_position[1] ) );
+        encode_chunk( *chunks[i], data );
+    }
+
+    boost::lock_guard<boost::mutex> guard( lock_ );
+    queued_columns_[column_position].swap( data );
+}
+
+void ChunkStore::flush()
+{
+    // The lock is held for the whole flush, to ensure that a column can never be
+    // loaded while it is in neither the queue nor its region file.
+    boost::lock_guard<boost::mutex> guard( lock_ );
+
+    typedef std::map<Vector2i, RegionColumnV, VectorLess<Vector2i> > RegionColumnMap;
+    RegionColumnMap region_columns;
+
+    BOOST_FOREACH( const ColumnDataMap::value_type& column_it, queued_columns_ )
+    {
+        const Vector2i& column_position = column_it.first;
+        const Vector2i region_position = WorldGenerator::get_region_position( column_position );
+        const Vector2i column_index = pointwise_quotient( column_position - region_position, Vector2i( Chunk::SIZE_X, Chunk::SIZE_Z ) );
+        region_columns[region_position].push_back( std::make_pair( column_index, &column_it.second ) );
+    }
+
+    // Each region's columns are dropped from the queue as soon as they're written, so if a
+    // region file can't be written, only the columns that belong in it are left queued.
+    BOOST_FOREACH( const RegionColumnMap::value_type& region_it, region_columns )
+    {
+        get_region_file( region_it.first ).write_columns( region_it.second );
+
+        BOOST_FOREACH( const RegionColumnV::value_type& column, region_it.second )
+        {
+            queued_columns_.erase( region_it.first + pointwise_product( column.first, Vector2i( Chunk::SIZE_X, Chunk::SIZE_Z ) ) );
+        }
+    }
+}
+
+ChunkStore::RegionFile& ChunkStore::get_region_file( const Vector2i& region_position )
+{
+    RegionFileMap::iterator region_it = region_files_.find( region_position );
+
+    if ( region_it == region_files_.end() )
+    {
+        const std::string filename = make_string() <<
+            path_ << "/region." <<
+            region_position[0] / WorldGenerator::REGION_SIZE << "." <<
+            region_position[1] / WorldGenerator::REGION_SIZE << ".dat";
+
+        RegionFileSP region_file( new RegionFile( filename ) );
+        region_it = region_files_.insert( std::make_pair( region_position, region_file ) ).first;
+    }
+
+    return *region_it->second;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkStore::RegionFile:
+//////////////////////////////////////////////////////////////////////////////////
+
+ChunkStore::RegionFile::RegionFile( const std::string& filename ) :
+    fd_( open( filename.c_str(), O_RDWR | O_CREAT, 0644 ) ),
+    map_( 0 ),
+    map_size_( 0 )
+{
+    if ( fd_ < 0 )
+    {
+        throw std::runtime_error( make_string() << "Unable to open region file " << filename << ": " << strerror( errno ) );
+    }
+
+    struct stat file_stat;
+
+    if ( fstat( fd_, &file_stat ) != 0 )
+    {
+        close( fd_ );
+        throw std::runtime_error( make_string() << "Unable to stat region file " << filename << ": " << strerror( errno ) );
+    }
+
+    if ( file_stat.st_size == 0 )
+    {
+        RegionFileHeader header;
+        memset( &header, 0, sizeof( header ) );
+        header.magic_ = REGION_FILE_MAGIC;
+        header.version_ = REGION_FILE_VERSION;
+
+        if ( pwrite( fd_, &header, sizeof( header ), 0 ) != ssize_t( sizeof( header ) ) )
+        {
+            close( fd_ );
+            throw std::runtime_error( make_string() << "Unable to initialize region file " << filename << ": " << strerror( errno ) );
+        }
+    }
+
+    map();
+
+    const RegionFileHeader* header = reinterpret_cast<const RegionFileHeader*>( map_ );
+
+    if ( map_size_ < sizeof( RegionFileHeader ) ||
+         header->magic_ != REGION_FILE_MAGIC ||
+         header->version_ != REGION_FILE_VERSION )
+    {
+        unmap();
+        close( fd_ );
+        throw std::runtime_error( "Invalid region file " + filename );
+    }
+}
+
+ChunkStore::RegionFile::~RegionFile()
+{
+    unmap();
+    close( fd_ );
+}
+
+bool ChunkStore::RegionFile::read_column( const Vector2i& column_index, const uint8_t*& data, uint32_t& size ) const
+{
+    assert( column_index[0] >= 0 && column_index[0] < COLUMNS_PER_REGION_X );
+    assert( column_index[1] >= 0 && column_index[1] < COLUMNS_PER_REGION_Z );
+
+    const RegionFileHeader* header = reinterpret_cast<const RegionFileHeader*>( map_ );
+    const RegionColumnEntry& entry = header->columns_[column_index[0]][column_index[1]];
+
+    if ( entry.offset_ == 0 || uint64_t( entry.offset_ ) + entry.size_ > map_size_ )
+    {
+        return false;
+    }
+
+    data = map_ + entry.offset_;
+    size = entry.size_;
+    return true;
+}
+
+void ChunkStore::RegionFile::write_columns( const RegionColumnV& columns )
+{
+    const RegionFileHeader* header = reinterpret_cast<const RegionFileHeader*>( map_ );
+
+    // Every column's data stays in use until the table entry pointing to it is replaced,
+    // including the old copy of a column that's being written, so that the column isn't
+    // lost if the write is interrupted.  Each new copy goes in the first gap between them
+    // that's big enough, which reuses the space left behind by the columns' old copies.
+    std::set<RegionExtent> extents;
+
+    for ( int x = 0; x < COLUMNS_PER_REGION_X; ++x )
+    {
+        for ( int z = 0; z < COLUMNS_PER_REGION_Z; ++z )
+        {
+            const RegionColumnEntry& entry = header->columns_[x][z];
+
+            if ( entry.offset_ != 0 )
+            {
+                extents.insert( RegionExtent( entry.offset_, uint64_t( entry.offset_ ) + entry.size_ ) );
+            }
+        }
+    }
+
+    BOOST_FOREACH( const RegionColumnV::value_type& column, columns )
+    {
+        const Vector2i& column_index = column.first;
+        const ByteV& data = *column.second;
+
+        assert( column_index[0] >= 0 && column_index[0] < COLUMNS_PER_REGION_X );
+        assert( column_index[1] >= 0 && column_index[1] < COLUMNS_PER_REGION_Z );
+        assert( !data.empty() );
+
+        const RegionColumnEntry old_entry = header->columns_[column_index[0]][column_index[1]];
+
+        uint64_t offset = sizeof( RegionFileHeader );
+
+        BOOST_FOREACH( const RegionExtent& extent, extents )
+        {
+            if ( extent.first >= offset + data.size() )
+            {
+                break;
+            }
+
+            offset = std::max( offset, extent.second );
+        }
+
+        if ( offset + data.size() > std::numeric_limits<uint32_t>::max() )
+        {
+            throw std::runtime_error( "Unable to write region file: it's too large for the column table" );
+        }
+
+        RegionColumnEntry entry;
+        entry.offset_ = offset;
+        entry.size_ = data.size();
+
+        const off_t entry_offset =
+            offsetof( RegionFileHeader, columns_ ) +
+            ( column_index[0] * COLUMNS_PER_REGION_Z + column_index[1] ) * sizeof( RegionColumnEntry );
+
+        // The column data must be in place before the table entry that points to it is updated.
+        if ( pwrite( fd_, &data[0], data.size(), entry.offset_ ) != ssize_t( data.size() ) ||
+             pwrite( fd_, &entry, sizeof( entry ), entry_offset ) != ssize_t( sizeof( entry ) ) )
+        {
+            throw std::runtime_error( make_string() << "Unable to write region file: " << strerror( errno ) );
+        }
+
+        if ( old_entry.offset_ != 0 )
+        {
+            extents.erase( RegionExtent( old_entry.offset_, uint64_t( old_entry.offset_ ) + old_entry.size_ ) );
+        }
+
+        extents.insert( RegionExtent( entry.offset_, uint64_t( entry.offset_ ) + entry.size_ ) );
+    }
+
+    // Now that the old copies of the columns are no longer used, any space after the last of
+    // the columns can be trimmed off of the file.  The extents don't overlap, so the last one
+    // ends furthest out.
+    const uint64_t used_size = extents.empty() ? sizeof( RegionFileHeader ) : extents.rbegin()->second;
+    const bool trim = used_size < map_size_;
+
+    unmap();
+
+    if ( trim && ftruncate( fd_, used_size ) != 0 )
+    {
+        throw std::runtime_error( make_string() << "Unable to trim region file: " << strerror( errno ) );
+    }
+
+    map();
+}
+
+void ChunkStore::RegionFile::map()
+{
+    assert( !map_ );
+
+    struct stat file_stat;
+
+    if ( fstat( fd_, &file_stat ) != 0 )
+    {
+        throw std::runtime_error( make_string() << "Unable to stat region file: " << strerror( errno ) );
+    }
+
+    map_size_ = file_stat.st_size;
+    void* map = mmap( 0, map_size_, PROT_READ, MAP_SHARED, fd_, 0 );
+
+    if ( map == MAP_FAILED )
+    {
+        throw std::runtime_error( make_string() << "Unable to map region file: " << strerror( errno ) );
+    }
+
+    map_ = static_cast<uint8_t*>( map );
+}
+
+void ChunkStore::RegionFile::unmap()
+{
+    if ( map_ )
+    {
+        munmap( map_, map_size_ );
+        map_ = 0;
+        map_size_ = 0;
+    }
+}
@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include <boost/thread.hpp>
+
+#include "world_generator.h"
+#include "chunk.h"
+
+// The ChunkStore persists columns of Chunks to disk.  There is one file per region
+// (see WorldGenerator::REGION_SIZE), consisting of a fixed-size table of column offsets
+// followed by the run-length encoded column data.  Region files are memory-mapped, and
+// are only touched when a column is actually loaded or saved.  A column that's saved again
+// is written into the first free space that fits (never over its old copy), and the file is
+// trimmed back whenever its end is freed, so region files don't grow as columns are resaved.
+//
+// Only the Block materials and data are stored; the lighting is recalculated after loading.
+struct ChunkStore : public boost::noncopyable
+{
+    // The world seed is stored alongside the regions, so that any columns that have not
+    // yet been saved will be generated consistently with those that have.  The default
+    // seed is only used if the store is new.
+    ChunkStore( const std::string& path, const uint64_t default_world_seed );
+    ~ChunkStore();
+
+    uint64_t get_world_seed() const { return world_seed_; }
+
+    // Fills in the column of Chunks at the given position, if it has ever been saved.
+    // This is safe to call from multiple threads at once.  Only copying the column's data
+    // out of the store is serialized; the columns are decoded in parallel.
+    bool load_column( const Vector2i& column_position, ChunkSPV& chunks );
+
+    // Encodes the given column of Chunks (which must be ordered from the bottom up), and
+    // queues it to be written out by the next call to flush().  The column will be returned
+    // by load_column() from then on, even before it's flushed.
+    void save_column( const Vector2i& column_position, const ChunkSPV& chunks );
+
+    // Writes all of the queued columns to their region files, and drops them from the queue.
+    // Since this might be time-consuming (and loads wait for it), it's best to call it in the
+    // background.
+    void flush();
+
+protected:
+
+    typedef std::vector<uint8_t> ByteV;
+
+    // The columns to be written to one region file, by their indices within the region.
+    typedef std::vector<std::pair<Vector2i, const ByteV*> > RegionColumnV;
+
+    struct RegionFile : public boost::noncopyable
+    {
+        RegionFile( const std::string& filename );
+        ~RegionFile();
+
+        bool read_column( const Vector2i& column_index, const uint8_t*& data, uint32_t& size ) const;
+        // All of the columns are written before the file is trimmed and mapped again.
+        void write_columns( const RegionColumnV& columns );
+
+    protected:
+
+        void map();
+        void unmap();
+
+        int fd_;
+
+        uint8_t* map_;
+
+        size_t map_size_;
+    };
+
+    typedef boost::shared_ptr<RegionFile> RegionFileSP;
+    typedef std::map<Vector2i, RegionFileSP, VectorLess<Vector2i> > RegionFileMap;
+    typedef std::map<Vector2i, ByteV, VectorLess<Vector2i> > ColumnDataMap;
+
+    RegionFile& get_region_file( const Vector2i& region_position );
+
+    std::string path_;
+
+    uint64_t world_seed_;
+
+    RegionFileMap region_files_;
+
+    ColumnDataMap queued_columns_;
+
+    boost::mutex lock_;
+};
+
+#endif // CHUNK_STORE_H
@@ -0,0 +1,266 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+
+#include "profiler.h"
+#include "chunk_update_graph.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkUpdateGraph:
+//////////////////////////////////////////////////////////////////////////////////
+
+ChunkUpdateGraph::ChunkUpdateGraph(
+    const ChunkSet& reset_chunks,
+    const ChunkSet& self_lighting_chunks,
+    const ChunkSet& neighbor_lighting_chunks,
+    const ChunkSet& geometry_chunks
+) :
+    worker_pool_( 0 ),
+    num_incomplete_nodes_( 0 ),
+    num_running_nodes_( 0 ),
+    paused_( false )
+{
+    add_nodes( reset_chunks, STEP_RESET_LIGHTING );
+    add_nodes( self_lighting_chunks, STEP_APPLY_LIGHTING_TO_SELF );
+    add_nodes( neighbor_lighting_chunks, STEP_APPLY_LIGHTING_TO_NEIGHBORS );
+    add_nodes( geometry_chunks, STEP_UPDATE_GEOMETRY );
+
+    const Vector3i above( 0, Chunk::SIZE_Y, 0 );
+
+    BOOST_FOREACH( Node& node, nodes_ )
+    {
+        const Vector3i& position = node.chunk_->get_position();
+
+        switch ( node.step_ )
+        {
+            case STEP_RESET_LIGHTING:
+                add_dependency( &node, STEP_RESET_LIGHTING, position + above );
+                break;
+
+            case STEP_APPLY_LIGHTING_TO_SELF:
+                add_dependency( &node, STEP_RESET_LIGHTING, position );
+                add_dependency( &node, STEP_RESET_LIGHTING, position - above );
+                break;
+
+            case STEP_APPLY_LIGHTING_TO_NEIGHBORS:
+            {
+                add_dependencies( &node, STEP_RESET_LIGHTING, position, 1 );
+                add_dependencies( &node, STEP_RESET_LIGHTING, position - above, 1 );
+                add_dependencies( &node, STEP_APPLY_LIGHTING_TO_SELF, position, 1 );
+
+                const int color = chunk_get_neighborhood_color( position );
+
+                for ( int x = -2; x <= 2; ++x )
+                {
+                    for ( int y = -2; y <= 2; ++y )
+                    {
+                        for ( int z = -2; z <= 2; ++z )
+                        {
+                            const Vector3i other_position =
+                                position + pointwise_product( Chunk::SIZE, Vector3i( x, y, z ) );
+
+                            if ( chunk_get_neighborhood_color( other_position ) < color )
+                            {
+                                add_dependency( &node, STEP_APPLY_LIGHTING_TO_NEIGHBORS, other_position );
+                            }
+                        }
+                    }
+                }
+                break;
+            }
+
+            case STEP_UPDATE_GEOMETRY:
+                add_dependencies( &node, STEP_RESET_LIGHTING, position, 1 );
+                add_dependencies( &node, STEP_APPLY_LIGHTING_TO_SELF, position, 1 );
+                add_dependencies( &node, STEP_APPLY_LIGHTING_TO_NEIGHBORS, position, 2 );
+                break;
+
+            default:
+                assert( false );
+        }
+    }
+}
+
+void ChunkUpdateGraph::run( boost::threadpool::pool& worker_pool, ChunkGuard& chunk_guard, const volatile int& chunk_lock_requests )
+{
+    boost::unique_lock<boost::mutex> guard( lock_ );
+
+    worker_pool_ = &worker_pool;
+    num_incomplete_nodes_ = nodes_.size();
+
+    BOOST_FOREACH( Node& node, nodes_ )
+    {
+        if ( node.num_dependencies_ == 0 )
+        {
+            ready_nodes_.push_back( &node );
+        }
+    }
+
+    dispatch();
+
+    while ( num_incomplete_nodes_ > 0 )
+    {
+        completed_.timed_wait( guard, boost::posix_time::milliseconds( POLL_INTERVAL_MS ) );
+
+        if ( num_incomplete_nodes_ == 0 || chunk_lock_requests == 0 )
+        {
+            continue;
+        }
+
+        // Stop handing out Nodes, and wait for the ones that are already running to finish.
+        paused_ = true;
+
+        while ( num_running_nodes_ > 0 )
+        {
+            completed_.wait( guard );
+        }
+
+        guard.unlock();
+
+        // Now, relinquish the lock until everyone who asked for it has had their turn.
+        // Simply unlocking and relocking is not enough, since the lock is not fair.
+        chunk_guard.unlock();
+
+        while ( chunk_lock_requests > 0 )
+        {
+            boost::this_thread::yield();
+        }
+
+        chunk_guard.lock();
+
+        guard.lock();
+        paused_ = false;
+        dispatch();
+    }
+
+    // The last Node signals completion just before it returns, so make sure that
+    // no worker is still inside of this object.
+    guard.unlock();
+    worker_pool_->wait();
+    worker_pool_ = 0;
+}
+
+void ChunkUpdateGraph::add_nodes( const ChunkSet& chunks, const Step step )
+{
+    BOOST_FOREACH( Chunk* chunk, chunks )
+    {
+        nodes_.push_back( Node( chunk, step ) );
+        step_nodes_[step][chunk->get_position()] = &nodes_.back();
+    }
+}
+
+void ChunkUpdateGraph::add_dependency( Node* node, const Step step, const Vector3i& position )
+{
+    Node* dependency = get_node( step, position );
+
+    if ( dependency && dependency != node )
+    {
+        dependency->dependents_.push_back( node );
+        ++node->num_dependencies_;
+    }
+}
+
+// Adds a dependency on the given step for all of the Chunks within the radius (in Chunks).
+void ChunkUpdateGraph::add_dependencies( Node* node, const Step step, const Vector3i& position, const int radius )
+{
+    for ( int x = -radius; x <= radius; ++x )
+    {
+        for ( int y = -radius; y <= radius; ++y )
+        {
+            for ( int z = -radius; z <= radius; ++z )
+            {
+                add_dependency( node, step, position + pointwise_product( Chunk::SIZE, Vector3i( x, y, z ) ) );
+            }
+        }
+    }
+}
+
+void ChunkUpdateGraph::execute( Node* node )
+{
+    bool geometry_updated = false;
+
+    switch ( node->step_ )
+    {
+        case STEP_RESET_LIGHTING:
+            SCOPE_TIMER_BEGIN( "Resetting lighting" )
+            node->chunk_->reset_lighting();
+            SCOPE_TIMER_END
+            break;
+
+        case STEP_APPLY_LIGHTING_TO_SELF:
+            SCOPE_TIMER_BEGIN( "Applying lighting to self" )
+            node->chunk_->apply_lighting_to_self();
+            SCOPE_TIMER_END
+            break;
+
+        case STEP_APPLY_LIGHTING_TO_NEIGHBORS:
+            SCOPE_TIMER_BEGIN( "Applying lighting to neighbors" )
+            node->chunk_->apply_lighting_to_neighbors();
+            SCOPE_TIMER_END
+            break;
+
+        case STEP_UPDATE_GEOMETRY:
+            SCOPE_TIMER_BEGIN( "Updating geometry" )
+            geometry_updated = node->chunk_->update_geometry();
+            SCOPE_TIMER_END
+            break;
+
+        default:
+            assert( false );
+    }
+
+    boost::lock_guard<boost::mutex> guard( lock_ );
+
+    if ( geometry_updated )
+    {
+        updated_geometry_chunks_.insert( node->chunk_ );
+    }
+
+    BOOST_FOREACH( Node* dependent, node->dependents_ )
+    {
+        if ( --dependent->num_dependencies_ == 0 )
+        {
+            ready_nodes_.push_back( dependent );
+        }
+    }
+
+    --num_running_nodes_;
+    --num_incomplete_nodes_;
+    dispatch();
+
+    if ( num_incomplete_nodes_ == 0 || ( paused_ && num_running_nodes_ == 0 ) )
+    {
+        completed_.notify_all();
+    }
+}
+
+// Precondition: the lock_ must be held.
+void ChunkUpdateGraph::dispatch()
+{
+    // The most recently readied Nodes are run first, since the Chunks that they touch
+    // are the most likely to still be in the cache.
+    while ( !paused_ && num_running_nodes_ < worker_pool_->size() && !ready_nodes_.empty() )
+    {
+        Node* node = ready_nodes_.back();
+        ready_nodes_.pop_back();
+        ++num_running_nodes_;
+        worker_pool_->schedule( boost::bind( &ChunkUpdateGraph::execute, this, node ) );
+    }
+}
@@ -0,0 +1,144 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef CHUNK_UPDATE_GRAPH_H
+#define CHUNK_UPDATE_GRAPH_H
+
+#include <deque>
+#include <vector>
+#include <boost/utility.hpp>
+#include <boost/thread.hpp>
+#include <boost/threadpool.hpp>
+
+#include "vector_hash_map.h"
+#include "chunk.h"
+
+// Updating the lighting and geometry of a set of Chunks consists of four steps per Chunk:
+// resetting the lighting, applying lighting to itself, applying lighting to its neighbors,
+// and updating its geometry.  Rather than performing each step for all of the Chunks and
+// waiting for them to finish before moving on to the next, this graph tracks which steps
+// for which nearby Chunks each step actually depends on.  Each step is scheduled to run
+// as soon as its own dependencies are complete.
+//
+// The dependencies are as follows:
+//
+//   * A reset must follow the reset of the Chunk above it, since sunlight travels down.
+//   * Self-lighting must follow the resets of the Chunk itself and the Chunk below it
+//     (which reads the sunlight at the bottom of this one).
+//   * Neighbor-lighting may spread light into any of the 26 surrounding Chunks, so it must
+//     follow all of the resets and self-lighting within that area.  Furthermore, it must
+//     never run at the same time as the neighbor-lighting for a Chunk whose area overlaps.
+//     Each Chunk is assigned one of 27 colors based on its position modulo 3, and the
+//     neighbor-lighting for a Chunk follows any overlapping ones with a lower color.
+//   * Geometry reads the lighting for all of the surrounding Chunks, so it must follow
+//     any step that might write to them.
+struct ChunkUpdateGraph : public boost::noncopyable
+{
+    typedef boost::unique_lock<boost::mutex> ChunkGuard;
+
+    ChunkUpdateGraph(
+        const ChunkSet& reset_chunks,
+        const ChunkSet& self_lighting_chunks,
+        const ChunkSet& neighbor_lighting_chunks,
+        const ChunkSet& geometry_chunks
+    );
+
+    // This runs all of the steps on the worker pool, and returns when they're complete.
+    // Whenever chunk_lock_requests is nonzero, it stops scheduling steps for long enough
+    // to hand the Chunk lock over, so that e.g. the main loop can continue.
+    void run( boost::threadpool::pool& worker_pool, ChunkGuard& chunk_guard, const volatile int& chunk_lock_requests );
+
+    // Once the graph has run, these are the Chunks whose meshes actually changed.  The
+    // geometry step leaves a Chunk's mesh alone if it would have come out the same.
+    const ChunkSet& get_updated_geometry_chunks() const { return updated_geometry_chunks_; }
+
+protected:
+
+    // This is how often chunk_lock_requests is checked while the graph is running.
+    static const long POLL_INTERVAL_MS = 1;
+
+    enum Step
+    {
+        STEP_RESET_LIGHTING,
+        STEP_APPLY_LIGHTING_TO_SELF,
+        STEP_APPLY_LIGHTING_TO_NEIGHBORS,
+        STEP_UPDATE_GEOMETRY,
+        NUM_STEPS
+    };
+
+    struct Node
+    {
+        Node( Chunk* chunk, const Step step ) :
+            chunk_( chunk ),
+            step_( step ),
+            num_dependencies_( 0 )
+        {
+        }
+
+        Chunk* chunk_;
+
+        Step step_;
+
+        std::vector<Node*> dependents_;
+
+        // Once the graph is running, this is protected by the lock_.
+        unsigned num_dependencies_;
+    };
+
+    typedef VectorHashMap<Vector3i, Node*> NodeMap;
+    typedef std::vector<Node*> NodeV;
+
+    void add_nodes( const ChunkSet& chunks, const Step step );
+    void add_dependency( Node* node, const Step step, const Vector3i& position );
+    void add_dependencies( Node* node, const Step step, const Vector3i& position, const int radius );
+
+    Node* get_node( const Step step, const Vector3i& position ) const
+    {
+        NodeMap::const_iterator node_it = step_nodes_[step].find( position );
+        return node_it == step_nodes_[step].end() ? 0 : node_it->second;
+    }
+
+    void execute( Node* node );
+    void dispatch();
+
+    std::deque<Node> nodes_;
+
+    NodeMap step_nodes_[NUM_STEPS];
+
+    boost::threadpool::pool* worker_pool_;
+
+    // The following members are protected by the lock_.
+
+    boost::mutex lock_;
+
+    boost::condition_variable completed_;
+
+    unsigned
+        num_incomplete_nodes_,
+        num_running_nodes_;
+
+    bool paused_;
+
+    // Only as many Nodes as there are workers are handed to the pool at once, and the rest
+    // wait here.  That way, pausing only has to wait for the Nodes that are actually running.
+    NodeV ready_nodes_;
+
+    ChunkSet updated_geometry_chunks_;
+};
+
+#endif // CHUNK_UPDATE_GRAPH_H
@@ -0,0 +1,484 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/bind.hpp>
+
+#include "cardinal_relation.h"
+#include "entity.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct BlockCollision
+{
+    Scalar normalized_time_;
+    Vector3f block_position_;
+    CardinalRelation entity_face_;
+};
+
+// A solid Block that an Entity's swept AABB hits at normalized_time_.  Potential
+// obstructions are ordered by time of impact, with ties broken by position.
+struct PotentialObstruction
+{
+    bool operator<( const PotentialObstruction& other ) const
+    {
+        if ( normalized_time_ != other.normalized_time_ )
+            return normalized_time_ < other.normalized_time_;
+        return VectorLess<Vector3f>()( block_position_, other.block_position_ );
+    }
+
+    Scalar normalized_time_;
+
+    Vector3f block_position_;
+
+    ConstBlockIterator block_;
+};
+
+// The most Blocks that are gathered for each collision test.  The movement is split in
+// half until its swept volume fits, so this only bounds the stack buffer, not the speed.
+const unsigned MAX_POTENTIAL_OBSTRUCTIONS = 256;
+
+// Returns the (max exclusive) bounds of all of the Blocks that overlap or touch the box.
+AABoxi get_touching_block_bounds( const AABoxf& box )
+{
+    return AABoxi(
+        vector_cast<int>( pointwise_floor( box.getMin() ) ) - Vector3i( 1, 1, 1 ),
+        vector_cast<int>( pointwise_floor( box.getMax() ) ) + Vector3i( 1, 1, 1 )
+    );
+}
+
+int get_volume( const AABoxi& box )
+{
+    const Vector3i size = box.getMax() - box.getMin();
+    return size[0] * size[1] * size[2];
+}
+
+Vector3f get_block_position( const ConstBlockIterator& block )
+{
+    return vector_cast<Scalar>( block.chunk_->get_position() + block.index_ );
+}
+
+bool is_in_fluid( const World& world, const AABoxf& bounds )
+{
+    ConstBlockIterator blocks[MAX_POTENTIAL_OBSTRUCTIONS];
+    const unsigned num_blocks = world.get_blocks_in_bounds(
+        get_touching_block_bounds( bounds ),
+        BLOCK_COLLISION_MODE_FLUID,
+        blocks,
+        MAX_POTENTIAL_OBSTRUCTIONS
+    );
+
+    for ( unsigned i = 0; i < num_blocks; ++i )
+    {
+        const Vector3f block_position = get_block_position( blocks[i] );
+        const AABoxf block_bounds( block_position, block_position + Block::SIZE );
+
+        if ( gmtl::intersect( bounds, block_bounds ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool find_collision(
+    const World& world,
+    const Vector3f& start,
+    const Vector3f& size,
+    const Vector3f& movement,
+    BlockCollision& collision
+)
+{
+    // TODO: Decompose this function.
+
+    const Vector3f halfsize = size / 2.0f;
+    collision.normalized_time_ = std::numeric_limits<Scalar>::max();
+    collision.block_position_ = Vector3f();
+
+    const AABoxf entity_bounds( start, start + size );
+    Vector3f
+        swept_min = entity_bounds.getMin(),
+        swept_max = entity_bounds.getMax();
+
+    for ( int i = 0; i < Vector3f::Size; ++i )
+    {
+        if ( movement[i] < 0.0f )
+        {
+            swept_min[i] += movement[i];
+        }
+        else swept_max[i] += movement[i];
+    }
+
+    const AABoxi swept_block_bounds = get_touching_block_bounds( AABoxf( swept_min, swept_max ) );
+
+    // Long movements are split in half, so that the Blocks of each half fit in the buffer.
+    if ( get_volume( swept_block_bounds ) > int( MAX_POTENTIAL_OBSTRUCTIONS ) )
+    {
+        const Vector3f half_movement = movement / 2.0f;
+
+        if ( find_collision( world, start, size, half_movement, collision ) )
+        {
+            collision.normalized_time_ /= 2.0f;
+            return true;
+        }
+        else if ( find_collision( world, start + half_movement, size, half_movement, collision ) )
+        {
+            collision.normalized_time_ = 0.5f + collision.normalized_time_ / 2.0f;
+            return true;
+        }
+        else return false;
+    }
+
+    ConstBlockIterator blocks[MAX_POTENTIAL_OBSTRUCTIONS];
+    const unsigned num_blocks = world.get_blocks_in_bounds(
+        swept_block_bounds,
+        BLOCK_COLLISION_MODE_SOLID,
+        blocks,
+        MAX_POTENTIAL_OBSTRUCTIONS
+    );
+
+    // Determine whether each Block actually intersects with the Entity's AABB at some point
+    // in its movement.  The normalized contact time can be outside the range [0,1], but we're
+    // only interested in values in [0,1], because they map to vectors within the movement vector.
+    PotentialObstruction potential_obstructions[MAX_POTENTIAL_OBSTRUCTIONS];
+    unsigned num_potential_obstructions = 0;
+
+    for ( unsigned i = 0; i < num_blocks; ++i )
+    {
+        PotentialObstruction& obstruction = potential_obstructions[num_potential_obstructions];
+        obstruction.block_position_ = get_block_position( blocks[i] );
+        obstruction.block_ = blocks[i];
+
+        const AABoxf block_bounds( obstruction.block_position_, obstruction.block_position_ + Block::SIZE );
+
+        if ( gmtl::intersect_bugfix( entity_bounds, movement, block_bounds, obstruction.normalized_time_ ) &&
+             obstruction.normalized_time_ >= 0.0f &&
+             obstruction.normalized_time_ <= 1.0f )
+        {
+            ++num_potential_obstructions;
+        }
+    }
+
+    // If there are multiple potential collisions, only return the one that would happen at the
+    // earliest point in time, so the first one that is accepted ends the search.
+    std::sort( potential_obstructions, potential_obstructions + num_potential_obstructions );
+
+    for ( unsigned i = 0; i < num_potential_obstructions; ++i )
+    {
+        const PotentialObstruction& obstruction = potential_obstructions[i];
+        const Vector3f block_position = obstruction.block_position_;
+        const Scalar normalized_first_contact = obstruction.normalized_time_;
+        const AABoxf block_bounds( block_position, block_position + Block::SIZE );
+
+        // Determine which face of the Block the Entity is colliding with by measuring the
+        // distance between the corresponding pairs of AABB planes (e.g. bottom & top) on the
+        // Entity and the Block, and choosing the face with the smallest distance.
+        Scalar min_dplane_offset = std::numeric_limits<Scalar>::max();
+        Vector3f collision_normal;
+        CardinalRelation collision_relation = CARDINAL_RELATION_BELOW;
+
+        FOREACH_CARDINAL_RELATION( relation )
+        {
+            // Make sure that the face that the Entity is colliding with is reachable;
+            // e.g. its not obstructed by another block.
+            const Vector3i block_neighbor_offset =
+                cardinal_relation_vector( cardinal_relation_reverse( relation ) );
+            const Block* block_neighbor =
+                obstruction.block_.chunk_->get_block_neighbor( obstruction.block_.index_, block_neighbor_offset ).block_;
+
+            if ( !block_neighbor ||
+                  block_neighbor->get_collision_mode() != BLOCK_COLLISION_MODE_SOLID )
+            {
+                const Vector3f
+                    entity_centroid = start + normalized_first_contact * movement + halfsize,
+                    block_centroid = block_position + Block::HALFSIZE,
+                    entity_normal = vector_cast<Scalar>( cardinal_relation_vector( relation ) ),
+                    block_normal = -entity_normal,
+                    entity_plane_point = entity_centroid + pointwise_product( entity_normal, halfsize ),
+                    block_plane_point = block_centroid + pointwise_product( block_normal, Block::HALFSIZE );
+
+                const Scalar
+                    entity_plane_offset = dot( entity_plane_point, entity_normal ),
+                    block_plane_offset = dot( block_plane_point, entity_normal ),
+                    dplane_offset = gmtl::Math::abs( entity_plane_offset - block_plane_offset );
+
+                if ( dplane_offset < min_dplane_offset )
+                {
+                    min_dplane_offset = dplane_offset;
+                    collision_normal = entity_normal;
+                    collision_relation = relation;
+                }
+            }
+        }
+
+        const AABoxf contact_entity_bounds(
+            entity_bounds.getMin() + normalized_first_contact * movement,
+            entity_bounds.getMax() + normalized_first_contact * movement
+        );
+
+        const Scalar planar_overlap =  min_planar_overlap( block_bounds, contact_entity_bounds, collision_normal );
+
+        // Generally it's not desirable for a collision to occur if the Entity and Block just
+        // barely have an edge or corner overlapping.  Allowing such collisions results in odd
+        // behavior when the Entity is e.g. against a wall and trying to jump.  Throw them out.
+        if ( planar_overlap > 0.01f )
+        {
+            // Throw out the collision unless the minimum difference between plane offsets is fairly small.
+            // This is a heuristic that helps avoid some degenerate cases arising from Blocks with very
+            // few visible faces (where the "closest" face might be far away).
+            if ( min_dplane_offset < 0.1f )
+            {
+                // If normalized_first_contact is zero, it indicates that the Entity was already intersecting
+                // with the Block before it moved.  In this case, the collision is ignored if the Entity's
+                // velocity is directed away from the block.
+                if ( normalized_first_contact > 0.0f || gmtl::dot( movement, collision_normal ) > 0.0f )
+                {
+                    collision.normalized_time_ = normalized_first_contact;
+                    collision.block_position_ = block_position;
+                    collision.entity_face_ = collision_relation;
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+void resolve_collision(
+    const Vector3f& movement,
+    const Vector3f& dv,
+    const BlockCollision& collision,
+    Vector3f& position,
+    Vector3f& velocity,
+    Vector3f& acceleration
+)
+{
+    velocity += dv * collision.normalized_time_;
+    position += movement * collision.normalized_time_;
+
+    const Vector3f normal =
+        vector_cast<Scalar>( cardinal_relation_vector( collision.entity_face_ ) ),
+        velocity_collision_component = gmtl::dot( velocity, normal ) * normal,
+        acceleration_collision_component = gmtl::dot( acceleration, normal ) * normal;
+
+    // Reverse the component of the Entity's velocity that is directed toward the
+    // block, and apply a little rebound as well.
+    velocity -= 1.05f * velocity_collision_component;
+
+    // Do the same thing with the Entity's acceleration.  This isn't physically accurate,
+    // but it makes the collision solver work better.
+    acceleration -= 1.05f * acceleration_collision_component;
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for EntitySystem:
+//////////////////////////////////////////////////////////////////////////////////
+
+const unsigned
+    EntitySystem::ENTITIES_PER_BATCH,
+    EntitySystem::INVALID_SLOT;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for EntitySystem:
+//////////////////////////////////////////////////////////////////////////////////
+
+EntitySystem::EntityId EntitySystem::add_entity( const Vector3f& position, const Vector3f& size )
+{
+    EntityId id;
+
+    if ( free_ids_.empty() )
+    {
+        id = id_slots_.size();
+        id_slots_.push_back( INVALID_SLOT );
+    }
+    else
+    {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+    }
+
+    id_slots_[id] = positions_.size();
+    slot_ids_.push_back( id );
+    positions_.push_back( position );
+    velocities_.push_back( Vector3f() );
+    sizes_.push_back( size );
+    accelerations_.push_back( Vector3f() );
+    flags_.push_back( ENTITY_FLAG_PHYSICS_ENABLED );
+#ifdef DEBUG_COLLISIONS
+    debug_collisions_.push_back( DebugCollisionV() );
+#endif
+    return id;
+}
+
+void EntitySystem::remove_entity( const EntityId id )
+{
+    const unsigned
+        slot = get_slot( id ),
+        last_slot = positions_.size() - 1;
+
+    if ( slot != last_slot )
+    {
+        const EntityId last_id = slot_ids_[last_slot];
+        slot_ids_[slot] = last_id;
+        id_slots_[last_id] = slot;
+        positions_[slot] = positions_[last_slot];
+        velocities_[slot] = velocities_[last_slot];
+        sizes_[slot] = sizes_[last_slot];
+        accelerations_[slot] = accelerations_[last_slot];
+        flags_[slot] = flags_[last_slot];
+#ifdef DEBUG_COLLISIONS
+        debug_collisions_[slot].swap( debug_collisions_[last_slot] );
+#endif
+    }
+
+    slot_ids_.pop_back();
+    positions_.pop_back();
+    velocities_.pop_back();
+    sizes_.pop_back();
+    accelerations_.pop_back();
+    flags_.pop_back();
+#ifdef DEBUG_COLLISIONS
+    debug_collisions_.pop_back();
+#endif
+
+    id_slots_[id] = INVALID_SLOT;
+    free_ids_.push_back( id );
+}
+
+AABoxf EntitySystem::get_aabb( const EntityId id ) const
+{
+    const unsigned slot = get_slot( id );
+    return AABoxf( positions_[slot], positions_[slot] + sizes_[slot] );
+}
+
+void EntitySystem::set_physics_enabled( const EntityId id, const bool enabled )
+{
+    uint8_t& flags = flags_[get_slot( id )];
+
+    if ( enabled )
+    {
+        flags |= ENTITY_FLAG_PHYSICS_ENABLED;
+    }
+    else flags &= ~ENTITY_FLAG_PHYSICS_ENABLED;
+}
+
+bool EntitySystem::is_swimming( const EntityId id, const World& world ) const
+{
+    return is_in_fluid( world, get_aabb( id ) );
+}
+
+void EntitySystem::step_all( const float step_time, World& world )
+{
+    const unsigned num_entities = positions_.size();
+
+    // Each batch only writes to the components in its own range of slots, and the World
+    // is only read, so the batches don't need to synchronize with each other.
+    if ( num_entities <= ENTITIES_PER_BATCH )
+    {
+        step_range( 0, num_entities, step_time, world );
+        return;
+    }
+
+    for ( unsigned begin = 0; begin < num_entities; begin += ENTITIES_PER_BATCH )
+    {
+        const unsigned end = std::min( begin + ENTITIES_PER_BATCH, num_entities );
+
+        world.get_worker_pool().schedule(
+            boost::bind( &EntitySystem::step_range, this, begin, end, step_time, boost::cref( world ) )
+        );
+    }
+
+    world.get_worker_pool().wait();
+}
+
+void EntitySystem::step_range( const unsigned begin, const unsigned end, const float step_time, const World& world )
+{
+    for ( unsigned slot = begin; slot < end; ++slot )
+    {
+        if ( flags_[slot] & ENTITY_FLAG_PHYSICS_ENABLED )
+        {
+            step_one( slot, step_time, world );
+        }
+    }
+}
+
+void EntitySystem::step_one( const unsigned slot, const float step_time, const World& world )
+{
+#ifdef DEBUG_COLLISIONS
+    debug_collisions_[slot].clear();
+#endif
+
+    Vector3f
+        &position = positions_[slot],
+        &velocity = velocities_[slot],
+        acceleration = accelerations_[slot];
+
+    const Vector3f& size = sizes_[slot];
+    uint8_t& flags = flags_[slot];
+
+    flags &= ~ENTITY_FLAG_FEET_CONTACTING_BLOCK;
+    Scalar time_simulated = 0.0f;
+
+    // A maximum of three integrator steps are simulated here, with the reasoning that
+    // three steps can correctly resolve a collision occuring in the pocket-style corner
+    // formed by three blocks.
+
+    for ( int steps = 0; steps < 3 && time_simulated < step_time; ++steps )
+    {
+        const Scalar step_time_slice = ( step_time - time_simulated );
+        const Vector3f
+            dv = acceleration * step_time_slice,
+            movement = ( velocity + dv ) * step_time_slice;
+
+        BlockCollision collision;
+
+        if ( find_collision( world, position, size, movement, collision ) )
+        {
+#ifdef DEBUG_COLLISIONS
+            DebugCollision debug_collision;
+            debug_collision.block_position_ = collision.block_position_;
+            debug_collision.block_face_ = cardinal_relation_reverse( collision.entity_face_ );
+            debug_collisions_[slot].push_back( debug_collision );
+#endif
+
+            if ( collision.entity_face_ == CARDINAL_RELATION_BELOW )
+            {
+                flags |= ENTITY_FLAG_FEET_CONTACTING_BLOCK;
+            }
+
+            resolve_collision( movement, dv, collision, position, velocity, acceleration );
+            time_simulated += collision.normalized_time_ * step_time_slice;
+        }
+        else
+        {
+            velocity += dv;
+            position += movement;
+            break;
+        }
+    }
+}
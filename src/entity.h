@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef ENTITY_H
+#define ENTITY_H
+
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "math.h"
+#include "world.h"
+
+// Entities are the things that move through the World and collide with its Blocks, like
+// the Player.  Their components are stored in contiguous arrays, so that step_all() can
+// run the collision code over thousands of them at once, in batches on the World's worker
+// pool.  Each Entity is referred to by an EntityId, which stays valid until it's removed.
+struct EntitySystem : public boost::noncopyable
+{
+    typedef unsigned EntityId;
+
+#ifdef DEBUG_COLLISIONS
+    struct DebugCollision
+    {
+        Vector3f block_position_;
+        CardinalRelation block_face_;
+    };
+
+    typedef std::vector<DebugCollision> DebugCollisionV;
+#endif
+
+    // The position is the minimum corner of the Entity's AABB.  New Entities have physics
+    // enabled, and no acceleration (not even gravity) until one is set.
+    EntityId add_entity( const Vector3f& position, const Vector3f& size );
+    void remove_entity( const EntityId id );
+
+    unsigned get_num_entities() const { return positions_.size(); }
+
+    const Vector3f& get_position( const EntityId id ) const { return positions_[get_slot( id )]; }
+    void set_position( const EntityId id, const Vector3f& position ) { positions_[get_slot( id )] = position; }
+    const Vector3f& get_velocity( const EntityId id ) const { return velocities_[get_slot( id )]; }
+    void set_velocity( const EntityId id, const Vector3f& velocity ) { velocities_[get_slot( id )] = velocity; }
+    const Vector3f& get_size( const EntityId id ) const { return sizes_[get_slot( id )]; }
+    AABoxf get_aabb( const EntityId id ) const;
+
+    // The acceleration is applied during every step until it's changed.
+    void set_acceleration( const EntityId id, const Vector3f& acceleration ) { accelerations_[get_slot( id )] = acceleration; }
+
+    // Entities without physics are skipped by step_all(), and only move when they are set.
+    void set_physics_enabled( const EntityId id, const bool enabled );
+    bool get_physics_enabled( const EntityId id ) const { return flags_[get_slot( id )] & ENTITY_FLAG_PHYSICS_ENABLED; }
+
+    // This is whether the Entity was standing on a Block at the end of the last step.
+    bool get_feet_contacting_block( const EntityId id ) const
+    {
+        return flags_[get_slot( id )] & ENTITY_FLAG_FEET_CONTACTING_BLOCK;
+    }
+
+    bool is_swimming( const EntityId id, const World& world ) const;
+
+#ifdef DEBUG_COLLISIONS
+    const DebugCollisionV& get_debug_collisions( const EntityId id ) const { return debug_collisions_[get_slot( id )]; }
+#endif
+
+    // This must be called with the Chunk lock held, since it reads the Chunks from the
+    // worker pool.
+    void step_all( const float step_time, World& world );
+
+protected:
+
+    // Entities are split into batches of this many for the worker pool.
+    static const unsigned ENTITIES_PER_BATCH = 128;
+
+    static const unsigned INVALID_SLOT = ~0u;
+
+    enum EntityFlag
+    {
+        ENTITY_FLAG_PHYSICS_ENABLED = 1 << 0,
+        ENTITY_FLAG_FEET_CONTACTING_BLOCK = 1 << 1
+    };
+
+    typedef std::vector<Vector3f> Vector3fV;
+    typedef std::vector<uint8_t> FlagsV;
+    typedef std::vector<unsigned> SlotV;
+    typedef std::vector<EntityId> EntityIdV;
+
+    unsigned get_slot( const EntityId id ) const
+    {
+        assert( id < id_slots_.size() && id_slots_[id] != INVALID_SLOT );
+        return id_slots_[id];
+    }
+
+    void step_range( const unsigned begin, const unsigned end, const float step_time, const World& world );
+    void step_one( const unsigned slot, const float step_time, const World& world );
+
+    // These are the components, indexed by slot.  Removing an Entity moves the last one
+    // into its slot, so that the arrays stay dense.
+    Vector3fV
+        positions_,
+        velocities_,
+        sizes_,
+        accelerations_;
+
+    FlagsV flags_;
+
+#ifdef DEBUG_COLLISIONS
+    std::vector<DebugCollisionV> debug_collisions_;
+#endif
+
+    EntityIdV slot_ids_;
+
+    SlotV id_slots_;
+
+    EntityIdV free_ids_;
+};
+
+#endif // ENTITY_H
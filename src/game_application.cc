@@ -28,8 +28,49 @@
 
 #include "log.h"
 #include "timer.h"
+#include "profiler.h"
 #include "game_application.h"
 
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+Scalar lerp_angle( const Scalar t, const Scalar a, const Scalar b )
+{
+    // The yaw wraps around, so this goes the short way around the circle.
+    Scalar difference = b - a;
+
+    if ( difference > gmtl::Math::PI )
+    {
+        difference -= 2.0f * gmtl::Math::PI;
+    }
+    else if ( difference < -gmtl::Math::PI )
+    {
+        difference += 2.0f * gmtl::Math::PI;
+    }
+
+    return a + t * difference;
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for SimulationSnapshot:
+//////////////////////////////////////////////////////////////////////////////////
+
+SimulationSnapshot::SimulationSnapshot() :
+    pitch_( 0.0f ),
+    yaw_( 0.0f ),
+    time_of_day_( 0.0f ),
+    material_selection_( BLOCK_MATERIAL_AIR ),
+    num_chunks_( 0 ),
+    num_uniform_chunks_( 0 ),
+    chunk_memory_usage_( 0 )
+{
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Function definitions for GameApplication:
 //////////////////////////////////////////////////////////////////////////////////
@@ -40,16 +81,19 @@ GameApplication::GameApplication( SDL_GL_Window &window ) :
     fps_frame_count_( 0 ),
     mouse_sensitivity_( 0.005f ),
     window_( window ),
-    player_( Vector3f( 0.0f, 200.0f, 0.0f ), gmtl::Math::PI_OVER_2, gmtl::Math::PI_OVER_4 ),
-    world_( time( NULL ) * 91387 + SDL_GetTicks() * 75181 ),
-    // world_( 0xeaafa35aaa8eafdf ), // NOTE: Always use a constant for consistent performance measurements.
+    player_( entities_, Vector3f( 0.0f, 200.0f, 0.0f ), gmtl::Math::PI_OVER_2, gmtl::Math::PI_OVER_4 ),
+    world_( time( NULL ) * 91387 + SDL_GetTicks() * 75181, player_.get_position(), "save" ),
+    // world_( 0xeaafa35aaa8eafdf, player_.get_position(), "save" ), // NOTE: Always use a constant for consistent performance measurements.
     input_mode_( INPUT_MODE_PLAYER ),
     gui_( *this, window_.get_screen() ),
-    chunk_updater_( 1 )
+    chunk_updater_( 1 ),
+    view_radius_( window_.get_draw_distance() ),
+    ticks_since_chunk_stats_( TICKS_PER_CHUNK_STATS ),
+    sky_( world_.get_sky() )
 {
     World::ChunkGuard chunk_guard( world_.get_chunk_lock() );
 
-    SCOPE_TIMER_BEGIN( "Updating chunk VBOs" )
+    SCOPE_TIMER_BEGIN( "Queueing chunk meshes" )
 
     BOOST_FOREACH( const ChunkMap::value_type& chunk_it, world_.get_chunks() )
     {
@@ -58,11 +102,18 @@ GameApplication::GameApplication( SDL_GL_Window &window ) :
 
     SCOPE_TIMER_END
 
+    world_.set_view_radius( view_radius_ );
+
+    // Until the first tick, the frames just show the starting state.
+    publish_snapshot();
+    publish_snapshot();
+
     gui_.stash();
 }
 
 GameApplication::~GameApplication()
 {
+    LOG( "Frame times: " << frame_times_.describe() );
     SDL_Quit();
 }
 
@@ -70,22 +121,41 @@ void GameApplication::main_loop()
 {
     run_ = true;
 
-    HighResolutionTimer frame_timer;
+    Profiler::set_thread_name( "Main" );
+    boost::thread simulation_thread( boost::bind( &GameApplication::simulation_loop, this ) );
 
-    while ( run_ )
+    try
     {
-        const double elapsed = frame_timer.get_seconds_elapsed();
-        process_events();
-        handle_chunk_changes();
+        HighResolutionTimer frame_timer;
 
-        if ( elapsed >= FRAME_INTERVAL )
+        while ( run_ )
         {
-            do_one_step( elapsed );
+            const double elapsed = frame_timer.get_seconds_elapsed();
+            process_events();
             schedule_chunk_update();
-            render();
-            frame_timer.reset();
+
+            if ( elapsed >= FRAME_INTERVAL )
+            {
+                frame_times_.add( elapsed );
+                gui_.do_one_step( elapsed );
+                render();
+                frame_timer.reset();
+            }
         }
     }
+    catch ( ... )
+    {
+        stop();
+        simulation_thread.join();
+        throw;
+    }
+
+    simulation_thread.join();
+
+    if ( !simulation_error_.empty() )
+    {
+        throw std::runtime_error( simulation_error_ );
+    }
 }
 
 void GameApplication::stop()
@@ -167,6 +237,26 @@ bool GameApplication::handle_universal_event( const SDL_Event& event )
                 toggle_fullscreen();
                 return true;
             }
+            else if ( event.key.keysym.sym == SDLK_F9 )
+            {
+                toggle_greedy_meshing();
+                return true;
+            }
+            else if ( event.key.keysym.sym == SDLK_F8 )
+            {
+                toggle_level_of_detail();
+                return true;
+            }
+            else if ( event.key.keysym.sym == SDLK_F7 )
+            {
+                write_profile_trace();
+                return true;
+            }
+            else if ( event.key.keysym.sym == SDLK_F6 )
+            {
+                toggle_texture_lighting();
+                return true;
+            }
             break;
 
         case SDL_VIDEORESIZE:
@@ -266,18 +356,38 @@ void GameApplication::handle_mouse_motion_event( const int xrel, const int yrel
         return;
     }
 
-    player_.adjust_direction( mouse_sensitivity_ * Scalar( yrel ), mouse_sensitivity_ * Scalar( -xrel ) );
+    queue_command(
+        boost::bind(
+            &Player::adjust_direction,
+            boost::ref( player_ ),
+            mouse_sensitivity_ * Scalar( yrel ),
+            mouse_sensitivity_ * Scalar( -xrel )
+        )
+    );
 }
 
 void GameApplication::handle_input_down_event( const PlayerInputBinding& binding )
 {
     PlayerInputAction action;
 
-    if ( !input_router_.get_action_for_binding( binding, action ) )
+    if ( input_router_.get_action_for_binding( binding, action ) )
     {
-        return;
+        queue_command( boost::bind( &GameApplication::do_input_down_action, this, action ) );
+    }
+}
+
+void GameApplication::handle_input_up_event( const PlayerInputBinding& binding )
+{
+    PlayerInputAction action;
+
+    if ( input_router_.get_action_for_binding( binding, action ) )
+    {
+        queue_command( boost::bind( &GameApplication::do_input_up_action, this, action ) );
     }
+}
 
+void GameApplication::do_input_down_action( const PlayerInputAction action )
+{
     switch ( action )
     {
         case PLAYER_INPUT_ACTION_MOVE_FORWARD:
@@ -333,15 +443,8 @@ void GameApplication::handle_input_down_event( const PlayerInputBinding& binding
     }
 }
 
-void GameApplication::handle_input_up_event( const PlayerInputBinding& binding )
+void GameApplication::do_input_up_action( const PlayerInputAction action )
 {
-    PlayerInputAction action;
-
-    if ( !input_router_.get_action_for_binding( binding, action ) )
-    {
-        return;
-    }
-
     switch ( action )
     {
         case PLAYER_INPUT_ACTION_MOVE_FORWARD:
@@ -404,10 +507,54 @@ void GameApplication::toggle_fullscreen()
     }
 }
 
+void GameApplication::toggle_greedy_meshing()
+{
+    World::PriorityChunkGuard chunk_guard( world_ );
+    world_.set_greedy_meshing( !Chunk::get_greedy_meshing() );
+    LOG( "Greedy meshing " << ( Chunk::get_greedy_meshing() ? "enabled." : "disabled." ) );
+}
+
+void GameApplication::toggle_level_of_detail()
+{
+    renderer_.set_level_of_detail_enabled( !renderer_.get_level_of_detail_enabled() );
+    LOG( "Level of detail " << ( renderer_.get_level_of_detail_enabled() ? "enabled." : "disabled." ) );
+}
+
+void GameApplication::toggle_texture_lighting()
+{
+    World::PriorityChunkGuard chunk_guard( world_ );
+    world_.set_texture_lighting( !Chunk::get_texture_lighting() );
+    LOG( "Texture lighting " << ( Chunk::get_texture_lighting() ? "enabled." : "disabled." ) );
+}
+
+void GameApplication::write_profile_trace()
+{
+    const std::string path = "trace.json";
+
+    try
+    {
+        Profiler::write_chrome_trace( path );
+        LOG( "Wrote the profile trace to " << path << "." );
+    }
+    catch ( const std::exception& e ) { LOG( "Unable to write the profile trace: " << e.what() << "." ); }
+}
+
 void GameApplication::schedule_chunk_update()
 {
     World::ChunkGuard chunk_guard( world_.get_chunk_lock(), boost::defer_lock );
 
+    if ( !chunk_guard.try_lock() )
+    {
+        return;
+    }
+
+    // Chunks are evicted by the simulation thread, so their meshes have to be dropped here,
+    // while it can't be evicting any more of them.
+    BOOST_FOREACH( const Vector3i& position, world_.get_evicted_chunks() )
+    {
+        renderer_.note_chunk_removal( position );
+    }
+
     boost::xtime not_long;
     not_long.sec = 0;
     not_long.nsec = 0;
@@ -415,9 +562,21 @@ void GameApplication::schedule_chunk_update()
     // If we can acquire the Chunk lock, AND the Chunk updater thread is not currently
     // executing an update, then it's okay to queue up a new update.
 
-    if ( chunk_guard.try_lock() && chunk_updater_.wait( not_long ) )
+    if ( chunk_updater_.wait( not_long ) )
     {
-        updated_chunks_ = world_.get_updated_chunks();
+        const ChunkSet updated_chunks = world_.get_updated_chunks();
+
+        if ( !updated_chunks.empty() )
+        {
+            SCOPE_TIMER_BEGIN( "Queueing chunk meshes" )
+
+            BOOST_FOREACH( Chunk* chunk, updated_chunks )
+            {
+                renderer_.note_chunk_changes( *chunk );
+            }
+
+            SCOPE_TIMER_END
+        }
 
         if ( world_.chunk_update_needed() )
         {
@@ -426,32 +585,86 @@ void GameApplication::schedule_chunk_update()
     }
 }
 
-void GameApplication::handle_chunk_changes()
+void GameApplication::queue_command( const Command& command )
 {
-    if ( !updated_chunks_.empty() )
+    boost::lock_guard<boost::mutex> command_guard( command_lock_ );
+    commands_.push_back( command );
+}
+
+void GameApplication::run_commands()
+{
+    CommandV commands;
+
     {
-        World::ChunkGuard chunk_guard( world_.get_chunk_lock() );
+        boost::lock_guard<boost::mutex> command_guard( command_lock_ );
+        commands.swap( commands_ );
+    }
+
+    BOOST_FOREACH( const Command& command, commands )
+    {
+        command();
+    }
+}
 
-        SCOPE_TIMER_BEGIN( "Updating chunk VBOs" )
+void GameApplication::simulation_loop()
+{
+    Profiler::set_thread_name( "Simulation" );
 
-        BOOST_FOREACH( Chunk* chunk, updated_chunks_ )
+    try
+    {
+        HighResolutionTimer tick_timer;
+        double lag = 0.0;
+
+        while ( run_ )
         {
-            renderer_.note_chunk_changes( *chunk );
-        }
+            lag += tick_timer.get_seconds_elapsed();
+            tick_timer.reset();
 
-        updated_chunks_.clear();
+            if ( lag < TICK_INTERVAL )
+            {
+                boost::this_thread::sleep( boost::posix_time::microseconds( long( ( TICK_INTERVAL - lag ) * 1e6 ) ) );
+                continue;
+            }
+
+            for ( unsigned i = 0; i < MAX_TICKS_PER_UPDATE && lag >= TICK_INTERVAL; ++i )
+            {
+                run_commands();
 
-        SCOPE_TIMER_END
+                SCOPE_TIMER_BEGIN( "Simulation tick" )
+                World::PriorityChunkGuard chunk_guard( world_ );
+                do_one_step( TICK_INTERVAL );
+                publish_snapshot();
+                SCOPE_TIMER_END
+
+                lag -= TICK_INTERVAL;
+            }
+
+            if ( lag >= TICK_INTERVAL )
+            {
+                lag = 0.0;
+            }
+        }
+    }
+    catch ( const std::exception& e )
+    {
+        simulation_error_ = e.what();
+        stop();
     }
 }
 
 void GameApplication::do_one_step( const float step_time )
 {
-    World::ChunkGuard chunk_guard( world_.get_chunk_lock() );
-
+    SCOPE_TIMER_BEGIN( "Stepping player" )
     player_.do_one_step( step_time, world_ );
+    SCOPE_TIMER_END
+
+    SCOPE_TIMER_BEGIN( "Stepping entities" )
+    entities_.step_all( step_time, world_ );
+    SCOPE_TIMER_END
+
+    SCOPE_TIMER_BEGIN( "Stepping world" )
     world_.do_one_step( step_time, player_.get_position() );
-    gui_.do_one_step( step_time );
+    SCOPE_TIMER_END
 
 #ifdef DEBUG_CHUNK_UPDATES
     static boost::rand48 generator( 0 );
@@ -480,10 +693,38 @@ void GameApplication::do_one_step( const float step_time )
     }
     else block_it.block_->set_material( BLOCK_MATERIAL_AIR );
 
-    world_.mark_chunk_for_update( block_it.chunk_ );
+    world_.mark_block_for_update( block_position );
 #endif
 }
 
+void GameApplication::publish_snapshot()
+{
+    SimulationFrame& frame = frames_.get_back();
+    frame.previous_ = latest_snapshot_;
+
+    latest_snapshot_.eye_position_ = player_.get_eye_position();
+    latest_snapshot_.pitch_ = player_.get_pitch();
+    latest_snapshot_.yaw_ = player_.get_yaw();
+    latest_snapshot_.time_of_day_ = world_.get_sky().get_time_of_day();
+    latest_snapshot_.material_selection_ = player_.get_material_selection();
+    latest_snapshot_.num_chunks_ = world_.get_chunks().size();
+
+    if ( ++ticks_since_chunk_stats_ >= TICKS_PER_CHUNK_STATS )
+    {
+        latest_snapshot_.num_uniform_chunks_ = world_.get_num_uniform_chunks();
+        latest_snapshot_.chunk_memory_usage_ = world_.get_chunk_memory_usage();
+        ticks_since_chunk_stats_ = 0;
+    }
+
+#ifdef DEBUG_COLLISIONS
+    latest_snapshot_.debug_collisions_ = player_.get_debug_collisions();
+    latest_snapshot_.player_aabb_ = player_.get_aabb();
+#endif
+
+    frame.current_ = latest_snapshot_;
+    frames_.publish();
+}
+
 void GameApplication::render()
 {
     DebugInfoWindow& debug_info_window = gui_.get_main_menu_window().get_debug_info_window();
@@ -494,23 +735,73 @@ void GameApplication::render()
     {
         fps_last_time_ = now;
         debug_info_window.set_engine_fps( fps_frame_count_ );
+        debug_info_window.set_engine_stalls( frame_times_.get_num_stalls(), frame_times_.get_num_frames() );
+        debug_info_window.set_profile_stats( Profiler::get_zone_stats( PROFILE_STATS_SECONDS ) );
         fps_frame_count_ = 0;
     }
 
+    if ( window_.get_draw_distance() != view_radius_ )
+    {
+        view_radius_ = window_.get_draw_distance();
+        queue_command( boost::bind( &World::set_view_radius, boost::ref( world_ ), view_radius_ ) );
+    }
+
     window_.reshape_window();
 
-    Camera camera( player_.get_eye_position(), player_.get_pitch(), player_.get_yaw(), window_.get_draw_distance() );
+    // The frame shows the state one tick in the past, part of the way from the previous tick
+    // to the current one, depending on how long ago the current one was published.
+    if ( frames_.update_front() )
+    {
+        interpolation_timer_ = HighResolutionTimer();
+    }
 
+    const SimulationFrame& frame = frames_.get_front();
+    const SimulationSnapshot
+        &previous = frame.previous_,
+        &current = frame.current_;
+    const Scalar t = std::min( Scalar( interpolation_timer_.get_seconds_elapsed() / TICK_INTERVAL ), 1.0f );
+
+    Camera camera(
+        previous.eye_position_ + t * ( current.eye_position_ - previous.eye_position_ ),
+        previous.pitch_ + t * ( current.pitch_ - previous.pitch_ ),
+        lerp_angle( t, previous.yaw_, current.yaw_ ),
+        window_.get_draw_distance()
+    );
+
+    // The time of day wraps around at midnight, just like the yaw does around the circle.
+    sky_.set_time_of_day(
+        lerp_angle( t, previous.time_of_day_ * 2.0f * gmtl::Math::PI, current.time_of_day_ * 2.0f * gmtl::Math::PI ) /
+        ( 2.0f * gmtl::Math::PI )
+    );
+
+    SCOPE_TIMER_BEGIN( "Rendering world" )
 #ifdef DEBUG_COLLISIONS
-    renderer_.render( window_, camera, world_, player_ );
+    renderer_.render( window_, camera, sky_, current.debug_collisions_, current.player_aabb_ );
 #else
-    renderer_.render( window_, camera, world_ );
+    renderer_.render( window_, camera, sky_ );
 #endif
+    SCOPE_TIMER_END
 
-    debug_info_window.set_engine_chunk_stats( renderer_.get_num_chunks_drawn(), world_.get_chunks().size(), renderer_.get_num_triangles_drawn() );
-    debug_info_window.set_current_material( get_block_material_attributes( player_.get_material_selection() ).name_ );
-
+    debug_info_window.set_engine_chunk_stats(
+        renderer_.get_num_chunks_drawn(),
+        current.num_chunks_,
+        renderer_.get_num_chunks_frustum_culled(),
+        renderer_.get_num_chunks_occlusion_culled(),
+        renderer_.get_num_triangles_drawn(),
+        renderer_.get_num_unmerged_triangles_drawn()
+    );
+    debug_info_window.set_engine_memory_stats(
+        current.chunk_memory_usage_,
+        current.num_uniform_chunks_,
+        current.num_chunks_
+    );
+    debug_info_window.set_current_material( get_block_material_attributes( current.material_selection_ ).name_ );
+
+    SCOPE_TIMER_BEGIN( "Rendering GUI" )
     gui_.render();
+    SCOPE_TIMER_END
 
+    SCOPE_TIMER_BEGIN( "Swapping buffers" )
     SDL_GL_SwapBuffers();
+    SCOPE_TIMER_END
 }
@@ -20,16 +20,64 @@
 #define GAME_APPLICATION_H
 
 #include <vector>
+#include <string>
 
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
 #include <boost/threadpool.hpp>
 
+#include "timer.h"
+#include "triple_buffer.h"
 #include "sdl_gl_window.h"
 #include "renderer.h"
+#include "entity.h"
 #include "player.h"
 #include "world.h"
 #include "gui.h"
 #include "player_input.h"
 
+// This is everything that the main thread needs from the Player and the World to draw a
+// frame, as of the end of one simulation tick.
+struct SimulationSnapshot
+{
+    SimulationSnapshot();
+
+    Vector3f eye_position_;
+
+    Scalar
+        pitch_,
+        yaw_,
+        time_of_day_;
+
+    BlockMaterial material_selection_;
+
+    unsigned
+        num_chunks_,
+        num_uniform_chunks_;
+
+    size_t chunk_memory_usage_;
+
+#ifdef DEBUG_COLLISIONS
+    EntitySystem::DebugCollisionV debug_collisions_;
+
+    AABoxf player_aabb_;
+#endif
+};
+
+// The main thread draws the state between the last two ticks, so that the motion is smooth
+// even though the frames and the ticks aren't in step.
+struct SimulationFrame
+{
+    SimulationSnapshot
+        previous_,
+        current_;
+};
+
+// The Player and the World are simulated on their own thread at a fixed tick rate, while
+// the main thread handles input and draws frames as fast as it's allowed to.  Input is
+// passed to the simulation thread as commands, and the simulation thread publishes a
+// SimulationFrame after each tick, so neither thread ever waits for the other (apart from
+// the Chunk lock, which the main thread only tries to take).
 struct GameApplication
 {
     GameApplication( SDL_GL_Window &window );
@@ -44,7 +92,24 @@ struct GameApplication
 
 protected:
 
-    static const double FRAME_INTERVAL = 1.0 / 60.0;
+    static const double
+        FRAME_INTERVAL = 1.0 / 60.0,
+        TICK_INTERVAL = 1.0 / 60.0;
+
+    // If the simulation falls further behind than this, it gives up on catching up, so that
+    // a long stall doesn't leave it running flat out to make up for lost time.
+    static const unsigned MAX_TICKS_PER_UPDATE = 5;
+
+    // The debug info window shows the distributions of the zones from this far back.
+    static const double PROFILE_STATS_SECONDS = 2.0;
+
+    // Counting the uniform Chunks and their memory usage means going through all of them,
+    // which is too slow to do every tick while holding the Chunk lock, so it's only done
+    // about once a second (which is as often as the debug info window shows the FPS).
+    static const unsigned TICKS_PER_CHUNK_STATS = 60;
+
+    typedef boost::function<void ()> Command;
+    typedef std::vector<Command> CommandV;
 
     enum InputMode
     {
@@ -63,27 +128,44 @@ protected:
     void handle_mouse_motion_event( const int xrel, const int yrel );
     void handle_input_down_event( const PlayerInputBinding& binding );
     void handle_input_up_event( const PlayerInputBinding& binding );
+    void do_input_down_action( const PlayerInputAction action );
+    void do_input_up_action( const PlayerInputAction action );
 
     void toggle_fullscreen();
+    void toggle_greedy_meshing();
+    void toggle_level_of_detail();
+    void toggle_texture_lighting();
+    void write_profile_trace();
 
     void schedule_chunk_update();
-    void handle_chunk_changes();
 
+    // Commands are run on the simulation thread, before the start of the next tick.
+    void queue_command( const Command& command );
+    void run_commands();
+
+    // Precondition: you must hold the Chunk lock before calling these!
     void do_one_step( const float step_time );
+    void publish_snapshot();
+
+    void simulation_loop();
     void render();
 
-    bool run_;
+    volatile bool run_;
 
     unsigned
         fps_last_time_,
         fps_frame_count_;
 
+    FrameTimeHistogram frame_times_;
+
     Scalar mouse_sensitivity_;
 
     SDL_GL_Window& window_;
 
     Renderer renderer_;
 
+    EntitySystem entities_;
+
     Player player_;
 
     World world_;
@@ -100,7 +182,27 @@ protected:
 
     boost::threadpool::pool chunk_updater_;
 
-    ChunkSet updated_chunks_;
+    Scalar view_radius_;
+
+    boost::mutex command_lock_;
+
+    CommandV commands_;
+
+    // These are only touched by the simulation thread.
+    SimulationSnapshot latest_snapshot_;
+
+    unsigned ticks_since_chunk_stats_;
+
+    TripleBuffer<SimulationFrame> frames_;
+
+    // This is only touched by the main thread, which draws with it at the time of day
+    // interpolated from the latest SimulationFrame.
+    Sky sky_;
+
+    HighResolutionTimer interpolation_timer_;
+
+    // If the simulation thread stops because of an exception, this is rethrown by main_loop().
+    std::string simulation_error_;
 };
 
 #endif // GAME_APPLICATION_H
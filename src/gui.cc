@@ -23,6 +23,7 @@
 
 #include <assert.h>
 #include <math.h>
+#include <stdio.h>
 
 #include <vector>
 #include <iostream>
@@ -67,19 +68,35 @@ DebugInfoWindow::DebugInfoWindow() :
     AG_ExpandHoriz( fps_label_ );
     AG_WidgetUpdate( fps_label_ );
 
+    stalls_label_ = AG_LabelNewS( window_, 0, "Stalls: 0/0" );
+    AG_ExpandHoriz( stalls_label_ );
+    AG_WidgetUpdate( stalls_label_ );
+
     chunks_label_ = AG_LabelNewS( window_, 0, "Chunks: 0/0" );
     AG_ExpandHoriz( chunks_label_ );
     AG_WidgetUpdate( chunks_label_ );
 
+    culling_label_ = AG_LabelNewS( window_, 0, "Culled: 0 by frustum, 0 by occlusion" );
+    AG_ExpandHoriz( culling_label_ );
+    AG_WidgetUpdate( culling_label_ );
+
     triangles_label_ = AG_LabelNewS( window_, 0, "Triangles: 0" );
     AG_ExpandHoriz( triangles_label_ );
     AG_WidgetUpdate( triangles_label_ );
 
+    memory_label_ = AG_LabelNewS( window_, 0, "Chunk Memory: 0.0 MB" );
+    AG_ExpandHoriz( memory_label_ );
+    AG_WidgetUpdate( memory_label_ );
+
     current_material_label_ = AG_LabelNewS( window_, 0, "Current Material: None" );
     AG_ExpandHoriz( current_material_label_ );
     AG_WidgetUpdate( current_material_label_ );
 
-    AG_WindowSetGeometry( window_, 0, 0, 300, 128 );
+    profile_label_ = AG_LabelNewS( window_, 0, "Profile: None" );
+    AG_ExpandHoriz( profile_label_ );
+    AG_WidgetUpdate( profile_label_ );
+
+    AG_WindowSetGeometry( window_, 0, 0, 420, 480 );
     AG_WindowSetPosition( window_, AG_WINDOW_TL, 0 );
     AG_WindowShow( window_ );
 }
@@ -89,10 +106,35 @@ void DebugInfoWindow::set_engine_fps( const unsigned fps )
     AG_LabelText( fps_label_, "FPS: %d", fps );
 }
 
-void DebugInfoWindow::set_engine_chunk_stats( const unsigned chunks_drawn, const unsigned chunks_total, const unsigned triangles_drawn )
+void DebugInfoWindow::set_engine_stalls( const unsigned stalls, const unsigned frames )
+{
+    AG_LabelText( stalls_label_, "Stalls: %d/%d", stalls, frames );
+}
+
+void DebugInfoWindow::set_engine_chunk_stats(
+    const unsigned chunks_drawn,
+    const unsigned chunks_total,
+    const unsigned chunks_frustum_culled,
+    const unsigned chunks_occlusion_culled,
+    const unsigned triangles_drawn,
+    const unsigned unmerged_triangles_drawn
+)
 {
     AG_LabelText( chunks_label_, "Chunks: %d/%d", chunks_drawn, chunks_total );
-    AG_LabelText( triangles_label_, "Triangles: %d", triangles_drawn );
+    AG_LabelText( culling_label_, "Culled: %d by frustum, %d by occlusion", chunks_frustum_culled, chunks_occlusion_culled );
+
+    if ( triangles_drawn != unmerged_triangles_drawn && unmerged_triangles_drawn > 0 )
+    {
+        const unsigned reduction = 100 - 100 * triangles_drawn / unmerged_triangles_drawn;
+        AG_LabelText( triangles_label_, "Triangles: %d (%d%% merged away)", triangles_drawn, reduction );
+    }
+    else AG_LabelText( triangles_label_, "Triangles: %d", triangles_drawn );
+}
+
+void DebugInfoWindow::set_engine_memory_stats( const size_t chunk_bytes, const unsigned uniform_chunks, const unsigned chunks_total )
+{
+    const double megabytes = double( chunk_bytes ) / ( 1024.0 * 1024.0 );
+    AG_LabelText( memory_label_, "Chunk Memory: %.1f MB (%d/%d uniform)", megabytes, uniform_chunks, chunks_total );
 }
 
 void DebugInfoWindow::set_current_material( const std::string& current_material )
@@ -100,6 +142,33 @@ void DebugInfoWindow::set_current_material( const std::string& current_material
     AG_LabelText( current_material_label_, "Current Material: %s", current_material.c_str() );
 }
 
+void DebugInfoWindow::set_profile_stats( const Profiler::ZoneStatsV& stats )
+{
+    make_string text;
+    text << "Profile (ms, median/p95/p99/max):";
+
+    char line[128];
+
+    BOOST_FOREACH( const Profiler::ZoneStats& zone, stats )
+    {
+        snprintf(
+            line,
+            sizeof( line ),
+            "\n%s: %.2f/%.2f/%.2f/%.2f (%u)",
+            zone.name_,
+            zone.median_ * 1000.0,
+            zone.p95_ * 1000.0,
+            zone.p99_ * 1000.0,
+            zone.max_ * 1000.0,
+            zone.count_
+        );
+
+        text << line;
+    }
+
+    AG_LabelText( profile_label_, "%s", std::string( text ).c_str() );
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Static function definitions for InputSettingsWindow:
 //////////////////////////////////////////////////////////////////////////////////
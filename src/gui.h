@@ -27,6 +27,7 @@
 #include <boost/shared_ptr.hpp>
 
 #include "player_input.h"
+#include "profiler.h"
 
 struct GameApplication;
 
@@ -52,15 +53,29 @@ struct DebugInfoWindow : public Window
     DebugInfoWindow();
 
     void set_engine_fps( const unsigned fps );
-    void set_engine_chunk_stats( const unsigned chunks_drawn, const unsigned chunks_total, const unsigned triangles_drawn );
+    void set_engine_stalls( const unsigned stalls, const unsigned frames );
+    void set_engine_chunk_stats(
+        const unsigned chunks_drawn,
+        const unsigned chunks_total,
+        const unsigned chunks_frustum_culled,
+        const unsigned chunks_occlusion_culled,
+        const unsigned triangles_drawn,
+        const unsigned unmerged_triangles_drawn
+    );
+    void set_engine_memory_stats( const size_t chunk_bytes, const unsigned uniform_chunks, const unsigned chunks_total );
     void set_current_material( const std::string& material );
+    void set_profile_stats( const Profiler::ZoneStatsV& stats );
 
 protected:
 
     AG_Label* fps_label_;
+    AG_Label* stalls_label_;
     AG_Label* chunks_label_;
+    AG_Label* culling_label_;
     AG_Label* triangles_label_;
+    AG_Label* memory_label_;
     AG_Label* current_material_label_;
+    AG_Label* profile_label_;
 };
 
 typedef boost::shared_ptr<DebugInfoWindow> DebugInfoWindowSP;
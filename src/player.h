@@ -19,28 +19,28 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
-#ifdef DEBUG_COLLISIONS
-# include <vector>
-#endif
-
-#include <set>
+#include <boost/utility.hpp>
 
 #include "math.h"
 #include "world.h"
+#include "entity.h"
 
-struct Player
+// The Player is an Entity in the given EntitySystem, which does the physics (in its
+// step_all()), while the Player turns the requested movements into an acceleration.
+struct Player : public boost::noncopyable
 {
-    Player( const Vector3f& position, const Scalar pitch, const Scalar yaw );
+    Player( EntitySystem& entities, const Vector3f& position, const Scalar pitch, const Scalar yaw );
+    ~Player();
 
     void do_one_step( const float step_time, World& world );
     void adjust_direction( const Scalar dpitch, const Scalar dyaw );
 
-    const Vector3f& get_position() const { return position_; }
+    const Vector3f& get_position() const { return entities_.get_position( entity_ ); }
     Vector3f get_eye_position() const;
     Vector3f get_eye_direction() const;
     Scalar get_pitch() const { return pitch_; }
     Scalar get_yaw() const { return yaw_; }
-    AABoxf get_aabb() const { return AABoxf( position_, position_ + SIZE ); }
+    AABoxf get_aabb() const { return entities_.get_aabb( entity_ ); }
 
     void request_move_forward( const bool r ) { requesting_move_forward_ = r; }
     void request_move_backward( const bool r ) { requesting_move_backward_ = r; }
@@ -56,17 +56,10 @@ struct Player
     void select_previous_material();
     BlockMaterial get_material_selection() const { return material_selection_; }
 
-    void toggle_noclip() { noclip_mode_ = !noclip_mode_; }
+    void toggle_noclip();
 
 #ifdef DEBUG_COLLISIONS
-    struct DebugCollision
-    {
-        Vector3f block_position_;
-        CardinalRelation block_face_;
-    };
-
-    typedef std::vector<DebugCollision> DebugCollisionV;
-    DebugCollisionV debug_collisions_;
+    const EntitySystem::DebugCollisionV& get_debug_collisions() const { return entities_.get_debug_collisions( entity_ ); }
 #endif
 
 private:
@@ -75,65 +68,14 @@ private:
         SIZE,
         HALFSIZE;
 
-    struct TargetBlock
-    {
-        Vector3i
-            block_position_,
-            face_direction_;
-    };
-
-    struct BlockCollision
-    {
-        Scalar normalized_time_;
-        Vector3f block_position_;
-        CardinalRelation player_face_;
-    };
-
-    struct PotentialObstruction
-    {
-        PotentialObstruction( const Vector3f& block_position, const Block* block ) :
-            block_position_( block_position ),
-            block_( block )
-        {
-        }
-
-        bool operator<( const PotentialObstruction& other ) const
-        {
-            if ( VectorLess<Vector3f>()( block_position_, other.block_position_ ) )
-                return true;
-            if ( block_position_ != other.block_position_ )
-                return false;
-            if ( block_ < other.block_ )
-                return true;
-            return false;
-        }
-
-        Vector3f block_position_;
-
-        const Block* block_;
-    };
-
-    typedef std::set<PotentialObstruction> PotentialObstructionSet;
-
     void do_one_step_noclip( const float step_time );
-    void do_one_step_clip( const float step_time, const World& world );
+    void do_one_step_clip( const World& world );
 
     void do_primary_fire( const float step_time, World& world );
     void do_secondary_fire( const float step_time, World& world );
-    bool get_target_block( const Scalar max_distance, World& world, TargetBlock& target ) const;
-
-    Vector3f get_acceleration( const World& world, const bool swimming );
-    bool is_swimming( const World& world ) const;
-    bool find_collision( const World& world, const Vector3f& movement, BlockCollision& collision );
-    void resolve_collision( const Vector3f& movement, const Vector3f& dv, const BlockCollision& collision, Vector3f& acceleration );
+    bool get_target_block( const Scalar max_distance, const World& world, World::RaycastHit& target ) const;
 
-    void get_potential_obstructions(
-        const World& world,
-        const gmtl::LineSegf& sweep,
-        const Vector3f& swept_box_size,
-        const BlockCollisionMode collision_mode,
-        PotentialObstructionSet& potential_obstructions
-    ) const;
+    Vector3f get_acceleration( const bool swimming ) const;
 
     void noclip_move_forward( const Scalar movement_units );
     void noclip_strafe( const Scalar movement_units );
@@ -158,9 +100,9 @@ private:
         PRIMARY_FIRE_INTERVAL_MS = 300,
         SECONDARY_FIRE_INTERVAL_MS = 300;
 
-    Vector3f
-        position_,
-        velocity_;
+    EntitySystem& entities_;
+
+    const EntitySystem::EntityId entity_;
 
     Scalar
         pitch_,
@@ -177,7 +119,7 @@ private:
         requesting_primary_fire_,
         requesting_secondary_fire_,
         noclip_mode_,
-        feet_contacting_block_;
+        swimming_;
 
     BlockMaterial
         material_selection_;
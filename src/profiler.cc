@@ -0,0 +1,252 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/foreach.hpp>
+
+#include "log.h"
+#include "profiler.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+typedef boost::shared_ptr<ProfilerThread> ProfilerThreadSP;
+typedef std::vector<ProfilerThreadSP> ProfilerThreadSPV;
+
+// The ProfilerThreads are owned by the registry rather than by their threads, so that the
+// zones recorded by a thread can still be written out after it exits.
+struct ProfilerRegistry
+{
+    ProfilerRegistry()
+    {
+        gpu_thread_.reset( new ProfilerThread( 0, epoch_ ) );
+        gpu_thread_->set_name( "GPU" );
+        threads_.push_back( gpu_thread_ );
+    }
+
+    ProfilerThread* add_thread()
+    {
+        boost::lock_guard<boost::mutex> guard( lock_ );
+        threads_.push_back( ProfilerThreadSP( new ProfilerThread( threads_.size(), epoch_ ) ) );
+        return threads_.back().get();
+    }
+
+    ProfilerThreadSPV get_threads()
+    {
+        boost::lock_guard<boost::mutex> guard( lock_ );
+        return threads_;
+    }
+
+    ProfilerThread& get_gpu_thread() { return *gpu_thread_; }
+
+protected:
+
+    HighResolutionTimer epoch_;
+
+    boost::mutex lock_;
+
+    ProfilerThreadSPV threads_;
+
+    ProfilerThreadSP gpu_thread_;
+};
+
+ProfilerRegistry& get_registry()
+{
+    // GCC guards the initialization of function statics, so any thread may get here first.
+    static ProfilerRegistry registry;
+    return registry;
+}
+
+// The ProfilerThreads must outlive their threads, so they aren't deleted at thread exit.
+void leave_profiler_thread( ProfilerThread* )
+{
+}
+
+bool zone_name_less( const ProfilerThread::Zone& a, const ProfilerThread::Zone& b )
+{
+    return std::strcmp( a.name_, b.name_ ) < 0;
+}
+
+bool zone_name_equal( const ProfilerThread::Zone& a, const ProfilerThread::Zone& b )
+{
+    return std::strcmp( a.name_, b.name_ ) == 0;
+}
+
+double get_percentile( const std::vector<double>& sorted_durations, const double percentile )
+{
+    const size_t index = size_t( percentile * double( sorted_durations.size() - 1 ) + 0.5 );
+    return sorted_durations[index];
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ProfilerThread:
+//////////////////////////////////////////////////////////////////////////////////
+
+void ProfilerThread::get_zones( ZoneV& zones )
+{
+    boost::lock_guard<boost::mutex> guard( lock_ );
+
+    const unsigned long first = num_zones_ > MAX_ZONES ? num_zones_ - MAX_ZONES : 0;
+
+    for ( unsigned long i = first; i < num_zones_; ++i )
+    {
+        zones.push_back( zones_[i % MAX_ZONES] );
+    }
+}
+
+void ProfilerThread::set_name( const std::string& name )
+{
+    boost::lock_guard<boost::mutex> guard( lock_ );
+    name_ = name;
+}
+
+std::string ProfilerThread::get_name()
+{
+    boost::lock_guard<boost::mutex> guard( lock_ );
+    return name_.empty() ? make_string() << "Thread " << id_ : name_;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for Profiler:
+//////////////////////////////////////////////////////////////////////////////////
+
+ProfilerThread& Profiler::get_thread()
+{
+    static boost::thread_specific_ptr<ProfilerThread> thread( leave_profiler_thread );
+
+    if ( !thread.get() )
+    {
+        thread.reset( get_registry().add_thread() );
+    }
+
+    return *thread;
+}
+
+void Profiler::set_thread_name( const std::string& name )
+{
+    get_thread().set_name( name );
+}
+
+void Profiler::record_gpu_zone( const char* name, const double begin, const double seconds )
+{
+    get_registry().get_gpu_thread().record( name, begin, begin + seconds );
+}
+
+Profiler::ZoneStatsV Profiler::get_zone_stats( const double max_age )
+{
+    const double min_end = get_thread().get_time() - max_age;
+
+    ProfilerThread::ZoneV zones;
+
+    BOOST_FOREACH( const ProfilerThreadSP& thread, get_registry().get_threads() )
+    {
+        ProfilerThread::ZoneV thread_zones;
+        thread->get_zones( thread_zones );
+
+        BOOST_FOREACH( const ProfilerThread::Zone& zone, thread_zones )
+        {
+            if ( zone.end_ >= min_end )
+            {
+                zones.push_back( zone );
+            }
+        }
+    }
+
+    std::sort( zones.begin(), zones.end(), zone_name_less );
+
+    ZoneStatsV result;
+    std::vector<double> durations;
+    ProfilerThread::ZoneV::const_iterator zone_it = zones.begin();
+
+    while ( zone_it != zones.end() )
+    {
+        ProfilerThread::ZoneV::const_iterator name_end = zone_it;
+        durations.clear();
+
+        while ( name_end != zones.end() && zone_name_equal( *name_end, *zone_it ) )
+        {
+            durations.push_back( name_end->end_ - name_end->begin_ );
+            ++name_end;
+        }
+
+        std::sort( durations.begin(), durations.end() );
+
+        ZoneStats stats( zone_it->name_ );
+        stats.count_ = durations.size();
+        stats.median_ = get_percentile( durations, 0.5 );
+        stats.p95_ = get_percentile( durations, 0.95 );
+        stats.p99_ = get_percentile( durations, 0.99 );
+        stats.max_ = durations.back();
+        result.push_back( stats );
+
+        zone_it = name_end;
+    }
+
+    return result;
+}
+
+void Profiler::write_chrome_trace( const std::string& path )
+{
+    std::ofstream file( path.c_str() );
+
+    if ( !file )
+    {
+        throw std::runtime_error( "Unable to open trace file: " + path );
+    }
+
+    // The trace format wants microseconds.
+    file << "{\"traceEvents\":[";
+
+    bool first = true;
+    file.precision( 3 );
+    file.setf( std::ios::fixed, std::ios::floatfield );
+
+    BOOST_FOREACH( const ProfilerThreadSP& thread, get_registry().get_threads() )
+    {
+        file << ( first ? "" : "," ) << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread->get_id()
+             << ",\"args\":{\"name\":\"" << thread->get_name() << "\"}}";
+        first = false;
+
+        ProfilerThread::ZoneV zones;
+        thread->get_zones( zones );
+
+        BOOST_FOREACH( const ProfilerThread::Zone& zone, zones )
+        {
+            file << ",\n{\"name\":\"" << zone.name_ << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread->get_id()
+                 << ",\"ts\":" << zone.begin_ * 1e6 << ",\"dur\":" << ( zone.end_ - zone.begin_ ) * 1e6 << "}";
+        }
+    }
+
+    file << "\n]}\n";
+
+    if ( !file )
+    {
+        throw std::runtime_error( "Unable to write trace file: " + path );
+    }
+}
@@ -0,0 +1,171 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+
+#include "timer.h"
+
+// A zone is a named span of time on one thread.  The zones are kept around (in a ring
+// buffer per thread) so that their distributions can be shown while the game is running,
+// or the whole lot can be written out and browsed in Chrome's about:tracing.
+//
+// NOTE: The zone names must be string literals (or otherwise live forever), since only
+//       the pointers are recorded.
+#define SCOPE_TIMER_BEGIN( label ) { ProfileZone __profile_zone( label );
+#define SCOPE_TIMER_END }
+
+// Each thread records its zones into its own ring buffer, so threads never contend with
+// each other while recording.  Once the buffer fills up, the oldest zones are overwritten.
+struct ProfilerThread : public boost::noncopyable
+{
+    struct Zone
+    {
+        const char* name_;
+
+        double
+            begin_,
+            end_;
+    };
+
+    typedef std::vector<Zone> ZoneV;
+
+    static const unsigned MAX_ZONES = 8192;
+
+    ProfilerThread( const unsigned id, const HighResolutionTimer& epoch ) :
+        id_( id ),
+        timer_( epoch ),
+        zones_( MAX_ZONES ),
+        num_zones_( 0 )
+    {
+    }
+
+    // Returns the number of seconds since the Profiler was started, which is what all of
+    // the zones are stamped with.
+    double get_time() { return timer_.get_seconds_elapsed(); }
+
+    void record( const char* name, const double begin, const double end )
+    {
+        // This lock is only ever contended while the zones are being read.
+        boost::lock_guard<boost::mutex> guard( lock_ );
+
+        Zone& zone = zones_[num_zones_ % MAX_ZONES];
+        zone.name_ = name;
+        zone.begin_ = begin;
+        zone.end_ = end;
+        ++num_zones_;
+    }
+
+    void get_zones( ZoneV& zones );
+
+    void set_name( const std::string& name );
+    std::string get_name();
+
+    unsigned get_id() const { return id_; }
+
+protected:
+
+    const unsigned id_;
+
+    HighResolutionTimer timer_;
+
+    boost::mutex lock_;
+
+    ZoneV zones_;
+
+    unsigned long num_zones_;
+
+    std::string name_;
+};
+
+struct Profiler
+{
+    // The percentiles of the durations (in seconds) of every zone with a given name.
+    struct ZoneStats
+    {
+        ZoneStats( const char* name = 0 ) :
+            name_( name ),
+            count_( 0 ),
+            median_( 0.0 ),
+            p95_( 0.0 ),
+            p99_( 0.0 ),
+            max_( 0.0 )
+        {
+        }
+
+        const char* name_;
+
+        unsigned count_;
+
+        double
+            median_,
+            p95_,
+            p99_,
+            max_;
+    };
+
+    typedef std::vector<ZoneStats> ZoneStatsV;
+
+    // The ProfilerThread for the calling thread is created the first time it's needed.
+    static ProfilerThread& get_thread();
+
+    static void set_thread_name( const std::string& name );
+
+    // Zones measured by the graphics card are recorded on a track of their own.  The
+    // begin time is when the commands were issued, since that's all the CPU knows about.
+    static void record_gpu_zone( const char* name, const double begin, const double seconds );
+
+    // Only the zones that ended within the last max_age seconds are included, sorted by name.
+    static ZoneStatsV get_zone_stats( const double max_age );
+
+    // Writes every zone that's still in the ring buffers in the Chrome trace event format.
+    static void write_chrome_trace( const std::string& path );
+};
+
+// This records a zone covering its own lifetime.
+struct ProfileZone : public boost::noncopyable
+{
+    ProfileZone( const char* name ) :
+        name_( name ),
+        thread_( Profiler::get_thread() ),
+        begin_( thread_.get_time() )
+    {
+    }
+
+    ~ProfileZone()
+    {
+        thread_.record( name_, begin_, thread_.get_time() );
+    }
+
+protected:
+
+    const char* name_;
+
+    ProfilerThread& thread_;
+
+    const double begin_;
+};
+
+#endif // PROFILER_H
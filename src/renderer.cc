@@ -20,9 +20,15 @@
 
 #include <GL/glew.h>
 
+#include <deque>
+#include <cmath>
+#include <limits>
+
 #include <boost/numeric/conversion/cast.hpp>
 #include <boost/foreach.hpp>
 
+#include "timer.h"
+#include "profiler.h"
 #include "renderer.h"
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -52,14 +58,112 @@ typedef std::vector<SimplePositionVertex> SimplePositionVertexV;
 template <typename T>
 void set_buffer_data( const GLenum target, const std::vector<T>& vertices, const GLenum usage )
 {
-    glBufferData( target, vertices.size() * sizeof( T ), &vertices[0], usage );
+    glBufferData( target, vertices.size() * sizeof( T ), vertices.empty() ? 0 : &vertices[0], usage );
+}
+
+// Reusable buffers are allocated in power of two sizes, so that a buffer that's refilled with
+// slightly more data than before (or reused for a different Chunk) can usually be updated in place.
+const GLsizeiptr MIN_BUFFER_CAPACITY = 4096;
+
+GLsizeiptr get_buffer_capacity( const GLsizeiptr size )
+{
+    GLsizeiptr capacity = MIN_BUFFER_CAPACITY;
+
+    while ( capacity < size )
+    {
+        capacity *= 2;
+    }
+
+    return capacity;
 }
 
-bool face_material_order( const BlockFace& a, const BlockFace& b )
+// The buffer must be bound to the target.  Its storage only ever grows.
+template <typename T>
+void refill_buffer_data( const GLenum target, const std::vector<T>& data, const GLenum usage, GLsizeiptr& capacity )
 {
-    return a.material_ < b.material_;
+    const GLsizeiptr size = data.size() * sizeof( T );
+
+    if ( size > capacity )
+    {
+        capacity = get_buffer_capacity( size );
+        glBufferData( target, capacity, 0, usage );
+    }
+
+    if ( size > 0 )
+    {
+        glBufferSubData( target, 0, size, &data[0] );
+    }
 }
 
+enum FrustumContainment
+{
+    OUTSIDE_FRUSTUM,
+    INTERSECTS_FRUSTUM,
+    INSIDE_FRUSTUM
+};
+
+FrustumContainment get_frustum_containment( const gmtl::Frustumf& frustum, const AABoxf& aabb )
+{
+    FrustumContainment containment = INSIDE_FRUSTUM;
+
+    // The normals of the frustum planes point inwards.  For each plane, only the corners of
+    // the box that are farthest along the normal and farthest against it need to be tested.
+    for ( int i = 0; i < 6; ++i )
+    {
+        const gmtl::Planef& plane = frustum.mPlanes[i];
+        Vector3f
+            farthest_inside,
+            farthest_outside;
+
+        for ( int j = 0; j < 3; ++j )
+        {
+            const bool positive = plane.mNorm[j] >= 0.0f;
+            farthest_inside[j] = positive ? aabb.getMax()[j] : aabb.getMin()[j];
+            farthest_outside[j] = positive ? aabb.getMin()[j] : aabb.getMax()[j];
+        }
+
+        if ( gmtl::dot( plane.mNorm, farthest_inside ) < plane.mOffset )
+        {
+            return OUTSIDE_FRUSTUM;
+        }
+        else if ( gmtl::dot( plane.mNorm, farthest_outside ) < plane.mOffset )
+        {
+            containment = INTERSECTS_FRUSTUM;
+        }
+    }
+
+    return containment;
+}
+
+// The position (with the face direction in the 'w' component) and texture coordinates of a
+// BlockVertex are small integers, and the lighting is normalized into the [0, 1] range.
+void set_block_vertex_attribute_pointers()
+{
+    glVertexAttribPointer( BLOCK_VERTEX_ATTRIBUTE_POSITION, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof( BlockVertex ), reinterpret_cast<void*>( 0 ) );
+    glVertexAttribPointer( BLOCK_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES, 3, GL_UNSIGNED_BYTE, GL_FALSE, sizeof( BlockVertex ), reinterpret_cast<void*>( 4 ) );
+    glVertexAttribPointer( BLOCK_VERTEX_ATTRIBUTE_LIGHTING, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof( BlockVertex ), reinterpret_cast<void*>( 8 ) );
+    glVertexAttribPointer( BLOCK_VERTEX_ATTRIBUTE_SUNLIGHTING, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof( BlockVertex ), reinterpret_cast<void*>( 12 ) );
+}
+
+struct VisibilityStep
+{
+    VisibilityStep( const Vector3i& position, const CardinalRelation entry_face, const unsigned directions ) :
+        position_( position ),
+        entry_face_( entry_face ),
+        directions_( directions )
+    {
+    }
+
+    Vector3i position_;
+
+    // The face of the Chunk through which it was entered, or NUM_CARDINAL_RELATIONS for the
+    // Chunk containing the Camera.
+    CardinalRelation entry_face_;
+
+    // A mask of all the directions that have been moved in to get to the Chunk.
+    unsigned directions_;
+};
+
 } // anonymous namespace
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -92,6 +196,21 @@ VertexBuffer::ClientStateGuard::~ClientStateGuard()
     glDisableClientState( state_ );
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for VertexBuffer::VertexAttributeGuard:
+//////////////////////////////////////////////////////////////////////////////////
+
+VertexBuffer::VertexAttributeGuard::VertexAttributeGuard( const GLuint attribute ) :
+    attribute_( attribute )
+{
+    glEnableVertexAttribArray( attribute_ );
+}
+
+VertexBuffer::VertexAttributeGuard::~VertexAttributeGuard()
+{
+    glDisableVertexAttribArray( attribute_ );
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Function definitions for VertexBuffer::TextureStateGuard:
 //////////////////////////////////////////////////////////////////////////////////
@@ -148,27 +267,18 @@ void VertexBuffer::draw_elements()
 // Function definitions for ChunkVertexBuffer:
 //////////////////////////////////////////////////////////////////////////////////
 
-ChunkVertexBuffer::ChunkVertexBuffer( const BlockVertexV& vertices, const GLenum vertex_usage, const GLenum index_usage )
+ChunkVertexBuffer::ChunkVertexBuffer( const GLenum index_usage ) :
+    index_usage_( index_usage ),
+    vertex_capacity_( 0 ),
+    index_capacity_( 0 )
 {
-    assert( vertices.size() > 0 );
-
-    std::vector<VertexBuffer::Index> indices;
-    indices.reserve( vertices.size() + vertices.size() / 2 );
-
-    for ( int i = 0; i < int( vertices.size() ); i += 4 )
-    {
-        indices.push_back( i + 0 );
-        indices.push_back( i + 3 );
-        indices.push_back( i + 2 );
-
-        indices.push_back( i + 0 );
-        indices.push_back( i + 2 );
-        indices.push_back( i + 1 );
-    }
+}
 
+void ChunkVertexBuffer::set_data( const BlockVertexV& vertices, const std::vector<Index>& indices )
+{
     BindGuard bind_guard( *this );
-    set_buffer_data( GL_ARRAY_BUFFER, vertices, vertex_usage );
-    set_buffer_data( GL_ELEMENT_ARRAY_BUFFER, indices, index_usage );
+    refill_buffer_data( GL_ARRAY_BUFFER, vertices, GL_STATIC_DRAW, vertex_capacity_ );
+    refill_buffer_data( GL_ELEMENT_ARRAY_BUFFER, indices, index_usage_, index_capacity_ );
     num_elements_ = indices.size();
 }
 
@@ -180,24 +290,13 @@ void ChunkVertexBuffer::render()
 
 void ChunkVertexBuffer::render_no_bind()
 {
-    ClientStateGuard vertex_array_guard( GL_VERTEX_ARRAY );
-    glVertexPointer( 3, GL_FLOAT, sizeof( BlockVertex ), reinterpret_cast<void*>( 0 ) );
-
-    ClientStateGuard normal_array_guard( GL_NORMAL_ARRAY );
-    glNormalPointer( GL_FLOAT, sizeof( BlockVertex ), reinterpret_cast<void*>( 12 ) );
-
-    TextureStateGuard texture_coord_array_guard0( GL_TEXTURE0, GL_TEXTURE_COORD_ARRAY );
-    glTexCoordPointer( 3, GL_FLOAT, sizeof( BlockVertex ), reinterpret_cast<void*>( 24 ) );
-
-    TextureStateGuard texture_coord_array_guard1( GL_TEXTURE1, GL_TEXTURE_COORD_ARRAY );
-    glTexCoordPointer( 3, GL_FLOAT, sizeof( BlockVertex ), reinterpret_cast<void*>( 36 ) );
-
-    TextureStateGuard texture_coord_array_guard2( GL_TEXTURE2, GL_TEXTURE_COORD_ARRAY );
-    glTexCoordPointer( 3, GL_FLOAT, sizeof( BlockVertex ), reinterpret_cast<void*>( 48 ) );
-
-    TextureStateGuard texture_coord_array_guard3( GL_TEXTURE3, GL_TEXTURE_COORD_ARRAY );
-    glTexCoordPointer( 3, GL_FLOAT, sizeof( BlockVertex ), reinterpret_cast<void*>( 60 ) );
+    VertexAttributeGuard
+        position_guard( BLOCK_VERTEX_ATTRIBUTE_POSITION ),
+        texcoords_guard( BLOCK_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES ),
+        lighting_guard( BLOCK_VERTEX_ATTRIBUTE_LIGHTING ),
+        sunlighting_guard( BLOCK_VERTEX_ATTRIBUTE_SUNLIGHTING );
 
+    set_block_vertex_attribute_pointers();
     draw_elements();
 }
 
@@ -205,79 +304,159 @@ void ChunkVertexBuffer::render_no_bind()
 // Static constant definitions for SortableChunkVertexBuffer:
 //////////////////////////////////////////////////////////////////////////////////
 
-const unsigned SortableChunkVertexBuffer::VERTICES_PER_FACE;
+const Scalar SortableChunkVertexBuffer::DISTANCE_QUANTIZATION;
+const unsigned SortableChunkVertexBuffer::MAX_INSERTION_MOVES_PER_FACE;
 
 //////////////////////////////////////////////////////////////////////////////////
 // Function definitions for SortableChunkVertexBuffer:
 //////////////////////////////////////////////////////////////////////////////////
 
-SortableChunkVertexBuffer::SortableChunkVertexBuffer( const BlockVertexV& vertices ) :
-    ChunkVertexBuffer( vertices, GL_STATIC_DRAW, GL_DYNAMIC_DRAW )
+SortableChunkVertexBuffer::SortableChunkVertexBuffer() :
+    ChunkVertexBuffer( GL_DYNAMIC_DRAW ),
+    sorted_( false )
+{
+}
+
+void SortableChunkVertexBuffer::set_data( const BlockVertexV& vertices, const Vector3fV& centroids )
+{
+    assert( vertices.size() == centroids.size() * ChunkMesh::VERTICES_PER_FACE );
+
+    // The indices are generated in back to front order the next time the buffer is rendered.
+    ChunkVertexBuffer::set_data( vertices, IndexV() );
+    centroids_ = centroids;
+
+    distance_indices_.clear();
+    distance_indices_.reserve( centroids_.size() );
+
+    for ( unsigned i = 0; i < centroids_.size(); ++i )
+    {
+        distance_indices_.push_back( std::make_pair( 0.0f, i ) );
+    }
+
+    sorted_ = false;
+}
+
+void SortableChunkVertexBuffer::render( const Camera& camera )
+{
+    // Since these faces are translucent, they must be rendered strictly in back to front order.
+    // The order hardly ever changes while the camera stays within the same Block, though.
+
+    const Vector3i camera_block = vector_cast<int>( pointwise_floor( camera.get_position() ) );
+
+    if ( !sorted_ || camera_block != sorted_camera_block_ )
+    {
+        sort( camera.get_position() );
+        upload_sorted_indices();
+        sorted_camera_block_ = camera_block;
+        sorted_ = true;
+    }
+
+    ChunkVertexBuffer::render();
+}
+
+bool SortableChunkVertexBuffer::insertion_sort( DistanceIndexV& distance_indices, const unsigned max_moves )
 {
-    assert( vertices.size() > 0 );
-    assert( vertices.size() % VERTICES_PER_FACE == 0 );
+    unsigned num_moves = 0;
 
-    for ( size_t i = 0; i < vertices.size(); i += VERTICES_PER_FACE )
+    for ( unsigned i = 1; i < distance_indices.size(); ++i )
     {
-        Vector3f centroid;
+        const DistanceIndex distance_index = distance_indices[i];
+        unsigned j = i;
 
-        for ( size_t j = 0; j < VERTICES_PER_FACE; ++j )
+        for ( ; j > 0 && distance_index < distance_indices[j - 1]; --j )
         {
-            const BlockVertex& v = vertices[i + j];
-            centroid += Vector3f( v.x_, v.y_, v.z_ );
-        }
+            if ( ++num_moves > max_moves )
+            {
+                distance_indices[j] = distance_index;
+                return false;
+            }
 
-        centroid /= VERTICES_PER_FACE;
+            distance_indices[j] = distance_indices[j - 1];
+        }
 
-        // Nudge the centroid slightly toward the center of the Block, so that
-        // neighboring Blocks with different translucent materials won't Z fight.
-        const BlockVertex& v = vertices[i];
-        centroid -= 0.1f * Vector3f( v.nx_, v.ny_, v.nz_ );
-        centroids_.push_back( centroid );
+        distance_indices[j] = distance_index;
     }
+
+    return true;
 }
 
-void SortableChunkVertexBuffer::render( const Camera& camera )
+void SortableChunkVertexBuffer::radix_sort( DistanceIndexV& distance_indices, DistanceIndexV& scratch )
 {
-    DistanceIndexV distance_indices;
-    distance_indices.reserve( centroids_.size() );
+    // The faces of a Chunk all lie within a few dozen Blocks of its nearest face, so each
+    // distance is quantized relative to that one, into a 16 bit key (clamped, just in case).
 
-    // Since these faces are translucent, they must be rendered strictly in back to front order.
+    const unsigned
+        RADIX_BITS = 8,
+        NUM_BUCKETS = 1 << RADIX_BITS,
+        MAX_KEY = ( 1 << ( 2 * RADIX_BITS ) ) - 1;
 
-    for ( unsigned i = 0; i < centroids_.size(); ++i )
+    Scalar min_distance = std::numeric_limits<Scalar>::max();
+
+    BOOST_FOREACH( const DistanceIndex& distance_index, distance_indices )
     {
-        const Vector3f camera_to_centroid = camera.get_position() - centroids_[i];
-        const Scalar distance_squared = gmtl::lengthSquared( camera_to_centroid );
-        distance_indices.push_back( std::make_pair( distance_squared, i ) );
+        min_distance = std::min( min_distance, distance_index.first );
     }
 
-    std::sort( distance_indices.begin(), distance_indices.end() );
-    render_sorted( distance_indices );
+    scratch.resize( distance_indices.size() );
+
+    for ( unsigned shift = 0; shift < 2 * RADIX_BITS; shift += RADIX_BITS )
+    {
+        unsigned bucket_offsets[NUM_BUCKETS] = { 0 };
+
+        BOOST_FOREACH( const DistanceIndex& distance_index, distance_indices )
+        {
+            const unsigned key = std::min( unsigned( ( distance_index.first - min_distance ) * DISTANCE_QUANTIZATION ), MAX_KEY );
+            ++bucket_offsets[( key >> shift ) & ( NUM_BUCKETS - 1 )];
+        }
+
+        for ( unsigned i = 0, offset = 0; i < NUM_BUCKETS; ++i )
+        {
+            const unsigned bucket_size = bucket_offsets[i];
+            bucket_offsets[i] = offset;
+            offset += bucket_size;
+        }
+
+        BOOST_FOREACH( const DistanceIndex& distance_index, distance_indices )
+        {
+            const unsigned key = std::min( unsigned( ( distance_index.first - min_distance ) * DISTANCE_QUANTIZATION ), MAX_KEY );
+            scratch[bucket_offsets[( key >> shift ) & ( NUM_BUCKETS - 1 )]++] = distance_index;
+        }
+
+        distance_indices.swap( scratch );
+    }
 }
 
-void SortableChunkVertexBuffer::render_sorted( const DistanceIndexV distance_indices )
+void SortableChunkVertexBuffer::sort( const Vector3f& camera_position )
 {
-    BindGuard bind_guard( *this );
-    IndexV indices;
-    indices.reserve( distance_indices.size() * 6 );
+    BOOST_FOREACH( DistanceIndex& distance_index, distance_indices_ )
+    {
+        distance_index.first = gmtl::length( Vector3f( camera_position - centroids_[distance_index.second] ) );
+    }
 
-    BOOST_REVERSE_FOREACH( const DistanceIndex& distance_index, distance_indices )
+    // Starting from the previous order, an insertion sort only has to do a little work if the
+    // camera has only moved a short distance.  Otherwise, the radix sort gets the order right
+    // to within the quantization, and the insertion sort finishes the job cheaply.
+
+    if ( !insertion_sort( distance_indices_, distance_indices_.size() * MAX_INSERTION_MOVES_PER_FACE ) )
     {
-        const unsigned face_index = distance_index.second;
-        const VertexBuffer::Index vertex_index = face_index * VERTICES_PER_FACE;
+        radix_sort( distance_indices_, scratch_ );
+        insertion_sort( distance_indices_, std::numeric_limits<unsigned>::max() );
+    }
+}
 
-        indices.push_back( vertex_index + 0 );
-        indices.push_back( vertex_index + 3 );
-        indices.push_back( vertex_index + 2 );
+void SortableChunkVertexBuffer::upload_sorted_indices()
+{
+    indices_.clear();
+    indices_.reserve( distance_indices_.size() * ChunkMesh::INDICES_PER_FACE );
 
-        indices.push_back( vertex_index + 0 );
-        indices.push_back( vertex_index + 2 );
-        indices.push_back( vertex_index + 1 );
+    BOOST_REVERSE_FOREACH( const DistanceIndex& distance_index, distance_indices_ )
+    {
+        ChunkMesh::get_face_indices( distance_index.second, 1, indices_ );
     }
 
-    set_buffer_data( GL_ELEMENT_ARRAY_BUFFER, indices, GL_DYNAMIC_DRAW );
-    num_elements_ = indices.size();
-    render_no_bind();
+    BindGuard bind_guard( *this );
+    refill_buffer_data( GL_ELEMENT_ARRAY_BUFFER, indices_, index_usage_, index_capacity_ );
+    num_elements_ = indices_.size();
 }
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -325,24 +504,281 @@ void AABoxVertexBuffer::render()
     draw_elements();
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkVertexArena:
+//////////////////////////////////////////////////////////////////////////////////
+
+ChunkVertexArena::ChunkVertexArena( const GLsizei capacity, const GLuint quad_ibo_id )
+{
+    glGenVertexArrays( 1, &vao_id_ );
+    glGenBuffers( 1, &vbo_id_ );
+
+    glBindVertexArray( vao_id_ );
+    glBindBuffer( GL_ARRAY_BUFFER, vbo_id_ );
+    glBufferData( GL_ARRAY_BUFFER, capacity * sizeof( BlockVertex ), 0, GL_STATIC_DRAW );
+
+    glEnableVertexAttribArray( BLOCK_VERTEX_ATTRIBUTE_POSITION );
+    glEnableVertexAttribArray( BLOCK_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES );
+    glEnableVertexAttribArray( BLOCK_VERTEX_ATTRIBUTE_LIGHTING );
+    glEnableVertexAttribArray( BLOCK_VERTEX_ATTRIBUTE_SUNLIGHTING );
+    set_block_vertex_attribute_pointers();
+
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, quad_ibo_id );
+    glBindVertexArray( 0 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+
+    free_ranges_[0] = capacity;
+}
+
+ChunkVertexArena::~ChunkVertexArena()
+{
+    glDeleteVertexArrays( 1, &vao_id_ );
+    glDeleteBuffers( 1, &vbo_id_ );
+}
+
+bool ChunkVertexArena::allocate( const GLsizei num_vertices, GLint& first_vertex )
+{
+    for ( FreeRangeMap::iterator it = free_ranges_.begin(); it != free_ranges_.end(); ++it )
+    {
+        if ( it->second >= num_vertices )
+        {
+            first_vertex = it->first;
+            const GLsizei remaining = it->second - num_vertices;
+            free_ranges_.erase( it );
+
+            if ( remaining > 0 )
+            {
+                free_ranges_[first_vertex + num_vertices] = remaining;
+            }
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ChunkVertexArena::free( const GLint first_vertex, const GLsizei num_vertices )
+{
+    FreeRangeMap::iterator it = free_ranges_.insert( std::make_pair( first_vertex, num_vertices ) ).first;
+
+    // Merge the range with its neighbors, if they're also free.
+
+    FreeRangeMap::iterator next = it;
+    ++next;
+
+    if ( next != free_ranges_.end() && it->first + it->second == next->first )
+    {
+        it->second += next->second;
+        free_ranges_.erase( next );
+    }
+
+    if ( it != free_ranges_.begin() )
+    {
+        FreeRangeMap::iterator previous = it;
+        --previous;
+
+        if ( previous->first + previous->second == it->first )
+        {
+            previous->second += it->second;
+            free_ranges_.erase( it );
+        }
+    }
+}
+
+void ChunkVertexArena::upload( const GLint first_vertex, const BlockVertexV& vertices )
+{
+    glBindBuffer( GL_ARRAY_BUFFER, vbo_id_ );
+    glBufferSubData( GL_ARRAY_BUFFER, first_vertex * sizeof( BlockVertex ), vertices.size() * sizeof( BlockVertex ), &vertices[0] );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+void ChunkVertexArena::draw( const GLintV& first_vertices, const GLsizeiV& num_indices )
+{
+    assert( first_vertices.size() == num_indices.size() );
+
+    if ( first_vertices.empty() )
+    {
+        return;
+    }
+
+    // Every draw starts at the beginning of the quad indices, and is offset to its own
+    // vertices by its base vertex.
+    index_offsets_.resize( first_vertices.size(), 0 );
+
+    glBindVertexArray( vao_id_ );
+    glMultiDrawElementsBaseVertex(
+        GL_TRIANGLES,
+        &num_indices[0],
+        GL_UNSIGNED_INT,
+        &index_offsets_[0],
+        first_vertices.size(),
+        &first_vertices[0]
+    );
+    glBindVertexArray( 0 );
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for ChunkVertexPool:
+//////////////////////////////////////////////////////////////////////////////////
+
+const GLsizei ChunkVertexPool::ARENA_CAPACITY;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkVertexPool:
+//////////////////////////////////////////////////////////////////////////////////
+
+ChunkVertexPool::ChunkVertexPool()
+{
+    // No Chunk can possibly have more faces than this.
+    const unsigned max_faces = Chunk::SIZE_X * Chunk::SIZE_Y * Chunk::SIZE_Z * NUM_CARDINAL_RELATIONS;
+
+    std::vector<VertexBuffer::Index> indices;
+    indices.reserve( max_faces * ChunkMesh::INDICES_PER_FACE );
+    ChunkMesh::get_face_indices( 0, max_faces, indices );
+
+    glGenBuffers( 1, &quad_ibo_id_ );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, quad_ibo_id_ );
+    set_buffer_data( GL_ELEMENT_ARRAY_BUFFER, indices, GL_STATIC_DRAW );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+}
+
+ChunkVertexPool::~ChunkVertexPool()
+{
+    arenas_.clear();
+    glDeleteBuffers( 1, &quad_ibo_id_ );
+}
+
+ChunkVertexAllocation ChunkVertexPool::allocate( const BlockVertexV& vertices )
+{
+    assert( !vertices.empty() );
+
+    ChunkVertexAllocation allocation;
+    allocation.num_vertices_ = vertices.size();
+
+    BOOST_FOREACH( const ChunkVertexArenaSP& arena, arenas_ )
+    {
+        if ( arena->allocate( allocation.num_vertices_, allocation.first_vertex_ ) )
+        {
+            allocation.arena_ = arena.get();
+            break;
+        }
+    }
+
+    if ( !allocation.arena_ )
+    {
+        arenas_.push_back( ChunkVertexArenaSP( new ChunkVertexArena( ARENA_CAPACITY, quad_ibo_id_ ) ) );
+        allocation.arena_ = arenas_.back().get();
+
+        const bool allocated = allocation.arena_->allocate( allocation.num_vertices_, allocation.first_vertex_ );
+        assert( allocated );
+    }
+
+    allocation.arena_->upload( allocation.first_vertex_, vertices );
+    return allocation;
+}
+
+void ChunkVertexPool::free( ChunkVertexAllocation& allocation )
+{
+    if ( allocation.arena_ )
+    {
+        allocation.arena_->free( allocation.first_vertex_, allocation.num_vertices_ );
+        allocation = ChunkVertexAllocation();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for ChunkVertexBufferPool:
+//////////////////////////////////////////////////////////////////////////////////
+
+const unsigned ChunkVertexBufferPool::REUSE_DELAY_FRAMES;
+const size_t ChunkVertexBufferPool::MAX_FREE_BUFFERS_PER_CAPACITY;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkVertexBufferPool:
+//////////////////////////////////////////////////////////////////////////////////
+
+ChunkVertexBufferPool::ChunkVertexBufferPool() :
+    frame_( 0 )
+{
+}
+
+SortableChunkVertexBufferSP ChunkVertexBufferPool::acquire( const GLsizeiptr vertex_bytes )
+{
+    FreeBufferMap::iterator free_it = free_buffers_.find( get_buffer_capacity( vertex_bytes ) );
+
+    if ( free_it == free_buffers_.end() || free_it->second.empty() )
+    {
+        return SortableChunkVertexBufferSP( new SortableChunkVertexBuffer );
+    }
+
+    SortableChunkVertexBufferSP buffer = free_it->second.back();
+    free_it->second.pop_back();
+    return buffer;
+}
+
+void ChunkVertexBufferPool::release( SortableChunkVertexBufferSP& buffer )
+{
+    if ( buffer )
+    {
+        released_buffers_.push_back( std::make_pair( frame_, buffer ) );
+        buffer.reset();
+    }
+}
+
+void ChunkVertexBufferPool::next_frame()
+{
+    ++frame_;
+
+    while ( !released_buffers_.empty() && frame_ - released_buffers_.front().first >= REUSE_DELAY_FRAMES )
+    {
+        const SortableChunkVertexBufferSP& buffer = released_buffers_.front().second;
+        std::vector<SortableChunkVertexBufferSP>& free_buffers = free_buffers_[buffer->get_vertex_capacity()];
+
+        if ( free_buffers.size() < MAX_FREE_BUFFERS_PER_CAPACITY )
+        {
+            free_buffers.push_back( buffer );
+        }
+
+        released_buffers_.pop_front();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for ChunkRenderer:
+//////////////////////////////////////////////////////////////////////////////////
+
+const size_t ChunkRenderer::RENDERERS_PER_SLAB;
+
+SlabAllocator ChunkRenderer::allocator_( sizeof( ChunkRenderer ), RENDERERS_PER_SLAB );
+
 //////////////////////////////////////////////////////////////////////////////////
 // Function definitions for ChunkRenderer:
 //////////////////////////////////////////////////////////////////////////////////
 
-ChunkRenderer::ChunkRenderer( const Vector3f& centroid, const AABoxf& aabb ) :
-    aabb_vbo_( aabb ),
+ChunkRenderer::ChunkRenderer(
+    ChunkVertexPool& vertex_pool,
+    ChunkVertexBufferPool& translucent_buffer_pool,
+    const Vector3f& mesh_origin,
+    const Vector3f& centroid,
+    const AABoxf& aabb
+) :
+    vertex_pool_( vertex_pool ),
+    translucent_buffer_pool_( translucent_buffer_pool ),
     centroid_( centroid ),
     aabb_( aabb ),
-    num_triangles_( 0 )
+    mesh_origin_( mesh_origin ),
+    level_of_detail_( 0 ),
+    num_triangles_( 0 ),
+    num_unmerged_triangles_( 0 )
 {
 }
 
-void ChunkRenderer::render_opaque()
+ChunkRenderer::~ChunkRenderer()
 {
-    if ( opaque_vbo_ )
-    {
-        opaque_vbo_->render();
-    }
+    vertex_pool_.free( opaque_allocation_ );
+    translucent_buffer_pool_.release( translucent_vbo_ );
 }
 
 void ChunkRenderer::render_translucent( const Camera& camera )
@@ -355,59 +791,104 @@ void ChunkRenderer::render_translucent( const Camera& camera )
 
 void ChunkRenderer::render_aabb()
 {
-    aabb_vbo_.render();
+    if ( !aabb_vbo_ )
+    {
+        aabb_vbo_.reset( new AABoxVertexBuffer( aabb_ ) );
+    }
+
+    aabb_vbo_->render();
 }
 
-void ChunkRenderer::rebuild( const Chunk& chunk )
+void ChunkRenderer::upload( const ChunkMeshSP& chunk_mesh, const unsigned level_of_detail )
 {
-    BlockFaceV faces = chunk.get_external_faces();
-    num_triangles_ = faces.size() * 2; // Two triangles per (square) face.
+    mesh_ = chunk_mesh;
+    level_of_detail_ = level_of_detail;
+    const ChunkMesh& mesh = chunk_mesh->get_level_of_detail( level_of_detail );
 
-    BlockVertexV
-        opaque_vertices,
-        translucent_vertices;
+    num_triangles_ = mesh.num_triangles_;
+    num_unmerged_triangles_ = mesh.num_unmerged_triangles_;
 
-    // Although each vertex specifies its own texture ID, and thus the faces can be drawn in
-    // any order, it makes sense to group them together by texture, under the assumption that
-    // this will be more friendly to the GPU's texture cache.
+    vertex_pool_.free( opaque_allocation_ );
 
-    std::sort( faces.begin(), faces.end(), face_material_order );
+    if ( !mesh.opaque_vertices_.empty() )
+    {
+        opaque_allocation_ = vertex_pool_.allocate( mesh.opaque_vertices_ );
+    }
 
-    BOOST_FOREACH( const BlockFace& face, faces )
+    // The existing buffer is refilled in place if it's big enough; otherwise it's traded in
+    // for one from the pool that is.
+
+    if ( !mesh.translucent_vertices_.empty() )
     {
-        const BlockMaterial material = face.material_;
+        const GLsizeiptr vertex_bytes = mesh.translucent_vertices_.size() * sizeof( BlockVertex );
 
-        if ( get_block_material_attributes( material ).translucent_ )
+        if ( !translucent_vbo_ || translucent_vbo_->get_vertex_capacity() < vertex_bytes )
         {
-            get_vertices_for_face( face, translucent_vertices );
+            translucent_buffer_pool_.release( translucent_vbo_ );
+            translucent_vbo_ = translucent_buffer_pool_.acquire( vertex_bytes );
         }
-        else get_vertices_for_face( face, opaque_vertices );
-    }
 
-    if ( !opaque_vertices.empty() )
-    {
-        opaque_vbo_.reset( new ChunkVertexBuffer( opaque_vertices ) );
+        translucent_vbo_->set_data( mesh.translucent_vertices_, mesh.translucent_centroids_ );
     }
-    else opaque_vbo_.reset();
+    else translucent_buffer_pool_.release( translucent_vbo_ );
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkRegion:
+//////////////////////////////////////////////////////////////////////////////////
+
+ChunkRenderer* ChunkRegion::find( const Vector3i& chunk_position ) const
+{
+    ChunkRendererMap::const_iterator it = chunk_renderers_.find( chunk_position );
+    return it == chunk_renderers_.end() ? 0 : it->second.get();
+}
+
+void ChunkRegion::insert( const Vector3i& chunk_position, ChunkRendererSP chunk_renderer )
+{
+    chunk_renderers_.insert( std::make_pair( chunk_position, chunk_renderer ) );
+    update_aabb();
+}
+
+void ChunkRegion::erase( const Vector3i& chunk_position )
+{
+    chunk_renderers_.erase( chunk_position );
+    update_aabb();
+}
 
-    if ( !translucent_vertices.empty() )
+ChunkLightTexture& ChunkRegion::get_light_texture()
+{
+    if ( !light_texture_ )
     {
-        translucent_vbo_.reset( new SortableChunkVertexBuffer( translucent_vertices ) );
+        light_texture_.reset( new ChunkLightTexture );
     }
-    else translucent_vbo_.reset();
+
+    return *light_texture_;
 }
 
-void ChunkRenderer::get_vertices_for_face( const BlockFace& face, BlockVertexV& vertices ) const
+void ChunkRegion::update_aabb()
 {
-    const BlockFace::Vertex* v = face.vertices_;
-    const Vector3f& n = face.normal_;
-    const Vector3f& t = face.tangent_;
-    const Scalar m = face.material_;
+    if ( chunk_renderers_.empty() )
+    {
+        aabb_ = AABoxf();
+        return;
+    }
 
-    vertices.push_back( BlockVertex( v[0].position_, n, t, Vector3f( 0.0f, 0.0f, m ), v[0].lighting_, v[0].sunlighting_ ) );
-    vertices.push_back( BlockVertex( v[1].position_, n, t, Vector3f( 1.0f, 0.0f, m ), v[1].lighting_, v[1].sunlighting_ ) );
-    vertices.push_back( BlockVertex( v[2].position_, n, t, Vector3f( 1.0f, 1.0f, m ), v[2].lighting_, v[2].sunlighting_ ) );
-    vertices.push_back( BlockVertex( v[3].position_, n, t, Vector3f( 0.0f, 1.0f, m ), v[3].lighting_, v[3].sunlighting_ ) );
+    Vector3f
+        min = chunk_renderers_.begin()->second->get_aabb().getMin(),
+        max = chunk_renderers_.begin()->second->get_aabb().getMax();
+
+    BOOST_FOREACH( const ChunkRendererMap::value_type& chunk_renderer_it, chunk_renderers_ )
+    {
+        const AABoxf& aabb = chunk_renderer_it.second->get_aabb();
+
+        for ( int i = 0; i < 3; ++i )
+        {
+            min[i] = std::min( min[i], aabb.getMin()[i] );
+            max[i] = std::max( max[i], aabb.getMax()[i] );
+        }
+    }
+
+    aabb_ = AABoxf( min, max );
 }
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -546,14 +1027,16 @@ SkyRenderer::SkyRenderer() :
     skydome_shader_( RendererMaterialManager::SHADER_DIRECTORY + "/skydome.vertex.glsl",
                      RendererMaterialManager::SHADER_DIRECTORY + "/skydome.fragment.glsl" )
 {
+    skydome_shader_.bind_uniform_block( FrameUniformBlock::NAME, FrameUniformBlock::BINDING );
+    skydome_shader_.enable();
+    skydome_shader_.set_uniform( skydome_shader_.get_uniform<float>( "skydome_radius" ), SkydomeVertexBuffer::RADIUS );
+    skydome_shader_.disable();
 }
 
 void SkyRenderer::render( const Sky& sky )
 {
+    // The zenith and horizon colors come from the FrameUniforms block.
     skydome_shader_.enable();
-    skydome_shader_.set_uniform_float( "skydome_radius", SkydomeVertexBuffer::RADIUS );
-    skydome_shader_.set_uniform_vec3f( "zenith_color", sky.get_zenith_color() );
-    skydome_shader_.set_uniform_vec3f( "horizon_color", sky.get_horizon_color() );
     skydome_vbo_.render();
     skydome_shader_.disable();
 
@@ -614,59 +1097,187 @@ void SkyRenderer::render_celestial_body( const GLuint texture_id, const Vector3f
     glBindTexture( GL_TEXTURE_2D, 0 );
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for GpuZoneTimer:
+//////////////////////////////////////////////////////////////////////////////////
+
+GpuZoneTimer::GpuZoneTimer( const char* name ) :
+    name_( name ),
+    supported_( glewIsSupported( "GL_ARB_timer_query" ) ),
+    measuring_( false ),
+    next_query_( 0 ),
+    num_pending_queries_( 0 )
+{
+    if ( supported_ )
+    {
+        glGenQueries( NUM_QUERIES, queries_ );
+    }
+    else LOG( "GPU timer queries are not supported, so \"" << name_ << "\" won't be measured." );
+}
+
+GpuZoneTimer::~GpuZoneTimer()
+{
+    if ( supported_ )
+    {
+        glDeleteQueries( NUM_QUERIES, queries_ );
+    }
+}
+
+void GpuZoneTimer::begin()
+{
+    if ( !supported_ )
+    {
+        return;
+    }
+
+    collect_results();
+
+    // If all of the queries are still in flight, this frame just isn't measured.
+    if ( num_pending_queries_ < NUM_QUERIES )
+    {
+        begin_times_[next_query_] = Profiler::get_thread().get_time();
+        glBeginQuery( GL_TIME_ELAPSED, queries_[next_query_] );
+        measuring_ = true;
+    }
+}
+
+void GpuZoneTimer::end()
+{
+    if ( measuring_ )
+    {
+        glEndQuery( GL_TIME_ELAPSED );
+        next_query_ = ( next_query_ + 1 ) % NUM_QUERIES;
+        ++num_pending_queries_;
+        measuring_ = false;
+    }
+}
+
+void GpuZoneTimer::collect_results()
+{
+    // The queries complete in the order they were issued.
+    while ( num_pending_queries_ > 0 )
+    {
+        const unsigned query = ( next_query_ + NUM_QUERIES - num_pending_queries_ ) % NUM_QUERIES;
+
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv( queries_[query], GL_QUERY_RESULT_AVAILABLE, &available );
+
+        if ( !available )
+        {
+            break;
+        }
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v( queries_[query], GL_QUERY_RESULT, &nanoseconds );
+        Profiler::record_gpu_zone( name_, begin_times_[query], double( nanoseconds ) * 1e-9 );
+        --num_pending_queries_;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Function definitions for Renderer:
 //////////////////////////////////////////////////////////////////////////////////
 
 Renderer::Renderer() :
+    max_chunk_height_( 0 ),
+#ifdef DISABLE_LEVEL_OF_DETAIL
+    level_of_detail_enabled_( false ),
+#else
+    level_of_detail_enabled_( true ),
+#endif
+    levels_of_detail_outdated_( true ),
+    chunk_gpu_timer_( "Rendering chunks (GPU)" ),
     num_chunks_drawn_( 0 ),
-    num_triangles_drawn_( 0 )
+    num_chunks_frustum_culled_( 0 ),
+    num_chunks_occlusion_culled_( 0 ),
+    num_triangles_drawn_( 0 ),
+    num_unmerged_triangles_drawn_( 0 )
 {
 }
 
 void Renderer::note_chunk_changes( const Chunk& chunk )
 {
-    ChunkRendererMap::iterator chunk_renderer_it = chunk_renderers_.find( chunk.get_position() );
+    const Vector3i& position = chunk.get_position();
+    const ChunkMeshSP mesh = chunk.get_mesh();
+    const ChunkLightVolumeSP light_volume = chunk.get_light_volume();
 
-    if ( chunk_renderer_it == chunk_renderers_.end() )
+    if ( light_volume )
     {
-        if ( !chunk.get_external_faces().empty() )
-        {
-            const Vector3f centroid =
-                vector_cast<Scalar>( chunk.get_position() ) +
-                vector_cast<Scalar>( Chunk::SIZE ) / 2.0f;
+        chunk_light_volumes_[position] = light_volume;
+        pending_light_volumes_.insert( position );
+    }
+    else
+    {
+        chunk_light_volumes_.erase( position );
+        pending_light_volumes_.erase( position );
+    }
 
-            const Vector3f chunk_min = vector_cast<Scalar>( chunk.get_position() );
-            const Vector3f chunk_max = chunk_min + vector_cast<Scalar>( Chunk::SIZE );
-            const AABoxf aabb( chunk_min, chunk_max );
+    // With texture lighting, a change in lighting alone leaves the mesh as it was, and then
+    // only the light volume has to be uploaded.  Otherwise, if the Chunk changed again before
+    // its last mesh was uploaded, the old mesh is skipped.
+    const ChunkRenderer* chunk_renderer = find_chunk_renderer( position );
 
-            ChunkRendererSP renderer( new ChunkRenderer( centroid, aabb ) );
-            renderer->rebuild( chunk );
-            chunk_renderers_.insert( std::make_pair( chunk.get_position(), renderer ) );
-        }
-    }
-    else if ( chunk.get_external_faces().empty() )
+    if ( !chunk_renderer || chunk_renderer->get_mesh() != mesh )
     {
-        chunk_renderers_.erase( chunk_renderer_it );
+        pending_chunk_meshes_[position] = mesh;
     }
-    else chunk_renderer_it->second->rebuild( chunk );
+
+    // The connectivity is needed right away, since the Chunks that are hidden behind
+    // this one may need to be culled (or revealed) even before its mesh is uploaded.
+    chunk_connectivity_[position] = mesh->connectivity_;
+    max_chunk_height_ = std::max( max_chunk_height_, position[1] );
+}
+
+void Renderer::note_chunk_removal( const Vector3i& position )
+{
+    erase_chunk_renderer( position );
+    pending_chunk_meshes_.erase( position );
+    chunk_light_volumes_.erase( position );
+    pending_light_volumes_.erase( position );
+    chunk_connectivity_.erase( position );
+}
+
+void Renderer::set_level_of_detail_enabled( const bool level_of_detail_enabled )
+{
+    level_of_detail_enabled_ = level_of_detail_enabled;
+    levels_of_detail_outdated_ = true;
 }
 
 #ifdef DEBUG_COLLISIONS
-void Renderer::render( const SDL_GL_Window& window, const Camera& camera, const World& world, const Player& player )
+void Renderer::render(
+    const SDL_GL_Window& window,
+    const Camera& camera,
+    const Sky& sky,
+    const EntitySystem::DebugCollisionV& debug_collisions,
+    const AABoxf& player_aabb
+)
 #else
-void Renderer::render( const SDL_GL_Window& window, const Camera& camera, const World& world )
+void Renderer::render( const SDL_GL_Window& window, const Camera& camera, const Sky& sky )
 #endif
 {
+    translucent_buffer_pool_.next_frame();
+    upload_light_volumes();
+    upload_chunk_meshes( camera );
+
     glClear( GL_DEPTH_BUFFER_BIT );
 
+    material_manager_.update_frame_uniforms( camera, sky );
+
     glPushMatrix();
         camera.rotate();
-        render_sky( world.get_sky() );
+        SCOPE_TIMER_BEGIN( "Rendering sky" )
+        render_sky( sky );
+        SCOPE_TIMER_END
+
         camera.translate();
-        render_chunks( camera, world.get_sky() );
+
+        SCOPE_TIMER_BEGIN( "Rendering chunks" )
+        chunk_gpu_timer_.begin();
+        render_chunks( camera );
+        chunk_gpu_timer_.end();
+        SCOPE_TIMER_END
 #ifdef DEBUG_COLLISIONS
-        render_collisions( player );
+        render_collisions( debug_collisions, player_aabb );
 #endif
 
     glPopMatrix();
@@ -674,12 +1285,310 @@ void Renderer::render( const SDL_GL_Window& window, const Camera& camera, const
     render_crosshairs( window );
 }
 
+ChunkRenderer* Renderer::find_chunk_renderer( const Vector3i& position )
+{
+    ChunkRegionMap::iterator region_it = chunk_regions_.find( ChunkMesh::get_origin( position ) );
+    return region_it == chunk_regions_.end() ? 0 : region_it->second.find( position );
+}
+
+void Renderer::erase_chunk_renderer( const Vector3i& position )
+{
+    ChunkRegionMap::iterator region_it = chunk_regions_.find( ChunkMesh::get_origin( position ) );
+
+    if ( region_it != chunk_regions_.end() )
+    {
+        region_it->second.erase( position );
+
+        if ( region_it->second.get_chunk_renderers().empty() )
+        {
+            chunk_regions_.erase( region_it );
+        }
+    }
+}
+
+unsigned Renderer::choose_level_of_detail( const Scalar distance, const ChunkRenderer* chunk_renderer ) const
+{
+    if ( !level_of_detail_enabled_ )
+    {
+        return 0;
+    }
+
+    const unsigned
+        max_level = ChunkMesh::NUM_LEVELS_OF_DETAIL - 1,
+        level = std::min( unsigned( distance / LEVEL_OF_DETAIL_DISTANCE ), max_level );
+
+    // The Chunk keeps its current level of detail if it would be chosen anywhere within the
+    // hysteresis distance.
+
+    if ( chunk_renderer )
+    {
+        const unsigned
+            current_level = chunk_renderer->get_level_of_detail(),
+            near_level = std::min( unsigned( std::max( distance - LEVEL_OF_DETAIL_HYSTERESIS, 0.0f ) / LEVEL_OF_DETAIL_DISTANCE ), max_level ),
+            far_level = std::min( unsigned( ( distance + LEVEL_OF_DETAIL_HYSTERESIS ) / LEVEL_OF_DETAIL_DISTANCE ), max_level );
+
+        if ( current_level >= near_level && current_level <= far_level )
+        {
+            return current_level;
+        }
+    }
+
+    return level;
+}
+
+void Renderer::update_levels_of_detail( const Camera& camera )
+{
+    const Scalar distance_moved = gmtl::length( Vector3f( camera.get_position() - level_of_detail_position_ ) );
+
+    if ( !levels_of_detail_outdated_ && distance_moved < LEVEL_OF_DETAIL_UPDATE_DISTANCE )
+    {
+        return;
+    }
+
+    // Chunks whose level of detail should change have their existing meshes queued up for
+    // upload again, so the switch is subject to the same budget as any other upload.
+
+    BOOST_FOREACH( const ChunkRegionMap::value_type& region_it, chunk_regions_ )
+    {
+        BOOST_FOREACH( const ChunkRendererMap::value_type& chunk_renderer_it, region_it.second.get_chunk_renderers() )
+        {
+            const ChunkRenderer& chunk_renderer = *chunk_renderer_it.second;
+            const Scalar distance = gmtl::length( Vector3f( chunk_renderer.get_centroid() - camera.get_position() ) );
+
+            if ( choose_level_of_detail( distance, &chunk_renderer ) != chunk_renderer.get_level_of_detail() &&
+                 pending_chunk_meshes_.find( chunk_renderer_it.first ) == pending_chunk_meshes_.end() )
+            {
+                pending_chunk_meshes_[chunk_renderer_it.first] = chunk_renderer.get_mesh();
+            }
+        }
+    }
+
+    level_of_detail_position_ = camera.get_position();
+    levels_of_detail_outdated_ = false;
+}
+
+void Renderer::upload_light_volumes()
+{
+    // Each of these is a small upload, and is what makes a change in lighting visible, so
+    // they aren't held to the mesh upload budget.  A Chunk that doesn't have a ChunkRenderer
+    // yet uploads its light volume when it gets one.
+
+    BOOST_FOREACH( const Vector3i& position, pending_light_volumes_ )
+    {
+        ChunkRegionMap::iterator region_it = chunk_regions_.find( ChunkMesh::get_origin( position ) );
+
+        if ( region_it != chunk_regions_.end() && region_it->second.find( position ) )
+        {
+            region_it->second.get_light_texture().upload( position, *chunk_light_volumes_[position] );
+        }
+    }
+
+    pending_light_volumes_.clear();
+}
+
+void Renderer::upload_chunk_meshes( const Camera& camera )
+{
+    update_levels_of_detail( camera );
+
+    if ( pending_chunk_meshes_.empty() )
+    {
+        return;
+    }
+
+    SCOPE_TIMER_BEGIN( "Uploading chunk meshes" )
+
+    DistanceMeshPairV meshes;
+    meshes.reserve( pending_chunk_meshes_.size() );
+
+    for ( ChunkMeshMap::iterator it = pending_chunk_meshes_.begin(); it != pending_chunk_meshes_.end(); ++it )
+    {
+        const Vector3f centroid = vector_cast<Scalar>( it->first ) + vector_cast<Scalar>( Chunk::SIZE ) / 2.0f;
+        meshes.push_back( std::make_pair( gmtl::lengthSquared( Vector3f( centroid - camera.get_position() ) ), it ) );
+    }
+
+    std::sort( meshes.begin(), meshes.end(), distance_mesh_order );
+
+    // At least one mesh is uploaded per frame, so that progress is always made.
+
+    HighResolutionTimer upload_timer;
+
+    BOOST_FOREACH( const DistanceMeshPair& distance_mesh, meshes )
+    {
+        const Vector3i& position = distance_mesh.second->first;
+        const ChunkMeshSP& mesh = distance_mesh.second->second;
+
+        if ( mesh->empty() )
+        {
+            erase_chunk_renderer( position );
+        }
+        else
+        {
+            ChunkRenderer* chunk_renderer = find_chunk_renderer( position );
+
+            if ( !chunk_renderer )
+            {
+                const Vector3f chunk_min = vector_cast<Scalar>( position );
+                const Vector3f chunk_max = chunk_min + vector_cast<Scalar>( Chunk::SIZE );
+                const Vector3f centroid = chunk_min + vector_cast<Scalar>( Chunk::SIZE ) / 2.0f;
+
+                const Vector3i mesh_origin = ChunkMesh::get_origin( position );
+
+                ChunkRendererSP new_chunk_renderer(
+                    new ChunkRenderer(
+                        chunk_vertex_pool_,
+                        translucent_buffer_pool_,
+                        vector_cast<Scalar>( mesh_origin ),
+                        centroid,
+                        AABoxf( chunk_min, chunk_max )
+                    )
+                );
+                ChunkRegion& region = chunk_regions_[mesh_origin];
+                region.insert( position, new_chunk_renderer );
+                chunk_renderer = new_chunk_renderer.get();
+
+                ChunkLightVolumeMap::const_iterator light_volume_it = chunk_light_volumes_.find( position );
+
+                if ( light_volume_it != chunk_light_volumes_.end() )
+                {
+                    region.get_light_texture().upload( position, *light_volume_it->second );
+                }
+            }
+
+            const Scalar distance = gmtl::Math::sqrt( distance_mesh.first );
+            chunk_renderer->upload( mesh, choose_level_of_detail( distance, chunk_renderer ) );
+        }
+
+        pending_chunk_meshes_.erase( distance_mesh.second );
+
+        if ( upload_timer.get_seconds_elapsed() >= MESH_UPLOAD_BUDGET )
+        {
+            break;
+        }
+    }
+
+    SCOPE_TIMER_END
+}
+
+void Renderer::find_visible_chunks(
+    const Camera& camera,
+    const gmtl::Frustumf& view_frustum,
+    ChunkVisibilityMap& visible_chunks
+) const
+{
+    // This walks outwards from the Chunk containing the Camera, stepping from each Chunk into
+    // its neighbors only through the faces that can be seen from the face it was entered by.
+    // So that the walk heads away from the Camera, it never moves in the direction opposite
+    // to one it's already moved in.  Any Chunk that isn't reached can't possibly be visible.
+
+    const Vector3f& camera_position = camera.get_position();
+    Vector3i camera_chunk;
+
+    for ( int i = 0; i < Vector3i::Size; ++i )
+    {
+        camera_chunk[i] = int( std::floor( camera_position[i] / Chunk::SIZE[i] ) ) * Chunk::SIZE[i];
+    }
+
+    const int
+        min_height = std::min( 0, camera_chunk[1] ),
+        max_height = std::max( max_chunk_height_, camera_chunk[1] );
+
+    const Scalar max_distance = camera.get_draw_distance() + Chunk::SIZE_X;
+    const Vector3f chunk_extent = vector_cast<Scalar>( Chunk::SIZE );
+
+    std::deque<VisibilityStep> steps;
+    steps.push_back( VisibilityStep( camera_chunk, NUM_CARDINAL_RELATIONS, 0 ) );
+    visible_chunks[camera_chunk] = true;
+
+    while ( !steps.empty() )
+    {
+        const VisibilityStep step = steps.front();
+        steps.pop_front();
+
+        ChunkConnectivityMap::const_iterator connectivity_it = chunk_connectivity_.find( step.position_ );
+        const ChunkFaceConnectivity connectivity =
+            connectivity_it == chunk_connectivity_.end() ? ChunkFaceConnectivity() : connectivity_it->second;
+
+        FOREACH_CARDINAL_RELATION( exit_face )
+        {
+            if ( step.directions_ & ( 1 << cardinal_relation_reverse( exit_face ) ) )
+            {
+                continue;
+            }
+
+            if ( step.entry_face_ != NUM_CARDINAL_RELATIONS && !connectivity.are_connected( step.entry_face_, exit_face ) )
+            {
+                continue;
+            }
+
+            const Vector3i relation = cardinal_relation_vector( exit_face );
+            const Vector3i neighbor(
+                step.position_[0] + relation[0] * Chunk::SIZE_X,
+                step.position_[1] + relation[1] * Chunk::SIZE_Y,
+                step.position_[2] + relation[2] * Chunk::SIZE_Z
+            );
+
+            if ( neighbor[1] < min_height || neighbor[1] > max_height ||
+                 visible_chunks.find( neighbor ) != visible_chunks.end() )
+            {
+                continue;
+            }
+
+            const Vector3f neighbor_min = vector_cast<Scalar>( neighbor );
+            const Vector3f neighbor_to_camera = neighbor_min + chunk_extent / 2.0f - camera_position;
+
+            if ( gmtl::lengthSquared( neighbor_to_camera ) > max_distance * max_distance ||
+                 get_frustum_containment( view_frustum, AABoxf( neighbor_min, neighbor_min + chunk_extent ) ) == OUTSIDE_FRUSTUM )
+            {
+                continue;
+            }
+
+            visible_chunks[neighbor] = true;
+            steps.push_back( VisibilityStep( neighbor, cardinal_relation_reverse( exit_face ), step.directions_ | ( 1 << exit_face ) ) );
+        }
+    }
+}
+
+void Renderer::add_draw_batches(
+    const ChunkRegion& region,
+    DistanceChunkPairV& region_chunks,
+    ChunkDrawBatchV& batches,
+    DistanceIndexV& batch_order
+)
+{
+    // The Chunks within each batch are drawn front-to-back, and the batches are ordered by
+    // their nearest Chunks.  Nearly all of the Chunks in a region will share one arena.
+
+    std::sort( region_chunks.begin(), region_chunks.end() );
+    const size_t first_batch = batches.size();
+
+    BOOST_FOREACH( const DistanceChunkPair& distance_chunk, region_chunks )
+    {
+        const ChunkVertexAllocation& allocation = distance_chunk.second->get_opaque_allocation();
+        size_t batch_index = first_batch;
+
+        while ( batch_index < batches.size() && batches[batch_index].arena_ != allocation.arena_ )
+        {
+            ++batch_index;
+        }
+
+        if ( batch_index == batches.size() )
+        {
+            batches.push_back( ChunkDrawBatch( distance_chunk.second->get_mesh_origin(), region.find_light_texture(), allocation.arena_ ) );
+            batch_order.push_back( std::make_pair( distance_chunk.first, batch_index ) );
+        }
+
+        ChunkDrawBatch& batch = batches[batch_index];
+        batch.first_vertices_.push_back( allocation.first_vertex_ );
+        batch.num_indices_.push_back( allocation.num_vertices_ / ChunkMesh::VERTICES_PER_FACE * ChunkMesh::INDICES_PER_FACE );
+    }
+}
+
 void Renderer::render_sky( const Sky& sky )
 {
     sky_renderer_.render( sky );
 }
 
-void Renderer::render_chunks( const Camera& camera, const Sky& sky )
+void Renderer::render_chunks( const Camera& camera )
 {
     // TODO: Decompose this function.
 
@@ -688,32 +1597,62 @@ void Renderer::render_chunks( const Camera& camera, const Sky& sky )
         get_opengl_matrix( GL_PROJECTION_MATRIX )
     );
 
-    typedef std::pair<Scalar, ChunkRenderer*> DistanceChunkPair;
-    typedef std::vector<DistanceChunkPair> DistanceChunkPairV;
-
-    DistanceChunkPairV
-        opaque_chunks,
-        translucent_chunks;
+    DistanceChunkPairV translucent_chunks;
+    ChunkDrawBatchV opaque_batches;
+    DistanceIndexV opaque_batch_order;
 
 #ifdef DEBUG_CHUNKS
     DistanceChunkPairV debug_chunks;
 #endif
 
     num_chunks_drawn_ = 0;
+    num_chunks_frustum_culled_ = 0;
+    num_chunks_occlusion_culled_ = 0;
     num_triangles_drawn_ = 0;
+    num_unmerged_triangles_drawn_ = 0;
 
-    BOOST_FOREACH( const ChunkRendererMap::value_type& chunk_renderer_it, chunk_renderers_ )
+    ChunkVisibilityMap visible_chunks;
+    find_visible_chunks( camera, view_frustum, visible_chunks );
+
+    BOOST_FOREACH( const ChunkRegionMap::value_type& region_it, chunk_regions_ )
     {
-        ChunkRenderer& chunk_renderer = *chunk_renderer_it.second.get();
+        const ChunkRegion& region = region_it.second;
+        const FrustumContainment region_containment = get_frustum_containment( view_frustum, region.get_aabb() );
+
+        if ( region_containment == OUTSIDE_FRUSTUM )
+        {
+            num_chunks_frustum_culled_ += region.get_chunk_renderers().size();
+            continue;
+        }
 
-        // TODO: Arrange the chunks into some kind of hierarchy and cull based on that.
-        if ( gmtl::isInVolume( view_frustum, chunk_renderer.get_aabb() ) )
+        DistanceChunkPairV region_opaque_chunks;
+
+        BOOST_FOREACH( const ChunkRendererMap::value_type& chunk_renderer_it, region.get_chunk_renderers() )
         {
+            ChunkRenderer& chunk_renderer = *chunk_renderer_it.second.get();
+
+            // If the whole region is inside of the frustum, its Chunks don't need to be tested.
+            if ( region_containment == INTERSECTS_FRUSTUM &&
+                 get_frustum_containment( view_frustum, chunk_renderer.get_aabb() ) == OUTSIDE_FRUSTUM )
+            {
+                ++num_chunks_frustum_culled_;
+                continue;
+            }
+
+            if ( visible_chunks.find( chunk_renderer_it.first ) == visible_chunks.end() )
+            {
+                ++num_chunks_occlusion_culled_;
+                continue;
+            }
+
             const Vector3f camera_to_centroid = camera.get_position() - chunk_renderer.get_centroid();
             const Scalar distance_squared = gmtl::lengthSquared( camera_to_centroid );
             const DistanceChunkPair distance_chunk = std::make_pair( distance_squared, &chunk_renderer );
 
-            opaque_chunks.push_back( distance_chunk );
+            if ( chunk_renderer.has_opaque_materials() )
+            {
+                region_opaque_chunks.push_back( distance_chunk );
+            }
 
             if ( chunk_renderer.has_translucent_materials() )
             {
@@ -725,24 +1664,36 @@ void Renderer::render_chunks( const Camera& camera, const Sky& sky )
 #endif
             ++num_chunks_drawn_;
             num_triangles_drawn_ += chunk_renderer.get_num_triangles();
+            num_unmerged_triangles_drawn_ += chunk_renderer.get_num_unmerged_triangles();
         }
+
+        add_draw_batches( region, region_opaque_chunks, opaque_batches, opaque_batch_order );
     }
 
-    material_manager_.configure_materials( camera, sky );
+    const bool texture_lighting = Chunk::get_texture_lighting();
+    material_manager_.configure_materials( texture_lighting );
 
     glEnable( GL_CULL_FACE );
     glEnable( GL_DEPTH_TEST );
     glDepthFunc( GL_LEQUAL );
 
-    // The opaque materials are rendered first, in front-to-back order.  This results in
-    // many of the farthest chunks being fully occluded, and thus their fragments will be
+    // The opaque materials are rendered first, in (roughly) front-to-back order.  This results
+    // in many of the farthest chunks being fully occluded, and thus their fragments will be
     // rejected without running any expensive fragment shaders.
 
-    std::sort( opaque_chunks.begin(), opaque_chunks.end() );
+    std::sort( opaque_batch_order.begin(), opaque_batch_order.end() );
 
-    BOOST_FOREACH( const DistanceChunkPair& it, opaque_chunks )
+    BOOST_FOREACH( const DistanceIndex& distance_index, opaque_batch_order )
     {
-        it.second->render_opaque();
+        ChunkDrawBatch& batch = opaque_batches[distance_index.second];
+        material_manager_.set_mesh_origin( batch.mesh_origin_ );
+
+        if ( texture_lighting )
+        {
+            material_manager_.set_light_texture( batch.light_texture_ );
+        }
+
+        batch.arena_->draw( batch.first_vertices_, batch.num_indices_ );
     }
 
     glDisable( GL_CULL_FACE );
@@ -754,6 +1705,15 @@ void Renderer::render_chunks( const Camera& camera, const Sky& sky )
 
     BOOST_REVERSE_FOREACH( const DistanceChunkPair& it, translucent_chunks )
     {
+        material_manager_.set_mesh_origin( it.second->get_mesh_origin() );
+
+        if ( texture_lighting )
+        {
+            // The mesh origin is also the key of the Chunk's region.
+            const ChunkRegionMap::const_iterator region_it = chunk_regions_.find( vector_cast<int>( it.second->get_mesh_origin() ) );
+            material_manager_.set_light_texture( region_it == chunk_regions_.end() ? 0 : region_it->second.find_light_texture() );
+        }
+
         it.second->render_translucent( camera );
     }
 
@@ -784,9 +1744,9 @@ void Renderer::render_chunks( const Camera& camera, const Sky& sky )
 }
 
 #ifdef DEBUG_COLLISIONS
-void Renderer::render_collisions( const Player& player )
+void Renderer::render_collisions( const EntitySystem::DebugCollisionV& debug_collisions, const AABoxf& player_aabb )
 {
-    BOOST_FOREACH( const Player::DebugCollision& collision, player.debug_collisions_ )
+    BOOST_FOREACH( const EntitySystem::DebugCollision& collision, debug_collisions )
     {
         AABoxVertexBuffer
             obstructing_block_vbo( AABoxf( collision.block_position_, collision.block_position_ + Block::SIZE ) );
@@ -821,7 +1781,7 @@ void Renderer::render_collisions( const Player& player )
     glEnable( GL_DEPTH_TEST );
     glColor3f( 0.0f, 0.0f, 1.0f );
     glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
-    AABoxVertexBuffer player_vbo( player.get_aabb() );
+    AABoxVertexBuffer player_vbo( player_aabb );
     player_vbo.render();
     glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
     glColor3f( 1.0f, 1.0f, 1.0f );
@@ -22,12 +22,17 @@
 #include <GL/glew.h>
 
 #include <set>
+#include <deque>
+
+#include <boost/scoped_ptr.hpp>
 
 #include "camera.h"
 #include "sdl_gl_window.h"
 #include "world.h"
-#include "player.h"
+#include "chunk_mesh.h"
+#include "entity.h"
 #include "renderer_material.h"
+#include "slab_allocator.h"
 
 struct VertexBuffer : public boost::noncopyable
 {
@@ -62,6 +67,16 @@ protected:
         GLenum state_;
     };
 
+    struct VertexAttributeGuard
+    {
+        VertexAttributeGuard( const GLuint attribute );
+        ~VertexAttributeGuard();
+
+    protected:
+
+        GLuint attribute_;
+    };
+
     struct TextureStateGuard
     {
         TextureStateGuard( const GLenum texture_unit, const GLenum state );
@@ -81,77 +96,113 @@ protected:
     GLsizei num_elements_;
 };
 
-struct BlockVertex
+struct ChunkVertexBuffer : public VertexBuffer
 {
-    BlockVertex()
-    {
-    }
+    ChunkVertexBuffer( const GLenum index_usage = GL_STATIC_DRAW );
 
-    BlockVertex(
-        const Vector3f& position,
-        const Vector3f& normal,
-        const Vector3f& tangent,
-        const Vector3f& texcoords,
-        const Vector3f& lighting,
-        const Vector3f& sunlighting
-    ) :
-        x_( position[0] ), y_( position[1] ), z_( position[2] ),
-        nx_( normal[0] ), ny_( normal[1] ), nz_( normal[2] ),
-        tx_( tangent[0] ), ty_( tangent[1] ), tz_( tangent[2] ),
-        s_( texcoords[0] ), t_( texcoords[1] ), p_( texcoords[2] ),
-        lr_( lighting[0] ), lg_( lighting[1] ), lb_( lighting[2] ),
-        slr_( sunlighting[0] ), slg_( sunlighting[1] ), slb_( sunlighting[2] )
-    {
-    }
+    // This may be called repeatedly to replace the contents of the buffers.  The storage is
+    // allocated in power of two sizes, and it's refilled in place whenever the new contents
+    // fit, so that a buffer that's reused doesn't need to be reallocated by the driver.
+    void set_data( const BlockVertexV& vertices, const std::vector<Index>& indices );
 
-    GLfloat x_, y_, z_;       // Position
-    GLfloat nx_, ny_, nz_;    // Normal
-    GLfloat tx_, ty_, tz_;    // Tangent
-    GLfloat s_, t_, p_;       // Texture coordinates
-    GLfloat lr_, lg_, lb_;    // Light color
-    GLfloat slr_, slg_, slb_; // Sunlight color
+    void render();
+    void render_no_bind();
 
-} __attribute__( ( packed ) );
+    // In bytes.
+    GLsizeiptr get_vertex_capacity() const { return vertex_capacity_; }
 
-typedef std::vector<BlockVertex> BlockVertexV;
+protected:
 
-struct ChunkVertexBuffer : public VertexBuffer
-{
-    ChunkVertexBuffer(
-        const BlockVertexV& vertices,
-        const GLenum vertex_usage = GL_STATIC_DRAW,
-        const GLenum index_usage = GL_STATIC_DRAW
-    );
+    GLenum index_usage_;
 
-    void render();
-    void render_no_bind();
+    GLsizeiptr
+        vertex_capacity_,
+        index_capacity_;
 };
 
-typedef boost::shared_ptr<ChunkVertexBuffer> ChunkVertexBufferSP;
 typedef std::vector<Vector3f> Vector3fV;
 
+// The faces in this buffer are re-sorted (back to front) only when the camera moves into a
+// different Block.  Each sort starts from the previous order, which is usually almost right
+// already, and falls back to a radix sort if that turns out to be too far off.
 struct SortableChunkVertexBuffer : public ChunkVertexBuffer
 {
-    SortableChunkVertexBuffer( const BlockVertexV& vertices );
+    SortableChunkVertexBuffer();
 
+    void set_data( const BlockVertexV& vertices, const Vector3fV& centroids );
     void render( const Camera& camera );
 
 private:
 
-    static const unsigned VERTICES_PER_FACE = 4;
+    // Distances are quantized to this fraction of a Block for the radix sort.
+    static const Scalar DISTANCE_QUANTIZATION = 256.0f;
+
+    // The insertion sort gives up after this many moves per face, on average.
+    static const unsigned MAX_INSERTION_MOVES_PER_FACE = 4;
 
     typedef std::pair<Scalar, unsigned> DistanceIndex;
     typedef std::vector<DistanceIndex> DistanceIndexV;
     typedef std::vector<VertexBuffer::Index> IndexV;
 
-    void render_sorted( const DistanceIndexV distance_indices );
+    static bool insertion_sort( DistanceIndexV& distance_indices, const unsigned max_moves );
+    static void radix_sort( DistanceIndexV& distance_indices, DistanceIndexV& scratch );
+
+    void sort( const Vector3f& camera_position );
+    void upload_sorted_indices();
 
     Vector3fV centroids_;
+
+    // The faces, in front to back order as of the most recent sort.
+    DistanceIndexV distance_indices_;
+
+    DistanceIndexV scratch_;
+
+    IndexV indices_;
+
+    Vector3i sorted_camera_block_;
+
+    bool sorted_;
 };
 
 typedef boost::shared_ptr<SortableChunkVertexBuffer> SortableChunkVertexBufferSP;
 typedef std::set<BlockMaterial> BlockMaterialSet;
 
+// The translucent buffers of Chunks that are rebuilt or removed are kept here for reuse, grouped
+// by their capacity, so that streaming Chunks in and out doesn't keep generating and deleting
+// buffers.  A released buffer may still be in use by draws that the graphics card hasn't
+// executed yet, so it only becomes available again a few frames later.
+struct ChunkVertexBufferPool : public boost::noncopyable
+{
+    static const unsigned REUSE_DELAY_FRAMES = 3;
+
+    // Beyond this many idle buffers of any one capacity, released buffers are just deleted.
+    static const size_t MAX_FREE_BUFFERS_PER_CAPACITY = 64;
+
+    ChunkVertexBufferPool();
+
+    // The buffer will have at least enough capacity for this many bytes of vertices the next
+    // time that its data is set.
+    SortableChunkVertexBufferSP acquire( const GLsizeiptr vertex_bytes );
+
+    // This resets the given pointer.
+    void release( SortableChunkVertexBufferSP& buffer );
+
+    void next_frame();
+
+protected:
+
+    // Maps each capacity onto the buffers that are ready to be reused.
+    typedef std::map<GLsizeiptr, std::vector<SortableChunkVertexBufferSP> > FreeBufferMap;
+    typedef std::pair<unsigned, SortableChunkVertexBufferSP> ReleasedBuffer;
+
+    FreeBufferMap free_buffers_;
+
+    // The buffers that are waiting out the reuse delay, along with the frame they were released on.
+    std::deque<ReleasedBuffer> released_buffers_;
+
+    unsigned frame_;
+};
+
 struct AABoxVertexBuffer : public VertexBuffer
 {
     AABoxVertexBuffer( const AABoxf& aabb );
@@ -159,38 +210,173 @@ struct AABoxVertexBuffer : public VertexBuffer
     void render();
 };
 
-struct ChunkRenderer
+// The opaque vertices of many Chunks are suballocated from each of these large buffers.  The
+// vertex format is configured once, in the arena's VAO, and then any number of the Chunks in
+// the arena can be drawn with a single call.
+struct ChunkVertexArena : public boost::noncopyable
+{
+    typedef std::vector<GLint> GLintV;
+    typedef std::vector<GLsizei> GLsizeiV;
+
+    // The quad_ibo_id must refer to a buffer filled with ChunkMesh::get_face_indices(), with
+    // at least enough of them for the largest possible Chunk mesh.
+    ChunkVertexArena( const GLsizei capacity, const GLuint quad_ibo_id );
+    ~ChunkVertexArena();
+
+    // Returns false if there isn't a large enough contiguous range of free vertices.
+    bool allocate( const GLsizei num_vertices, GLint& first_vertex );
+    void free( const GLint first_vertex, const GLsizei num_vertices );
+    void upload( const GLint first_vertex, const BlockVertexV& vertices );
+
+    // Each draw starts at first_vertices[i], and spans num_indices[i] of the quad indices.
+    void draw( const GLintV& first_vertices, const GLsizeiV& num_indices );
+
+protected:
+
+    // Maps the first vertex of each free range onto its size.
+    typedef std::map<GLint, GLsizei> FreeRangeMap;
+
+    GLuint
+        vao_id_,
+        vbo_id_;
+
+    FreeRangeMap free_ranges_;
+
+    std::vector<const GLvoid*> index_offsets_;
+};
+
+typedef boost::shared_ptr<ChunkVertexArena> ChunkVertexArenaSP;
+
+struct ChunkVertexAllocation
+{
+    ChunkVertexAllocation() :
+        arena_( 0 ),
+        first_vertex_( 0 ),
+        num_vertices_( 0 )
+    {
+    }
+
+    ChunkVertexArena* arena_;
+
+    GLint first_vertex_;
+
+    GLsizei num_vertices_;
+};
+
+struct ChunkVertexPool : public boost::noncopyable
+{
+    static const GLsizei ARENA_CAPACITY = 1 << 20; // In vertices.
+
+    ChunkVertexPool();
+    ~ChunkVertexPool();
+
+    // New arenas are created as needed, but they're never released.
+    ChunkVertexAllocation allocate( const BlockVertexV& vertices );
+    void free( ChunkVertexAllocation& allocation );
+
+protected:
+
+    GLuint quad_ibo_id_;
+
+    std::vector<ChunkVertexArenaSP> arenas_;
+};
+
+struct ChunkRenderer : public boost::noncopyable
 {
-    ChunkRenderer( const Vector3f& centroid = Vector3f(), const AABoxf& aabb = AABoxf() );
+    ChunkRenderer(
+        ChunkVertexPool& vertex_pool,
+        ChunkVertexBufferPool& translucent_buffer_pool,
+        const Vector3f& mesh_origin,
+        const Vector3f& centroid,
+        const AABoxf& aabb
+    );
+    ~ChunkRenderer();
+
+    // ChunkRenderers come and go as often as the Chunks do, so they're allocated from slabs.
+    static void* operator new( size_t size ) { return allocator_.allocate( size ); }
+    static void operator delete( void* pointer ) { allocator_.deallocate( pointer ); }
 
-    void render_opaque();
     void render_translucent( const Camera& camera );
     void render_aabb();
-    void rebuild( const Chunk& chunk );
+    void upload( const ChunkMeshSP& mesh, const unsigned level_of_detail );
 
+    bool has_opaque_materials() const { return opaque_allocation_.arena_; }
     bool has_translucent_materials() const { return translucent_vbo_; }
+    const ChunkVertexAllocation& get_opaque_allocation() const { return opaque_allocation_; }
     const Vector3f& get_centroid() const { return centroid_; }
     const AABoxf& get_aabb() const { return aabb_; }
+    const Vector3f& get_mesh_origin() const { return mesh_origin_; }
+    const ChunkMeshSP& get_mesh() const { return mesh_; }
+    unsigned get_level_of_detail() const { return level_of_detail_; }
     unsigned get_num_triangles() const { return num_triangles_; }
+    unsigned get_num_unmerged_triangles() const { return num_unmerged_triangles_; }
 
 protected:
 
-    void get_vertices_for_face( const BlockFace& face, BlockVertexV& vertices ) const;
+    static const size_t RENDERERS_PER_SLAB = 256;
+
+    static SlabAllocator allocator_;
+
+    ChunkVertexPool& vertex_pool_;
 
-    ChunkVertexBufferSP opaque_vbo_;
+    ChunkVertexBufferPool& translucent_buffer_pool_;
+
+    ChunkVertexAllocation opaque_allocation_;
 
     SortableChunkVertexBufferSP translucent_vbo_;
 
-    AABoxVertexBuffer aabb_vbo_;
+    // This is only needed for debugging, so it isn't created until it's first rendered.
+    boost::scoped_ptr<AABoxVertexBuffer> aabb_vbo_;
 
     Vector3f centroid_;
 
     AABoxf aabb_;
 
+    Vector3f mesh_origin_;
+
+    // All of the levels of detail are kept, so that the Chunk can switch between them
+    // without being rebuilt.
+    ChunkMeshSP mesh_;
+
+    unsigned level_of_detail_;
+
     unsigned num_triangles_;
+
+    // The number of triangles there would have been without greedy meshing.
+    unsigned num_unmerged_triangles_;
 };
 
 typedef boost::shared_ptr<ChunkRenderer> ChunkRendererSP;
+typedef std::map<Vector3i, ChunkRendererSP, VectorLess<Vector3i> > ChunkRendererMap;
+
+// The ChunkRenderers are grouped into cubic regions of Chunks that share the same mesh origin
+// (see ChunkMesh::get_origin()).  Entire regions that are outside of the view frustum can be
+// culled without testing each of their Chunks, and the opaque parts of the Chunks in each
+// region are drawn together.
+struct ChunkRegion
+{
+    ChunkRenderer* find( const Vector3i& chunk_position ) const;
+    void insert( const Vector3i& chunk_position, ChunkRendererSP chunk_renderer );
+    void erase( const Vector3i& chunk_position );
+
+    const ChunkRendererMap& get_chunk_renderers() const { return chunk_renderers_; }
+    const AABoxf& get_aabb() const { return aabb_; }
+
+    // The light texture is only created once a light volume is uploaded (see
+    // Chunk::get_texture_lighting()), so this returns null until then.
+    ChunkLightTexture& get_light_texture();
+    const ChunkLightTexture* find_light_texture() const { return light_texture_.get(); }
+
+protected:
+
+    void update_aabb();
+
+    ChunkRendererMap chunk_renderers_;
+
+    AABoxf aabb_;
+
+    ChunkLightTextureSP light_texture_;
+};
 
 struct SkydomeVertexBuffer : public VertexBuffer
 {
@@ -234,41 +420,196 @@ protected:
     StarVertexBufferSP star_vbo_;
 };
 
+// This measures how long the graphics card takes to execute the commands issued between
+// begin() and end(), and records it as a zone in the Profiler.  The results are collected a
+// few frames later, so that it never has to wait for the graphics card to catch up.
+struct GpuZoneTimer : public boost::noncopyable
+{
+    GpuZoneTimer( const char* name );
+    ~GpuZoneTimer();
+
+    void begin();
+    void end();
+
+protected:
+
+    static const unsigned NUM_QUERIES = 4;
+
+    void collect_results();
+
+    const char* name_;
+
+    bool
+        supported_,
+        measuring_;
+
+    GLuint queries_[NUM_QUERIES];
+
+    double begin_times_[NUM_QUERIES];
+
+    unsigned
+        next_query_,
+        num_pending_queries_;
+};
+
 struct Renderer
 {
     Renderer();
 
+    // Changed Chunks don't have their meshes uploaded immediately.  Instead, the meshes are
+    // queued up, and each frame, the ones nearest to the Camera are uploaded until the time
+    // budget for uploads is used up.  Thus, rebuilding many Chunks at once doesn't stall.
     void note_chunk_changes( const Chunk& chunk );
+    void note_chunk_removal( const Vector3i& position );
+
+    // Distant Chunks are drawn with coarser meshes, unless this is disabled.
+    bool get_level_of_detail_enabled() const { return level_of_detail_enabled_; }
+    void set_level_of_detail_enabled( const bool level_of_detail_enabled );
 
+    // Nothing here touches the World, so this doesn't need the Chunk lock.  The Sky (and,
+    // when debugging collisions, what the Player collided with) can be a copy of the state
+    // from the simulation.
 #ifdef DEBUG_COLLISIONS
-    void render( const SDL_GL_Window& window, const Camera& camera, const World& world, const Player& player );
+    void render(
+        const SDL_GL_Window& window,
+        const Camera& camera,
+        const Sky& sky,
+        const EntitySystem::DebugCollisionV& debug_collisions,
+        const AABoxf& player_aabb
+    );
 #else
-    void render( const SDL_GL_Window& window, const Camera& camera, const World& world );
+    void render( const SDL_GL_Window& window, const Camera& camera, const Sky& sky );
 #endif
 
     unsigned get_num_chunks_drawn() const { return num_chunks_drawn_; }
+    unsigned get_num_chunks_frustum_culled() const { return num_chunks_frustum_culled_; }
+    unsigned get_num_chunks_occlusion_culled() const { return num_chunks_occlusion_culled_; }
     unsigned get_num_triangles_drawn() const { return num_triangles_drawn_; }
+    unsigned get_num_unmerged_triangles_drawn() const { return num_unmerged_triangles_drawn_; }
 
 protected:
 
+    static const double MESH_UPLOAD_BUDGET = 0.003;
+
+    // Chunks that are more than N times this far from the Camera are drawn at level of
+    // detail N, if it's available.
+    static const Scalar LEVEL_OF_DETAIL_DISTANCE = 80.0f;
+
+    // A Chunk must be this far past the boundary between two levels of detail before it
+    // switches, so that Chunks near the boundary don't keep flipping back and forth.
+    static const Scalar LEVEL_OF_DETAIL_HYSTERESIS = 8.0f;
+
+    // The levels of detail are only reconsidered after the Camera moves this far.
+    static const Scalar LEVEL_OF_DETAIL_UPDATE_DISTANCE = 4.0f;
+
+    typedef std::map<Vector3i, ChunkMeshSP, VectorLess<Vector3i> > ChunkMeshMap;
+    typedef std::map<Vector3i, ChunkLightVolumeSP, VectorLess<Vector3i> > ChunkLightVolumeMap;
+    typedef std::set<Vector3i, VectorLess<Vector3i> > ChunkPositionSet;
+    typedef std::map<Vector3i, ChunkRegion, VectorLess<Vector3i> > ChunkRegionMap;
+    typedef VectorHashMap<Vector3i, ChunkFaceConnectivity> ChunkConnectivityMap;
+    typedef VectorHashMap<Vector3i, bool> ChunkVisibilityMap;
+    typedef std::pair<Scalar, ChunkMeshMap::iterator> DistanceMeshPair;
+    typedef std::vector<DistanceMeshPair> DistanceMeshPairV;
+
+    static bool distance_mesh_order( const DistanceMeshPair& a, const DistanceMeshPair& b )
+    {
+        return a.first < b.first;
+    }
+
+    // The opaque parts of the visible Chunks in a region that share an arena are drawn as a
+    // single batch.
+    struct ChunkDrawBatch
+    {
+        ChunkDrawBatch( const Vector3f& mesh_origin, const ChunkLightTexture* light_texture, ChunkVertexArena* arena ) :
+            mesh_origin_( mesh_origin ),
+            light_texture_( light_texture ),
+            arena_( arena )
+        {
+        }
+
+        Vector3f mesh_origin_;
+
+        const ChunkLightTexture* light_texture_;
+
+        ChunkVertexArena* arena_;
+
+        ChunkVertexArena::GLintV first_vertices_;
+
+        ChunkVertexArena::GLsizeiV num_indices_;
+    };
+
+    typedef std::vector<ChunkDrawBatch> ChunkDrawBatchV;
+    typedef std::pair<Scalar, ChunkRenderer*> DistanceChunkPair;
+    typedef std::vector<DistanceChunkPair> DistanceChunkPairV;
+    typedef std::pair<Scalar, size_t> DistanceIndex;
+    typedef std::vector<DistanceIndex> DistanceIndexV;
+
+    static void add_draw_batches(
+        const ChunkRegion& region,
+        DistanceChunkPairV& region_chunks,
+        ChunkDrawBatchV& batches,
+        DistanceIndexV& batch_order
+    );
+
+    ChunkRenderer* find_chunk_renderer( const Vector3i& position );
+    void erase_chunk_renderer( const Vector3i& position );
+    unsigned choose_level_of_detail( const Scalar distance, const ChunkRenderer* chunk_renderer ) const;
+    void update_levels_of_detail( const Camera& camera );
+    void upload_light_volumes();
+    void upload_chunk_meshes( const Camera& camera );
+    void find_visible_chunks( const Camera& camera, const gmtl::Frustumf& view_frustum, ChunkVisibilityMap& visible_chunks ) const;
     void render_sky( const Sky& sky );
-    void render_chunks( const Camera& camera, const Sky& sky );
+    void render_chunks( const Camera& camera );
 #ifdef DEBUG_COLLISIONS
-    void render_collisions( const Player& player );
+    void render_collisions( const EntitySystem::DebugCollisionV& debug_collisions, const AABoxf& player_aabb );
 #endif
     void render_crosshairs( const SDL_GL_Window& window );
     gmtl::Matrix44f get_opengl_matrix( const GLenum matrix );
 
     RendererMaterialManager material_manager_;
 
-    typedef std::map<Vector3i, ChunkRendererSP, VectorLess<Vector3i> > ChunkRendererMap;
-    ChunkRendererMap chunk_renderers_;
+    // These must be destroyed after the ChunkRenderers, since they return their vertices to them.
+    ChunkVertexPool chunk_vertex_pool_;
+
+    ChunkVertexBufferPool translucent_buffer_pool_;
+
+    ChunkRegionMap chunk_regions_;
+
+    // The connectivity of every Chunk that's been noted, including those without any faces
+    // to render.  Chunks that aren't in here are assumed to be empty.
+    ChunkConnectivityMap chunk_connectivity_;
+
+    // The height of the tallest Chunk column that's been noted.
+    int max_chunk_height_;
+
+    ChunkMeshMap pending_chunk_meshes_;
+
+    // The latest light volume of every Chunk that's been noted with one, so that a
+    // ChunkRenderer that's created after its Chunk's light volume arrived can upload it.
+    ChunkLightVolumeMap chunk_light_volumes_;
+
+    ChunkPositionSet pending_light_volumes_;
+
+    bool level_of_detail_enabled_;
+
+    // The Camera position at which the levels of detail were last reconsidered.
+    Vector3f level_of_detail_position_;
+
+    bool levels_of_detail_outdated_;
 
     SkyRenderer sky_renderer_;
 
+    GpuZoneTimer chunk_gpu_timer_;
+
     unsigned num_chunks_drawn_;
 
+    unsigned num_chunks_frustum_culled_;
+
+    unsigned num_chunks_occlusion_culled_;
+
     unsigned num_triangles_drawn_;
+
+    unsigned num_unmerged_triangles_drawn_;
 };
 
 #endif // RENDERER_H
@@ -19,8 +19,14 @@
 #include <SDL/SDL_image.h> 
 
 #include <stdexcept> 
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
 
 #include "log.h"
+#include "timer.h"
 #include "renderer_material.h"
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -53,6 +59,177 @@ struct SurfaceGuard
     SDL_Surface* surface_;
 };
 
+// This must be incremented whenever the layout of the texture cache file changes.  The
+// cache is written in the native byte order, since it is only ever read on the machine
+// that wrote it.
+const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+const char TEXTURE_CACHE_MAGIC[4] = { 'D', 'B', 'T', 'C' };
+
+const uint64_t TEXTURE_CACHE_KEY_SEED = 0xcbf29ce484222325ull;
+
+struct MaterialTextureArrayFormat
+{
+    const char* filename_postfix_;
+    int size_;
+    int channels_;
+    GLenum format_;
+    GLenum compressed_format_;
+    int compressed_block_bytes_;
+};
+
+// The color map keeps its alpha channel (BC3).  The bump map only keeps its 'x' and 'z'
+// components (BC5), and the shader reconstructs the height from them.  The specular map
+// has just the one channel (BC4).  These are indexed by MaterialTextureArray.
+const MaterialTextureArrayFormat MATERIAL_TEXTURE_ARRAY_FORMATS[] =
+{
+    {
+        ".png",
+        RendererMaterialManager::TEXTURE_SIZE,
+        RendererMaterialManager::TEXTURE_CHANNELS,
+        GL_RGBA,
+        GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+        16
+    },
+    {
+        ".bump.png",
+        RendererMaterialManager::BUMP_MAP_SIZE,
+        RendererMaterialManager::BUMP_MAP_CHANNELS,
+        GL_RGB,
+        GL_COMPRESSED_RG_RGTC2,
+        16
+    },
+    {
+        ".specular.png",
+        RendererMaterialManager::SPECULAR_MAP_SIZE,
+        RendererMaterialManager::SPECULAR_MAP_CHANNELS,
+        GL_LUMINANCE,
+        GL_COMPRESSED_RED_RGTC1,
+        8
+    }
+};
+
+uint64_t hash_value( const uint64_t hash, const uint64_t value )
+{
+    const uint64_t mixed = ( hash ^ value ) * 0x9e3779b97f4a7c15ull;
+    return mixed ^ ( mixed >> 29 );
+}
+
+uint64_t hash_string( uint64_t hash, const std::string& value )
+{
+    for ( size_t i = 0; i < value.size(); ++i )
+    {
+        hash = hash_value( hash, uint64_t( value[i] ) );
+    }
+
+    return hash_value( hash, value.size() );
+}
+
+int get_num_mipmap_levels( int size )
+{
+    int levels = 1;
+
+    while ( size > 1 )
+    {
+        size /= 2;
+        ++levels;
+    }
+
+    return levels;
+}
+
+int get_level_size( const int size, const int level )
+{
+    return std::max( size >> level, 1 );
+}
+
+size_t get_level_bytes( const MaterialTextureArrayFormat& format, const int level, const bool compressed )
+{
+    const size_t level_size = get_level_size( format.size_, level );
+
+    if ( compressed )
+    {
+        // The compressed formats all store 4x4 blocks, even for the levels that are smaller than that.
+        const size_t blocks = ( level_size + 3 ) / 4;
+        return blocks * blocks * format.compressed_block_bytes_ * NUM_BLOCK_MATERIALS;
+    }
+
+    return level_size * level_size * format.channels_ * NUM_BLOCK_MATERIALS;
+}
+
+size_t get_texture_array_bytes( const MaterialTextureArrayFormat& format, const bool compressed )
+{
+    size_t bytes = 0;
+
+    for ( int level = 0; level < get_num_mipmap_levels( format.size_ ); ++level )
+    {
+        bytes += get_level_bytes( format, level, compressed );
+    }
+
+    return bytes;
+}
+
+// Each texel of the destination level is the average of the 2x2 source texels that it covers.
+void downsample_texture_array(
+    const std::vector<unsigned char>& source,
+    const int source_size,
+    const int channels,
+    std::vector<unsigned char>& destination
+)
+{
+    const int size = source_size / 2;
+    destination.resize( size * size * channels * NUM_BLOCK_MATERIALS );
+
+    for ( int layer = 0; layer < NUM_BLOCK_MATERIALS; ++layer )
+    {
+        const unsigned char* source_layer = &source[layer * source_size * source_size * channels];
+        unsigned char* destination_layer = &destination[layer * size * size * channels];
+
+        for ( int y = 0; y < size; ++y )
+        {
+            const unsigned char* row_0 = source_layer + ( y * 2 ) * source_size * channels;
+            const unsigned char* row_1 = row_0 + source_size * channels;
+
+            for ( int x = 0; x < size * channels; ++x )
+            {
+                const int column = ( x / channels ) * 2 * channels + x % channels;
+                const int sum = row_0[column] + row_0[column + channels] + row_1[column] + row_1[column + channels];
+                destination_layer[y * size * channels + x] = static_cast<unsigned char>( ( sum + 2 ) / 4 );
+            }
+        }
+    }
+}
+
+void set_texture_array_parameters( const int levels )
+{
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1 );
+}
+
+// Only the first three components are written, since the remainder is padding.
+void set_padded_vec3( GLfloat* destination, const Vector3f& value )
+{
+    destination[0] = value[0];
+    destination[1] = value[1];
+    destination[2] = value[2];
+}
+
+template< typename T >
+bool read_value( std::istream& input, T& value )
+{
+    input.read( reinterpret_cast<char*>( &value ), sizeof( value ) );
+    return input.good();
+}
+
+template< typename T >
+void write_value( std::ostream& output, const T& value )
+{
+    output.write( reinterpret_cast<const char*>( &value ), sizeof( value ) );
+}
+
 } // anonymous namespace
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -127,12 +304,109 @@ Texture::~Texture()
     glDeleteTextures( 1, &texture_id_ );
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for ChunkLightTexture:
+//////////////////////////////////////////////////////////////////////////////////
+
+const int ChunkLightTexture::SIZE;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ChunkLightTexture:
+//////////////////////////////////////////////////////////////////////////////////
+
+ChunkLightTexture::ChunkLightTexture()
+{
+    glGenTextures( NUM_TEXTURES, texture_ids_ );
+
+    for ( int i = 0; i < NUM_TEXTURES; ++i )
+    {
+        glBindTexture( GL_TEXTURE_3D, texture_ids_[i] );
+
+        // The shader relies on the filtering to smooth the light between Blocks.
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+
+        glTexImage3D( GL_TEXTURE_3D, 0, GL_RGBA4, SIZE, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4_REV, 0 );
+    }
+
+    glBindTexture( GL_TEXTURE_3D, 0 );
+}
+
+ChunkLightTexture::~ChunkLightTexture()
+{
+    glDeleteTextures( NUM_TEXTURES, texture_ids_ );
+}
+
+void ChunkLightTexture::upload( const Vector3i& chunk_position, const ChunkLightVolume& light_volume )
+{
+    const Vector3i chunk_offset = pointwise_quotient( Vector3i( chunk_position - ChunkMesh::get_origin( chunk_position ) ), Chunk::SIZE );
+    const Vector3i texel_offset = chunk_offset * ChunkLightVolume::SIZE;
+    const uint16_t* texels[NUM_TEXTURES] = { light_volume.light_, light_volume.sunlight_ };
+
+    for ( int i = 0; i < NUM_TEXTURES; ++i )
+    {
+        glBindTexture( GL_TEXTURE_3D, texture_ids_[i] );
+        glTexSubImage3D(
+            GL_TEXTURE_3D,
+            0,
+            texel_offset[0],
+            texel_offset[1],
+            texel_offset[2],
+            ChunkLightVolume::SIZE,
+            ChunkLightVolume::SIZE,
+            ChunkLightVolume::SIZE,
+            GL_RGBA,
+            GL_UNSIGNED_SHORT_4_4_4_4_REV,
+            texels[i]
+        );
+    }
+
+    glBindTexture( GL_TEXTURE_3D, 0 );
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for FrameUniformBlock:
+//////////////////////////////////////////////////////////////////////////////////
+
+const std::string FrameUniformBlock::NAME = "FrameUniforms";
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for FrameUniformBlock:
+//////////////////////////////////////////////////////////////////////////////////
+
+FrameUniformBlock::FrameUniformBlock( const Camera& camera, const Sky& sky ) :
+    camera_position_(),
+    fog_distance_( camera.get_draw_distance() ),
+    sun_direction_(),
+    moon_direction_(),
+    sun_light_color_(),
+    moon_light_color_(),
+    zenith_color_(),
+    horizon_color_()
+{
+    const Vector3f
+        sun_direction = spherical_to_cartesian( Vector3f( 1.0f, sky.get_sun_angle()[0], sky.get_sun_angle()[1] ) ),
+        moon_direction = spherical_to_cartesian( Vector3f( 1.0f, sky.get_moon_angle()[0], sky.get_moon_angle()[1] ) );
+
+    set_padded_vec3( camera_position_, camera.get_position() );
+    set_padded_vec3( sun_direction_, sun_direction );
+    set_padded_vec3( moon_direction_, moon_direction );
+    set_padded_vec3( sun_light_color_, sky.get_sun_light_color() );
+    set_padded_vec3( moon_light_color_, sky.get_moon_light_color() );
+    set_padded_vec3( zenith_color_, sky.get_zenith_color() );
+    set_padded_vec3( horizon_color_, sky.get_horizon_color() );
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Static constant definitions for RendererMaterial:
 //////////////////////////////////////////////////////////////////////////////////
 
 const std::string
     RendererMaterialManager::TEXTURE_DIRECTORY = "./media/materials/textures",
+    RendererMaterialManager::TEXTURE_CACHE_FILENAME = "./media/materials/textures.cache",
     RendererMaterialManager::SHADER_DIRECTORY  = "./media/materials/shaders";
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -140,8 +414,32 @@ const std::string
 //////////////////////////////////////////////////////////////////////////////////
 
 RendererMaterialManager::RendererMaterialManager() :
-    material_shader_( new Shader( SHADER_DIRECTORY + "/block.vertex.glsl", SHADER_DIRECTORY + "/block.fragment.glsl" ) )
+    material_shader_( new Shader(
+        SHADER_DIRECTORY + "/block.vertex.glsl",
+        SHADER_DIRECTORY + "/block.fragment.glsl",
+        get_block_vertex_attributes()
+    ) ),
+    mesh_origin_uniform_( material_shader_->get_uniform<Vector3f>( "mesh_origin" ) ),
+    mesh_origin_( 0.0f, 0.0f, 0.0f ),
+    mesh_origin_set_( false ),
+    texture_lighting_uniform_( material_shader_->get_uniform<int>( "texture_lighting" ) ),
+    light_texture_( 0 ),
+    light_texture_set_( false ),
+    frame_uniform_buffer_( FrameUniformBlock::BINDING, sizeof( FrameUniformBlock ) )
 {
+    std::fill( texture_array_ids_, texture_array_ids_ + NUM_MATERIAL_TEXTURE_ARRAYS, 0 );
+
+    material_shader_->bind_uniform_block( FrameUniformBlock::NAME, FrameUniformBlock::BINDING );
+
+    // The texture units never change, so the samplers are only set up once.
+    material_shader_->enable();
+    material_shader_->set_uniform( material_shader_->get_uniform<int>( "material_texture_array" ), 0 );
+    material_shader_->set_uniform( material_shader_->get_uniform<int>( "material_specular_map_array" ), 1 );
+    material_shader_->set_uniform( material_shader_->get_uniform<int>( "material_bump_map_array" ), 2 );
+    material_shader_->set_uniform( material_shader_->get_uniform<int>( "light_texture" ), 3 );
+    material_shader_->set_uniform( material_shader_->get_uniform<int>( "sunlight_texture" ), 4 );
+    material_shader_->disable();
+
     GLint supported_layers;
     glGetIntegerv( GL_MAX_ARRAY_TEXTURE_LAYERS, &supported_layers );
 
@@ -162,55 +460,84 @@ RendererMaterialManager::RendererMaterialManager() :
     // just a couple of calls: a call to reorder the vertex indices, and a call to draw
     // them all.  This is MUCH FASTER.
 
-    create_texture_array( ".png",          TEXTURE_SIZE,      TEXTURE_CHANNELS,      texture_array_id_ );
-    create_texture_array( ".bump.png",     BUMP_MAP_SIZE,     BUMP_MAP_CHANNELS,     bump_map_array_id_ );
-    create_texture_array( ".specular.png", SPECULAR_MAP_SIZE, SPECULAR_MAP_CHANNELS, specular_map_array_id_ );
+    //
+    // Decoding all of the PNGs takes a while, and uncompressed arrays of this size use a
+    // lot of texture memory, so when compression is supported the compressed arrays are
+    // cached with all of their mipmap levels.  The PNGs are only decoded again when the
+    // cache is stale.
+
+    HighResolutionTimer load_timer;
+    const bool compress = glewIsSupported( "GL_EXT_texture_compression_s3tc GL_ARB_texture_compression_rgtc" );
+    const uint64_t source_key = get_texture_source_key();
+    const bool cached = compress && load_texture_cache( source_key );
+
+    if ( !cached )
+    {
+        for ( int i = 0; i < NUM_MATERIAL_TEXTURE_ARRAYS; ++i )
+        {
+            create_texture_array( MaterialTextureArray( i ), compress );
+        }
+
+        if ( compress )
+        {
+            write_texture_cache( source_key );
+        }
+    }
+
+    size_t
+        texture_bytes = 0,
+        uncompressed_texture_bytes = 0;
+
+    for ( int i = 0; i < NUM_MATERIAL_TEXTURE_ARRAYS; ++i )
+    {
+        texture_bytes += get_texture_array_bytes( MATERIAL_TEXTURE_ARRAY_FORMATS[i], compress );
+        uncompressed_texture_bytes += get_texture_array_bytes( MATERIAL_TEXTURE_ARRAY_FORMATS[i], false );
+    }
+
+    LOG( ( cached ? "Loaded material textures from the cache" : "Decoded material textures" )
+        << " in " << int( load_timer.get_seconds_elapsed() * 1000.0 ) << " ms, using "
+        << texture_bytes / 1024 << " KiB of texture memory (" << uncompressed_texture_bytes / 1024 << " KiB uncompressed)." );
 }
 
 RendererMaterialManager::~RendererMaterialManager()
 {
-    glDeleteTextures( 1, &texture_array_id_ );
-    glDeleteTextures( 1, &bump_map_array_id_ );
-    glDeleteTextures( 1, &specular_map_array_id_ );
+    glDeleteTextures( NUM_MATERIAL_TEXTURE_ARRAYS, texture_array_ids_ );
+}
+
+void RendererMaterialManager::update_frame_uniforms( const Camera& camera, const Sky& sky )
+{
+    const FrameUniformBlock frame_uniforms( camera, sky );
+    frame_uniform_buffer_.set_data( &frame_uniforms );
 }
 
-void RendererMaterialManager::configure_materials( const Camera& camera, const Sky& sky )
+void RendererMaterialManager::configure_materials( const bool texture_lighting )
 {
     glEnable( GL_TEXTURE_2D );
     glEnable( GL_BLEND );
     glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
 
     glActiveTexture( GL_TEXTURE0 );
-    glBindTexture( GL_TEXTURE_2D_ARRAY, texture_array_id_ );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, texture_array_ids_[MATERIAL_TEXTURE_ARRAY_COLOR] );
 
     glActiveTexture( GL_TEXTURE1 );
-    glBindTexture( GL_TEXTURE_2D_ARRAY, specular_map_array_id_ );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, texture_array_ids_[MATERIAL_TEXTURE_ARRAY_SPECULAR_MAP] );
 
     glActiveTexture( GL_TEXTURE2 );
-    glBindTexture( GL_TEXTURE_2D_ARRAY, bump_map_array_id_ );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, texture_array_ids_[MATERIAL_TEXTURE_ARRAY_BUMP_MAP] );
 
     material_shader_->enable();
-
-    const Vector3f
-        sun_direction = spherical_to_cartesian( Vector3f( 1.0f, sky.get_sun_angle()[0], sky.get_sun_angle()[1] ) ),
-        moon_direction = spherical_to_cartesian( Vector3f( 1.0f, sky.get_moon_angle()[0], sky.get_moon_angle()[1] ) );
-
-    material_shader_->set_uniform_vec3f( "camera_position", camera.get_position() );
-    material_shader_->set_uniform_float( "fog_distance", camera.get_draw_distance() );
-
-    material_shader_->set_uniform_vec3f( "sun_direction", sun_direction );
-    material_shader_->set_uniform_vec3f( "moon_direction", moon_direction );
-
-    material_shader_->set_uniform_vec3f( "sun_light_color", sky.get_sun_light_color() );
-    material_shader_->set_uniform_vec3f( "moon_light_color", sky.get_moon_light_color() );
-
-    material_shader_->set_uniform_int( "material_texture_array", 0 );
-    material_shader_->set_uniform_int( "material_specular_map_array", 1 );
-    material_shader_->set_uniform_int( "material_bump_map_array", 2 );
+    material_shader_->set_uniform( texture_lighting_uniform_, texture_lighting );
+    mesh_origin_set_ = false;
+    light_texture_set_ = false;
 }
 
 void RendererMaterialManager::deconfigure_materials()
 {
+    if ( light_texture_set_ )
+    {
+        set_light_texture( 0 );
+    }
+
     glActiveTexture( GL_TEXTURE2 );
     glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
 
@@ -226,6 +553,73 @@ void RendererMaterialManager::deconfigure_materials()
     material_shader_->disable();
 }
 
+void RendererMaterialManager::set_mesh_origin( const Vector3f& mesh_origin )
+{
+    // Consecutive batches usually come from the same region, and thus share an origin.
+    if ( !mesh_origin_set_ || mesh_origin != mesh_origin_ )
+    {
+        material_shader_->set_uniform( mesh_origin_uniform_, mesh_origin );
+        mesh_origin_ = mesh_origin;
+        mesh_origin_set_ = true;
+    }
+}
+
+void RendererMaterialManager::set_light_texture( const ChunkLightTexture* light_texture )
+{
+    if ( !light_texture_set_ || light_texture != light_texture_ )
+    {
+        glActiveTexture( GL_TEXTURE3 );
+        glBindTexture( GL_TEXTURE_3D, light_texture ? light_texture->get_light_texture_id() : 0 );
+
+        glActiveTexture( GL_TEXTURE4 );
+        glBindTexture( GL_TEXTURE_3D, light_texture ? light_texture->get_sunlight_texture_id() : 0 );
+
+        glActiveTexture( GL_TEXTURE0 );
+        light_texture_ = light_texture;
+        light_texture_set_ = true;
+    }
+}
+
+Shader::AttributeLocationMap RendererMaterialManager::get_block_vertex_attributes()
+{
+    Shader::AttributeLocationMap attributes;
+    attributes["vertex_position"]     = BLOCK_VERTEX_ATTRIBUTE_POSITION;
+    attributes["vertex_texcoords"]    = BLOCK_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES;
+    attributes["vertex_lighting"]     = BLOCK_VERTEX_ATTRIBUTE_LIGHTING;
+    attributes["vertex_sunlighting"]  = BLOCK_VERTEX_ATTRIBUTE_SUNLIGHTING;
+    return attributes;
+}
+
+uint64_t RendererMaterialManager::get_texture_source_key()
+{
+    uint64_t key = hash_value( TEXTURE_CACHE_KEY_SEED, TEXTURE_CACHE_VERSION );
+
+    for ( int i = 0; i < NUM_MATERIAL_TEXTURE_ARRAYS; ++i )
+    {
+        const MaterialTextureArrayFormat& format = MATERIAL_TEXTURE_ARRAY_FORMATS[i];
+        key = hash_value( key, format.size_ );
+        key = hash_value( key, format.compressed_format_ );
+
+        FOREACH_BLOCK_MATERIAL( material )
+        {
+            const BlockMaterialAttributes& attributes = get_block_material_attributes( material );
+            const std::string filename = TEXTURE_DIRECTORY + "/" + attributes.texture_filename_ + format.filename_postfix_;
+            key = hash_string( key, filename );
+
+            // A missing file will fail to load when the PNGs are decoded, so it doesn't matter what it hashes to.
+            struct stat file_stat;
+
+            if ( stat( filename.c_str(), &file_stat ) == 0 )
+            {
+                key = hash_value( key, file_stat.st_size );
+                key = hash_value( key, file_stat.st_mtime );
+            }
+        }
+    }
+
+    return key;
+}
+
 void RendererMaterialManager::read_texture_data(
     const std::string& filename,
     const int size,
@@ -269,40 +663,177 @@ void RendererMaterialManager::read_texture_data(
     SDL_UnlockSurface( guard.surface_ );
 }
 
-void RendererMaterialManager::create_texture_array(
-    const std::string& filename_postfix,
-    const int texture_size,
-    const int texture_channels,
-    GLuint& id
-)
+bool RendererMaterialManager::load_texture_cache( const uint64_t source_key )
 {
-    std::vector<unsigned char> texture_data;
+    std::ifstream input( TEXTURE_CACHE_FILENAME.c_str(), std::ios::in | std::ios::binary );
+
+    if ( !input )
+    {
+        return false;
+    }
+
+    char magic[sizeof( TEXTURE_CACHE_MAGIC )];
+    uint32_t version;
+    uint64_t cached_source_key;
+    input.read( magic, sizeof( magic ) );
+
+    if ( !input.good() || memcmp( magic, TEXTURE_CACHE_MAGIC, sizeof( magic ) ) != 0 ||
+         !read_value( input, version ) || version != TEXTURE_CACHE_VERSION ||
+         !read_value( input, cached_source_key ) || cached_source_key != source_key )
+    {
+        LOG( "The texture cache '" << TEXTURE_CACHE_FILENAME << "' is stale." );
+        return false;
+    }
+
+    // All of the arrays are read before any textures are created, so that a truncated
+    // cache doesn't leave any of them half-built.
+    std::vector<unsigned char> array_data[NUM_MATERIAL_TEXTURE_ARRAYS];
+
+    for ( int i = 0; i < NUM_MATERIAL_TEXTURE_ARRAYS; ++i )
+    {
+        const MaterialTextureArrayFormat& format = MATERIAL_TEXTURE_ARRAY_FORMATS[i];
+        uint32_t internal_format, size, layers, levels;
+
+        if ( !read_value( input, internal_format ) || internal_format != format.compressed_format_ ||
+             !read_value( input, size ) || size != uint32_t( format.size_ ) ||
+             !read_value( input, layers ) || layers != uint32_t( NUM_BLOCK_MATERIALS ) ||
+             !read_value( input, levels ) || levels != uint32_t( get_num_mipmap_levels( format.size_ ) ) )
+        {
+            LOG( "The texture cache '" << TEXTURE_CACHE_FILENAME << "' has an unexpected layout." );
+            return false;
+        }
+
+        array_data[i].resize( get_texture_array_bytes( format, true ) );
+        input.read( reinterpret_cast<char*>( &array_data[i][0] ), array_data[i].size() );
+
+        if ( !input.good() )
+        {
+            LOG( "The texture cache '" << TEXTURE_CACHE_FILENAME << "' is truncated." );
+            return false;
+        }
+    }
+
+    for ( int i = 0; i < NUM_MATERIAL_TEXTURE_ARRAYS; ++i )
+    {
+        const MaterialTextureArrayFormat& format = MATERIAL_TEXTURE_ARRAY_FORMATS[i];
+        const int levels = get_num_mipmap_levels( format.size_ );
+
+        glGenTextures( 1, &texture_array_ids_[i] );
+        glBindTexture( GL_TEXTURE_2D_ARRAY, texture_array_ids_[i] );
+        set_texture_array_parameters( levels );
+
+        size_t level_offset = 0;
+
+        for ( int level = 0; level < levels; ++level )
+        {
+            const int level_size = get_level_size( format.size_, level );
+            const size_t level_bytes = get_level_bytes( format, level, true );
+            glCompressedTexImage3D( GL_TEXTURE_2D_ARRAY, level, format.compressed_format_, level_size, level_size,
+                NUM_BLOCK_MATERIALS, 0, level_bytes, &array_data[i][level_offset] );
+            level_offset += level_bytes;
+        }
+    }
+
+    return true;
+}
+
+void RendererMaterialManager::write_texture_cache( const uint64_t source_key )
+{
+    // The cache is written to a temporary file first, so that a partially written cache
+    // is never mistaken for a complete one.
+    const std::string temporary_filename = TEXTURE_CACHE_FILENAME + ".tmp";
+    std::ofstream output( temporary_filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+
+    if ( !output )
+    {
+        LOG( "Unable to write the texture cache '" << temporary_filename << "'." );
+        return;
+    }
+
+    output.write( TEXTURE_CACHE_MAGIC, sizeof( TEXTURE_CACHE_MAGIC ) );
+    write_value( output, TEXTURE_CACHE_VERSION );
+    write_value( output, source_key );
+
+    std::vector<unsigned char> level_data;
+
+    for ( int i = 0; i < NUM_MATERIAL_TEXTURE_ARRAYS; ++i )
+    {
+        const MaterialTextureArrayFormat& format = MATERIAL_TEXTURE_ARRAY_FORMATS[i];
+        const int levels = get_num_mipmap_levels( format.size_ );
+
+        write_value( output, uint32_t( format.compressed_format_ ) );
+        write_value( output, uint32_t( format.size_ ) );
+        write_value( output, uint32_t( NUM_BLOCK_MATERIALS ) );
+        write_value( output, uint32_t( levels ) );
+
+        glBindTexture( GL_TEXTURE_2D_ARRAY, texture_array_ids_[i] );
+
+        for ( int level = 0; level < levels; ++level )
+        {
+            GLint compressed_bytes = 0;
+            glGetTexLevelParameteriv( GL_TEXTURE_2D_ARRAY, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressed_bytes );
+
+            if ( size_t( compressed_bytes ) != get_level_bytes( format, level, true ) )
+            {
+                LOG( "The driver compressed level " << level << " of '" << format.filename_postfix_
+                    << "' to an unexpected size; the texture cache will not be written." );
+                output.close();
+                std::remove( temporary_filename.c_str() );
+                return;
+            }
+
+            level_data.resize( compressed_bytes );
+            glGetCompressedTexImage( GL_TEXTURE_2D_ARRAY, level, &level_data[0] );
+            output.write( reinterpret_cast<const char*>( &level_data[0] ), level_data.size() );
+        }
+    }
+
+    output.close();
+
+    if ( !output || std::rename( temporary_filename.c_str(), TEXTURE_CACHE_FILENAME.c_str() ) != 0 )
+    {
+        LOG( "Unable to write the texture cache '" << TEXTURE_CACHE_FILENAME << "'." );
+        std::remove( temporary_filename.c_str() );
+    }
+}
+
+void RendererMaterialManager::create_texture_array( const MaterialTextureArray array, const bool compress )
+{
+    const MaterialTextureArrayFormat& format = MATERIAL_TEXTURE_ARRAY_FORMATS[array];
+    std::vector<unsigned char>
+        level_data,
+        next_level_data;
 
     FOREACH_BLOCK_MATERIAL( material )
     {
         const BlockMaterialAttributes& attributes = get_block_material_attributes( material );
         const std::string filename_base = TEXTURE_DIRECTORY + "/" + attributes.texture_filename_;
-        read_texture_data( filename_base + filename_postfix, texture_size, texture_channels, texture_data );
+        read_texture_data( filename_base + format.filename_postfix_, format.size_, format.channels_, level_data );
     }
 
-    GLenum texture_format = 0;
+    const GLenum internal_format = compress ? format.compressed_format_ : format.format_;
+    const int levels = get_num_mipmap_levels( format.size_ );
 
-    switch ( texture_channels )
+    glGenTextures( 1, &texture_array_ids_[array] );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, texture_array_ids_[array] );
+    set_texture_array_parameters( levels );
+
+    // The rows of the smallest levels aren't a multiple of 4 bytes long.
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+    for ( int level = 0; level < levels; ++level )
     {
-        case 4: texture_format = GL_RGBA; break;
-        case 3: texture_format = GL_RGB; break;
-        case 1: texture_format = GL_LUMINANCE; break;
-        default: throw std::runtime_error( make_string() << "Unsupported number of texture channels: " << texture_channels );
-    }
+        const int level_size = get_level_size( format.size_, level );
 
-    glGenTextures( 1, &id );
-    glBindTexture( GL_TEXTURE_2D_ARRAY, id );
+        if ( level > 0 )
+        {
+            downsample_texture_array( level_data, level_size * 2, format.channels_, next_level_data );
+            level_data.swap( next_level_data );
+        }
 
-    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+        glTexImage3D( GL_TEXTURE_2D_ARRAY, level, internal_format, level_size, level_size, NUM_BLOCK_MATERIALS, 0,
+            format.format_, GL_UNSIGNED_BYTE, &level_data[0] );
+    }
 
-    glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, texture_format, texture_size, texture_size, NUM_BLOCK_MATERIALS, 0, texture_format, GL_UNSIGNED_BYTE, &texture_data[0] );
-    glGenerateMipmap( GL_TEXTURE_2D_ARRAY );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
 }
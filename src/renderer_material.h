@@ -22,6 +22,7 @@
 #include <GL/glew.h>
 
 #include <vector>
+#include <stdint.h>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/utility.hpp>
@@ -47,10 +48,73 @@ private:
     Vector2i size_;
 };
 
+// The light levels of the Chunks in a region (see ChunkMesh::get_origin()), for rendering with
+// texture lighting.  Each Chunk has its own cube of texels, which is replaced all at once
+// whenever its ChunkLightVolume changes.  Since each cube includes the apron around its Chunk,
+// the filtering for a face never has to reach into another Chunk's texels.
+struct ChunkLightTexture : public boost::noncopyable
+{
+    static const int SIZE = ChunkMesh::ORIGIN_SPACING * ChunkLightVolume::SIZE;
+
+    ChunkLightTexture();
+    ~ChunkLightTexture();
+
+    // The Chunk at the given position must be in this texture's region.
+    void upload( const Vector3i& chunk_position, const ChunkLightVolume& light_volume );
+
+    GLuint get_light_texture_id() const { return texture_ids_[LIGHT_TEXTURE]; }
+    GLuint get_sunlight_texture_id() const { return texture_ids_[SUNLIGHT_TEXTURE]; }
+
+private:
+
+    enum
+    {
+        LIGHT_TEXTURE,
+        SUNLIGHT_TEXTURE,
+        NUM_TEXTURES
+    };
+
+    GLuint texture_ids_[NUM_TEXTURES];
+};
+
+typedef boost::shared_ptr<ChunkLightTexture> ChunkLightTextureSP;
+
+// The generic vertex attribute indices that the Chunk vertex data is bound to.
+enum BlockVertexAttribute
+{
+    BLOCK_VERTEX_ATTRIBUTE_POSITION,
+    BLOCK_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES,
+    BLOCK_VERTEX_ATTRIBUTE_LIGHTING,
+    BLOCK_VERTEX_ATTRIBUTE_SUNLIGHTING
+};
+
+// The per-frame camera and sky state, which the block and skydome shaders share through
+// their FrameUniforms block.  This must match that block's std140 layout, in which every
+// vec3 starts on a 16 byte boundary.
+struct FrameUniformBlock
+{
+    static const GLuint BINDING = 0;
+
+    static const std::string NAME;
+
+    FrameUniformBlock( const Camera& camera, const Sky& sky );
+
+    GLfloat
+        camera_position_[3],
+        fog_distance_,
+        sun_direction_[4],
+        moon_direction_[4],
+        sun_light_color_[4],
+        moon_light_color_[4],
+        zenith_color_[4],
+        horizon_color_[4];
+};
+
 struct RendererMaterialManager : public boost::noncopyable
 {
     static const std::string
         TEXTURE_DIRECTORY,
+        TEXTURE_CACHE_FILENAME,
         SHADER_DIRECTORY;
 
     static const size_t
@@ -64,11 +128,41 @@ struct RendererMaterialManager : public boost::noncopyable
     RendererMaterialManager();
     ~RendererMaterialManager();
 
-    void configure_materials( const Camera& camera, const Sky& sky );
+    // This must be called once per frame, before anything is rendered with the block or
+    // skydome shaders.
+    void update_frame_uniforms( const Camera& camera, const Sky& sky );
+
+    // With texture lighting, the light levels are sampled from the region's ChunkLightTexture
+    // (see set_light_texture()), instead of from the vertices.
+    void configure_materials( const bool texture_lighting );
     void deconfigure_materials();
 
+    // Chunk vertex positions are relative to their mesh origin (see ChunkMesh::get_origin()),
+    // so this must be called before rendering them.  The materials must be configured.
+    void set_mesh_origin( const Vector3f& mesh_origin );
+
+    // With texture lighting, this must likewise be called with the ChunkLightTexture of each
+    // region before rendering its Chunks.  It may be null, if the region doesn't have any
+    // light volumes yet.
+    void set_light_texture( const ChunkLightTexture* light_texture );
+
 protected:
 
+    // The material textures are stored in these arrays, which are always created (and
+    // written to the texture cache) in this order.
+    enum MaterialTextureArray
+    {
+        MATERIAL_TEXTURE_ARRAY_COLOR,
+        MATERIAL_TEXTURE_ARRAY_BUMP_MAP,
+        MATERIAL_TEXTURE_ARRAY_SPECULAR_MAP,
+        NUM_MATERIAL_TEXTURE_ARRAYS
+    };
+
+    static Shader::AttributeLocationMap get_block_vertex_attributes();
+
+    // This identifies the current set of source images, so that a stale cache can be detected.
+    static uint64_t get_texture_source_key();
+
     void read_texture_data(
         const std::string& filename,
         const int size,
@@ -76,19 +170,35 @@ protected:
         std::vector<unsigned char>& texture_data
     );
 
-    void create_texture_array(
-        const std::string& filename_postfix,
-        const int texture_size,
-        const int texture_channels,
-        GLuint& id
-    );
+    // Returns false if the cache is missing, stale, or unreadable, in which case no textures are created.
+    bool load_texture_cache( const uint64_t source_key );
+    void write_texture_cache( const uint64_t source_key );
 
-    GLuint
-        texture_array_id_,
-        bump_map_array_id_,
-        specular_map_array_id_;
+    // The full mipmap chain is built on the CPU.  If compression is requested, the driver
+    // compresses each level as it is uploaded.
+    void create_texture_array( const MaterialTextureArray array, const bool compress );
+
+    GLuint texture_array_ids_[NUM_MATERIAL_TEXTURE_ARRAYS];
 
     ShaderSP material_shader_;
+
+    ShaderUniform<Vector3f> mesh_origin_uniform_;
+
+    // The mesh origin that the shader currently has, if it's been set since the materials
+    // were configured.
+    Vector3f mesh_origin_;
+
+    bool mesh_origin_set_;
+
+    ShaderUniform<int> texture_lighting_uniform_;
+
+    // The light texture that's currently bound, if one has been since the materials were
+    // configured.
+    const ChunkLightTexture* light_texture_;
+
+    bool light_texture_set_;
+
+    UniformBuffer frame_uniform_buffer_;
 };
 
 #endif // RENDERER_MATERIAL_H
@@ -0,0 +1,121 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <assert.h>
+
+#include <vector>
+
+// A FIFO queue that stores its elements in a single circular buffer.  It provides the
+// subset of the std::queue interface that is needed for e.g. flood fills, but it never
+// allocates once it has grown large enough, unlike the (deque-backed) std::queue, which
+// allocates and frees blocks of nodes as it goes.  It's best kept around and reused.
+//
+// NOTE: The capacity doubles if the buffer fills up, so it is only fixed once it has
+//       reached the largest size that it needs to be.
+template <typename T>
+struct RingBuffer
+{
+    typedef T value_type;
+    typedef std::size_t size_type;
+
+    explicit RingBuffer( const size_type initial_capacity = MIN_CAPACITY ) :
+        head_( 0 ),
+        size_( 0 )
+    {
+        size_type capacity = MIN_CAPACITY;
+
+        while ( capacity < initial_capacity )
+        {
+            capacity *= 2;
+        }
+
+        elements_.resize( capacity );
+    }
+
+    size_type size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_type capacity() const { return elements_.size(); }
+
+    T& front()
+    {
+        assert( !empty() );
+        return elements_[head_];
+    }
+
+    const T& front() const
+    {
+        assert( !empty() );
+        return elements_[head_];
+    }
+
+    void push( const T& value )
+    {
+        if ( size_ == elements_.size() )
+        {
+            grow();
+        }
+
+        elements_[wrap( head_ + size_ )] = value;
+        ++size_;
+    }
+
+    void pop()
+    {
+        assert( !empty() );
+        head_ = wrap( head_ + 1 );
+        --size_;
+    }
+
+    void clear()
+    {
+        head_ = 0;
+        size_ = 0;
+    }
+
+private:
+
+    // The capacity is always a power of two, so that wrapping an index around is a mask.
+    enum { MIN_CAPACITY = 64 };
+
+    size_type wrap( const size_type index ) const
+    {
+        return index & ( elements_.size() - 1 );
+    }
+
+    void grow()
+    {
+        std::vector<T> elements( elements_.size() * 2 );
+
+        for ( size_type i = 0; i < size_; ++i )
+        {
+            elements[i] = elements_[wrap( head_ + i )];
+        }
+
+        elements_.swap( elements );
+        head_ = 0;
+    }
+
+    std::vector<T> elements_;
+    size_type head_;
+    size_type size_;
+};
+
+#endif // RING_BUFFER_H
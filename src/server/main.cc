@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+// This is the headless dedicated server.  It runs a server World (and the fluid
+// simulation) around all of the clients' Players, and replicates it to them over TCP.  It
+// doesn't use SDL, OpenGL, or the GUI at all, so it can be run on a machine without a
+// display.
+//
+// Usage: digbuild_server [port [store path]]
+
+#include <string>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+
+#include "../log.h"
+#include "../timer.h"
+#include "../world.h"
+#include "../world_replication.h"
+#include "replication_server.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const unsigned DEFAULT_PORT = 7780;
+
+const char* DEFAULT_STORE_PATH = "server_save";
+
+// This is where the GameApplication starts its Player, too.
+const Vector3f SPAWN_POSITION( 0.0f, 200.0f, 0.0f );
+
+// The clients do their own lighting and meshing, so the server's ticks are only the
+// simulation, which doesn't need to run any faster than this.
+const double TICK_INTERVAL = 1.0 / 20.0;
+
+// The tick times and bandwidth are logged this often.
+const unsigned TICKS_PER_STATUS = 200;
+
+volatile sig_atomic_t running = 1;
+
+// The World is saved by its destructor, so interrupting the server has to end the main
+// loop rather than the process.
+void stop_running( int )
+{
+    running = 0;
+}
+
+void serve( const unsigned port, const std::string& store_path )
+{
+    World world( time( NULL ) * 91387, SPAWN_POSITION, store_path, WORLD_MODE_SERVER );
+    WorldReplicator replicator( SPAWN_POSITION );
+    ReplicationServer server( port, world.get_world_seed(), replicator );
+
+    LOG( "Serving world " << world.get_world_seed() << " from " << store_path << " on port " << port << "." );
+
+    HighResolutionTimer tick_timer;
+    double lag = 0.0;
+    double busy_seconds = 0.0;
+    uint64_t status_bytes_sent = 0;
+    unsigned num_ticks = 0;
+
+    while ( running )
+    {
+        lag += tick_timer.get_seconds_elapsed();
+        tick_timer.reset();
+
+        // The wait for the next tick is spent waiting for the clients.
+        if ( lag < TICK_INTERVAL )
+        {
+            server.receive( int( ( TICK_INTERVAL - lag ) * 1000.0 ) );
+            continue;
+        }
+
+        // If the server falls behind, the ticks that it missed are dropped rather than
+        // run back to back, since the clients would only see them all at once anyway.
+        lag = std::min( lag - TICK_INTERVAL, TICK_INTERVAL );
+
+        HighResolutionTimer busy_timer;
+        server.receive( 0 );
+
+        {
+            World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+            world.do_one_step( TICK_INTERVAL, replicator.get_player_positions() );
+        }
+
+        world.update_chunks();
+
+        {
+            World::ChunkGuard chunk_guard( world.get_chunk_lock() );
+
+            // Nothing is drawn, so the evicted Chunks don't need to be dealt with.
+            world.get_evicted_chunks();
+            replicator.replicate( world );
+        }
+
+        server.send();
+        busy_seconds += busy_timer.get_seconds_elapsed();
+
+        if ( ++num_ticks % TICKS_PER_STATUS == 0 )
+        {
+            const uint64_t bytes_sent = server.get_bytes_sent() - status_bytes_sent;
+
+            LOG( num_ticks << " ticks, " << busy_seconds / TICKS_PER_STATUS * 1000.0 << " ms per tick, " <<
+                 bytes_sent / TICKS_PER_STATUS << " bytes sent per tick, " <<
+                 server.get_num_clients() << " clients, " << world.get_chunks().size() << " chunks." );
+
+            busy_seconds = 0.0;
+            status_bytes_sent += bytes_sent;
+        }
+    }
+
+    LOG( "Saving the world and shutting down." );
+}
+
+} // anonymous namespace
+
+int main( int argc, char **argv )
+{
+    int result = -1;
+
+    signal( SIGINT, stop_running );
+    signal( SIGTERM, stop_running );
+
+    try
+    {
+        const unsigned port = argc > 1 ? unsigned( atoi( argv[1] ) ) : DEFAULT_PORT;
+        const std::string store_path = argc > 2 ? argv[2] : DEFAULT_STORE_PATH;
+        serve( port, store_path );
+        result = 0;
+    }
+    catch ( const std::exception& e ) { LOG( "Error: " << e.what() << "." ); }
+
+    return result;
+}
@@ -0,0 +1,296 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <boost/foreach.hpp>
+
+#include "../log.h"
+#include "replication_server.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Clients only ever send their Player's position, so this is plenty for each read.
+const size_t READ_BUFFER_SIZE = 4096;
+
+bool set_non_blocking( const int socket )
+{
+    const int flags = fcntl( socket, F_GETFL );
+    return flags >= 0 && fcntl( socket, F_SETFL, flags | O_NONBLOCK ) >= 0;
+}
+
+bool would_block()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+pollfd make_poll_fd( const int socket )
+{
+    pollfd poll_fd;
+    poll_fd.fd = socket;
+    poll_fd.events = POLLIN;
+    poll_fd.revents = 0;
+    return poll_fd;
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ReplicationServer:
+//////////////////////////////////////////////////////////////////////////////////
+
+ReplicationServer::ReplicationServer( const unsigned port, const uint64_t world_seed, WorldReplicator& replicator ) :
+    world_seed_( world_seed ),
+    replicator_( replicator ),
+    listen_socket_( -1 ),
+    bytes_sent_( 0 )
+{
+    if ( port > 65535 )
+    {
+        throw std::runtime_error( make_string() << "Invalid port " << port );
+    }
+
+    listen_socket_ = socket( AF_INET, SOCK_STREAM, 0 );
+
+    if ( listen_socket_ < 0 )
+    {
+        throw std::runtime_error( make_string() << "Unable to create listening socket: " << strerror( errno ) );
+    }
+
+    // Otherwise a restarted server couldn't listen on the port until the old connections
+    // had timed out.
+    const int reuse_address = 1;
+    setsockopt( listen_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse_address, sizeof( reuse_address ) );
+
+    sockaddr_in address;
+    memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_ANY );
+    address.sin_port = htons( port );
+
+    if ( bind( listen_socket_, reinterpret_cast<const sockaddr*>( &address ), sizeof( address ) ) < 0 ||
+         listen( listen_socket_, SOMAXCONN ) < 0 ||
+         !set_non_blocking( listen_socket_ ) )
+    {
+        const std::string error = strerror( errno );
+        close( listen_socket_ );
+        throw std::runtime_error( make_string() << "Unable to listen on port " << port << ": " << error );
+    }
+}
+
+ReplicationServer::~ReplicationServer()
+{
+    BOOST_FOREACH( const Connection& connection, connections_ )
+    {
+        close_connection( connection );
+    }
+
+    close( listen_socket_ );
+}
+
+void ReplicationServer::receive( const int timeout_milliseconds )
+{
+    std::vector<pollfd> poll_fds;
+    poll_fds.push_back( make_poll_fd( listen_socket_ ) );
+
+    BOOST_FOREACH( const Connection& connection, connections_ )
+    {
+        poll_fds.push_back( make_poll_fd( connection.socket_ ) );
+    }
+
+    if ( poll( &poll_fds[0], poll_fds.size(), timeout_milliseconds ) < 0 )
+    {
+        // A signal (such as the one that stops the server) just cuts the wait short.
+        if ( errno == EINTR )
+        {
+            return;
+        }
+
+        throw std::runtime_error( make_string() << "Unable to poll sockets: " << strerror( errno ) );
+    }
+
+    // The poll_fds are in the same order as the connections, after the listening socket.
+    unsigned poll_index = 1;
+
+    for ( ConnectionList::iterator connection_it = connections_.begin(); connection_it != connections_.end(); ++poll_index )
+    {
+        if ( poll_fds[poll_index].revents != 0 && !read_connection( *connection_it ) )
+        {
+            close_connection( *connection_it );
+            connection_it = connections_.erase( connection_it );
+        }
+        else ++connection_it;
+    }
+
+    if ( poll_fds[0].revents & POLLIN )
+    {
+        accept_connections();
+    }
+}
+
+void ReplicationServer::send()
+{
+    for ( ConnectionList::iterator connection_it = connections_.begin(); connection_it != connections_.end(); )
+    {
+        if ( !write_connection( *connection_it ) )
+        {
+            close_connection( *connection_it );
+            connection_it = connections_.erase( connection_it );
+        }
+        else ++connection_it;
+    }
+}
+
+void ReplicationServer::accept_connections()
+{
+    while ( true )
+    {
+        sockaddr_in address;
+        socklen_t address_size = sizeof( address );
+        const int socket = accept( listen_socket_, reinterpret_cast<sockaddr*>( &address ), &address_size );
+
+        if ( socket < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            if ( !would_block() )
+            {
+                LOG( "Unable to accept connection: " << strerror( errno ) << "." );
+            }
+
+            return;
+        }
+
+        if ( !set_non_blocking( socket ) )
+        {
+            LOG( "Unable to make connection non-blocking: " << strerror( errno ) << "." );
+            close( socket );
+            continue;
+        }
+
+        // The modified Blocks are sent in lots of small ticks, which shouldn't be held back.
+        const int no_delay = 1;
+        setsockopt( socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof( no_delay ) );
+
+        const ReplicationClientId client_id = replicator_.add_client( world_seed_ );
+        connections_.push_back( Connection( socket, client_id ) );
+
+        LOG( "Client " << client_id << " connected from " << inet_ntoa( address.sin_addr ) << "." );
+    }
+}
+
+bool ReplicationServer::read_connection( const Connection& connection )
+{
+    uint8_t buffer[READ_BUFFER_SIZE];
+    const ssize_t size = recv( connection.socket_, buffer, sizeof( buffer ), 0 );
+
+    if ( size == 0 )
+    {
+        LOG( "Client " << connection.client_id_ << " disconnected." );
+        return false;
+    }
+    else if ( size < 0 )
+    {
+        if ( errno == EINTR || would_block() )
+        {
+            return true;
+        }
+
+        LOG( "Unable to read from client " << connection.client_id_ << ": " << strerror( errno ) << "." );
+        return false;
+    }
+
+    try
+    {
+        replicator_.receive( connection.client_id_, buffer, size );
+    }
+    catch ( const std::exception& e )
+    {
+        LOG( "Disconnecting client " << connection.client_id_ << ": " << e.what() << "." );
+        return false;
+    }
+
+    return true;
+}
+
+bool ReplicationServer::write_connection( Connection& connection )
+{
+    ByteV messages;
+    replicator_.take_messages( connection.client_id_, messages );
+    connection.unsent_.insert( connection.unsent_.end(), messages.begin(), messages.end() );
+
+    if ( connection.unsent_.size() > MAX_UNSENT_BYTES )
+    {
+        LOG( "Disconnecting client " << connection.client_id_ << ", which isn't keeping up." );
+        return false;
+    }
+
+    size_t offset = 0;
+
+    while ( offset < connection.unsent_.size() )
+    {
+        // MSG_NOSIGNAL keeps a closed connection from raising SIGPIPE, so that it's just
+        // reported as an error here.
+        const ssize_t size = ::send(
+            connection.socket_, &connection.unsent_[offset], connection.unsent_.size() - offset, MSG_NOSIGNAL );
+
+        if ( size >= 0 )
+        {
+            offset += size;
+            bytes_sent_ += size;
+        }
+        else if ( would_block() )
+        {
+            break;
+        }
+        else if ( errno != EINTR )
+        {
+            LOG( "Unable to write to client " << connection.client_id_ << ": " << strerror( errno ) << "." );
+            return false;
+        }
+    }
+
+    connection.unsent_.erase( connection.unsent_.begin(), connection.unsent_.begin() + offset );
+
+    return true;
+}
+
+void ReplicationServer::close_connection( const Connection& connection )
+{
+    replicator_.remove_client( connection.client_id_ );
+    close( connection.socket_ );
+}
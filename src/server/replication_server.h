@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef REPLICATION_SERVER_H
+#define REPLICATION_SERVER_H
+
+#include <list>
+#include <boost/utility.hpp>
+
+#include "../world_replication.h"
+
+// The ReplicationServer carries the WorldReplicator's messages over TCP, with one connection
+// per client.  Every socket is non-blocking, and poll() waits on all of them at once, so the
+// whole server runs on a single thread.
+struct ReplicationServer : public boost::noncopyable
+{
+    // A client whose unsent messages pile up beyond this many bytes isn't keeping up with
+    // the World, so it's disconnected rather than buffered without bound.
+    static const size_t MAX_UNSENT_BYTES = 64 * 1024 * 1024;
+
+    // This throws if the port can't be listened on.
+    ReplicationServer( const unsigned port, const uint64_t world_seed, WorldReplicator& replicator );
+    ~ReplicationServer();
+
+    // Accepts any new connections, and passes whatever the clients have sent on to the
+    // WorldReplicator.  This waits up to the given number of milliseconds for something to
+    // arrive, so it doubles as the wait between ticks.
+    void receive( const int timeout_milliseconds );
+
+    // Sends everything that the WorldReplicator has queued up for each of the clients.  If
+    // a socket can't take it all right away, the rest is sent by later calls.
+    void send();
+
+    unsigned get_num_clients() const { return connections_.size(); }
+
+    // The total number of bytes written to all of the clients' sockets.
+    uint64_t get_bytes_sent() const { return bytes_sent_; }
+
+protected:
+
+    struct Connection
+    {
+        Connection( const int socket, const ReplicationClientId client_id ) :
+            socket_( socket ),
+            client_id_( client_id )
+        {
+        }
+
+        int socket_;
+
+        ReplicationClientId client_id_;
+
+        ByteV unsent_;
+    };
+
+    // A list, so that closing a connection doesn't copy the unsent messages of the rest.
+    typedef std::list<Connection> ConnectionList;
+
+    void accept_connections();
+
+    // These return false if the connection should be closed.
+    bool read_connection( const Connection& connection );
+    bool write_connection( Connection& connection );
+
+    void close_connection( const Connection& connection );
+
+    uint64_t world_seed_;
+
+    WorldReplicator& replicator_;
+
+    int listen_socket_;
+
+    ConnectionList connections_;
+
+    uint64_t bytes_sent_;
+};
+
+#endif // REPLICATION_SERVER_H
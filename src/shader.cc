@@ -22,14 +22,31 @@
 
 #include "shader.h"
 
-Shader::Shader( const std::string& vertex_shader_filename, const std::string& fragment_shader_program )
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for Shader:
+//////////////////////////////////////////////////////////////////////////////////
+
+Shader::Shader(
+    const std::string& vertex_shader_filename,
+    const std::string& fragment_shader_program,
+    const AttributeLocationMap& attribute_locations
+)
 {
     gl_shader_program_ = glCreateProgram();
 
     if ( gl_shader_program_ != 0 )
     {
+        // The attribute locations must be bound before the program is linked.
+        for ( AttributeLocationMap::const_iterator it = attribute_locations.begin(); it != attribute_locations.end(); ++it )
+        {
+            glBindAttribLocation( gl_shader_program_, it->second, it->first.c_str() );
+        }
+
         gl_vertex_shader_ = load_shader( vertex_shader_filename, GL_VERTEX_SHADER );
         gl_fragment_shader_ = load_shader( fragment_shader_program, GL_FRAGMENT_SHADER );
+
+        glLinkProgram( gl_shader_program_ );
+        check_program_status();
     }
     else throw std::runtime_error( "glCreateProgram() failed" );
 }
@@ -77,10 +94,8 @@ GLuint Shader::load_shader( const std::string& filename, const GLenum shader_typ
 
     glShaderSource( gl_shader, 1, &text, NULL );
     glCompileShader( gl_shader );
-    check_shader_status( gl_shader, GL_COMPILE_STATUS );
+    check_shader_status( gl_shader );
     glAttachShader( gl_shader_program_, gl_shader );
-    glLinkProgram( gl_shader_program_ );
-    check_shader_status( gl_shader, GL_LINK_STATUS );
     return gl_shader;
 }
 
@@ -89,11 +104,11 @@ void Shader::delete_program() const
     glDeleteProgram( gl_shader_program_ );
 }
 
-void Shader::check_shader_status( const GLuint shader, const GLenum status_type ) const
+void Shader::check_shader_status( const GLuint shader ) const
 {
     int status;
 
-    glGetShaderiv( shader, status_type, &status );
+    glGetShaderiv( shader, GL_COMPILE_STATUS, &status );
 
     if ( status == GL_FALSE )
     {
@@ -105,30 +120,64 @@ void Shader::check_shader_status( const GLuint shader, const GLenum status_type
         {
             std::vector<char> log( length );
             glGetShaderInfoLog( shader, length, NULL, &log[0] );
-            throw std::runtime_error( "Shader compilation/linking failed: " + std::string( &log[0] ) );
+            throw std::runtime_error( "Shader compilation failed: " + std::string( &log[0] ) );
         }
-        else throw std::runtime_error( "Shader compilation/linking failed" );
+        else throw std::runtime_error( "Shader compilation failed" );
     }
 }
 
-void Shader::set_uniform_vec3f( const std::string& name, const Vector3f& value ) const
+void Shader::check_program_status() const
 {
-    glUniform3f( get_uniform_location( name ), value[0], value[1], value[2] );
+    int status;
+
+    glGetProgramiv( gl_shader_program_, GL_LINK_STATUS, &status );
+
+    if ( status == GL_FALSE )
+    {
+        int length;
+
+        glGetProgramiv( gl_shader_program_, GL_INFO_LOG_LENGTH, &length );
+
+        if ( length > 0 )
+        {
+            std::vector<char> log( length );
+            glGetProgramInfoLog( gl_shader_program_, length, NULL, &log[0] );
+            throw std::runtime_error( "Shader linking failed: " + std::string( &log[0] ) );
+        }
+        else throw std::runtime_error( "Shader linking failed" );
+    }
 }
 
-void Shader::set_uniform_vec2f( const std::string& name, const Vector2f& value ) const
+void Shader::set_uniform( const ShaderUniform<Vector3f>& uniform, const Vector3f& value ) const
 {
-    glUniform2f( get_uniform_location( name ), value[0], value[1] );
+    glUniform3f( uniform.location_, value[0], value[1], value[2] );
 }
 
-void Shader::set_uniform_float( const std::string& name, const float value ) const
+void Shader::set_uniform( const ShaderUniform<Vector2f>& uniform, const Vector2f& value ) const
 {
-    glUniform1f( get_uniform_location( name ), value );
+    glUniform2f( uniform.location_, value[0], value[1] );
 }
 
-void Shader::set_uniform_int( const std::string& name, const int value ) const
+void Shader::set_uniform( const ShaderUniform<float>& uniform, const float value ) const
 {
-    glUniform1i( get_uniform_location( name ), value );
+    glUniform1f( uniform.location_, value );
+}
+
+void Shader::set_uniform( const ShaderUniform<int>& uniform, const int value ) const
+{
+    glUniform1i( uniform.location_, value );
+}
+
+void Shader::bind_uniform_block( const std::string& name, const GLuint binding ) const
+{
+    const GLuint index = glGetUniformBlockIndex( gl_shader_program_, name.c_str() );
+
+    if ( index == GL_INVALID_INDEX )
+    {
+        throw std::runtime_error( "Could not find uniform block: " + name );
+    }
+
+    glUniformBlockBinding( gl_shader_program_, index, binding );
 }
 
 int Shader::get_uniform_location( const std::string& name ) const
@@ -142,3 +191,38 @@ int Shader::get_uniform_location( const std::string& name ) const
 
     return location;
 }
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for UniformBuffer:
+//////////////////////////////////////////////////////////////////////////////////
+
+UniformBuffer::UniformBuffer( const GLuint binding, const GLsizeiptr size ) :
+    buffer_id_( 0 ),
+    size_( size )
+{
+    glGenBuffers( 1, &buffer_id_ );
+
+    if ( buffer_id_ == 0 )
+    {
+        throw std::runtime_error( "glGenBuffers() failed" );
+    }
+
+    glBindBuffer( GL_UNIFORM_BUFFER, buffer_id_ );
+    glBufferData( GL_UNIFORM_BUFFER, size_, NULL, GL_STREAM_DRAW );
+    glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+    glBindBufferBase( GL_UNIFORM_BUFFER, binding, buffer_id_ );
+}
+
+UniformBuffer::~UniformBuffer()
+{
+    glDeleteBuffers( 1, &buffer_id_ );
+}
+
+void UniformBuffer::set_data( const void* data )
+{
+    // Respecifying the whole buffer lets the driver hand out fresh storage, instead of
+    // waiting for the previous frame to finish reading the old contents.
+    glBindBuffer( GL_UNIFORM_BUFFER, buffer_id_ );
+    glBufferData( GL_UNIFORM_BUFFER, size_, data, GL_STREAM_DRAW );
+    glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+}
@@ -21,23 +21,62 @@
 
 #include <GL/glew.h>
 #include <string>
+#include <map>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
 
 #include "math.h"
 
+// A uniform's location, which is looked up once by Shader::get_uniform() instead of by name
+// every time it's set.  It can only be set to a value of type T.
+template< typename T >
+struct ShaderUniform
+{
+    ShaderUniform() :
+        location_( -1 )
+    {
+    }
+
+    explicit ShaderUniform( const GLint location ) :
+        location_( location )
+    {
+    }
+
+    GLint location_;
+};
+
 struct Shader
 {
-    Shader( const std::string& vertex_shader_filename, const std::string& fragment_shader_filename );
+    // Maps the names of vertex attributes onto the generic attribute indices they are bound to.
+    typedef std::map<std::string, GLuint> AttributeLocationMap;
+
+    Shader(
+        const std::string& vertex_shader_filename,
+        const std::string& fragment_shader_filename,
+        const AttributeLocationMap& attribute_locations = AttributeLocationMap()
+    );
     ~Shader();
 
     void enable() const;
     void disable() const;
 
-    void set_uniform_vec3f( const std::string& name, const Vector3f& value ) const;
-    void set_uniform_vec2f( const std::string& name, const Vector2f& value ) const;
-    void set_uniform_float( const std::string& name, const float v ) const;
-    void set_uniform_int( const std::string& name, const int v ) const;
+    // The uniforms should be looked up once, after the Shader is created, and kept.
+    template< typename T >
+    ShaderUniform<T> get_uniform( const std::string& name ) const
+    {
+        return ShaderUniform<T>( get_uniform_location( name ) );
+    }
+
+    // The Shader must be enabled to set its uniforms.
+    void set_uniform( const ShaderUniform<Vector3f>& uniform, const Vector3f& value ) const;
+    void set_uniform( const ShaderUniform<Vector2f>& uniform, const Vector2f& value ) const;
+    void set_uniform( const ShaderUniform<float>& uniform, const float value ) const;
+    void set_uniform( const ShaderUniform<int>& uniform, const int value ) const;
+
+    // Any number of Shaders can share a UniformBuffer, by binding the uniform block that
+    // it backs to the same binding point.
+    void bind_uniform_block( const std::string& name, const GLuint binding ) const;
 
 protected:
 
@@ -48,11 +87,28 @@ protected:
 
     GLuint load_shader( const std::string& filename, const GLenum shader_type );
     void delete_program() const;
-    void check_shader_status( const GLuint shader, const GLenum status_type ) const;
+    void check_shader_status( const GLuint shader ) const;
+    void check_program_status() const;
     int get_uniform_location( const std::string& name ) const;
 };
 
 typedef boost::shared_ptr<Shader> ShaderSP;
 
+// The storage for a uniform block, which stays bound to its binding point for as long as
+// it exists.  Its contents are replaced all at once, typically once per frame.
+struct UniformBuffer : public boost::noncopyable
+{
+    UniformBuffer( const GLuint binding, const GLsizeiptr size );
+    ~UniformBuffer();
+
+    void set_data( const void* data );
+
+protected:
+
+    GLuint buffer_id_;
+
+    GLsizeiptr size_;
+};
+
 #endif // SHADER_H
 
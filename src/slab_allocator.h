@@ -0,0 +1,124 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+
+// This hands out fixed-size blocks of memory, which are carved out of much larger slabs.
+// Freed blocks are kept on a free list and handed out again, so objects that come and go
+// constantly don't keep going back to the general purpose heap.  The slabs are only
+// released when the allocator is destroyed.  It is safe to use from any thread.
+struct SlabAllocator : public boost::noncopyable
+{
+    SlabAllocator( const size_t block_size, const size_t blocks_per_slab ) :
+        block_stride_( get_block_stride( block_size ) ),
+        blocks_per_slab_( blocks_per_slab ),
+        free_list_( 0 )
+    {
+        assert( blocks_per_slab_ > 0 );
+    }
+
+    ~SlabAllocator()
+    {
+        BOOST_FOREACH( char* slab, slabs_ )
+        {
+            ::operator delete( slab );
+        }
+    }
+
+    void* allocate( const size_t size )
+    {
+        assert( size <= block_stride_ );
+
+        boost::lock_guard<boost::mutex> guard( lock_ );
+
+        if ( !free_list_ )
+        {
+            add_slab();
+        }
+
+        FreeBlock* block = free_list_;
+        free_list_ = block->next_;
+        return block;
+    }
+
+    void deallocate( void* pointer )
+    {
+        if ( !pointer )
+        {
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> guard( lock_ );
+        FreeBlock* block = static_cast<FreeBlock*>( pointer );
+        block->next_ = free_list_;
+        free_list_ = block;
+    }
+
+protected:
+
+    // Every block is aligned at least as strictly as anything that operator new returns.
+    static const size_t BLOCK_ALIGNMENT = 16;
+
+    struct FreeBlock
+    {
+        FreeBlock* next_;
+    };
+
+    static size_t get_block_stride( const size_t block_size )
+    {
+        const size_t size = block_size < sizeof( FreeBlock ) ? sizeof( FreeBlock ) : block_size;
+        return ( size + BLOCK_ALIGNMENT - 1 ) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    }
+
+    // Precondition: the lock_ is held.
+    void add_slab()
+    {
+        char* slab = static_cast<char*>( ::operator new( block_stride_ * blocks_per_slab_ ) );
+        slabs_.push_back( slab );
+
+        for ( size_t i = blocks_per_slab_; i > 0; --i )
+        {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>( slab + ( i - 1 ) * block_stride_ );
+            block->next_ = free_list_;
+            free_list_ = block;
+        }
+    }
+
+    const size_t
+        block_stride_,
+        blocks_per_slab_;
+
+    FreeBlock* free_list_;
+
+    std::vector<char*> slabs_;
+
+    boost::mutex lock_;
+};
+
+#endif // SLAB_ALLOCATOR_H
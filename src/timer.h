@@ -19,6 +19,10 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include <string>
+
+#include "log.h"
+
 #ifndef _WINAPI
     #include <time.h>
     #include <stdexcept>
@@ -96,33 +100,83 @@
     };
 #endif
 
-#ifdef DEBUG_TIMERS
-    #include <string>
-    #include "log.h"
-    #define SCOPE_TIMER_BEGIN( label ) { ScopeTimer __scope_timer( label );
-    #define SCOPE_TIMER_END }
-    
-    struct ScopeTimer
+// This counts frames by how long they took, so that occasional stalls show up even when
+// the average frame rate looks fine.
+struct FrameTimeHistogram
+{
+    static const unsigned NUM_BUCKETS = 6;
+
+    // A frame that takes longer than this (i.e. two frames at 60 Hz) counts as a stall.
+    static const double STALL_SECONDS = 1.0 / 30.0;
+
+    FrameTimeHistogram()
     {
-        ScopeTimer( const std::string& position ) : 
-            position_( position )
+        clear();
+    }
+
+    void add( const double seconds )
+    {
+        unsigned bucket = 0;
+
+        while ( bucket < NUM_BUCKETS - 1 && seconds >= get_bucket_limit( bucket ) )
         {
+            ++bucket;
         }
-    
-        ~ScopeTimer()
+
+        ++buckets_[bucket];
+        ++num_frames_;
+
+        if ( seconds >= STALL_SECONDS )
         {
-            const double ms = timer_.get_seconds_elapsed() * 1000.0;
-            LOG( position_ << " took " <<  ms << " ms." );
+            ++num_stalls_;
         }
-    
-    protected:
-    
-        HighResolutionTimer timer_;
-        std::string position_;
-    };
-#else
-    #define SCOPE_TIMER_BEGIN( label )
-    #define SCOPE_TIMER_END
-#endif
+    }
+
+    void clear()
+    {
+        for ( unsigned i = 0; i < NUM_BUCKETS; ++i )
+        {
+            buckets_[i] = 0;
+        }
+
+        num_frames_ = 0;
+        num_stalls_ = 0;
+    }
+
+    unsigned get_num_frames() const { return num_frames_; }
+    unsigned get_num_stalls() const { return num_stalls_; }
+
+    std::string describe() const
+    {
+        make_string result;
+
+        for ( unsigned i = 0; i < NUM_BUCKETS; ++i )
+        {
+            if ( i < NUM_BUCKETS - 1 )
+            {
+                result << "<" << get_bucket_limit( i ) * 1000.0 << " ms: ";
+            }
+            else result << ">=" << get_bucket_limit( i - 1 ) * 1000.0 << " ms: ";
+
+            result << buckets_[i] << ( i < NUM_BUCKETS - 1 ? ", " : "" );
+        }
+
+        return result;
+    }
+
+protected:
+
+    static double get_bucket_limit( const unsigned bucket )
+    {
+        static const double LIMITS[NUM_BUCKETS - 1] = { 0.008, 0.017, 0.033, 0.050, 0.100 };
+        return LIMITS[bucket];
+    }
+
+    unsigned buckets_[NUM_BUCKETS];
+
+    unsigned
+        num_frames_,
+        num_stalls_;
+};
 
 #endif // TIMER_H
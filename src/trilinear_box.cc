@@ -132,6 +132,102 @@ Scalar TrilinearBox::interpolate( const Vector3f& position ) const
     return tz;
 }
 
+void TrilinearBox::interpolate_column( const Vector3f& start, const Scalar step, const unsigned count, Scalar* out ) const
+{
+    assert( start[0] >= 0.0f && start[0] <= 1.0 );
+    assert( start[2] >= 0.0f && start[2] <= 1.0 );
+
+    const Scalar
+        vertex_space_x = start[0] * Scalar( vertex_field_size_[0] - 1 ),
+        vertex_space_z = start[2] * Scalar( vertex_field_size_[2] - 1 );
+
+    const int
+        vertex_index_x = int( vertex_space_x ),
+        vertex_index_z = int( vertex_space_z );
+
+    const Scalar
+        tx = vertex_space_x - Scalar( vertex_index_x ),
+        tz = vertex_space_z - Scalar( vertex_index_z );
+
+    // The order of the interpolations matches interpolate(), so that the results come out
+    // exactly the same.  Only the last three depend on Y, so the X interpolants are reused
+    // for every point that falls in the same cell.
+
+    int cell_y = -1;
+    Scalar tx00 = 0.0f, tx01 = 0.0f, tx10 = 0.0f, tx11 = 0.0f;
+
+    for ( unsigned i = 0; i < count; ++i )
+    {
+        const Scalar position_y = start[1] + Scalar( i ) * step;
+        assert( position_y >= 0.0f && position_y <= 1.0 );
+
+        const Scalar vertex_space_y = position_y * Scalar( vertex_field_size_[1] - 1 );
+        const int vertex_index_y = int( vertex_space_y );
+
+        if ( vertex_index_y != cell_y )
+        {
+            cell_y = vertex_index_y;
+
+            const Vector3i vertex_index( vertex_index_x, vertex_index_y, vertex_index_z );
+
+            const Scalar
+                p000 = get_vertex( vertex_index + Vector3i( 0, 0, 0 ) ),
+                p001 = get_vertex( vertex_index + Vector3i( 0, 0, 1 ) ),
+                p010 = get_vertex( vertex_index + Vector3i( 0, 1, 0 ) ),
+                p011 = get_vertex( vertex_index + Vector3i( 0, 1, 1 ) ),
+                p100 = get_vertex( vertex_index + Vector3i( 1, 0, 0 ) ),
+                p101 = get_vertex( vertex_index + Vector3i( 1, 0, 1 ) ),
+                p110 = get_vertex( vertex_index + Vector3i( 1, 1, 0 ) ),
+                p111 = get_vertex( vertex_index + Vector3i( 1, 1, 1 ) );
+
+            gmtl::Math::lerp( tx00, tx, p000, p100 );
+            gmtl::Math::lerp( tx01, tx, p001, p101 );
+            gmtl::Math::lerp( tx10, tx, p010, p110 );
+            gmtl::Math::lerp( tx11, tx, p011, p111 );
+        }
+
+        const Scalar ty = vertex_space_y - Scalar( vertex_index_y );
+
+        Scalar ty0, ty1;
+        gmtl::Math::lerp( ty0, ty, tx00, tx10 );
+        gmtl::Math::lerp( ty1, ty, tx01, tx11 );
+
+        gmtl::Math::lerp( out[i], tz, ty0, ty1 );
+    }
+}
+
+Vector2f TrilinearBox::get_range( const Vector3f& min_position, const Vector3f& max_position ) const
+{
+    // Every interpolated value lies between the minimum and maximum of its cell's vertices,
+    // so it's enough to look at the vertices of every cell that the bounds touch.
+
+    Vector3i min_index, max_index;
+
+    for ( int i = 0; i < 3; ++i )
+    {
+        assert( min_position[i] >= 0.0f && min_position[i] <= max_position[i] && max_position[i] <= 1.0 );
+        min_index[i] = int( min_position[i] * Scalar( vertex_field_size_[i] - 1 ) );
+        max_index[i] = std::min( int( max_position[i] * Scalar( vertex_field_size_[i] - 1 ) ) + 1, vertex_field_size_[i] - 1 );
+    }
+
+    Vector2f range( get_vertex( min_index ), get_vertex( min_index ) );
+
+    for ( int x = min_index[0]; x <= max_index[0]; ++x )
+    {
+        for ( int y = min_index[1]; y <= max_index[1]; ++y )
+        {
+            for ( int z = min_index[2]; z <= max_index[2]; ++z )
+            {
+                const Scalar value = get_vertex( Vector3i( x, y, z ) );
+                range[0] = std::min( range[0], value );
+                range[1] = std::max( range[1], value );
+            }
+        }
+    }
+
+    return range;
+}
+
 size_t TrilinearBox::vertex_field_index( const Vector3i& index ) const
 {
     return index[0] + index[1] * vertex_field_size_[0] + index[2] * vertex_field_size_[0] * vertex_field_size_[1];
@@ -34,6 +34,15 @@ struct TrilinearBox
 
     Scalar interpolate( const Vector3f& position ) const;
 
+    // Evaluates count points starting at the given position and stepping along the Y axis.
+    // The results are identical to calling interpolate() for each point, but the vertices
+    // and X interpolants are only looked up once per cell.
+    void interpolate_column( const Vector3f& start, const Scalar step, const unsigned count, Scalar* out ) const;
+
+    // Returns the minimum and maximum values that interpolate() can yield for any position
+    // within the given bounds.  These are conservative, since they come from the vertices.
+    Vector2f get_range( const Vector3f& min_position, const Vector3f& max_position ) const;
+
 private:
 
     size_t vertex_field_index( const Vector3i& index ) const;
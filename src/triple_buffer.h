@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <boost/utility.hpp>
+
+// This hands values from one producer thread to one consumer thread without locking.
+// The producer fills in the back buffer and publishes it, and the consumer reads from
+// the front buffer, which it swaps for the most recently published one on demand.  The
+// third buffer sits between them, so neither side ever has to wait for the other, and
+// the consumer always sees a complete value (but may skip some, if it's slow).
+template <typename T>
+struct TripleBuffer : public boost::noncopyable
+{
+    TripleBuffer() :
+        back_( 0 ),
+        middle_( 1 ),
+        front_( 2 )
+    {
+    }
+
+    // Only the producer may call these.
+    T& get_back() { return buffers_[back_]; }
+
+    void publish()
+    {
+        back_ = exchange_middle( back_ | FRESH_BIT ) & INDEX_MASK;
+    }
+
+    // Only the consumer may call these.  Returns whether the front buffer changed.
+    bool update_front()
+    {
+        if ( !( middle_ & FRESH_BIT ) )
+        {
+            return false;
+        }
+
+        front_ = exchange_middle( front_ ) & INDEX_MASK;
+        return true;
+    }
+
+    const T& get_front() const { return buffers_[front_]; }
+
+protected:
+
+    // The middle index also records whether the buffer behind it has been published since
+    // the consumer last took it.
+    static const int
+        INDEX_MASK = 0x3,
+        FRESH_BIT = 0x4;
+
+    // The compare-and-swap is a full barrier, so the writes to a buffer are all visible by
+    // the time it can be taken from the middle.
+    int exchange_middle( const int value )
+    {
+        int old_value;
+
+        do
+        {
+            old_value = middle_;
+        }
+        while ( __sync_val_compare_and_swap( &middle_, old_value, value ) != old_value );
+
+        return old_value;
+    }
+
+    T buffers_[3];
+
+    int back_;
+
+    volatile int middle_;
+
+    int front_;
+};
+
+#endif // TRIPLE_BUFFER_H
@@ -0,0 +1,268 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef VECTOR_HASH_MAP_H
+#define VECTOR_HASH_MAP_H
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// An open-addressing hash map (with linear probing) for integer vector keys.  It provides
+// the subset of the std::map interface that is needed for e.g. the ChunkMap, but lookups
+// are O(1) instead of O(log n) and don't chase pointers all over the heap.
+//
+// NOTE: Unlike std::map, the iteration order is unspecified, and inserting or erasing an
+//       element invalidates all iterators.  Also, the keys of value_type aren't const,
+//       but they must not be modified.
+template <typename Key, typename T>
+struct VectorHashMap
+{
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef std::pair<Key, T> value_type;
+    typedef std::size_t size_type;
+
+    template <typename MapType, typename ValueType>
+    struct Iterator : public std::iterator<std::forward_iterator_tag, ValueType>
+    {
+        Iterator( MapType* map = 0, const size_type slot = 0 ) :
+            map_( map ),
+            slot_( slot )
+        {
+            skip_empty_slots();
+        }
+
+        // This allows an iterator to be converted to a const_iterator.
+        template <typename OtherMapType, typename OtherValueType>
+        Iterator( const Iterator<OtherMapType, OtherValueType>& other ) :
+            map_( other.map_ ),
+            slot_( other.slot_ )
+        {
+        }
+
+        ValueType& operator*() const { return map_->slots_[slot_].value_; }
+        ValueType* operator->() const { return &map_->slots_[slot_].value_; }
+
+        Iterator& operator++()
+        {
+            ++slot_;
+            skip_empty_slots();
+            return *this;
+        }
+
+        Iterator operator++( int )
+        {
+            Iterator result = *this;
+            ++*this;
+            return result;
+        }
+
+        bool operator==( const Iterator& other ) const { return slot_ == other.slot_; }
+        bool operator!=( const Iterator& other ) const { return slot_ != other.slot_; }
+
+    private:
+
+        template <typename OtherMapType, typename OtherValueType> friend struct Iterator;
+        friend struct VectorHashMap;
+
+        void skip_empty_slots()
+        {
+            while ( map_ && slot_ < map_->slots_.size() && !map_->slots_[slot_].occupied_ )
+            {
+                ++slot_;
+            }
+        }
+
+        MapType* map_;
+        size_type slot_;
+    };
+
+    typedef Iterator<VectorHashMap, value_type> iterator;
+    typedef Iterator<const VectorHashMap, const value_type> const_iterator;
+
+    VectorHashMap() :
+        size_( 0 )
+    {
+    }
+
+    iterator begin() { return iterator( this, 0 ); }
+    iterator end() { return iterator( this, slots_.size() ); }
+    const_iterator begin() const { return const_iterator( this, 0 ); }
+    const_iterator end() const { return const_iterator( this, slots_.size() ); }
+
+    size_type size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    iterator find( const Key& key )
+    {
+        return iterator( this, find_slot( key ) );
+    }
+
+    const_iterator find( const Key& key ) const
+    {
+        return const_iterator( this, find_slot( key ) );
+    }
+
+    T& operator[]( const Key& key )
+    {
+        // Keep the load factor at or below 1/2, so that the probe sequences stay short.
+        if ( ( size_ + 1 ) * 2 > slots_.size() )
+        {
+            rehash( std::max( size_type( MIN_SLOTS ), slots_.size() * 2 ) );
+        }
+
+        size_type slot = get_ideal_slot( key );
+
+        while ( slots_[slot].occupied_ )
+        {
+            if ( slots_[slot].value_.first == key )
+            {
+                return slots_[slot].value_.second;
+            }
+
+            slot = next_slot( slot );
+        }
+
+        slots_[slot].occupied_ = true;
+        slots_[slot].value_.first = key;
+        ++size_;
+        return slots_[slot].value_.second;
+    }
+
+    size_type erase( const Key& key )
+    {
+        size_type hole = find_slot( key );
+
+        if ( hole == slots_.size() )
+        {
+            return 0;
+        }
+
+        // Rather than leaving a tombstone behind, shift any following elements in the same
+        // probe sequence back into the hole, so that lookups never have to skip over them.
+        for ( size_type slot = next_slot( hole ); slots_[slot].occupied_; slot = next_slot( slot ) )
+        {
+            const size_type ideal = get_ideal_slot( slots_[slot].value_.first );
+
+            const bool movable = ( hole <= slot ) ?
+                ( ideal <= hole || ideal > slot ) :
+                ( ideal <= hole && ideal > slot );
+
+            if ( movable )
+            {
+                slots_[hole] = slots_[slot];
+                hole = slot;
+            }
+        }
+
+        slots_[hole] = Slot();
+        --size_;
+        return 1;
+    }
+
+    void clear()
+    {
+        slots_.clear();
+        size_ = 0;
+    }
+
+private:
+
+    enum { MIN_SLOTS = 16 };
+
+    struct Slot
+    {
+        Slot() :
+            occupied_( false )
+        {
+        }
+
+        bool occupied_;
+        value_type value_;
+    };
+
+    typedef std::vector<Slot> SlotV;
+
+    size_type get_ideal_slot( const Key& key ) const
+    {
+        uint32_t hash = 0;
+
+        for ( int i = 0; i < Key::Size; ++i )
+        {
+            hash = ( hash ^ uint32_t( key[i] ) ) * 0x9e3779b1u;
+        }
+
+        // The keys are often multiples of a power of two (e.g. Chunk positions), so the
+        // hash bits have to be mixed thoroughly before the low ones are used.
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bu;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35u;
+        hash ^= hash >> 16;
+
+        return hash & ( slots_.size() - 1 );
+    }
+
+    size_type next_slot( const size_type slot ) const
+    {
+        return ( slot + 1 ) & ( slots_.size() - 1 );
+    }
+
+    // Returns slots_.size() if the key is not present.
+    size_type find_slot( const Key& key ) const
+    {
+        if ( slots_.empty() )
+        {
+            return 0;
+        }
+
+        for ( size_type slot = get_ideal_slot( key ); slots_[slot].occupied_; slot = next_slot( slot ) )
+        {
+            if ( slots_[slot].value_.first == key )
+            {
+                return slot;
+            }
+        }
+
+        return slots_.size();
+    }
+
+    void rehash( const size_type num_slots )
+    {
+        SlotV old_slots( num_slots );
+        old_slots.swap( slots_ );
+        size_ = 0;
+
+        for ( typename SlotV::iterator it = old_slots.begin(); it != old_slots.end(); ++it )
+        {
+            if ( it->occupied_ )
+            {
+                ( *this )[it->value_.first] = it->value_.second;
+            }
+        }
+    }
+
+    SlotV slots_;
+
+    size_type size_;
+};
+
+#endif // VECTOR_HASH_MAP_H
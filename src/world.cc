@@ -16,6 +16,8 @@
 // along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
 ///////////////////////////////////////////////////////////////////////////
 
+#include <limits>
+
 #include <boost/random/uniform_int.hpp>
 #include <boost/random/uniform_real.hpp>
 #include <boost/random/uniform_on_sphere.hpp>
@@ -25,6 +27,7 @@
 
 #include "world.h"
 #include "timer.h"
+#include "profiler.h"
 
 //////////////////////////////////////////////////////////////////////////////////
 // Local definitions:
@@ -70,83 +73,66 @@ const Sky::Profile SKY_PROFILES[] =
     )
 };
 
-bool highest_chunk( const Chunk* a, const Chunk* b )
+const Chunk* find_chunk( const ChunkMap& chunks, const Vector3i& position )
 {
-    return a->get_position()[1] > b->get_position()[1];
+    ChunkMap::const_iterator chunk_it = chunks.find( position );
+    return chunk_it == chunks.end() ? 0 : chunk_it->second.get();
 }
 
-void sort_and_reset_lighting( ChunkV& chunks )
+// Neighbor links are always stitched between Chunks in the map, so the map only needs to be
+// searched when there's no Chunk to step from.
+const Chunk* step_to_chunk( const ChunkMap& chunks, const Chunk* chunk, const Vector3i& relation, const Vector3i& position )
 {
-    std::sort( chunks.begin(), chunks.end(), highest_chunk );
-
-    BOOST_FOREACH( Chunk* chunk, chunks )
-    {
-        chunk->reset_lighting();
-    }
+    return chunk ? chunk->get_neighbor( relation ) : find_chunk( chunks, position );
 }
 
-bool are_chunks_doubly_separated( const Chunk& chunk_a, const Chunk& chunk_b )
+bool highest_chunk( const Chunk* a, const Chunk* b )
 {
-    const Vector3i& a = chunk_a.get_position();
-    const Vector3i& b = chunk_b.get_position();
-
-    for ( int i = 0; i < Vector3i::Size; ++i )
-    {
-        if ( abs( a[i] - b[i] ) > Chunk::SIZE[i] * 3 )
-        {
-            return true;
-        }
-    }
-
-    return false;
+    return a->get_position()[1] > b->get_position()[1];
 }
 
-// This function takes a set of Chunks, and returns a subset of them that are spaced
-// out such that apply_lighting_to_neighbors() may be safely called on them in parallel.
-void find_doubly_separated_chunks( const ChunkSet& chunks, ChunkSet& separated_chunks )
+typedef bool ChunkColumnMask[Chunk::SIZE_X][Chunk::SIZE_Z];
+
+// This resets the Chunk's lighting, and marks the columns whose bottom Block changed from
+// being a sunlight source to not (or vice versa).
+bool reset_changes_base_sunlight( Chunk& chunk, ChunkColumnMask& base_sunlight_changed )
 {
-    BOOST_FOREACH( Chunk* chunk, chunks )
+    for ( int x = 0; x < Chunk::SIZE_X; ++x )
     {
-        bool separated = true;
-
-        BOOST_FOREACH( Chunk* separated_chunk, separated_chunks )
-        {
-            if ( !are_chunks_doubly_separated( *chunk, *separated_chunk ) )
-            {
-                separated = false;
-                break;
-            }
-        }
-
-        if ( separated )
+        for ( int z = 0; z < Chunk::SIZE_Z; ++z )
         {
-            separated_chunks.insert( chunk );
+            Block& block = chunk.get_block( Vector3i( x, 0, z ) );
+            base_sunlight_changed[x][z] = block.is_sunlight_source();
         }
     }
-}
 
-bool reset_changes_base_sunlight( Chunk& chunk )
-{
-    bool base_sunlight[Chunk::SIZE_X][Chunk::SIZE_Z];
+    chunk.reset_lighting();
+
+    bool changed = false;
 
     for ( int x = 0; x < Chunk::SIZE_X; ++x )
     {
         for ( int z = 0; z < Chunk::SIZE_Z; ++z )
         {
             Block& block = chunk.get_block( Vector3i( x, 0, z ) );
-            base_sunlight[x][z] = block.is_sunlight_source();
+            base_sunlight_changed[x][z] = base_sunlight_changed[x][z] != block.is_sunlight_source();
+            changed |= base_sunlight_changed[x][z];
         }
     }
 
-    chunk.reset_lighting();
+    return changed;
+}
 
+// A change in the sunlight coming down a column only affects the Chunk below if there's
+// anything translucent at the top of it to pass the change along.  Otherwise, resetting
+// the Chunk would leave its lighting exactly as it was.
+bool sunlight_change_reaches( const Chunk& chunk, const ChunkColumnMask& base_sunlight_changed )
+{
     for ( int x = 0; x < Chunk::SIZE_X; ++x )
     {
         for ( int z = 0; z < Chunk::SIZE_Z; ++z )
         {
-            Block& block = chunk.get_block( Vector3i( x, 0, z ) );
-
-            if ( base_sunlight[x][z] != block.is_sunlight_source() )
+            if ( base_sunlight_changed[x][z] && chunk.get_opaque_height( x, z ) < Chunk::SIZE_Y )
             {
                 return true;
             }
@@ -156,6 +142,10 @@ bool reset_changes_base_sunlight( Chunk& chunk )
     return false;
 }
 
+// The Chunks below one whose sunlight changed are only added (and reset) as long as the
+// change keeps reaching further down the column.  The ones that it doesn't reach are still
+// reset along with the rest of the surroundings, but they don't need to be treated as
+// modified, which would in turn reset everything around them.
 void add_chunks_affected_by_sunlight( ChunkSet& chunks )
 {
     ChunkV height_sorted_chunks;
@@ -167,6 +157,8 @@ void add_chunks_affected_by_sunlight( ChunkSet& chunks )
 
     std::sort( height_sorted_chunks.begin(), height_sorted_chunks.end(), highest_chunk );
 
+    ChunkColumnMask base_sunlight_changed;
+
     BOOST_FOREACH( Chunk* chunk, height_sorted_chunks )
     {
         Chunk* next = chunk;
@@ -175,11 +167,11 @@ void add_chunks_affected_by_sunlight( ChunkSet& chunks )
         {
             chunks.insert( next );
 
-            if ( reset_changes_base_sunlight( *next ) )
+            if ( reset_changes_base_sunlight( *next, base_sunlight_changed ) )
             {
                 next = next->get_neighbor( cardinal_relation_vector( CARDINAL_RELATION_BELOW ) );
 
-                if ( chunks.find( next ) != chunks.end() )
+                if ( next && ( chunks.find( next ) != chunks.end() || !sunlight_change_reaches( *next, base_sunlight_changed ) ) )
                 {
                     next = 0;
                 }
@@ -189,6 +181,62 @@ void add_chunks_affected_by_sunlight( ChunkSet& chunks )
     }
 }
 
+Vector2i get_column_position( const Vector3f& position )
+{
+    const Vector2i block_position(
+        int( gmtl::Math::floor( position[0] ) ),
+        int( gmtl::Math::floor( position[2] ) )
+    );
+
+    return Vector2i(
+        block_position[0] - ( ( block_position[0] % Chunk::SIZE_X ) + Chunk::SIZE_X ) % Chunk::SIZE_X,
+        block_position[1] - ( ( block_position[1] % Chunk::SIZE_Z ) + Chunk::SIZE_Z ) % Chunk::SIZE_Z
+    );
+}
+
+Scalar get_column_distance( const Vector2i& column_position, const Vector3f& position )
+{
+    const Vector2f column_center(
+        Scalar( column_position[0] ) + Scalar( Chunk::SIZE_X ) / 2.0f,
+        Scalar( column_position[1] ) + Scalar( Chunk::SIZE_Z ) / 2.0f
+    );
+
+    return gmtl::length( Vector2f( column_center - Vector2f( position[0], position[2] ) ) );
+}
+
+Scalar get_nearest_column_distance( const Vector2i& column_position, const Vector3fV& positions )
+{
+    Scalar nearest_distance = std::numeric_limits<Scalar>::max();
+
+    BOOST_FOREACH( const Vector3f& position, positions )
+    {
+        nearest_distance = std::min( nearest_distance, get_column_distance( column_position, position ) );
+    }
+
+    return nearest_distance;
+}
+
+bool closest_column( const std::pair<int, Vector2i>& a, const std::pair<int, Vector2i>& b )
+{
+    return a.first < b.first;
+}
+
+void add_chunks_and_neighbors( const ChunkSet& chunks, ChunkSet& result )
+{
+    BOOST_FOREACH( Chunk* chunk, chunks )
+    {
+        FOREACH_SURROUNDING( x, y, z )
+        {
+            Chunk* neighbor = chunk->get_neighbor( Vector3i( x, y, z ) );
+
+            if ( neighbor )
+            {
+                result.insert( neighbor );
+            }
+        }
+    }
+}
+
 unsigned hardware_concurrency()
 {
     const unsigned concurrency = boost::thread::hardware_concurrency();
@@ -267,8 +315,12 @@ Sky::Sky( const uint64_t world_seed ) :
 
 void Sky::do_one_step( const float step_time )
 {
-    time_of_day_ += DAY_CYCLE_SPEED * step_time;
-    time_of_day_ -= gmtl::Math::floor( time_of_day_ );
+    set_time_of_day( time_of_day_ + DAY_CYCLE_SPEED * step_time );
+}
+
+void Sky::set_time_of_day( const Scalar time_of_day )
+{
+    time_of_day_ = time_of_day - gmtl::Math::floor( time_of_day );
 
     // TODO: This is pretty ugly.  It would be nice to make it a bit more general.
 
@@ -282,6 +334,10 @@ void Sky::do_one_step( const float step_time )
         const Scalar t = ( time_of_day_ - 0.30f ) / 0.05f;
         profile_ = SKY_PROFILES[SKY_MODE_SUNSET].lerp( t, SKY_PROFILES[SKY_MODE_MIDDAY] );
     }
+    else if ( time_of_day_ > 0.35f && time_of_day_ <= 0.65 )
+    {
+        profile_ = SKY_PROFILES[SKY_MODE_MIDDAY];
+    }
     else if ( time_of_day_ > 0.65 && time_of_day_ <= 0.70f )
     {
         const Scalar t = ( time_of_day_ - 0.65f ) / 0.05f;
@@ -292,6 +348,7 @@ void Sky::do_one_step( const float step_time )
         const Scalar t = ( time_of_day_ - 0.70f ) / 0.10f;
         profile_ = SKY_PROFILES[SKY_MODE_SUNSET].lerp( t, SKY_PROFILES[SKY_MODE_NIGHT] );
     }
+    else profile_ = SKY_PROFILES[SKY_MODE_NIGHT];
 
     sun_angle_[0] = ( 1.0f - 2.0f * time_of_day_ ) * gmtl::Math::PI;
     sun_angle_[1] = 0.01f * gmtl::Math::PI * gmtl::Math::sin( time_of_day_ * 2.0f * gmtl::Math::PI );
@@ -304,95 +361,160 @@ void Sky::do_one_step( const float step_time )
 // Function definitions for World:
 //////////////////////////////////////////////////////////////////////////////////
 
-World::World( const uint64_t world_seed ) :
-    generator_( world_seed ),
-    sky_( world_seed ),
+World::World(
+    const uint64_t world_seed,
+    const Vector3f& spawn_position,
+    const std::string& store_path,
+    const WorldMode mode
+) :
+    mode_( mode ),
+    store_( mode == WORLD_MODE_REPLICA ? 0 : new ChunkStore( store_path, world_seed ) ),
+    world_seed_( store_ ? store_->get_world_seed() : world_seed ),
+    generator_( world_seed_ ),
+    sky_( world_seed_ ),
     time_since_simulation_( 0.0f ),
+    time_since_save_( 0.0f ),
+    simulation_step_( 0 ),
+    simulation_radius_( DEFAULT_SIMULATION_RADIUS ),
     worker_pool_( hardware_concurrency() ),
-    outstanding_jobs_( 0 )
+    updating_chunks_( false ),
+    chunk_lock_requests_( 0 ),
+    view_radius_( DEFAULT_VIEW_RADIUS ),
+    generator_pool_( hardware_concurrency() )
 {
+    if ( mode_ == WORLD_MODE_REPLICA )
+    {
+        return;
+    }
+
     ChunkGuard chunk_guard( chunk_lock_ );
 
+    // The startup time is always logged, along with the number of threads that were used,
+    // since it's the most noticeable (and most easily comparable) cost of world generation.
+    HighResolutionTimer startup_timer;
+
     SCOPE_TIMER_BEGIN( "World generation" )
 
-    for ( int x = 0; x < 3; ++x )
+    const Vector2i spawn_column = get_column_position( spawn_position );
+
+    for ( int x = -SPAWN_RADIUS; x <= SPAWN_RADIUS; ++x )
     {
-        for ( int z = 0; z < 3; ++z )
+        for ( int z = -SPAWN_RADIUS; z <= SPAWN_RADIUS; ++z )
         {
-            const Vector2i region_position( x * WorldGenerator::REGION_SIZE, z * WorldGenerator::REGION_SIZE );
-            ChunkSPV region = generator_.generate_region( region_position, worker_pool_ );
+            const Vector2i column_position =
+                spawn_column + Vector2i( x * Chunk::SIZE_X, z * Chunk::SIZE_Z );
 
-            BOOST_FOREACH( ChunkSP chunk, region )
-            {
-                chunk_stitch_into_map( chunk, chunks_ );
-            }
+            columns_generating_.insert( column_position );
+            generator_pool_.schedule( boost::bind( &World::generate_column, this, column_position ) );
         }
     }
 
-    yield( chunk_guard );
+    generator_pool_.wait();
 
     SCOPE_TIMER_END
 
-    ChunkSet chunks;
+    const double generation_seconds = startup_timer.get_seconds_elapsed();
+    startup_timer.reset();
 
-    BOOST_FOREACH( ChunkMap::value_type& chunk_it, chunks_ )
+    ChunkSet chunks, updated_geometry_chunks;
+    stitch_generated_columns( chunks );
+
+    // The update graph resets the lighting for each column in top-down order, which
+    // ensures that sunlight is correctly propagated from the top Chunks to the ones below.
+    // A server World doesn't light anything, so its Chunks only need to be compacted.
+    if ( mode_ == WORLD_MODE_SERVER )
+    {
+        compact_chunks( chunks );
+    }
+    else run_update_graph( chunk_guard, chunks, chunks, chunks, chunks, updated_geometry_chunks );
+
+    const unsigned num_spawn_columns = ( 2 * SPAWN_RADIUS + 1 ) * ( 2 * SPAWN_RADIUS + 1 );
+    LOG( "Loaded or generated " << num_spawn_columns << " columns in " << generation_seconds * 1000.0 <<
+         " ms and updated " << chunks.size() << " chunks in " << startup_timer.get_seconds_elapsed() * 1000.0 <<
+         " ms, using " << hardware_concurrency() << " threads." );
+}
+
+World::~World()
+{
+    generator_pool_.wait();
+
+    if ( !store_ )
     {
-        chunks.insert( chunk_it.second.get() );
+        return;
     }
 
-    // The lighting for each Chunk needs to be reset in top-down order to ensure
-    // that sunlight is correctly propagated from the top Chunks to the ones below.
-    reset_lighting_top_down( chunk_guard, chunks );
+    BOOST_FOREACH( const Vector2i& column_position, dirty_columns_ )
+    {
+        if ( column_loaded( column_position ) )
+        {
+            store_->save_column( column_position, get_column( column_position ) );
+        }
+    }
 
-    apply_lighting_to_self( chunk_guard, chunks );
-    apply_lighting_to_neighbors( chunk_guard, chunks );
-    update_geometry( chunk_guard, chunks );
+    store_->flush();
 }
 
-void World::do_one_step( const float step_time, const Vector3f& player_position )
+size_t World::get_chunk_memory_usage() const
 {
-    sky_.do_one_step( step_time );
+    size_t memory_usage = 0;
 
-    time_since_simulation_ += step_time;
+    BOOST_FOREACH( const ChunkMap::value_type& chunk_it, chunks_ )
+    {
+        memory_usage += chunk_it.second->get_memory_usage();
+    }
 
-    if ( time_since_simulation_ > SIMULATION_INTERVAL )
+    return memory_usage;
+}
+
+unsigned World::get_num_uniform_chunks() const
+{
+    unsigned num_uniform_chunks = 0;
+
+    BOOST_FOREACH( const ChunkMap::value_type& chunk_it, chunks_ )
     {
-        time_since_simulation_ = 0.0f;
+        num_uniform_chunks += chunk_it.second->is_uniform();
+    }
 
-        const Vector3i player_block_position = vector_cast<int>( pointwise_round( player_position ) );
-        const Vector3i player_chunk_position = player_block_position - get_block_index( player_block_position );
+    return num_uniform_chunks;
+}
 
-        BlockV blocks_visited;
-        ChunkSet chunks_modified;
+void World::do_one_step( const float step_time, const Vector3fV& player_positions )
+{
+    sky_.do_one_step( step_time );
 
-        // TODO: Right now, only the Chunks that are immediately surrounding the Player's position
-        //       are simulated.  The simulated area should be extended outwards.
+    if ( mode_ == WORLD_MODE_REPLICA )
+    {
+        return;
+    }
 
-        // TODO: Consider performing the simulation of multiple Chunks in parallel, using the same
-        //       approach as the lighting (apply to self, apply to neighbors).
+    // Any newly stitched columns need to be updated, which will take care of lighting
+    // them (and their existing neighbors) and building their geometry.  They're not
+    // passed through mark_chunk_for_update(), since that would mark them as dirty.
+    ChunkSet stitched_chunks;
+    stitch_generated_columns( stitched_chunks );
+    chunks_needing_update_.insert( stitched_chunks.begin(), stitched_chunks.end() );
 
-        FOREACH_SURROUNDING( x, y, z )
-        {
-            const Vector3i position =
-                player_chunk_position + pointwise_product( Chunk::SIZE, Vector3i( x, y, z ) );
+    time_since_save_ += step_time;
+    save_dirty_columns();
 
-            Chunk* chunk = get_chunk( position );
+    time_since_simulation_ += step_time;
 
-            if ( chunk )
-            {
-                chunk->simulate( blocks_visited, chunks_modified );
-            }
-        }
+    if ( time_since_simulation_ > SIMULATION_INTERVAL )
+    {
+        time_since_simulation_ = 0.0f;
 
-        BOOST_FOREACH( Block* block, blocks_visited )
-        {
-            block->set_visited( false );
-        }
+        request_columns( player_positions );
+        evict_distant_chunks( player_positions );
+
+        Vector3iV player_chunk_positions;
 
-        BOOST_FOREACH( Chunk* chunk, chunks_modified )
+        BOOST_FOREACH( const Vector3f& player_position, player_positions )
         {
-            mark_chunk_for_update( chunk );
+            const Vector3i player_block_position = vector_cast<int>( pointwise_round( player_position ) );
+            player_chunk_positions.push_back( player_block_position - get_block_index( player_block_position ) );
         }
+
+        simulate_fluids( player_chunk_positions );
     }
 }
 
@@ -401,11 +523,29 @@ void World::update_chunks()
     ChunkGuard chunk_guard( chunk_lock_ );
     assert( updated_chunks_.empty() );
 
-    if ( chunks_needing_update_.empty() )
+    if ( !chunk_update_needed() )
     {
         return;
     }
 
+    // Nothing is drawn from a server World, so it doesn't need any lighting or geometry.
+    // Its newly stitched Chunks still start out expanded, though.
+    if ( mode_ == WORLD_MODE_SERVER )
+    {
+        compact_chunks( chunks_needing_update_ );
+        chunks_needing_update_.clear();
+        chunks_needing_geometry_update_.clear();
+        blocks_needing_update_.clear();
+        return;
+    }
+
+    // This includes the time spent waiting for the lock whenever the update yields it.
+    const ProfileZone profile_zone( "Rebuilding chunks" );
+
+    // While the update is in progress, the Chunks it's working on must not be evicted,
+    // since the lock will be released periodically.
+    updating_chunks_ = true;
+
     // If a Chunk is modified, it is not sufficient to simply rebuild the lighting/geometry
     // for that Chunk.  Lighting can travel up to 16 blocks, so a change to one Chunk might
     // spread light to other surrounding Chunks.  The Chunks are (at least) 16 blocks in size,
@@ -431,6 +571,12 @@ void World::update_chunks()
     ChunkSet chunks_needing_update = chunks_needing_update_;
     chunks_needing_update_.clear();
 
+    BlockPositionSet blocks_needing_update;
+    blocks_needing_update.swap( blocks_needing_update_ );
+
+    ChunkSet chunks_needing_geometry_update;
+    chunks_needing_geometry_update.swap( chunks_needing_geometry_update_ );
+
     ChunkSet reset_chunks;
     ChunkSet possibly_modified_chunks;
     ChunkSet neighbor_chunks;
@@ -471,138 +617,600 @@ void World::update_chunks()
         }
     }
 
-    // This reset might can be done without any sorting, due to the fact that
-    // the Chunks in which the sunlighting may have changed were already reset
-    // in top-down order by add_chunks_affected_by_sunlight().
-    reset_lighting_unordered( chunk_guard, reset_chunks );
+    // Individual Blocks that were modified are handled incrementally, which only touches
+    // the Blocks whose lighting actually changed.  Any Block that is inside of a Chunk that
+    // is about to be fully relit can be skipped, since that takes care of its surroundings too.
+    // Only the positions are kept for now, since the full relight compacts the Chunks that it
+    // touches, which would leave any Block pointers into them dangling.
+    Vector3iV modified_block_positions;
+
+    BOOST_FOREACH( const Vector3i& block_position, blocks_needing_update )
+    {
+        Chunk* chunk = get_chunk( block_position - get_block_index( block_position ) );
+
+        if ( chunk && possibly_modified_chunks.find( chunk ) == possibly_modified_chunks.end() )
+        {
+            modified_block_positions.push_back( block_position );
+        }
+    }
+
+    ChunkSet geometry_chunks = possibly_modified_chunks;
+    geometry_chunks.insert( chunks_needing_geometry_update.begin(), chunks_needing_geometry_update.end() );
+
+    // The Chunks in chunks_needing_update were already reset by add_chunks_affected_by_sunlight(),
+    // and the rest of the resets within each column are ordered from the top down by the graph.
+    // Only the Chunks whose meshes actually changed are reported as updated, since the rest
+    // don't need to be sent to the graphics card again.
+    ChunkSet updated_geometry_chunks;
+
+    if ( !chunks_needing_update.empty() && modified_block_positions.empty() )
+    {
+        run_update_graph( chunk_guard, reset_chunks, possibly_modified_chunks, neighbor_chunks, geometry_chunks, updated_geometry_chunks );
+    }
+    else
+    {
+        if ( !chunks_needing_update.empty() )
+        {
+            run_update_graph( chunk_guard, reset_chunks, possibly_modified_chunks, neighbor_chunks, ChunkSet(), updated_geometry_chunks );
+        }
+
+        // The incremental lighting has to wait until the full relight is done, since it reads
+        // the lighting around the modified Blocks.  The geometry waits for both.  This is done
+        // all at once (without yielding), but it's very fast.
+        if ( !modified_block_positions.empty() )
+        {
+            BlockIteratorV modified_blocks;
+
+            BOOST_FOREACH( const Vector3i& block_position, modified_block_positions )
+            {
+                const BlockIterator block_it = get_block( block_position );
+
+                if ( block_it.block_ )
+                {
+                    modified_blocks.push_back( block_it );
+                }
+            }
+
+            ChunkSet relit_chunks;
+
+            SCOPE_TIMER_BEGIN( "Incremental lighting" )
+            chunk_update_block_lighting( modified_blocks, relit_chunks );
+            SCOPE_TIMER_END
+
+            geometry_chunks.insert( relit_chunks.begin(), relit_chunks.end() );
+        }
+
+        run_update_graph( chunk_guard, ChunkSet(), ChunkSet(), ChunkSet(), geometry_chunks, updated_geometry_chunks );
+    }
+
+    updated_chunks_ = updated_geometry_chunks;
+    updating_chunks_ = false;
+}
 
-    apply_lighting_to_self( chunk_guard, possibly_modified_chunks );
-    apply_lighting_to_neighbors( chunk_guard, neighbor_chunks );
-    update_geometry( chunk_guard, possibly_modified_chunks );
+void World::wake_fluids( const Vector3i& block_position )
+{
+    const Vector3i relations[] =
+    {
+        Vector3i( 0, 0, 0 ),
+        cardinal_relation_vector( CARDINAL_RELATION_ABOVE ),
+        cardinal_relation_vector( CARDINAL_RELATION_BELOW ),
+        cardinal_relation_vector( CARDINAL_RELATION_NORTH ),
+        cardinal_relation_vector( CARDINAL_RELATION_SOUTH ),
+        cardinal_relation_vector( CARDINAL_RELATION_EAST ),
+        cardinal_relation_vector( CARDINAL_RELATION_WEST )
+    };
+
+    BOOST_FOREACH( const Vector3i& relation, relations )
+    {
+        const Vector3i position = block_position + relation;
+        const Vector3i block_index = get_block_index( position );
+        Chunk* chunk = get_chunk( position - block_index );
 
-    // TODO: Only add Chunks that were DEFINITELY modified to updated_chunks_.  This will
-    //       save time because they won't need to be sent to the graphics card.
-    updated_chunks_ = possibly_modified_chunks;
+        if ( chunk )
+        {
+            chunk->wake_fluid( block_index, simulation_step_ );
+        }
+    }
 }
 
-void World::reset_lighting_unordered( ChunkGuard& chunk_guard, const ChunkSet& chunks )
+void World::simulate_fluids( const Vector3iV& player_chunk_positions )
 {
-    SCOPE_TIMER_BEGIN( "Resetting lighting (unordered)" )
+    ++simulation_step_;
 
-    BOOST_FOREACH( Chunk* chunk, chunks )
+    // The Chunks of each color are simulated in parallel, one color after another, since a
+    // Chunk's fluids may flow into any of its neighbors (just like its lighting).
+    ChunkV chunks_by_color[CHUNK_NUM_NEIGHBORHOOD_COLORS];
+    ChunkSet simulated_chunks;
+
+    BOOST_FOREACH( const Vector3i& player_chunk_position, player_chunk_positions )
     {
-        schedule( chunk_guard, boost::bind( &Chunk::reset_lighting, chunk ) );
+        for ( int x = -simulation_radius_; x <= simulation_radius_; ++x )
+        {
+            for ( int y = -simulation_radius_; y <= simulation_radius_; ++y )
+            {
+                for ( int z = -simulation_radius_; z <= simulation_radius_; ++z )
+                {
+                    const Vector3i position =
+                        player_chunk_position + pointwise_product( Chunk::SIZE, Vector3i( x, y, z ) );
+
+                    Chunk* chunk = get_chunk( position );
+
+                    if ( chunk && chunk->has_awake_fluids() && simulated_chunks.insert( chunk ).second )
+                    {
+                        chunks_by_color[chunk_get_neighborhood_color( position )].push_back( chunk );
+                    }
+                }
+            }
+        }
     }
 
-    yield( chunk_guard );
+    SCOPE_TIMER_BEGIN( "Simulating fluids" )
+
+    BOOST_FOREACH( const ChunkV& chunks, chunks_by_color )
+    {
+        std::vector<BlockIteratorV> blocks_modified( chunks.size() );
+
+        for ( size_t i = 0; i < chunks.size(); ++i )
+        {
+            worker_pool_.schedule( boost::bind( &Chunk::simulate, chunks[i], simulation_step_, boost::ref( blocks_modified[i] ) ) );
+        }
+
+        worker_pool_.wait();
+
+        BOOST_FOREACH( const BlockIteratorV& chunk_blocks_modified, blocks_modified )
+        {
+            BOOST_FOREACH( const BlockIterator& block_it, chunk_blocks_modified )
+            {
+                mark_block_for_update( block_it.chunk_->get_position() + block_it.index_ );
+            }
+        }
+    }
 
     SCOPE_TIMER_END
 }
 
-void World::reset_lighting_top_down( ChunkGuard& chunk_guard, const ChunkSet& chunks )
+void World::generate_column( const Vector2i column_position )
 {
-    SCOPE_TIMER_BEGIN( "Resetting lighting (top-down)" )
+    GeneratedColumn column;
 
-    // The reset in a single column needs to be performed from the top down,
-    // but blocks in different columns can be reset in any order.
+    SCOPE_TIMER_BEGIN( "Generating column" )
 
-    typedef std::map<Vector2i, ChunkV, VectorLess<Vector2i> > ColumnMap;
-    ColumnMap column_chunks;
+    column.loaded_ = store_->load_column( column_position, column.chunks_ );
 
-    BOOST_FOREACH( Chunk* chunk, chunks )
+    if ( !column.loaded_ )
     {
-        const Vector2i column_position( chunk->get_position()[0], chunk->get_position()[2] );
-        column_chunks[column_position].push_back( chunk );
+        column.chunks_ = generator_.generate_column( column_position );
     }
 
-    BOOST_FOREACH( const ColumnMap::value_type& it, column_chunks )
+    SCOPE_TIMER_END
+
+    boost::lock_guard<boost::mutex> guard( generated_columns_lock_ );
+    generated_columns_[column_position] = column;
+}
+
+void World::request_columns( const Vector3fV& player_positions )
+{
+    if ( columns_generating_.size() >= MAX_COLUMNS_GENERATING )
     {
-        schedule( chunk_guard, boost::bind( &sort_and_reset_lighting, it.second ) );
+        return;
     }
 
-    yield( chunk_guard );
+    const int radius = int( gmtl::Math::ceil( view_radius_ / Chunk::SIZE_X ) );
 
-    SCOPE_TIMER_END
+    typedef std::pair<int, Vector2i> DistanceColumn;
+    std::vector<DistanceColumn> missing_columns;
+
+    // A column that is near several Players is listed once for each, but it's only
+    // generated once, for whichever is closest.
+    BOOST_FOREACH( const Vector3f& player_position, player_positions )
+    {
+        const Vector2i player_column = get_column_position( player_position );
+
+        for ( int x = -radius; x <= radius; ++x )
+        {
+            for ( int z = -radius; z <= radius; ++z )
+            {
+                const Vector2i column_position =
+                    player_column + Vector2i( x * Chunk::SIZE_X, z * Chunk::SIZE_Z );
+
+                if ( get_column_distance( column_position, player_position ) <= view_radius_ &&
+                     columns_generating_.find( column_position ) == columns_generating_.end() &&
+                     !column_loaded( column_position ) )
+                {
+                    missing_columns.push_back( std::make_pair( x * x + z * z, column_position ) );
+                }
+            }
+        }
+    }
+
+    // Generate the closest columns first, and only a handful at a time, so that the
+    // generator does not fall far behind if the Player is moving quickly.
+    std::sort( missing_columns.begin(), missing_columns.end(), closest_column );
+
+    for ( unsigned i = 0; i < missing_columns.size() && columns_generating_.size() < MAX_COLUMNS_GENERATING; ++i )
+    {
+        const Vector2i& column_position = missing_columns[i].second;
+
+        if ( columns_generating_.insert( column_position ).second )
+        {
+            generator_pool_.schedule( boost::bind( &World::generate_column, this, column_position ) );
+        }
+    }
 }
 
-void World::apply_lighting_to_self( ChunkGuard& chunk_guard, const ChunkSet& chunks )
+void World::stitch_generated_columns( ChunkSet& stitched_chunks )
 {
-    SCOPE_TIMER_BEGIN( "Self-lighting" )
+    GeneratedColumnMap generated_columns;
 
-    BOOST_FOREACH( Chunk* chunk, chunks )
     {
-        schedule( chunk_guard, boost::bind( &Chunk::apply_lighting_to_self, chunk ) );
+        boost::lock_guard<boost::mutex> guard( generated_columns_lock_ );
+        generated_columns.swap( generated_columns_ );
     }
 
-    yield( chunk_guard );
+    BOOST_FOREACH( GeneratedColumnMap::value_type& column_it, generated_columns )
+    {
+        columns_generating_.erase( column_it.first );
 
-    SCOPE_TIMER_END
+        // Freshly generated columns are dirty, so that they will be saved for next time.
+        if ( !column_it.second.loaded_ )
+        {
+            dirty_columns_.insert( column_it.first );
+        }
+
+        BOOST_FOREACH( ChunkSP chunk, column_it.second.chunks_ )
+        {
+            chunk_stitch_into_map( chunk, chunks_ );
+            stitched_chunks.insert( chunk.get() );
+        }
+    }
 }
 
-// The neighbor lighting pass crosses between Chunk boundaries.  Thus, if neighbor lighting
-// is performed on two nearby Chunks in parallel, threading issues could arise (e.g. two
-// threads could be modifying the same Chunk at the same time).  This function takes this
-// into account, and only performs parallel computation on Chunks that are too far apart
-// for their lights to overlap the same Blocks.
-void World::apply_lighting_to_neighbors( ChunkGuard& chunk_guard, ChunkSet chunks )
+void World::evict_distant_chunks( const Vector3fV& player_positions )
 {
-    SCOPE_TIMER_BEGIN( "Neighbor-lighting" )
+    // An in-progress update holds onto raw Chunk pointers while it yields, so
+    // nothing can be evicted until it finishes.
+    if ( updating_chunks_ )
+    {
+        return;
+    }
 
-    ChunkSet separated_chunks;
+    ColumnSet evicted_columns;
 
-    while ( !chunks.empty() )
+    BOOST_FOREACH( ChunkMap::value_type& chunk_it, chunks_ )
     {
-        find_doubly_separated_chunks( chunks, separated_chunks );
-        assert( !separated_chunks.empty() );
+        const Vector3i& position = chunk_it.second->get_position();
+        const Vector2i column_position( position[0], position[2] );
 
-        BOOST_FOREACH( Chunk* chunk, separated_chunks )
+        if ( get_nearest_column_distance( column_position, player_positions ) > view_radius_ + EVICTION_MARGIN )
         {
-            schedule( chunk_guard, boost::bind( &Chunk::apply_lighting_to_neighbors, chunk ) );
-            chunks.erase( chunk );
+            evicted_columns.insert( column_position );
         }
+    }
 
-        separated_chunks.clear();
-        yield( chunk_guard );
+    if ( evicted_columns.empty() )
+    {
+        return;
     }
 
-    SCOPE_TIMER_END
+    BOOST_FOREACH( const Vector2i& column_position, evicted_columns )
+    {
+        evict_column( column_position );
+    }
+
+    generator_pool_.schedule( boost::bind( &ChunkStore::flush, store_.get() ) );
 }
 
-void World::update_geometry( ChunkGuard& chunk_guard, const ChunkSet& chunks )
+void World::save_dirty_columns()
 {
-    SCOPE_TIMER_BEGIN( "Updating geometry" )
+    if ( columns_to_save_.empty() )
+    {
+        if ( time_since_save_ < SAVE_INTERVAL || dirty_columns_.empty() )
+        {
+            return;
+        }
 
-    BOOST_FOREACH( Chunk* chunk, chunks )
+        time_since_save_ = 0.0f;
+        columns_to_save_ = dirty_columns_;
+    }
+
+    for ( unsigned i = 0; i < MAX_COLUMNS_SAVED_PER_STEP && !columns_to_save_.empty(); ++i )
     {
-        schedule( chunk_guard, boost::bind( &Chunk::update_geometry, chunk ) );
+        const Vector2i column_position = *columns_to_save_.begin();
+        columns_to_save_.erase( columns_to_save_.begin() );
+
+        // The column might have been evicted (and saved along the way) since the round began.
+        if ( dirty_columns_.erase( column_position ) && column_loaded( column_position ) )
+        {
+            store_->save_column( column_position, get_column( column_position ) );
+        }
     }
 
-    yield( chunk_guard );
+    if ( columns_to_save_.empty() )
+    {
+        generator_pool_.schedule( boost::bind( &ChunkStore::flush, store_.get() ) );
+    }
+}
 
-    SCOPE_TIMER_END
+void World::insert_column( const Vector2i& column_position, const ChunkSPV& chunks )
+{
+    assert( !column_loaded( column_position ) );
+
+    BOOST_FOREACH( ChunkSP chunk, chunks )
+    {
+        chunk_stitch_into_map( chunk, chunks_ );
+        chunks_needing_update_.insert( chunk.get() );
+    }
 }
 
-void World::schedule( ChunkGuard& chunk_guard, boost::threadpool::pool::task_type const& task )
+void World::evict_column( const Vector2i& column_position )
 {
-    worker_pool_.schedule( task );
+    assert( !updating_chunks_ );
+
+    const ChunkSPV column = get_column( column_position );
+
+    if ( dirty_columns_.erase( column_position ) && store_ )
+    {
+        store_->save_column( column_position, column );
+    }
 
-    // Don't yield until there are enough tasks scheduled to keep all of the processors
-    // busy for a while (in the background).
-    if ( ++outstanding_jobs_ > worker_pool_.size() )
+    BOOST_FOREACH( ChunkSP chunk, column )
     {
-        outstanding_jobs_ = 0;
-        yield( chunk_guard );
+        chunks_needing_update_.erase( chunk.get() );
+        chunks_needing_geometry_update_.erase( chunk.get() );
+        updated_chunks_.erase( chunk.get() );
+        evicted_chunks_.push_back( chunk->get_position() );
+        chunk_unstitch_from_map( chunk, chunks_ );
     }
 }
 
-void World::yield( ChunkGuard& chunk_guard )
+bool World::raycast(
+    const Vector3f& origin,
+    const Vector3f& direction,
+    const Scalar max_distance,
+    const BlockCollisionMode collision_mode,
+    RaycastHit& hit
+) const
 {
-    // First, ensure that all background access to the Chunks has ceased.
-    worker_pool_.wait();
+    const Scalar length = gmtl::length( direction );
+
+    if ( length == 0.0f )
+    {
+        return false;
+    }
+
+    const Vector3f unit_direction = direction / length;
+
+    Vector3i
+        block_position = vector_cast<int>( pointwise_floor( origin ) ),
+        block_index = get_block_index( block_position ),
+        step;
 
-    // Now, briefly relinquish the lock so that other processes can have
-    // a chance to access the Chunks.
-    chunk_guard.unlock();
-    boost::this_thread::yield();
-    chunk_guard.lock();
+    // For each axis, this is the distance along the ray to the next Block boundary, and the
+    // distance between successive boundaries.
+    Vector3f
+        boundary_distance,
+        boundary_interval;
+
+    for ( int i = 0; i < Vector3i::Size; ++i )
+    {
+        if ( unit_direction[i] > 0.0f )
+        {
+            step[i] = 1;
+            boundary_distance[i] = ( Scalar( block_position[i] + 1 ) - origin[i] ) / unit_direction[i];
+            boundary_interval[i] = 1.0f / unit_direction[i];
+        }
+        else if ( unit_direction[i] < 0.0f )
+        {
+            step[i] = -1;
+            boundary_distance[i] = ( origin[i] - Scalar( block_position[i] ) ) / -unit_direction[i];
+            boundary_interval[i] = -1.0f / unit_direction[i];
+        }
+        else
+        {
+            step[i] = 0;
+            boundary_distance[i] = std::numeric_limits<Scalar>::max();
+            boundary_interval[i] = std::numeric_limits<Scalar>::max();
+        }
+    }
+
+    // If the origin is inside of a matching Block, it's treated as though the ray entered
+    // it through the face that it's pointing away from.
+    const unsigned major = major_axis( unit_direction );
+    hit.face_direction_ = Vector3i( 0, 0, 0 );
+    hit.face_direction_[major] = -step[major];
+    hit.distance_ = 0.0f;
+
+    // The current Chunk is cached, and the traversal moves between neighboring Chunks via
+    // their neighbor links, so the ChunkMap is only searched when there's no Chunk to start from.
+    ChunkMap::const_iterator chunk_it = chunks_.find( block_position - block_index );
+    Chunk* chunk = chunk_it == chunks_.end() ? 0 : chunk_it->second.get();
+
+    while ( true )
+    {
+        if ( chunk )
+        {
+            const Chunk& const_chunk = *chunk;
+
+            if ( const_chunk.get_block( block_index ).get_collision_mode() == collision_mode )
+            {
+                hit.block_position_ = block_position;
+                return true;
+            }
+        }
+
+        const unsigned axis =
+            boundary_distance[0] < boundary_distance[1] ?
+                ( boundary_distance[0] < boundary_distance[2] ? 0 : 2 ) :
+                ( boundary_distance[1] < boundary_distance[2] ? 1 : 2 );
+
+        if ( boundary_distance[axis] > max_distance )
+        {
+            return false;
+        }
+
+        block_position[axis] += step[axis];
+        block_index[axis] += step[axis];
+        hit.face_direction_ = Vector3i( 0, 0, 0 );
+        hit.face_direction_[axis] = -step[axis];
+        hit.distance_ = boundary_distance[axis];
+        boundary_distance[axis] += boundary_interval[axis];
+
+        if ( block_index[axis] < 0 || block_index[axis] >= Chunk::SIZE[axis] )
+        {
+            Vector3i relation( 0, 0, 0 );
+            relation[axis] = step[axis];
+            block_index[axis] -= step[axis] * Chunk::SIZE[axis];
+
+            if ( chunk )
+            {
+                chunk = chunk->get_neighbor( relation );
+            }
+            else
+            {
+                chunk_it = chunks_.find( block_position - block_index );
+                chunk = chunk_it == chunks_.end() ? 0 : chunk_it->second.get();
+            }
+        }
+    }
+}
+
+unsigned World::get_blocks_in_bounds(
+    const AABoxi& bounds,
+    const BlockCollisionMode collision_mode,
+    ConstBlockIterator* blocks,
+    const unsigned max_blocks
+) const
+{
+    const Vector3i
+        min_position = bounds.getMin(),
+        max_position = bounds.getMax() - Vector3i( 1, 1, 1 ),
+        min_chunk_position = min_position - get_block_index( min_position ),
+        max_chunk_position = max_position - get_block_index( max_position );
+
+    unsigned num_blocks = 0;
+    const Chunk* x_chunk = find_chunk( chunks_, min_chunk_position );
+
+    for ( int chunk_x = min_chunk_position[0]; chunk_x <= max_chunk_position[0]; chunk_x += Chunk::SIZE_X )
+    {
+        const Chunk* z_chunk = x_chunk;
+
+        for ( int chunk_z = min_chunk_position[2]; chunk_z <= max_chunk_position[2]; chunk_z += Chunk::SIZE_Z )
+        {
+            const Chunk* chunk = z_chunk;
+
+            for ( int chunk_y = min_chunk_position[1]; chunk_y <= max_chunk_position[1]; chunk_y += Chunk::SIZE_Y )
+            {
+                const Vector3i chunk_position( chunk_x, chunk_y, chunk_z );
+
+                if ( chunk )
+                {
+                    Vector3i min_index, max_index;
+
+                    for ( int i = 0; i < Vector3i::Size; ++i )
+                    {
+                        min_index[i] = std::max( min_position[i] - chunk_position[i], 0 );
+                        max_index[i] = std::min( max_position[i] - chunk_position[i], Chunk::SIZE[i] - 1 );
+                    }
+
+                    Vector3i index;
+                    for ( index[0] = min_index[0]; index[0] <= max_index[0]; ++index[0] )
+                    {
+                        for ( index[2] = min_index[2]; index[2] <= max_index[2]; ++index[2] )
+                        {
+                            for ( index[1] = min_index[1]; index[1] <= max_index[1]; ++index[1] )
+                            {
+                                const Block& block = chunk->get_block( index );
+
+                                if ( block.get_collision_mode() == collision_mode )
+                                {
+                                    if ( num_blocks == max_blocks )
+                                    {
+                                        return num_blocks;
+                                    }
+
+                                    blocks[num_blocks++] = ConstBlockIterator( chunk, &block, index );
+                                }
+                            }
+                        }
+                    }
+                }
+
+                chunk = step_to_chunk( chunks_, chunk, Vector3i( 0, 1, 0 ), chunk_position + Vector3i( 0, Chunk::SIZE_Y, 0 ) );
+            }
+
+            z_chunk = step_to_chunk(
+                chunks_, z_chunk, Vector3i( 0, 0, 1 ), Vector3i( chunk_x, min_chunk_position[1], chunk_z + Chunk::SIZE_Z )
+            );
+        }
+
+        x_chunk = step_to_chunk(
+            chunks_, x_chunk, Vector3i( 1, 0, 0 ), Vector3i( chunk_x + Chunk::SIZE_X, min_chunk_position[1], min_chunk_position[2] )
+        );
+    }
+
+    return num_blocks;
+}
+
+// Returns all of the Chunks in the column, from the bottom up.
+ChunkSPV World::get_column( const Vector2i& column_position ) const
+{
+    ChunkSPV column;
+    ChunkMap::const_iterator chunk_it =
+        chunks_.find( Vector3i( column_position[0], 0, column_position[1] ) );
+
+    while ( chunk_it != chunks_.end() )
+    {
+        column.push_back( chunk_it->second );
+        const Vector3i next_position = chunk_it->second->get_position() + Vector3i( 0, Chunk::SIZE_Y, 0 );
+        chunk_it = chunks_.find( next_position );
+    }
+
+    return column;
+}
+
+void World::run_update_graph(
+    ChunkGuard& chunk_guard,
+    const ChunkSet& reset_chunks,
+    const ChunkSet& self_lighting_chunks,
+    const ChunkSet& neighbor_lighting_chunks,
+    const ChunkSet& geometry_chunks,
+    ChunkSet& updated_geometry_chunks
+)
+{
+    // Uniform Chunks are expanded whenever their Blocks are accessed for modification, which
+    // is how the update steps access the Chunks they work on (and their neighbors).  That
+    // mustn't happen from several workers at once, so all of those Chunks are expanded up
+    // front, and compacted again once the update is over.
+    ChunkSet touched_chunks;
+    add_chunks_and_neighbors( reset_chunks, touched_chunks );
+    add_chunks_and_neighbors( self_lighting_chunks, touched_chunks );
+    add_chunks_and_neighbors( neighbor_lighting_chunks, touched_chunks );
+    add_chunks_and_neighbors( geometry_chunks, touched_chunks );
+
+    BOOST_FOREACH( Chunk* chunk, touched_chunks )
+    {
+        chunk->expand();
+    }
+
+    SCOPE_TIMER_BEGIN( "Updating chunks" )
+
+    ChunkUpdateGraph graph( reset_chunks, self_lighting_chunks, neighbor_lighting_chunks, geometry_chunks );
+    graph.run( worker_pool_, chunk_guard, chunk_lock_requests_ );
+    updated_geometry_chunks.insert( graph.get_updated_geometry_chunks().begin(), graph.get_updated_geometry_chunks().end() );
+
+    SCOPE_TIMER_END
+
+    compact_chunks( touched_chunks );
+}
+
+void World::compact_chunks( const ChunkSet& chunks )
+{
+    SCOPE_TIMER_BEGIN( "Compacting chunks" )
+
+    BOOST_FOREACH( Chunk* chunk, chunks )
+    {
+        chunk->compact();
+    }
+
+    SCOPE_TIMER_END
 }
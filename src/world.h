@@ -20,10 +20,17 @@
 #define WORLD_H
 
 #include <cstdlib>
+#include <vector>
+#include <set>
+#include <map>
 
 #include <boost/threadpool.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "world_generator.h"
+#include "chunk_store.h"
+#include "chunk_update_graph.h"
 #include "chunk.h"
 
 struct Sky
@@ -59,6 +66,11 @@ struct Sky
 
     void do_one_step( float step_time );
 
+    // The profile and the angles of the sun and moon are all derived from the time of day,
+    // so a copy of the Sky can be moved to any time (e.g. one interpolated between steps).
+    Scalar get_time_of_day() const { return time_of_day_; }
+    void set_time_of_day( const Scalar time_of_day );
+
     Scalar get_star_intensity() const { return profile_.star_intensity_; }
     const StarV& get_stars() const { return stars_; }
     const Vector3f& get_zenith_color() const { return profile_.zenith_color_; }
@@ -85,17 +97,101 @@ protected:
         moon_angle_;
 };
 
+typedef std::vector<Vector3i> Vector3iV;
+typedef std::vector<Vector3f> Vector3fV;
+
+// A standalone World generates (or loads) the columns around the Player itself, and does all
+// of its own simulation, lighting, and meshing.  A server World does the same for all of its
+// clients' Players, except that it skips the lighting and meshing (since nothing is drawn),
+// and records which Blocks were modified so that they can be replicated to the clients.  A
+// replica World is a client's copy of a server World.  It does not generate, load, save,
+// evict, or simulate anything by itself, since it's filled in by a WorldReplica (see
+// world_replication.h), but it does all of its own lighting and meshing.
+enum WorldMode
+{
+    WORLD_MODE_STANDALONE,
+    WORLD_MODE_SERVER,
+    WORLD_MODE_REPLICA
+};
+
 struct World
 {
     typedef boost::unique_lock<boost::mutex> ChunkGuard;
 
-    World( const uint64_t world_seed );
+    // This grabs the Chunk lock, but also asks any Chunk update that is in progress to hand
+    // the lock over as soon as the steps it's currently running finish.  Code that can't
+    // afford to wait for long, like the main loop, should use this to grab the lock.
+    struct PriorityChunkGuard : public boost::noncopyable
+    {
+        PriorityChunkGuard( World& world ) :
+            guard_( world.chunk_lock_, boost::defer_lock )
+        {
+            __sync_add_and_fetch( &world.chunk_lock_requests_, 1 );
+            guard_.lock();
+            __sync_sub_and_fetch( &world.chunk_lock_requests_, 1 );
+        }
+
+    protected:
+
+        ChunkGuard guard_;
+    };
+
+    static const Scalar DEFAULT_VIEW_RADIUS = 250.0f;
+
+    static const int DEFAULT_SIMULATION_RADIUS = 2;
+
+    // Only the columns of Chunks immediately surrounding the spawn position are generated
+    // up front.  The rest of the World is streamed in around the Player by do_one_step().
+    // Columns are saved to (and loaded from) the ChunkStore at the given path; if it
+    // already exists, the seed that it was created with is used instead of world_seed.
+    // A replica World has no ChunkStore, and starts out empty.
+    World(
+        const uint64_t world_seed,
+        const Vector3f& spawn_position,
+        const std::string& store_path,
+        const WorldMode mode = WORLD_MODE_STANDALONE
+    );
+    ~World();
+
+    WorldMode get_mode() const { return mode_; }
+    uint64_t get_world_seed() const { return world_seed_; }
+
+    void do_one_step( float step_time, const Vector3f& player_position )
+    {
+        do_one_step( step_time, Vector3fV( 1, player_position ) );
+    }
+
+    // The columns around each of the Players are streamed in, and the columns that aren't
+    // near any of them are evicted.  For a replica World, this only steps the Sky.
+    void do_one_step( float step_time, const Vector3fV& player_positions );
+
+    // Columns of Chunks within this horizontal distance of the Player are generated in
+    // the background, and columns that wander too far outside of it are evicted.
+    void set_view_radius( const Scalar view_radius ) { view_radius_ = view_radius; }
 
-    void do_one_step( float step_time, const Vector3f& player_position );
+    // The fluids in Chunks within this many Chunks of the Player (along each axis) are
+    // simulated.  The cost of each step is bounded by Chunk::MAX_FLUID_BLOCKS_PER_STEP.
+    void set_simulation_radius( const int simulation_radius ) { simulation_radius_ = simulation_radius; }
+
+    // This runs one step of the fluid simulation for the Chunks within the simulation radius
+    // of the given Chunk.  do_one_step() calls it every SIMULATION_INTERVAL, around the Player.
+    // Precondition: you must hold the Chunk lock before calling this!
+    void simulate_fluids( const Vector3i& player_chunk_position )
+    {
+        simulate_fluids( Vector3iV( 1, player_chunk_position ) );
+    }
+
+    // Likewise, but around each of several Players, without simulating any Chunk twice.
+    // Precondition: you must hold the Chunk lock before calling this!
+    void simulate_fluids( const Vector3iV& player_chunk_positions );
 
     const Sky& get_sky() const { return sky_; }
     const ChunkMap& get_chunks() const { return chunks_; }
 
+    // The memory used by the Chunks (not including their meshes), and how many are uniform.
+    size_t get_chunk_memory_usage() const;
+    unsigned get_num_uniform_chunks() const;
+
     Vector3i get_block_index( const Vector3i& block_position ) const
     {
         // Use std::div() instead of '%' to ensure rounding towards zero.
@@ -118,12 +214,14 @@ struct World
         return block_index;
     }
 
-    BlockIterator get_block( const Vector3i& block_position ) const
+    // The Block is only writable through the non-const overload, which has to expand its Chunk
+    // if it's uniform.  The const overload never does, so it should be used for reading.
+    BlockIterator get_block( const Vector3i& block_position )
     {
         BlockIterator result;
         result.index_ = get_block_index( block_position );
         const Vector3i chunk_position = block_position - result.index_;
-        ChunkMap::const_iterator chunk_it = chunks_.find( chunk_position );
+        ChunkMap::iterator chunk_it = chunks_.find( chunk_position );
 
         if ( chunk_it != chunks_.end() )
         {
@@ -134,6 +232,56 @@ struct World
         return result;
     }
 
+    ConstBlockIterator get_block( const Vector3i& block_position ) const
+    {
+        ConstBlockIterator result;
+        result.index_ = get_block_index( block_position );
+        const Vector3i chunk_position = block_position - result.index_;
+        ChunkMap::const_iterator chunk_it = chunks_.find( chunk_position );
+
+        if ( chunk_it != chunks_.end() )
+        {
+            const Chunk& chunk = *chunk_it->second;
+            result.chunk_ = &chunk;
+            result.block_ = &chunk.get_block( result.index_ );
+        }
+
+        return result;
+    }
+
+    struct RaycastHit
+    {
+        Vector3i block_position_;
+
+        // This points out of the face of the Block that the ray entered through.
+        Vector3i face_direction_;
+
+        // The distance along the ray to where it entered the Block.
+        Scalar distance_;
+    };
+
+    // This walks the Blocks along the ray in order (with the grid traversal of Amanatides
+    // and Woo), and stops at the first one with the given collision mode that is within
+    // max_distance of the origin.  The direction doesn't need to be normalized.
+    bool raycast(
+        const Vector3f& origin,
+        const Vector3f& direction,
+        const Scalar max_distance,
+        const BlockCollisionMode collision_mode,
+        RaycastHit& hit
+    ) const;
+
+    // This stores up to max_blocks iterators to the Blocks with the given collision mode that
+    // are within the bounds (whose maximum is exclusive), and returns how many were stored.
+    // Chunks are visited through their neighbor links, so the ChunkMap is only searched when
+    // there's no neighboring Chunk to start from.
+    unsigned get_blocks_in_bounds(
+        const AABoxi& bounds,
+        const BlockCollisionMode collision_mode,
+        ConstBlockIterator* blocks,
+        const unsigned max_blocks
+    ) const;
+
     // This function should be used when an existing column of Chunks is not tall enough.
     void extend_chunk_column( const Vector3i& position )
     {
@@ -150,25 +298,86 @@ struct World
             ChunkSP new_top( new Chunk( new_top_position ) );
             chunk_stitch_into_map( new_top, chunks_ );
             column_top = new_top.get();
+
+            // The new Chunk has no lighting yet, so it needs a full update.
+            mark_chunk_for_update( column_top );
         }
     }
 
+    // This must be called whenever a Chunk is modified, so that it is both rebuilt
+    // and eventually written back to the ChunkStore.  The lighting for the whole Chunk
+    // (and its surroundings) will be reset, so if only a few Blocks were modified, it's
+    // much cheaper to use mark_block_for_update() instead.
     void mark_chunk_for_update( Chunk* chunk )
     {
         assert( chunk );
         chunks_needing_update_.insert( chunk );
+        dirty_columns_.insert( Vector2i( chunk->get_position()[0], chunk->get_position()[2] ) );
+    }
+
+    // This must be called whenever the material of a Block is modified.  The lighting
+    // around the Block will be updated incrementally, and any fluids that might now be
+    // able to flow into (or out of) it are woken up.  The Chunk's heightmap is updated
+    // right away, since relighting the Chunk above it may consult it before this Block's
+    // own lighting is updated.  A server World also records the Block for replication.
+    void mark_block_for_update( const Vector3i& block_position )
+    {
+        const Vector3i block_index = get_block_index( block_position );
+        Chunk* chunk = get_chunk( block_position - block_index );
+
+        if ( chunk )
+        {
+            chunk->update_heightmap( block_index );
+        }
+
+        if ( mode_ == WORLD_MODE_SERVER )
+        {
+            modified_blocks_.insert( block_position );
+        }
+
+        blocks_needing_update_.insert( block_position );
+        dirty_columns_.insert( Vector2i( block_position[0], block_position[2] ) - get_column_offset( block_position ) );
+        wake_fluids( block_position );
     }
 
     bool chunk_update_needed() const
     {
-        return !chunks_needing_update_.empty();
+        return
+            !chunks_needing_update_.empty() ||
+            !chunks_needing_geometry_update_.empty() ||
+            !blocks_needing_update_.empty();
+    }
+
+    // This switches the meshing mode for all Chunks, and rebuilds all of their geometry
+    // (but not their lighting) during the next update.
+    // Precondition: you must hold the Chunk lock before calling this!
+    void set_greedy_meshing( const bool greedy_meshing )
+    {
+        Chunk::set_greedy_meshing( greedy_meshing );
+
+        BOOST_FOREACH( const ChunkMap::value_type& chunk_it, chunks_ )
+        {
+            chunks_needing_geometry_update_.insert( chunk_it.second.get() );
+        }
+    }
+
+    // Likewise for the lighting mode (see Chunk::get_texture_lighting()).
+    // Precondition: you must hold the Chunk lock before calling this!
+    void set_texture_lighting( const bool texture_lighting )
+    {
+        Chunk::set_texture_lighting( texture_lighting );
+
+        BOOST_FOREACH( const ChunkMap::value_type& chunk_it, chunks_ )
+        {
+            chunks_needing_geometry_update_.insert( chunk_it.second.get() );
+        }
     }
 
     // This function updates the Chunk lighting and geometry for all of the Chunks that
     // have been marked for update.  Since this might be a time-consuming process, it
-    // periodically yields its execution for e.g. the rendering loop to continue.  When
+    // yields its execution whenever a PriorityChunkGuard is waiting for the lock.  When
     // the Chunks are all updated, you can call get_updated_chunks() to determine which
-    // ones were affected.
+    // ones were affected.  A server World skips the lighting and geometry altogether.
     void update_chunks();
 
     // Precondition: you must hold the Chunk lock before calling this!
@@ -179,33 +388,137 @@ struct World
         return result;
     }
 
+    // Returns the positions of the Chunks that have been evicted since the last call.
+    // Precondition: you must hold the Chunk lock before calling this!
+    Vector3iV get_evicted_chunks()
+    {
+        Vector3iV result = evicted_chunks_;
+        evicted_chunks_.clear();
+        return result;
+    }
+
+    // Returns the positions of the Blocks that have been passed to mark_block_for_update()
+    // since the last call, without duplicates.  These are only recorded by a server World.
+    // Precondition: you must hold the Chunk lock before calling this!
+    Vector3iV get_modified_blocks()
+    {
+        Vector3iV result( modified_blocks_.begin(), modified_blocks_.end() );
+        modified_blocks_.clear();
+        return result;
+    }
+
+    // These are how a WorldReplica fills in a replica World.  A column can only be inserted
+    // if it isn't already loaded, and it's lit and meshed by the next update.  A column can
+    // only be evicted while no update is in progress, since an update holds onto its Chunks.
+    // Precondition: you must hold the Chunk lock before calling these!
+    bool is_updating_chunks() const { return updating_chunks_; }
+    bool is_column_loaded( const Vector2i& column_position ) const { return column_loaded( column_position ); }
+    void insert_column( const Vector2i& column_position, const ChunkSPV& chunks );
+    void evict_column( const Vector2i& column_position );
+    void set_time_of_day( const Scalar time_of_day ) { sky_.set_time_of_day( time_of_day ); }
+
     // The Chunk lock is held by this class whenever it may be accessing the Chunks.  Any
     // code outside of this class should grab the lock before doing the same.
     boost::mutex& get_chunk_lock() { return chunk_lock_; }
 
+    // The worker pool is idle whenever the Chunk lock is held by someone else, so code
+    // that holds the lock may use it, as long as it waits for its tasks before letting go.
+    boost::threadpool::pool& get_worker_pool() { return worker_pool_; }
+
 protected:
 
     static const float SIMULATION_INTERVAL = 0.2f;
 
+    static const Scalar EVICTION_MARGIN = 2.0f * Chunk::SIZE_X;
+
+    static const int SPAWN_RADIUS = 2;
+
+    static const unsigned MAX_COLUMNS_GENERATING = 16;
+
+    // The columns that stay loaded are saved every so often, and not just when they're
+    // evicted, so that a crash doesn't lose everything since they were loaded.  They're
+    // encoded a few at a time, so that no one step is held up by all of them.
+    static const float SAVE_INTERVAL = 30.0f;
+    static const unsigned MAX_COLUMNS_SAVED_PER_STEP = 4;
+
+    struct GeneratedColumn
+    {
+        GeneratedColumn() :
+            loaded_( false )
+        {
+        }
+
+        ChunkSPV chunks_;
+
+        // This is set if the column was loaded from the ChunkStore, rather than generated.
+        bool loaded_;
+    };
+
+    typedef std::set<Vector2i, VectorLess<Vector2i> > ColumnSet;
+    typedef std::set<Vector3i, VectorLess<Vector3i> > BlockPositionSet;
+    typedef std::map<Vector2i, GeneratedColumn, VectorLess<Vector2i> > GeneratedColumnMap;
+
     Chunk* get_chunk( const Vector3i& position )
     {
         ChunkMap::const_iterator it = chunks_.find( position );
         return it == chunks_.end() ? 0 : it->second.get();
     }
 
-    void reset_lighting_unordered( ChunkGuard& chunk_guard, const ChunkSet& chunks );
-    void reset_lighting_top_down( ChunkGuard& chunk_guard, const ChunkSet& chunks );
-    void apply_lighting_to_self( ChunkGuard& chunk_guard, const ChunkSet& chunks );
-    void apply_lighting_to_neighbors( ChunkGuard& chunk_guard, ChunkSet chunks );
-    void update_geometry( ChunkGuard& chunk_guard, const ChunkSet& chunks );
+    Vector2i get_column_offset( const Vector3i& block_position ) const
+    {
+        const Vector3i block_index = get_block_index( block_position );
+        return Vector2i( block_index[0], block_index[2] );
+    }
 
-    void schedule( ChunkGuard& chunk_guard, boost::threadpool::pool::task_type const& task );
-    void yield( ChunkGuard& chunk_guard );
+    bool column_loaded( const Vector2i& column_position ) const
+    {
+        return chunks_.find( Vector3i( column_position[0], 0, column_position[1] ) ) != chunks_.end();
+    }
+
+    void wake_fluids( const Vector3i& block_position );
+
+    void generate_column( const Vector2i column_position );
+    void request_columns( const Vector3fV& player_positions );
+    void stitch_generated_columns( ChunkSet& stitched_chunks );
+    void evict_distant_chunks( const Vector3fV& player_positions );
+    void save_dirty_columns();
+    ChunkSPV get_column( const Vector2i& column_position ) const;
+
+    void compact_chunks( const ChunkSet& chunks );
+
+    void run_update_graph(
+        ChunkGuard& chunk_guard,
+        const ChunkSet& reset_chunks,
+        const ChunkSet& self_lighting_chunks,
+        const ChunkSet& neighbor_lighting_chunks,
+        const ChunkSet& geometry_chunks,
+        ChunkSet& updated_geometry_chunks
+    );
 
     ChunkSet
         chunks_needing_update_,
+        chunks_needing_geometry_update_,
         updated_chunks_;
 
+    BlockPositionSet
+        blocks_needing_update_,
+        modified_blocks_;
+
+    Vector3iV evicted_chunks_;
+
+    // The columns that have been modified (or freshly generated) since they were last saved.
+    ColumnSet dirty_columns_;
+
+    // The dirty columns that are still to be saved in the current round of saving.
+    ColumnSet columns_to_save_;
+
+    const WorldMode mode_;
+
+    // This is null for a replica World.
+    boost::scoped_ptr<ChunkStore> store_;
+
+    uint64_t world_seed_;
+
     WorldGenerator generator_;
 
     Sky sky_;
@@ -214,11 +527,36 @@ protected:
 
     float time_since_simulation_;
 
+    float time_since_save_;
+
+    // This is stamped on the Blocks that are woken up, so that they don't flow until the
+    // following step.
+    uint16_t simulation_step_;
+
+    int simulation_radius_;
+
     boost::threadpool::pool worker_pool_;
 
-    unsigned outstanding_jobs_;
+    bool updating_chunks_;
 
     boost::mutex chunk_lock_;
+
+    // The number of PriorityChunkGuards waiting for the chunk_lock_.
+    volatile int chunk_lock_requests_;
+
+    Scalar view_radius_;
+
+    // The columns in columns_generating_ have been handed to the generator_pool_, and
+    // are moved into generated_columns_ (under the generated_columns_lock_) when done.
+    ColumnSet columns_generating_;
+
+    GeneratedColumnMap generated_columns_;
+
+    boost::mutex generated_columns_lock_;
+
+    // This must be destroyed first, so that no generation jobs are left
+    // running that might try to access the other members.
+    boost::threadpool::pool generator_pool_;
 };
 
 #endif // WORLD_H
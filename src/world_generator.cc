@@ -16,6 +16,8 @@
 // along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
 ///////////////////////////////////////////////////////////////////////////
 
+#include <cstdlib>
+
 #include <boost/random/uniform_int.hpp>
 #include <boost/random/variate_generator.hpp>
 #include <boost/random/linear_congruential.hpp>
@@ -32,6 +34,9 @@ namespace {
 
 const unsigned SEA_LEVEL = 128;
 
+// Blocks where both of the TrilinearBox densities fall strictly within this range are hollowed out.
+const double CAVE_DENSITY_RANGE[2] = { 0.45, 0.55 };
+
 Block& get_block( ChunkSPV& chunks, const Vector2i& column_position, const unsigned x, const unsigned z, const unsigned height )
 {
     const unsigned chunk_index = height / Chunk::SIZE_Y;
@@ -60,25 +65,80 @@ void generate_chunk_column(
     ChunkHeightmap heights
 )
 {
-    for ( int x = 0; x < Chunk::SIZE_X; ++x )
-    {
-        for ( int z = 0; z < Chunk::SIZE_Z; ++z )
-        {
-            const Vector2i relative_position = column_position - region_position + Vector2i( x, z );
+    const Vector2i column_relative_position = column_position - region_position;
 
-            const Scalar fundamental_height =
-                features.get_fundamental_patch().interpolate( vector_cast<Scalar>( relative_position ) / Scalar( WorldGenerator::REGION_SIZE ) );
+    // The surface heights are evaluated a row at a time.  A Chunk column never straddles
+    // two octave patches, since the octave edge is a multiple of the Chunk size.
+    const BicubicPatch& octave_patch = features.get_octave_patch( column_relative_position / int( RegionFeatures::BICUBIC_OCTAVE_EDGE ) );
 
-            const BicubicPatch octave_patch = features.get_octave_patch( relative_position / int( RegionFeatures::BICUBIC_OCTAVE_EDGE ) );
+    Scalar
+        fundamental_heights[Chunk::SIZE_Z][Chunk::SIZE_X],
+        octave_heights[Chunk::SIZE_Z][Chunk::SIZE_X];
 
-            const Vector2f octave_position(
-                Scalar( relative_position[0] % RegionFeatures::BICUBIC_OCTAVE_EDGE ) / RegionFeatures::BICUBIC_OCTAVE_EDGE,
-                Scalar( relative_position[1] % RegionFeatures::BICUBIC_OCTAVE_EDGE ) / RegionFeatures::BICUBIC_OCTAVE_EDGE
+    for ( int z = 0; z < Chunk::SIZE_Z; ++z )
+    {
+        const Vector2i row_position = column_relative_position + Vector2i( 0, z );
+
+        features.get_fundamental_patch().interpolate_row(
+            vector_cast<Scalar>( row_position ) / Scalar( WorldGenerator::REGION_SIZE ),
+            Scalar( 1 ) / Scalar( WorldGenerator::REGION_SIZE ),
+            Chunk::SIZE_X,
+            fundamental_heights[z]
+        );
+
+        octave_patch.interpolate_row(
+            Vector2f(
+                Scalar( row_position[0] % RegionFeatures::BICUBIC_OCTAVE_EDGE ) / RegionFeatures::BICUBIC_OCTAVE_EDGE,
+                Scalar( row_position[1] % RegionFeatures::BICUBIC_OCTAVE_EDGE ) / RegionFeatures::BICUBIC_OCTAVE_EDGE
+            ),
+            Scalar( 1 ) / Scalar( RegionFeatures::BICUBIC_OCTAVE_EDGE ),
+            Chunk::SIZE_X,
+            octave_heights[z]
+        );
+    }
+
+    // A cave requires both densities to fall within a narrow range, so a Chunk where either
+    // TrilinearBox's vertices stay outside of that range can't contain any caves at all.
+    const unsigned num_cave_bands = RegionFeatures::TRILINEAR_BOX_HEIGHT / Chunk::SIZE_Y;
+    bool band_may_contain_caves[num_cave_bands];
+
+    for ( unsigned band = 0; band < num_cave_bands; ++band )
+    {
+        const Vector3f
+            min_position(
+                Scalar( column_relative_position[0] ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[0] ),
+                Scalar( band * Chunk::SIZE_Y ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[1] ),
+                Scalar( column_relative_position[1] ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[2] )
+            ),
+            max_position(
+                Scalar( column_relative_position[0] + Chunk::SIZE_X - 1 ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[0] ),
+                Scalar( ( band + 1 ) * Chunk::SIZE_Y - 1 ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[1] ),
+                Scalar( column_relative_position[1] + Chunk::SIZE_Z - 1 ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[2] )
             );
 
+        band_may_contain_caves[band] = true;
+
+        for ( unsigned box = 0; box < RegionFeatures::NUM_TRILINEAR_BOXES; ++box )
+        {
+            const Vector2f range = features.get_box( box ).get_range( min_position, max_position );
+
+            if ( range[1] <= CAVE_DENSITY_RANGE[0] || range[0] >= CAVE_DENSITY_RANGE[1] )
+            {
+                band_may_contain_caves[band] = false;
+            }
+        }
+    }
+
+    for ( int x = 0; x < Chunk::SIZE_X; ++x )
+    {
+        for ( int z = 0; z < Chunk::SIZE_Z; ++z )
+        {
+            const Vector2i relative_position = column_relative_position + Vector2i( x, z );
+
             const Scalar
+                fundamental_height = fundamental_heights[z][x],
                 // NOTE: Remove the abs(), 32.0f, and negation here to undo the ridge experiment.
-                octave_height = abs( octave_patch.interpolate( octave_position ) ),
+                octave_height = abs( octave_heights[z][x] ),
                 total_height = 32.0f + fundamental_height - octave_height;
 
             const std::pair<BlockMaterial, Scalar> layers[] = 
@@ -91,6 +151,11 @@ void generate_chunk_column(
                 std::make_pair( BLOCK_MATERIAL_GRASS,   63.0f + ( total_height ) * 1.00f )
             };
 
+            // The densities are evaluated a Chunk-sized band at a time, and only for the bands
+            // that might contain caves.
+            Scalar densities[RegionFeatures::NUM_TRILINEAR_BOXES][Chunk::SIZE_Y];
+            unsigned density_band = num_cave_bands;
+
             const unsigned num_layers = sizeof( layers ) / sizeof( std::pair<Scalar, BlockMaterial> );
             unsigned bottom = 0;
 
@@ -104,20 +169,38 @@ void generate_chunk_column(
                 {
                     Block& block = get_block( chunks, column_position, x, z, y );
 
-                    // TODO: Ensure that the components of this vector are clamped (or repeated) to [0.0,1.0].
-                    const Vector3f box_position(
-                        Scalar( relative_position[0] ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[0] ),
-                        Scalar( y                    ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[1] ),
-                        Scalar( relative_position[1] ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[2] )
-                    );
-
                     if ( material != BLOCK_MATERIAL_LAVA )
                     {
-                        const Scalar
-                            densityA = features.get_box( 0 ).interpolate( box_position ),
-                            densityB = features.get_box( 1 ).interpolate( box_position );
+                        // TODO: Ensure that the box positions are clamped (or repeated) to [0.0,1.0].
+                        const unsigned band = y / Chunk::SIZE_Y;
+                        assert( band < num_cave_bands );
+
+                        if ( band != density_band && band_may_contain_caves[band] )
+                        {
+                            density_band = band;
+
+                            const Vector3f box_position(
+                                Scalar( relative_position[0] ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[0] ),
+                                Scalar( band * Chunk::SIZE_Y ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[1] ),
+                                Scalar( relative_position[1] ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[2] )
+                            );
+
+                            for ( unsigned box = 0; box < RegionFeatures::NUM_TRILINEAR_BOXES; ++box )
+                            {
+                                features.get_box( box ).interpolate_column(
+                                    box_position,
+                                    Scalar( 1 ) / Scalar( RegionFeatures::TRILINEAR_BOX_SIZE[1] ),
+                                    Chunk::SIZE_Y,
+                                    densities[box]
+                                );
+                            }
+                        }
+
+                        const unsigned band_y = y % Chunk::SIZE_Y;
 
-                        if ( densityA > 0.45 && densityA < 0.55 && densityB > 0.45 && densityB < 0.55 )
+                        if ( band_may_contain_caves[band] &&
+                             densities[0][band_y] > CAVE_DENSITY_RANGE[0] && densities[0][band_y] < CAVE_DENSITY_RANGE[1] &&
+                             densities[1][band_y] > CAVE_DENSITY_RANGE[0] && densities[1][band_y] < CAVE_DENSITY_RANGE[1] )
                         {
                             block.set_material( BLOCK_MATERIAL_AIR );
                         }
@@ -238,45 +321,7 @@ void populate_trees(
     }
 }
 
-void generate_chunk_concurrently( 
-    ChunkSPV& chunks,
-    const uint64_t world_seed,
-    const RegionFeatures& features,
-    const Vector2i& region_position,
-    const Vector2i& column_position
-)
-{
-    ChunkSPV column_chunks;
-    ChunkHeightmap heights;
-    generate_chunk_column( column_chunks, features, region_position, column_position, heights );
-    populate_trees( column_chunks, world_seed, column_position, heights );
-
-    static boost::mutex lock;
-    boost::lock_guard<boost::mutex> guard( lock );
-    chunks.insert( chunks.end(), column_chunks.begin(), column_chunks.end() );
-}
-
-} // anonymous namespace
-
-//////////////////////////////////////////////////////////////////////////////////
-// Static constant definitions for WorldGenerator:
-//////////////////////////////////////////////////////////////////////////////////
-
-const int WorldGenerator::REGION_SIZE;
-
-const Vector2i
-    WorldGenerator::CHUNKS_PER_REGION_EDGE( REGION_SIZE / Chunk::SIZE_X, REGION_SIZE / Chunk::SIZE_Z );
-
-//////////////////////////////////////////////////////////////////////////////////
-// Function definitions for WorldGenerator:
-//////////////////////////////////////////////////////////////////////////////////
-
-WorldGenerator::WorldGenerator( const uint64_t world_seed ) :
-    world_seed_( world_seed )
-{
-}
-
-ChunkSPV WorldGenerator::generate_region( const Vector2i& region_position, boost::threadpool::pool worker_pool )
+RegionFeatures get_region_features( const uint64_t world_seed, const Vector2i& region_position )
 {
     // TODO: The region features here are static for now, but eventually they should be randomized
     //       depending on the position of the region itself.
@@ -309,32 +354,56 @@ ChunkSPV WorldGenerator::generate_region( const Vector2i& region_position, boost
         octave_corner_features
     );
 
-    RegionFeatures region_features( world_seed_, region_position, fundamental_features, octave_features );
+    return RegionFeatures( world_seed, region_position, fundamental_features, octave_features );
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Static constant definitions for WorldGenerator:
+//////////////////////////////////////////////////////////////////////////////////
+
+const int WorldGenerator::REGION_SIZE;
+
+const Vector2i
+    WorldGenerator::CHUNKS_PER_REGION_EDGE( REGION_SIZE / Chunk::SIZE_X, REGION_SIZE / Chunk::SIZE_Z );
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for WorldGenerator:
+//////////////////////////////////////////////////////////////////////////////////
+
+WorldGenerator::WorldGenerator( const uint64_t world_seed ) :
+    world_seed_( world_seed )
+{
+}
+
+ChunkSPV WorldGenerator::generate_column( const Vector2i& column_position ) const
+{
+    // NOTE: The RegionFeatures are rebuilt for every column.  They are very cheap to build
+    //       compared to the column itself, so it's not worth sharing them between threads.
+    const Vector2i region_position = get_region_position( column_position );
+    const RegionFeatures region_features = get_region_features( world_seed_, region_position );
+
     ChunkSPV chunks;
+    ChunkHeightmap heights;
+    generate_chunk_column( chunks, region_features, region_position, column_position, heights );
+    populate_trees( chunks, world_seed_, column_position, heights );
+    return chunks;
+}
+
+Vector2i WorldGenerator::get_region_position( const Vector2i& column_position )
+{
+    Vector2i region_position;
 
-    for ( int x = 0; x < CHUNKS_PER_REGION_EDGE[0]; ++x )
+    // Round towards negative infinity, so that columns with negative coordinates
+    // end up in the correct region.
+    for ( int i = 0; i < Vector2i::Size; ++i )
     {
-        for ( int z = 0; z < CHUNKS_PER_REGION_EDGE[1]; ++z )
-        {
-            const Vector2i column_position =
-                region_position + Vector2i( x * Chunk::SIZE_X, z * Chunk::SIZE_Z );
-
-            worker_pool.schedule(
-                boost::bind(
-                    &generate_chunk_concurrently,
-                    boost::ref( chunks ),
-                    world_seed_,
-                    boost::ref( region_features ),
-                    boost::ref( region_position ),
-                    column_position
-                )
-            );
-        }
+        const std::div_t div = std::div( column_position[i], REGION_SIZE );
+        region_position[i] = ( div.quot - ( div.rem < 0 ? 1 : 0 ) ) * REGION_SIZE;
     }
 
-    worker_pool.wait();
-
-    return chunks;
+    return region_position;
 }
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -19,8 +19,6 @@
 #ifndef WORLD_GENERATOR
 #define WORLD_GENERATOR
 
-#include <boost/threadpool.hpp>
-
 #include "bicubic_patch.h"
 #include "trilinear_box.h"
 #include "chunk.h"
@@ -36,7 +34,11 @@ struct WorldGenerator
 
     WorldGenerator( const uint64_t world_seed );
 
-    ChunkSPV generate_region( const Vector2i& region_position, boost::threadpool::pool worker_pool );
+    // Generates the column of Chunks whose base is at the given position.  This is safe
+    // to call from multiple threads at once, so columns may be generated in parallel.
+    ChunkSPV generate_column( const Vector2i& column_position ) const;
+
+    static Vector2i get_region_position( const Vector2i& column_position );
 
 protected:
 
@@ -0,0 +1,826 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include <boost/foreach.hpp>
+
+#include "log.h"
+#include "world_replication.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// Local definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const int NUM_CHUNK_BLOCKS = Chunk::SIZE_X * Chunk::SIZE_Y * Chunk::SIZE_Z;
+
+// The message size (32 bits) and type (8 bits).
+const size_t MESSAGE_HEADER_SIZE = 5;
+
+// Positions further out than this can't be legitimate, and would overflow the Block math.
+const Scalar MAX_POSITION_COORDINATE = 1e8f;
+
+template <typename T>
+void append_value( ByteV& data, const T& value )
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>( &value );
+    data.insert( data.end(), bytes, bytes + sizeof( T ) );
+}
+
+template <typename T>
+bool read_value( const uint8_t*& data, const uint8_t* end, T& value )
+{
+    if ( data + sizeof( T ) > end )
+    {
+        return false;
+    }
+
+    memcpy( &value, data, sizeof( T ) );
+    data += sizeof( T );
+    return true;
+}
+
+// The size is filled in by end_message(), once the contents have all been appended.
+size_t begin_message( ByteV& messages, const ReplicationMessageType type )
+{
+    const size_t offset = messages.size();
+    append_value( messages, uint32_t( 0 ) );
+    append_value( messages, uint8_t( type ) );
+    return offset;
+}
+
+void end_message( ByteV& messages, const size_t offset )
+{
+    const uint32_t size = uint32_t( messages.size() - offset - sizeof( uint32_t ) );
+    memcpy( &messages[offset], &size, sizeof( size ) );
+}
+
+void append_position( ByteV& data, const Vector3f& position )
+{
+    for ( int i = 0; i < Vector3f::Size; ++i )
+    {
+        append_value( data, position[i] );
+    }
+}
+
+bool read_position( const uint8_t*& data, const uint8_t* end, Vector3f& position )
+{
+    for ( int i = 0; i < Vector3f::Size; ++i )
+    {
+        if ( !read_value( data, end, position[i] ) || !( std::fabs( position[i] ) <= MAX_POSITION_COORDINATE ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void append_column_position( ByteV& data, const Vector2i& column_position )
+{
+    append_value( data, int32_t( column_position[0] ) );
+    append_value( data, int32_t( column_position[1] ) );
+}
+
+bool read_column_position( const uint8_t*& data, const uint8_t* end, Vector2i& column_position )
+{
+    int32_t x, z;
+
+    if ( !read_value( data, end, x ) || !read_value( data, end, z ) ||
+         x % Chunk::SIZE_X != 0 || z % Chunk::SIZE_Z != 0 )
+    {
+        return false;
+    }
+
+    column_position = Vector2i( x, z );
+    return true;
+}
+
+// The palette holds the material in the low byte, and the data in the high byte.
+uint16_t get_palette_entry( const Block& block )
+{
+    return uint16_t( block.get_material() | block.get_data() << 8 );
+}
+
+Vector2i get_block_column( const World& world, const Vector3i& block_position )
+{
+    const Vector3i chunk_position = block_position - world.get_block_index( block_position );
+    return Vector2i( chunk_position[0], chunk_position[2] );
+}
+
+// The replicator is given a non-const World, but the modified Blocks are only read, so
+// they're found through the const World::get_block(), which never expands a uniform Chunk.
+const Block* find_block( const World& world, const Vector3i& block_position )
+{
+    return world.get_block( block_position ).block_;
+}
+
+Scalar get_column_distance( const Vector2i& column_position, const Vector3f& position )
+{
+    const Vector2f column_center(
+        Scalar( column_position[0] ) + Scalar( Chunk::SIZE_X ) / 2.0f,
+        Scalar( column_position[1] ) + Scalar( Chunk::SIZE_Z ) / 2.0f
+    );
+
+    return gmtl::length( Vector2f( column_center - Vector2f( position[0], position[2] ) ) );
+}
+
+bool closest_column( const std::pair<Scalar, Vector2i>& a, const std::pair<Scalar, Vector2i>& b )
+{
+    return a.first < b.first;
+}
+
+void append_column( const World& world, const Vector2i& column_position, ByteV& messages )
+{
+    const size_t offset = begin_message( messages, REPLICATION_MESSAGE_COLUMN );
+    append_column_position( messages, column_position );
+
+    const size_t num_chunks_offset = messages.size();
+    append_value( messages, uint16_t( 0 ) );
+
+    const ChunkMap::const_iterator bottom_it =
+        world.get_chunks().find( Vector3i( column_position[0], 0, column_position[1] ) );
+    assert( bottom_it != world.get_chunks().end() );
+
+    uint16_t num_chunks = 0;
+    const Vector3i above = cardinal_relation_vector( CARDINAL_RELATION_ABOVE );
+
+    for ( const Chunk* chunk = bottom_it->second.get(); chunk; chunk = chunk->get_neighbor( above ) )
+    {
+        palette_encode_chunk( *chunk, messages );
+        ++num_chunks;
+    }
+
+    memcpy( &messages[num_chunks_offset], &num_chunks, sizeof( num_chunks ) );
+    end_message( messages, offset );
+}
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions:
+//////////////////////////////////////////////////////////////////////////////////
+
+void palette_encode_chunk( const Chunk& chunk, ByteV& data )
+{
+    std::vector<uint16_t> palette;
+    std::vector<uint16_t> indices;
+
+    if ( chunk.is_uniform() )
+    {
+        palette.push_back( get_palette_entry( chunk.get_block( Vector3i( 0, 0, 0 ) ) ) );
+    }
+    else
+    {
+        // Neighboring Blocks are usually the same, so the last one is checked first.
+        typedef std::map<uint16_t, uint16_t> PaletteIndexMap;
+        PaletteIndexMap palette_indices;
+        indices.reserve( NUM_CHUNK_BLOCKS );
+
+        FOREACH_BLOCK( x, y, z )
+        {
+            const uint16_t entry = get_palette_entry( chunk.get_block( Vector3i( x, y, z ) ) );
+
+            if ( indices.empty() || palette[indices.back()] != entry )
+            {
+                const std::pair<PaletteIndexMap::iterator, bool> inserted =
+                    palette_indices.insert( std::make_pair( entry, uint16_t( palette.size() ) ) );
+
+                if ( inserted.second )
+                {
+                    palette.push_back( entry );
+                }
+
+                indices.push_back( inserted.first->second );
+            }
+            else indices.push_back( indices.back() );
+        }
+    }
+
+    append_value( data, uint16_t( palette.size() ) );
+
+    BOOST_FOREACH( const uint16_t entry, palette )
+    {
+        append_value( data, entry );
+    }
+
+    unsigned bits = 0;
+
+    while ( ( 1u << bits ) < palette.size() )
+    {
+        ++bits;
+    }
+
+    if ( bits == 0 )
+    {
+        return;
+    }
+
+    // The indices are packed starting from the lowest bit of each byte.
+    uint32_t accumulator = 0;
+    unsigned accumulated_bits = 0;
+
+    BOOST_FOREACH( const uint16_t index, indices )
+    {
+        accumulator |= uint32_t( index ) << accumulated_bits;
+        accumulated_bits += bits;
+
+        while ( accumulated_bits >= 8 )
+        {
+            data.push_back( uint8_t( accumulator ) );
+            accumulator >>= 8;
+            accumulated_bits -= 8;
+        }
+    }
+
+    if ( accumulated_bits > 0 )
+    {
+        data.push_back( uint8_t( accumulator ) );
+    }
+}
+
+bool palette_decode_chunk( const uint8_t*& data, const uint8_t* end, Chunk& chunk )
+{
+    uint16_t palette_size;
+
+    if ( !read_value( data, end, palette_size ) || palette_size == 0 || palette_size > NUM_CHUNK_BLOCKS )
+    {
+        return false;
+    }
+
+    std::vector<Block> palette( palette_size );
+
+    BOOST_FOREACH( Block& block, palette )
+    {
+        uint16_t entry;
+
+        if ( !read_value( data, end, entry ) || ( entry & 0xff ) >= NUM_BLOCK_MATERIALS )
+        {
+            return false;
+        }
+
+        block.set_material( BlockMaterial( entry & 0xff ) );
+        block.set_data( uint8_t( entry >> 8 ) );
+    }
+
+    unsigned bits = 0;
+
+    while ( ( 1u << bits ) < palette.size() )
+    {
+        ++bits;
+    }
+
+    if ( size_t( end - data ) < size_t( ( NUM_CHUNK_BLOCKS * bits + 7 ) / 8 ) )
+    {
+        return false;
+    }
+
+    const uint32_t mask = ( 1u << bits ) - 1;
+    uint32_t accumulator = 0;
+    unsigned accumulated_bits = 0;
+
+    FOREACH_BLOCK( x, y, z )
+    {
+        while ( accumulated_bits < bits )
+        {
+            accumulator |= uint32_t( *data++ ) << accumulated_bits;
+            accumulated_bits += 8;
+        }
+
+        const uint32_t index = accumulator & mask;
+        accumulator >>= bits;
+        accumulated_bits -= bits;
+
+        if ( index >= palette.size() )
+        {
+            return false;
+        }
+
+        chunk.set_block( Vector3i( x, y, z ), palette[index] );
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for ReplicationMessageReader:
+//////////////////////////////////////////////////////////////////////////////////
+
+ReplicationMessageReader::ReplicationMessageReader() :
+    read_offset_( 0 )
+{
+}
+
+void ReplicationMessageReader::receive( const uint8_t* data, const size_t size )
+{
+    // The messages that have already been read are dropped once they take up a good
+    // part of the buffer, rather than every time.
+    if ( read_offset_ > buffer_.size() / 2 )
+    {
+        buffer_.erase( buffer_.begin(), buffer_.begin() + read_offset_ );
+        read_offset_ = 0;
+    }
+
+    buffer_.insert( buffer_.end(), data, data + size );
+}
+
+bool ReplicationMessageReader::read_message( ReplicationMessageType& type, ByteV& contents )
+{
+    if ( buffer_.size() - read_offset_ < MESSAGE_HEADER_SIZE )
+    {
+        return false;
+    }
+
+    uint32_t size;
+    memcpy( &size, &buffer_[read_offset_], sizeof( size ) );
+
+    if ( size == 0 || size > MAX_MESSAGE_SIZE )
+    {
+        throw std::runtime_error( make_string() << "Invalid replication message size " << size );
+    }
+
+    if ( buffer_.size() - read_offset_ < sizeof( size ) + size )
+    {
+        return false;
+    }
+
+    const uint8_t type_index = buffer_[read_offset_ + sizeof( size )];
+
+    if ( type_index >= NUM_REPLICATION_MESSAGE_TYPES )
+    {
+        throw std::runtime_error( make_string() << "Invalid replication message type " << unsigned( type_index ) );
+    }
+
+    type = ReplicationMessageType( type_index );
+    contents.assign(
+        buffer_.begin() + read_offset_ + MESSAGE_HEADER_SIZE,
+        buffer_.begin() + read_offset_ + sizeof( size ) + size );
+    read_offset_ += sizeof( size ) + size;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for WorldReplicator:
+//////////////////////////////////////////////////////////////////////////////////
+
+WorldReplicator::Client::Client() :
+    view_radius_( World::DEFAULT_VIEW_RADIUS ),
+    bytes_sent_( 0 )
+{
+}
+
+WorldReplicator::WorldReplicator( const Vector3f& spawn_position ) :
+    spawn_position_( spawn_position ),
+    next_client_id_( 0 )
+{
+}
+
+ReplicationClientId WorldReplicator::add_client( const uint64_t world_seed )
+{
+    const ReplicationClientId client_id = next_client_id_++;
+    ClientSP client( new Client );
+    client->player_position_ = spawn_position_;
+
+    const size_t offset = begin_message( client->messages_, REPLICATION_MESSAGE_WELCOME );
+    append_value( client->messages_, world_seed );
+    append_position( client->messages_, spawn_position_ );
+    end_message( client->messages_, offset );
+    client->bytes_sent_ = client->messages_.size();
+
+    clients_[client_id] = client;
+    return client_id;
+}
+
+void WorldReplicator::remove_client( const ReplicationClientId client_id )
+{
+    clients_.erase( client_id );
+}
+
+void WorldReplicator::receive( const ReplicationClientId client_id, const uint8_t* data, const size_t size )
+{
+    Client& client = get_client( client_id );
+    client.reader_.receive( data, size );
+
+    ReplicationMessageType type;
+    ByteV contents;
+
+    while ( client.reader_.read_message( type, contents ) )
+    {
+        const uint8_t* read = contents.empty() ? 0 : &contents[0];
+        const uint8_t* end = read + contents.size();
+        Vector3f player_position;
+
+        if ( type != REPLICATION_MESSAGE_PLAYER_POSITION || !read_position( read, end, player_position ) || read != end )
+        {
+            throw std::runtime_error( make_string() << "Invalid replication message from client " << client_id );
+        }
+
+        client.player_position_ = player_position;
+    }
+}
+
+Vector3fV WorldReplicator::get_player_positions() const
+{
+    Vector3fV player_positions;
+
+    BOOST_FOREACH( const ClientMap::value_type& client_it, clients_ )
+    {
+        player_positions.push_back( client_it.second->player_position_ );
+    }
+
+    if ( player_positions.empty() )
+    {
+        player_positions.push_back( spawn_position_ );
+    }
+
+    return player_positions;
+}
+
+void WorldReplicator::set_view_radius( const ReplicationClientId client_id, const Scalar view_radius )
+{
+    get_client( client_id ).view_radius_ = view_radius;
+}
+
+void WorldReplicator::replicate( World& world )
+{
+    // The modified Blocks are grouped by column, so that each client only has to look at
+    // the ones in the columns it has.
+    typedef std::map<Vector2i, Vector3iV, VectorLess<Vector2i> > ColumnBlockMap;
+    ColumnBlockMap modified_columns;
+
+    BOOST_FOREACH( const Vector3i& block_position, world.get_modified_blocks() )
+    {
+        modified_columns[get_block_column( world, block_position )].push_back( block_position );
+    }
+
+    // Every column is stitched into the World all at once, so its bottom Chunk being
+    // loaded means that the whole column is.
+    std::vector<Vector2i> loaded_columns;
+
+    BOOST_FOREACH( const ChunkMap::value_type& chunk_it, world.get_chunks() )
+    {
+        const Vector3i& position = chunk_it.second->get_position();
+
+        if ( position[1] == 0 )
+        {
+            loaded_columns.push_back( Vector2i( position[0], position[2] ) );
+        }
+    }
+
+    BOOST_FOREACH( const ClientMap::value_type& client_it, clients_ )
+    {
+        Client& client = *client_it.second;
+        ByteV& messages = client.messages_;
+        const size_t messages_start = messages.size();
+
+        for ( ColumnSet::iterator column_it = client.columns_.begin(); column_it != client.columns_.end(); )
+        {
+            const Vector2i& column_position = *column_it;
+
+            if ( !world.is_column_loaded( column_position ) ||
+                 get_column_distance( column_position, client.player_position_ ) > client.view_radius_ + EVICTION_MARGIN )
+            {
+                const size_t offset = begin_message( messages, REPLICATION_MESSAGE_EVICT_COLUMN );
+                append_column_position( messages, column_position );
+                end_message( messages, offset );
+                client.columns_.erase( column_it++ );
+            }
+            else ++column_it;
+        }
+
+        // The modified Blocks are only sent for the columns that the client already has.  The
+        // rest will have their modifications included whenever they're sent in full.
+        const size_t tick_offset = begin_message( messages, REPLICATION_MESSAGE_TICK );
+        append_value( messages, world.get_sky().get_time_of_day() );
+
+        const size_t num_blocks_offset = messages.size();
+        append_value( messages, uint32_t( 0 ) );
+        uint32_t num_blocks = 0;
+
+        BOOST_FOREACH( const ColumnBlockMap::value_type& column_it, modified_columns )
+        {
+            if ( client.columns_.find( column_it.first ) == client.columns_.end() )
+            {
+                continue;
+            }
+
+            BOOST_FOREACH( const Vector3i& block_position, column_it.second )
+            {
+                const Block* block = find_block( world, block_position );
+
+                if ( block )
+                {
+                    for ( int i = 0; i < Vector3i::Size; ++i )
+                    {
+                        append_value( messages, int32_t( block_position[i] ) );
+                    }
+
+                    append_value( messages, uint8_t( block->get_material() ) );
+                    append_value( messages, block->get_data() );
+                    ++num_blocks;
+                }
+            }
+        }
+
+        memcpy( &messages[num_blocks_offset], &num_blocks, sizeof( num_blocks ) );
+        end_message( messages, tick_offset );
+
+        // The missing columns are streamed in nearest first.
+        typedef std::pair<Scalar, Vector2i> DistanceColumn;
+        std::vector<DistanceColumn> missing_columns;
+
+        BOOST_FOREACH( const Vector2i& column_position, loaded_columns )
+        {
+            const Scalar distance = get_column_distance( column_position, client.player_position_ );
+
+            if ( distance <= client.view_radius_ && client.columns_.find( column_position ) == client.columns_.end() )
+            {
+                missing_columns.push_back( std::make_pair( distance, column_position ) );
+            }
+        }
+
+        std::sort( missing_columns.begin(), missing_columns.end(), closest_column );
+
+        const size_t columns_start = messages.size();
+
+        for ( unsigned i = 0; i < missing_columns.size() && messages.size() - columns_start < MAX_COLUMN_BYTES_PER_TICK; ++i )
+        {
+            append_column( world, missing_columns[i].second, messages );
+            client.columns_.insert( missing_columns[i].second );
+        }
+
+        client.bytes_sent_ += messages.size() - messages_start;
+    }
+}
+
+void WorldReplicator::take_messages( const ReplicationClientId client_id, ByteV& messages )
+{
+    messages.clear();
+    messages.swap( get_client( client_id ).messages_ );
+}
+
+uint64_t WorldReplicator::get_bytes_sent( const ReplicationClientId client_id ) const
+{
+    return get_client( client_id ).bytes_sent_;
+}
+
+WorldReplicator::Client& WorldReplicator::get_client( const ReplicationClientId client_id ) const
+{
+    const ClientMap::const_iterator client_it = clients_.find( client_id );
+
+    if ( client_it == clients_.end() )
+    {
+        throw std::runtime_error( make_string() << "Unknown replication client " << client_id );
+    }
+
+    return *client_it->second;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Function definitions for WorldReplica:
+//////////////////////////////////////////////////////////////////////////////////
+
+WorldReplica::WorldReplica() :
+    welcomed_( false ),
+    world_seed_( 0 ),
+    spawn_position_( 0.0f, 0.0f, 0.0f )
+{
+}
+
+void WorldReplica::receive( const uint8_t* data, const size_t size )
+{
+    reader_.receive( data, size );
+
+    Message message;
+
+    while ( reader_.read_message( message.type_, message.contents_ ) )
+    {
+        // The WELCOME is handled right away, since the replica World can't be created
+        // until it has arrived.
+        if ( message.type_ == REPLICATION_MESSAGE_WELCOME )
+        {
+            const uint8_t* read = message.contents_.empty() ? 0 : &message.contents_[0];
+            const uint8_t* end = read + message.contents_.size();
+
+            if ( welcomed_ || !read_value( read, end, world_seed_ ) || !read_position( read, end, spawn_position_ ) || read != end )
+            {
+                throw std::runtime_error( "Invalid replication welcome message" );
+            }
+
+            welcomed_ = true;
+        }
+        else if ( !welcomed_ || message.type_ == REPLICATION_MESSAGE_PLAYER_POSITION )
+        {
+            throw std::runtime_error( make_string() << "Unexpected replication message type " << message.type_ );
+        }
+        else messages_.push_back( message );
+    }
+}
+
+void WorldReplica::apply( World& world )
+{
+    assert( world.get_mode() == WORLD_MODE_REPLICA );
+
+    while ( !messages_.empty() )
+    {
+        const Message& message = messages_.front();
+
+        switch ( message.type_ )
+        {
+            case REPLICATION_MESSAGE_COLUMN:
+                if ( !apply_column( world, message.contents_ ) )
+                {
+                    return;
+                }
+                break;
+
+            case REPLICATION_MESSAGE_EVICT_COLUMN:
+                if ( !apply_evict_column( world, message.contents_ ) )
+                {
+                    return;
+                }
+                break;
+
+            case REPLICATION_MESSAGE_TICK:
+                apply_tick( world, message.contents_ );
+                break;
+
+            default:
+                assert( false );
+                break;
+        }
+
+        messages_.pop_front();
+    }
+}
+
+void WorldReplica::encode_player_position( const Vector3f& player_position, ByteV& messages )
+{
+    const size_t offset = begin_message( messages, REPLICATION_MESSAGE_PLAYER_POSITION );
+    append_position( messages, player_position );
+    end_message( messages, offset );
+}
+
+bool WorldReplica::apply_column( World& world, const ByteV& contents )
+{
+    const uint8_t* read = contents.empty() ? 0 : &contents[0];
+    const uint8_t* end = read + contents.size();
+
+    Vector2i column_position;
+    uint16_t num_chunks;
+
+    if ( !read_column_position( read, end, column_position ) || !read_value( read, end, num_chunks ) || num_chunks == 0 )
+    {
+        throw std::runtime_error( "Invalid replicated column" );
+    }
+
+    // The server doesn't send a column again without evicting it first, but if it did, the
+    // old copy would have to be evicted to make room.
+    if ( world.is_column_loaded( column_position ) )
+    {
+        if ( world.is_updating_chunks() )
+        {
+            return false;
+        }
+
+        world.evict_column( column_position );
+    }
+
+    ChunkSPV chunks;
+
+    for ( uint16_t i = 0; i < num_chunks; ++i )
+    {
+        ChunkSP chunk( new Chunk( Vector3i( column_position[0], i * Chunk::SIZE_Y, column_position[1] ) ) );
+
+        if ( !palette_decode_chunk( read, end, *chunk ) )
+        {
+            throw std::runtime_error( "Invalid replicated chunk" );
+        }
+
+        chunks.push_back( chunk );
+    }
+
+    if ( read != end )
+    {
+        throw std::runtime_error( "Invalid replicated column" );
+    }
+
+    world.insert_column( column_position, chunks );
+    return true;
+}
+
+bool WorldReplica::apply_evict_column( World& world, const ByteV& contents )
+{
+    const uint8_t* read = contents.empty() ? 0 : &contents[0];
+    const uint8_t* end = read + contents.size();
+
+    Vector2i column_position;
+
+    if ( !read_column_position( read, end, column_position ) || read != end )
+    {
+        throw std::runtime_error( "Invalid replicated column eviction" );
+    }
+
+    if ( !world.is_column_loaded( column_position ) )
+    {
+        return true;
+    }
+
+    if ( world.is_updating_chunks() )
+    {
+        return false;
+    }
+
+    world.evict_column( column_position );
+    return true;
+}
+
+void WorldReplica::apply_tick( World& world, const ByteV& contents )
+{
+    const uint8_t* read = contents.empty() ? 0 : &contents[0];
+    const uint8_t* end = read + contents.size();
+
+    Scalar time_of_day;
+    uint32_t num_blocks;
+
+    if ( !read_value( read, end, time_of_day ) || !( time_of_day >= 0.0f && time_of_day <= 1.0f ) ||
+         !read_value( read, end, num_blocks ) )
+    {
+        throw std::runtime_error( "Invalid replicated tick" );
+    }
+
+    world.set_time_of_day( time_of_day );
+
+    for ( uint32_t i = 0; i < num_blocks; ++i )
+    {
+        Vector3i block_position;
+
+        for ( int j = 0; j < Vector3i::Size; ++j )
+        {
+            int32_t coordinate;
+
+            if ( !read_value( read, end, coordinate ) )
+            {
+                throw std::runtime_error( "Invalid replicated tick" );
+            }
+
+            block_position[j] = coordinate;
+        }
+
+        uint8_t material, data;
+
+        if ( !read_value( read, end, material ) || !read_value( read, end, data ) || material >= NUM_BLOCK_MATERIALS )
+        {
+            throw std::runtime_error( "Invalid replicated tick" );
+        }
+
+        if ( !world.is_column_loaded( get_block_column( world, block_position ) ) || block_position[1] < 0 )
+        {
+            continue;
+        }
+
+        BlockIterator block_it = world.get_block( block_position );
+
+        // The server's column may have been extended (e.g. by building above it).
+        if ( !block_it.block_ )
+        {
+            world.extend_chunk_column( block_position );
+            block_it = world.get_block( block_position );
+        }
+
+        Block& block = *block_it.block_;
+
+        if ( block.get_material() != material || block.get_data() != data )
+        {
+            block.set_material( BlockMaterial( material ) );
+            block.set_data( data );
+            world.mark_block_for_update( block_position );
+        }
+    }
+
+    if ( read != end )
+    {
+        throw std::runtime_error( "Invalid replicated tick" );
+    }
+}
@@ -0,0 +1,222 @@
+///////////////////////////////////////////////////////////////////////////
+// Copyright 2011 Evan Mezeske.
+//
+// This file is part of Digbuild.
+// 
+// Digbuild is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.
+// 
+// Digbuild is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Digbuild.  If not, see <http://www.gnu.org/licenses/>.
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef WORLD_REPLICATION_H
+#define WORLD_REPLICATION_H
+
+#include <deque>
+#include <vector>
+#include <map>
+#include <set>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include "math.h"
+#include "world.h"
+
+// A server World is replicated to each of its clients as a stream of messages.  As each
+// client's Player moves around, the server sends it every loaded column within its view
+// radius (nearest first), and tells it to evict the columns that fall too far out.  After
+// that, each tick only sends the Blocks that were modified in the columns that the client
+// already has.  Only the Blocks' materials and data are replicated; each client lights and
+// meshes its replica World itself, just as it would after loading the columns from disk.
+// When the fluid simulation raises the flow level of a Block that's already fluid, the
+// Block isn't marked for update (it's drawn the same either way), so a replica's flow
+// levels can lag behind the server's until those Blocks are next marked.
+//
+// Every message is a 32 bit size (counting the type, but not the size itself), followed by
+// a one byte ReplicationMessageType, and then its contents:
+//
+//   WELCOME          The world seed (64 bits) and the spawn position (three floats).
+//   COLUMN           The column position (two 32 bit ints), the number of Chunks (16 bits),
+//                    and then each Chunk from the bottom up (see palette_encode_chunk()).
+//   EVICT_COLUMN     The column position (two 32 bit ints).
+//   TICK             The time of day (a float), the number of modified Blocks (32 bits),
+//                    and then each one's position (three 32 bit ints), material, and data.
+//   PLAYER_POSITION  The position of the client's Player (three floats).  This is the only
+//                    message sent by clients, rather than by the server.
+//
+// NOTE: The messages are in the native byte order, like the ChunkStore's region files, so
+//       the server and its clients must have the same endianness.
+enum ReplicationMessageType
+{
+    REPLICATION_MESSAGE_WELCOME,
+    REPLICATION_MESSAGE_COLUMN,
+    REPLICATION_MESSAGE_EVICT_COLUMN,
+    REPLICATION_MESSAGE_TICK,
+    REPLICATION_MESSAGE_PLAYER_POSITION,
+    NUM_REPLICATION_MESSAGE_TYPES
+};
+
+typedef std::vector<uint8_t> ByteV;
+
+// Each Chunk is palette-compressed: the distinct materials (and data) of its Blocks are
+// listed once, and each Block is packed into just enough bits to index into that palette,
+// in the same order as the Chunk's storage.  A uniform Chunk takes no bits per Block at all.
+void palette_encode_chunk( const Chunk& chunk, ByteV& data );
+
+// This returns false if the data is malformed.
+bool palette_decode_chunk( const uint8_t*& data, const uint8_t* end, Chunk& chunk );
+
+// This splits a stream of bytes back up into messages, however it happens to arrive.
+struct ReplicationMessageReader : public boost::noncopyable
+{
+    ReplicationMessageReader();
+
+    void receive( const uint8_t* data, const size_t size );
+
+    // This returns false if no complete message has arrived yet.  The contents don't
+    // include the size or the type.  It throws if the stream is malformed.
+    bool read_message( ReplicationMessageType& type, ByteV& contents );
+
+protected:
+
+    // Messages larger than this can't be legitimate (a column of Chunks is much smaller).
+    static const uint32_t MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+
+    ByteV buffer_;
+
+    size_t read_offset_;
+};
+
+typedef unsigned ReplicationClientId;
+
+// The WorldReplicator is the server's half of the replication.  Each client's outgoing
+// messages are buffered until the transport takes them.
+struct WorldReplicator : public boost::noncopyable
+{
+    // The columns streamed to a client in one tick are limited to roughly this many bytes,
+    // so that a client entering a new area doesn't hold up the rest of the clients (or the
+    // modified Blocks being sent to it).  At least one column is always sent, though.
+    static const size_t MAX_COLUMN_BYTES_PER_TICK = 64 * 1024;
+
+    // Columns are evicted from a client a little further out than they're streamed in, so
+    // that a Player moving back and forth along the edge doesn't make them flicker.
+    static const Scalar EVICTION_MARGIN = 2.0f * Chunk::SIZE_X;
+
+    WorldReplicator( const Vector3f& spawn_position );
+
+    // A new client's Player starts out at the spawn position, until the client reports
+    // where it actually is.  The client is welcomed as soon as it's added.
+    ReplicationClientId add_client( const uint64_t world_seed );
+    void remove_client( const ReplicationClientId client_id );
+
+    // This handles the messages received from a client.  It throws if they're malformed,
+    // in which case the client should be disconnected.
+    void receive( const ReplicationClientId client_id, const uint8_t* data, const size_t size );
+
+    // The World should stream in (and simulate) the columns around all of these.  It's the
+    // spawn position if there aren't any clients, so the spawn area stays loaded.
+    Vector3fV get_player_positions() const;
+
+    void set_view_radius( const ReplicationClientId client_id, const Scalar view_radius );
+
+    // This queues up one tick's worth of messages for every client.  It should be called
+    // once per tick, after the World has been stepped.
+    // Precondition: you must hold the World's Chunk lock before calling this!
+    void replicate( World& world );
+
+    // Takes the messages that have been queued up for the client since the last call.
+    void take_messages( const ReplicationClientId client_id, ByteV& messages );
+
+    // The total number of bytes that have been queued up for the client.
+    uint64_t get_bytes_sent( const ReplicationClientId client_id ) const;
+
+protected:
+
+    typedef std::set<Vector2i, VectorLess<Vector2i> > ColumnSet;
+
+    struct Client
+    {
+        Client();
+
+        Vector3f player_position_;
+
+        Scalar view_radius_;
+
+        // The columns that the client has been sent, and not told to evict since.
+        ColumnSet columns_;
+
+        ByteV messages_;
+
+        uint64_t bytes_sent_;
+        
+        ReplicationMessageReader reader_;
+    };
+
+    typedef boost::shared_ptr<Client> ClientSP;
+    typedef std::map<ReplicationClientId, ClientSP> ClientMap;
+
+    Client& get_client( const ReplicationClientId client_id ) const;
+
+    Vector3f spawn_position_;
+
+    ReplicationClientId next_client_id_;
+
+    ClientMap clients_;
+};
+
+// The WorldReplica is the client's half of the replication.  It queues up the messages
+// from the server, and applies them to a replica World.
+struct WorldReplica : public boost::noncopyable
+{
+    WorldReplica();
+
+    // This throws if the stream is malformed.
+    void receive( const uint8_t* data, const size_t size );
+
+    // The WELCOME message says what the replica World should be created with.
+    bool is_welcomed() const { return welcomed_; }
+    uint64_t get_world_seed() const { return world_seed_; }
+    const Vector3f& get_spawn_position() const { return spawn_position_; }
+
+    // The messages are applied in the order that they were sent.  A column can't be evicted
+    // while the World is being updated, though, so if one is to be evicted, it and the rest
+    // of the messages after it wait until the next call.  This throws if a message is invalid.
+    // Precondition: you must hold the World's Chunk lock before calling this!
+    void apply( World& world );
+
+    static void encode_player_position( const Vector3f& player_position, ByteV& messages );
+
+protected:
+
+    struct Message
+    {
+        ReplicationMessageType type_;
+
+        ByteV contents_;
+    };
+
+    // These return false if the message has to wait until the next call to apply().
+    bool apply_column( World& world, const ByteV& contents );
+    bool apply_evict_column( World& world, const ByteV& contents );
+    void apply_tick( World& world, const ByteV& contents );
+
+    ReplicationMessageReader reader_;
+
+    std::deque<Message> messages_;
+
+    bool welcomed_;
+
+    uint64_t world_seed_;
+
+    Vector3f spawn_position_;
+};
+
+#endif // WORLD_REPLICATION_H